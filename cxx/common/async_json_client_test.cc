@@ -0,0 +1,143 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "kythe/cxx/common/fake_http_server.h"
+#include "kythe/cxx/common/net_client.h"
+
+namespace kythe {
+namespace {
+
+/// \brief Answers every request with its own path and body.
+int Echo(const std::string &path, const std::string &content_type,
+         const std::string &body, std::string *response) {
+  if (path == "/missing") {
+    return 404;
+  }
+  *response = path + ":" + body;
+  return 200;
+}
+
+TEST(AsyncJsonClientTest, AnswersEveryRequest) {
+  FakeHttpServer server(Echo);
+  std::string error_text;
+  ASSERT_TRUE(server.Start(&error_text)) << error_text;
+  AsyncJsonClient client(4);
+  std::vector<std::string> responses(20);
+  for (size_t i = 0; i < responses.size(); ++i) {
+    client.Request(server.base_uri() + "/echo", true, std::to_string(i),
+                   [&responses, i](const RequestStats &stats,
+                                   const std::string &response) {
+                     EXPECT_TRUE(stats.succeeded);
+                     EXPECT_EQ(200, stats.response_code);
+                     responses[i] = response;
+                   });
+  }
+  client.Wait();
+  for (size_t i = 0; i < responses.size(); ++i) {
+    EXPECT_EQ("/echo:" + std::to_string(i), responses[i]);
+  }
+  EXPECT_EQ(20, client.finished_count());
+  EXPECT_EQ(0, client.failed_count());
+  EXPECT_EQ(20, server.request_count());
+}
+
+TEST(AsyncJsonClientTest, ReusesConnections) {
+  FakeHttpServer server(Echo);
+  std::string error_text;
+  ASSERT_TRUE(server.Start(&error_text)) << error_text;
+  AsyncJsonClient client(2);
+  for (int round = 0; round < 5; ++round) {
+    for (int i = 0; i < 10; ++i) {
+      client.Request(server.base_uri() + "/echo", true, "{}", nullptr);
+    }
+    client.Wait();
+  }
+  EXPECT_EQ(50, server.request_count());
+  EXPECT_LE(server.connection_count(), 2);
+  EXPECT_LE(server.max_concurrent_requests(), 2);
+}
+
+TEST(AsyncJsonClientTest, OverlapsSlowRequests) {
+  FakeHttpServer server(Echo);
+  server.set_latency(std::chrono::milliseconds(50));
+  std::string error_text;
+  ASSERT_TRUE(server.Start(&error_text)) << error_text;
+  AsyncJsonClient client(8);
+  for (int i = 0; i < 16; ++i) {
+    client.Request(server.base_uri() + "/echo", true, "{}", nullptr);
+  }
+  client.Wait();
+  // The server held several of these at once rather than seeing them one
+  // at a time.
+  EXPECT_GT(server.max_concurrent_requests(), 1);
+  EXPECT_LE(server.max_concurrent_requests(), 8);
+  EXPECT_GE(client.LatencyPercentile(0.5), 0.05);
+  EXPECT_GE(client.LatencyPercentile(1.0), client.LatencyPercentile(0.0));
+}
+
+TEST(AsyncJsonClientTest, ReportsFailures) {
+  FakeHttpServer server(Echo);
+  std::string error_text;
+  ASSERT_TRUE(server.Start(&error_text)) << error_text;
+  AsyncJsonClient client;
+  bool called = false;
+  client.Request(server.base_uri() + "/missing", true, "{}",
+                 [&called](const RequestStats &stats,
+                           const std::string &response) {
+                   called = true;
+                   EXPECT_FALSE(stats.succeeded);
+                   EXPECT_EQ(404, stats.response_code);
+                 });
+  client.Wait();
+  EXPECT_TRUE(called);
+  EXPECT_EQ(1, client.failed_count());
+}
+
+TEST(AsyncJsonClientTest, CallbacksCanQueueRequests) {
+  FakeHttpServer server(Echo);
+  std::string error_text;
+  ASSERT_TRUE(server.Start(&error_text)) << error_text;
+  AsyncJsonClient client(1);
+  std::string second_response;
+  client.Request(server.base_uri() + "/first", true, "a",
+                 [&](const RequestStats &stats, const std::string &response) {
+                   client.Request(server.base_uri() + "/second", true,
+                                  response,
+                                  [&](const RequestStats &stats,
+                                      const std::string &response) {
+                                    second_response = response;
+                                  });
+                 });
+  client.Wait();
+  EXPECT_EQ("/second:/first:a", second_response);
+}
+
+}  // namespace
+}  // namespace kythe
+
+int main(int argc, char **argv) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  kythe::JsonClient::InitNetwork();
+  ::testing::InitGoogleTest(&argc, argv);
+  int result = RUN_ALL_TESTS();
+  return result;
+}
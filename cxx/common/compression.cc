@@ -0,0 +1,377 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "compression.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "google/protobuf/io/gzip_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "snappy.h"
+
+namespace kythe {
+namespace {
+namespace io = google::protobuf::io;
+
+/// Marks the start of a Snappy stream. Neither gzip data (which starts with
+/// 0x1f 0x8b) nor zlib data (whose first byte ends in 0x8) can start with
+/// 0xff.
+const char kSnappyMagic[] = {'\xff', 'K', 'S', 'Z'};
+constexpr size_t kSnappyMagicSize = sizeof(kSnappyMagic);
+
+/// The largest amount of uncompressed data stored in one Snappy block.
+constexpr size_t kSnappyBlockSize = 64 * 1024;
+
+/// The size of the little-endian length that precedes each Snappy block.
+constexpr size_t kSnappyLengthSize = 4;
+
+/// \brief Writes `size` bytes from `data` to `output`.
+/// \return false if `output` failed.
+bool WriteBytes(io::ZeroCopyOutputStream *output, const char *data,
+                size_t size) {
+  while (size > 0) {
+    void *buffer;
+    int buffer_size;
+    if (!output->Next(&buffer, &buffer_size)) {
+      return false;
+    }
+    if (buffer_size <= 0) {
+      continue;
+    }
+    size_t chunk = std::min(size, static_cast<size_t>(buffer_size));
+    ::memcpy(buffer, data, chunk);
+    if (chunk < static_cast<size_t>(buffer_size)) {
+      output->BackUp(buffer_size - chunk);
+    }
+    data += chunk;
+    size -= chunk;
+  }
+  return true;
+}
+
+/// \brief Reads up to `size` bytes from `input` into `out`.
+/// \return The number of bytes read, which is less than `size` only if
+/// `input` ran out.
+size_t ReadBytes(io::ZeroCopyInputStream *input, size_t size,
+                 std::string *out) {
+  out->clear();
+  while (out->size() < size) {
+    const void *data;
+    int data_size;
+    if (!input->Next(&data, &data_size)) {
+      break;
+    }
+    if (data_size <= 0) {
+      continue;
+    }
+    size_t chunk =
+        std::min(size - out->size(), static_cast<size_t>(data_size));
+    out->append(static_cast<const char *>(data), chunk);
+    if (chunk < static_cast<size_t>(data_size)) {
+      input->BackUp(data_size - chunk);
+    }
+  }
+  return out->size();
+}
+
+/// \brief Adapts protobuf's `GzipOutputStream`.
+class GzipCompressingStream : public CompressingOutputStream {
+ public:
+  explicit GzipCompressingStream(io::ZeroCopyOutputStream *output)
+      : stream_(output, MakeOptions()) {}
+
+  bool Next(void **data, int *size) override {
+    return stream_.Next(data, size);
+  }
+  void BackUp(int count) override { stream_.BackUp(count); }
+  google::protobuf::int64 ByteCount() const override {
+    return stream_.ByteCount();
+  }
+  bool Close() override { return stream_.Close(); }
+
+ private:
+  static io::GzipOutputStream::Options MakeOptions() {
+    io::GzipOutputStream::Options options;
+    // Accept the default compression level and compression strategy.
+    options.format = io::GzipOutputStream::GZIP;
+    return options;
+  }
+
+  io::GzipOutputStream stream_;
+};
+
+/// \brief Writes `kSnappyMagic` followed by a sequence of blocks, each of
+/// which is a little-endian 32-bit length and that many bytes of
+/// Snappy-compressed data.
+class SnappyCompressingStream : public CompressingOutputStream {
+ public:
+  explicit SnappyCompressingStream(io::ZeroCopyOutputStream *output)
+      : output_(output), block_(kSnappyBlockSize, '\0') {
+    ok_ = WriteBytes(output_, kSnappyMagic, kSnappyMagicSize);
+  }
+
+  ~SnappyCompressingStream() override { Close(); }
+
+  bool Next(void **data, int *size) override {
+    if (closed_ || !ok_) {
+      return false;
+    }
+    if (block_used_ == block_.size() && !FlushBlock()) {
+      return false;
+    }
+    *data = &block_[block_used_];
+    *size = static_cast<int>(block_.size() - block_used_);
+    byte_count_ += *size;
+    block_used_ = block_.size();
+    return true;
+  }
+
+  void BackUp(int count) override {
+    block_used_ -= count;
+    byte_count_ -= count;
+  }
+
+  google::protobuf::int64 ByteCount() const override { return byte_count_; }
+
+  bool Close() override {
+    if (!closed_) {
+      closed_ = true;
+      ok_ = FlushBlock() && ok_;
+    }
+    return ok_;
+  }
+
+ private:
+  /// \brief Compresses and writes out the buffered data, if any.
+  bool FlushBlock() {
+    if (block_used_ == 0) {
+      return ok_;
+    }
+    compressed_.resize(kSnappyLengthSize +
+                       snappy::MaxCompressedLength(block_used_));
+    size_t compressed_size;
+    snappy::RawCompress(block_.data(), block_used_,
+                        &compressed_[kSnappyLengthSize], &compressed_size);
+    for (size_t i = 0; i < kSnappyLengthSize; ++i) {
+      compressed_[i] = static_cast<char>((compressed_size >> (8 * i)) & 0xff);
+    }
+    block_used_ = 0;
+    ok_ = ok_ && WriteBytes(output_, compressed_.data(),
+                            kSnappyLengthSize + compressed_size);
+    return ok_;
+  }
+
+  /// The stream to write compressed data to.
+  io::ZeroCopyOutputStream *output_;
+  /// Uncompressed data waiting to be written.
+  std::string block_;
+  /// The number of bytes in `block_` that hold data.
+  size_t block_used_ = 0;
+  /// Scratch space for compressed blocks.
+  std::string compressed_;
+  /// The number of uncompressed bytes written so far.
+  google::protobuf::int64 byte_count_ = 0;
+  /// false if `output_` has failed.
+  bool ok_ = true;
+  /// true once `Close` has been called.
+  bool closed_ = false;
+};
+
+/// \brief Reads the format written by `SnappyCompressingStream` (after its
+/// magic number has been consumed).
+class SnappyDecompressingStream : public io::ZeroCopyInputStream {
+ public:
+  explicit SnappyDecompressingStream(io::ZeroCopyInputStream *input)
+      : input_(input) {}
+
+  bool Next(const void **data, int *size) override {
+    while (block_position_ == block_.size()) {
+      if (!ReadBlock()) {
+        return false;
+      }
+    }
+    *data = block_.data() + block_position_;
+    *size = static_cast<int>(block_.size() - block_position_);
+    byte_count_ += *size;
+    block_position_ = block_.size();
+    return true;
+  }
+
+  void BackUp(int count) override {
+    block_position_ -= count;
+    byte_count_ -= count;
+  }
+
+  bool Skip(int count) override {
+    const void *data;
+    int size;
+    while (count > 0 && Next(&data, &size)) {
+      if (size > count) {
+        BackUp(size - count);
+        return true;
+      }
+      count -= size;
+    }
+    return count == 0;
+  }
+
+  google::protobuf::int64 ByteCount() const override { return byte_count_; }
+
+  /// \brief Returns a description of the last error, or null.
+  const char *error() const { return error_; }
+
+ private:
+  /// \brief Reads and decompresses the next block into `block_`.
+  /// \return false at the end of the stream or on error.
+  bool ReadBlock() {
+    if (error_) {
+      return false;
+    }
+    size_t read = ReadBytes(input_, kSnappyLengthSize, &compressed_);
+    if (read == 0) {
+      return false;
+    }
+    if (read != kSnappyLengthSize) {
+      error_ = "Truncated Snappy block header";
+      return false;
+    }
+    size_t compressed_size = 0;
+    for (size_t i = 0; i < kSnappyLengthSize; ++i) {
+      compressed_size |= static_cast<size_t>(
+                             static_cast<unsigned char>(compressed_[i]))
+                         << (8 * i);
+    }
+    if (ReadBytes(input_, compressed_size, &compressed_) != compressed_size) {
+      error_ = "Truncated Snappy block";
+      return false;
+    }
+    size_t uncompressed_size;
+    if (!snappy::GetUncompressedLength(compressed_.data(), compressed_.size(),
+                                       &uncompressed_size) ||
+        uncompressed_size > kSnappyBlockSize) {
+      error_ = "Bad Snappy block length";
+      return false;
+    }
+    block_.resize(uncompressed_size);
+    block_position_ = 0;
+    if (!snappy::RawUncompress(compressed_.data(), compressed_.size(),
+                               &block_[0])) {
+      block_.clear();
+      error_ = "Corrupt Snappy block";
+      return false;
+    }
+    return true;
+  }
+
+  /// The stream to read compressed data from.
+  io::ZeroCopyInputStream *input_;
+  /// The most recently decompressed block.
+  std::string block_;
+  /// How much of `block_` has been handed out.
+  size_t block_position_ = 0;
+  /// Scratch space for compressed blocks.
+  std::string compressed_;
+  /// The number of uncompressed bytes read so far.
+  google::protobuf::int64 byte_count_ = 0;
+  /// Set to a static string on error.
+  const char *error_ = nullptr;
+};
+
+/// \brief Picks a decoder by peeking at the start of its input.
+class DetectingDecompressingStream : public DecompressingInputStream {
+ public:
+  explicit DetectingDecompressingStream(io::ZeroCopyInputStream *input) {
+    ReadBytes(input, kSnappyMagicSize, &prefix_);
+    if (prefix_.size() == kSnappyMagicSize &&
+        !::memcmp(prefix_.data(), kSnappyMagic, kSnappyMagicSize)) {
+      snappy_.reset(new SnappyDecompressingStream(input));
+      active_ = snappy_.get();
+      return;
+    }
+    // Give the bytes we peeked at back to the gzip decoder.
+    prefix_stream_.reset(
+        new io::ArrayInputStream(prefix_.data(), prefix_.size()));
+    joined_inputs_[0] = prefix_stream_.get();
+    joined_inputs_[1] = input;
+    joined_.reset(new io::ConcatenatingInputStream(joined_inputs_, 2));
+    gzip_.reset(new io::GzipInputStream(joined_.get()));
+    active_ = gzip_.get();
+  }
+
+  bool Next(const void **data, int *size) override {
+    return active_->Next(data, size);
+  }
+  void BackUp(int count) override { active_->BackUp(count); }
+  bool Skip(int count) override { return active_->Skip(count); }
+  google::protobuf::int64 ByteCount() const override {
+    return active_->ByteCount();
+  }
+
+  const char *ErrorMessage() const override {
+    return gzip_ ? gzip_->ZlibErrorMessage() : snappy_->error();
+  }
+
+ private:
+  /// The bytes read while detecting the codec.
+  std::string prefix_;
+  /// Reads `prefix_`.
+  std::unique_ptr<io::ArrayInputStream> prefix_stream_;
+  /// `prefix_stream_` followed by the rest of the input.
+  io::ZeroCopyInputStream *joined_inputs_[2];
+  /// Reads from `joined_inputs_`.
+  std::unique_ptr<io::ConcatenatingInputStream> joined_;
+  /// The decoder for gzip and zlib data, if that's what we found.
+  std::unique_ptr<io::GzipInputStream> gzip_;
+  /// The decoder for Snappy data, if that's what we found.
+  std::unique_ptr<SnappyDecompressingStream> snappy_;
+  /// Whichever of `gzip_` and `snappy_` is in use.
+  io::ZeroCopyInputStream *active_;
+};
+}  // anonymous namespace
+
+bool ParseCompressionCodec(const std::string &name, CompressionCodec *codec) {
+  if (name == "gzip") {
+    *codec = CompressionCodec::kGzip;
+  } else if (name == "snappy") {
+    *codec = CompressionCodec::kSnappy;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<CompressingOutputStream> NewCompressingOutputStream(
+    CompressionCodec codec, io::ZeroCopyOutputStream *output) {
+  switch (codec) {
+    case CompressionCodec::kSnappy:
+      return std::unique_ptr<CompressingOutputStream>(
+          new SnappyCompressingStream(output));
+    case CompressionCodec::kGzip:
+    default:
+      return std::unique_ptr<CompressingOutputStream>(
+          new GzipCompressingStream(output));
+  }
+}
+
+std::unique_ptr<DecompressingInputStream> NewDecompressingInputStream(
+    io::ZeroCopyInputStream *input) {
+  return std::unique_ptr<DecompressingInputStream>(
+      new DetectingDecompressingStream(input));
+}
+
+}  // namespace kythe
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_COMPRESSION_H_
+#define KYTHE_CXX_COMMON_COMPRESSION_H_
+
+#include <memory>
+#include <string>
+
+#include "google/protobuf/io/zero_copy_stream.h"
+
+namespace kythe {
+
+/// \brief The ways in which .kindex files, index pack entries and claim
+/// files may be compressed.
+///
+/// Readers detect the codec from the start of the data, so files written
+/// with any codec can be read by the C++ tools without extra configuration.
+enum class CompressionCodec {
+  /// gzip (RFC 1952). Understood by every Kythe tool; the default.
+  kGzip,
+  /// Snappy blocks behind a small header. Several times cheaper to
+  /// decompress than gzip at the cost of larger files. Only the C++ tools
+  /// can read it.
+  kSnappy
+};
+
+/// \brief Parses a codec name ("gzip" or "snappy").
+/// \return false if `name` doesn't name a codec.
+bool ParseCompressionCodec(const std::string &name, CompressionCodec *codec);
+
+/// \brief A stream that compresses what is written to it.
+class CompressingOutputStream
+    : public google::protobuf::io::ZeroCopyOutputStream {
+ public:
+  /// \brief Flushes buffered data and ends the compressed stream. No more
+  /// data may be written afterward. The destructor calls `Close` if it
+  /// hasn't been called already.
+  /// \return false on failure and true on success.
+  virtual bool Close() = 0;
+};
+
+/// \brief Returns a stream that writes `codec`-compressed data to `output`.
+/// \param output The stream to write to. Must outlive the returned stream.
+std::unique_ptr<CompressingOutputStream> NewCompressingOutputStream(
+    CompressionCodec codec, google::protobuf::io::ZeroCopyOutputStream *output);
+
+/// \brief A stream that decompresses what is read from it.
+class DecompressingInputStream
+    : public google::protobuf::io::ZeroCopyInputStream {
+ public:
+  /// \brief Returns a description of the last decoding error, or null if
+  /// there hasn't been one.
+  virtual const char *ErrorMessage() const = 0;
+};
+
+/// \brief Returns a stream that decompresses the data read from `input`.
+///
+/// The codec is chosen by looking at the first few bytes of `input`. Data
+/// that doesn't start like a Snappy stream is treated as gzip or zlib, as
+/// the tools have always done.
+/// \param input The stream to read from. Must outlive the returned stream.
+std::unique_ptr<DecompressingInputStream> NewDecompressingInputStream(
+    google::protobuf::io::ZeroCopyInputStream *input);
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_COMPRESSION_H_
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "compression.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "google/protobuf/io/gzip_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+namespace io = google::protobuf::io;
+
+/// \brief Returns some text that compresses reasonably well and spans a few
+/// Snappy blocks.
+std::string MakeContent() {
+  std::string content;
+  for (int i = 0; content.size() < 200 * 1024; ++i) {
+    content += "#include \"header" + std::to_string(i % 97) + ".h\"\n";
+  }
+  return content;
+}
+
+std::string Compress(CompressionCodec codec, const std::string &content) {
+  std::string compressed;
+  io::StringOutputStream output(&compressed);
+  auto stream = NewCompressingOutputStream(codec, &output);
+  // Use an odd chunk size to exercise BackUp.
+  io::ArrayInputStream input(content.data(), content.size(), 1000);
+  const void *data;
+  int size;
+  while (input.Next(&data, &size)) {
+    void *buffer;
+    int buffer_size;
+    EXPECT_TRUE(stream->Next(&buffer, &buffer_size));
+    int chunk = std::min(size, buffer_size);
+    memcpy(buffer, data, chunk);
+    stream->BackUp(buffer_size - chunk);
+    input.BackUp(size - chunk);
+  }
+  EXPECT_EQ(static_cast<int64_t>(content.size()), stream->ByteCount());
+  EXPECT_TRUE(stream->Close());
+  return compressed;
+}
+
+/// \brief Decompresses `compressed`, feeding it to the decoder in small
+/// pieces.
+bool Decompress(const std::string &compressed, std::string *content) {
+  io::ArrayInputStream input(compressed.data(), compressed.size(), 3);
+  auto stream = NewDecompressingInputStream(&input);
+  content->clear();
+  const void *data;
+  int size;
+  while (stream->Next(&data, &size)) {
+    content->append(static_cast<const char *>(data), size);
+  }
+  return stream->ErrorMessage() == nullptr;
+}
+
+TEST(CompressionTest, ParseCodec) {
+  CompressionCodec codec;
+  ASSERT_TRUE(ParseCompressionCodec("snappy", &codec));
+  EXPECT_EQ(CompressionCodec::kSnappy, codec);
+  ASSERT_TRUE(ParseCompressionCodec("gzip", &codec));
+  EXPECT_EQ(CompressionCodec::kGzip, codec);
+  EXPECT_FALSE(ParseCompressionCodec("lzw", &codec));
+}
+
+TEST(CompressionTest, RoundTrip) {
+  std::string content = MakeContent();
+  for (auto codec : {CompressionCodec::kGzip, CompressionCodec::kSnappy}) {
+    std::string compressed = Compress(codec, content);
+    EXPECT_LT(compressed.size(), content.size());
+    std::string decompressed;
+    EXPECT_TRUE(Decompress(compressed, &decompressed));
+    EXPECT_EQ(content, decompressed);
+  }
+}
+
+TEST(CompressionTest, EmptyInput) {
+  for (auto codec : {CompressionCodec::kGzip, CompressionCodec::kSnappy}) {
+    std::string decompressed = "junk";
+    EXPECT_TRUE(Decompress(Compress(codec, ""), &decompressed));
+    EXPECT_TRUE(decompressed.empty());
+  }
+}
+
+TEST(CompressionTest, ReadsZlib) {
+  std::string content = MakeContent();
+  std::string compressed;
+  {
+    io::StringOutputStream output(&compressed);
+    io::GzipOutputStream::Options options;
+    options.format = io::GzipOutputStream::ZLIB;
+    io::GzipOutputStream stream(&output, options);
+    void *buffer;
+    int size;
+    ASSERT_TRUE(stream.Next(&buffer, &size));
+    ASSERT_GE(size, 16);
+    memcpy(buffer, content.data(), 16);
+    stream.BackUp(size - 16);
+  }
+  std::string decompressed;
+  EXPECT_TRUE(Decompress(compressed, &decompressed));
+  EXPECT_EQ(content.substr(0, 16), decompressed);
+}
+
+TEST(CompressionTest, DetectsCorruptSnappy) {
+  std::string compressed =
+      Compress(CompressionCodec::kSnappy, MakeContent());
+  std::string decompressed;
+  EXPECT_FALSE(Decompress(compressed.substr(0, compressed.size() / 2),
+                          &decompressed));
+  compressed[10] ^= 0x55;
+  EXPECT_FALSE(Decompress(compressed, &decompressed));
+}
+
+}  // namespace
+}  // namespace kythe
+
+int main(int argc, char **argv) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  ::testing::InitGoogleTest(&argc, argv);
+  int result = RUN_ALL_TESTS();
+  return result;
+}
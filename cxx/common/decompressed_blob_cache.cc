@@ -0,0 +1,111 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "decompressed_blob_cache.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+namespace kythe {
+
+bool DecompressedBlobCache::IsValidDigest(const std::string &digest) {
+  if (digest.size() != 64) {
+    return false;
+  }
+  // This also rules out path separators and extensions.
+  for (char c : digest) {
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string DecompressedBlobCache::PathFor(const std::string &digest) const {
+  llvm::SmallString<256> path(directory_);
+  llvm::sys::path::append(path, digest);
+  return path.str();
+}
+
+std::unique_ptr<llvm::MemoryBuffer> DecompressedBlobCache::Lookup(
+    const std::string &digest) const {
+  if (!IsValidDigest(digest)) {
+    return nullptr;
+  }
+  auto buffer = llvm::MemoryBuffer::getFile(PathFor(digest));
+  if (!buffer) {
+    return nullptr;
+  }
+  return std::move(buffer.get());
+}
+
+bool DecompressedBlobCache::Contains(const std::string &digest) const {
+  return IsValidDigest(digest) && llvm::sys::fs::exists(PathFor(digest));
+}
+
+bool DecompressedBlobCache::Insert(const std::string &digest,
+                                   llvm::StringRef content,
+                                   std::string *error_text) {
+  if (!IsValidDigest(digest)) {
+    *error_text = "Invalid blob name: " + digest;
+    return false;
+  }
+  std::string path = PathFor(digest);
+  int fd;
+  llvm::SmallString<256> temp_path;
+  if (auto err = llvm::sys::fs::createUniqueFile(
+          llvm::Twine(path) + ".%%%%%%%%.new", fd, temp_path)) {
+    *error_text = err.message() + " (" + path + ")";
+    return false;
+  }
+  bool ok = true;
+  const char *next = content.data();
+  size_t remaining = content.size();
+  while (ok && remaining > 0) {
+    ssize_t written = ::write(fd, next, remaining);
+    if (written >= 0) {
+      next += written;
+      remaining -= written;
+    } else if (errno != EINTR) {
+      *error_text = strerror(errno);
+      ok = false;
+    }
+  }
+  if (::close(fd) != 0 && ok) {
+    *error_text = strerror(errno);
+    ok = false;
+  }
+  // Concurrent writers of the same digest race harmlessly here, since they
+  // all write the same bytes.
+  if (ok) {
+    if (auto err =
+            llvm::sys::fs::rename(llvm::Twine(temp_path), llvm::Twine(path))) {
+      *error_text = err.message() + " (" + path + ")";
+      ok = false;
+    }
+  }
+  if (!ok) {
+    llvm::sys::fs::remove(llvm::Twine(temp_path));
+  }
+  return ok;
+}
+
+}  // namespace kythe
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_DECOMPRESSED_BLOB_CACHE_H_
+#define KYTHE_CXX_COMMON_DECOMPRESSED_BLOB_CACHE_H_
+
+#include <memory>
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace kythe {
+
+/// \brief A directory of decompressed file content named by SHA256 digest.
+///
+/// Index packs store each file gzipped. Units built in the same tree share
+/// most of their inputs (standard library headers, for instance), so keeping
+/// one decompressed copy per machine saves decompressing the same blob once
+/// for every unit that needs it. Cached blobs are memory-mapped, so processes
+/// that use the same cache also share the pages.
+///
+/// Entries are published with atomic renames; any number of threads and
+/// processes may use the same directory at once. Nothing is ever evicted.
+class DecompressedBlobCache {
+ public:
+  /// \param directory An existing directory to keep blobs in.
+  explicit DecompressedBlobCache(const std::string &directory)
+      : directory_(directory) {}
+
+  /// \brief Checks whether `digest` is a lowercase hex SHA256 digest (and so
+  /// may name a blob).
+  static bool IsValidDigest(const std::string &digest);
+
+  /// \brief Returns the blob named `digest`, or null if it isn't cached.
+  /// The buffer is null-terminated.
+  std::unique_ptr<llvm::MemoryBuffer> Lookup(const std::string &digest) const;
+
+  /// \brief Checks whether the blob named `digest` is cached.
+  bool Contains(const std::string &digest) const;
+
+  /// \brief Stores `content` as the blob named `digest`.
+  /// \param error_text Non-null; used to return error details.
+  /// \return false on failure and true on success.
+  bool Insert(const std::string &digest, llvm::StringRef content,
+              std::string *error_text);
+
+ private:
+  /// \brief Returns the path at which the blob `digest` is kept.
+  std::string PathFor(const std::string &digest) const;
+
+  /// The directory that holds the blobs.
+  std::string directory_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_DECOMPRESSED_BLOB_CACHE_H_
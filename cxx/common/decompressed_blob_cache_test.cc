@@ -0,0 +1,76 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "decompressed_blob_cache.h"
+
+#include <stdlib.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "llvm/Support/FileSystem.h"
+
+namespace kythe {
+namespace {
+
+const char kDigest[] =
+    "5b41362bc82b7f3d56edc5a306db22105707d01ff4819e26faef9724a2d406c9";
+
+/// \brief Returns a fresh directory for a blob cache.
+std::string TempCacheDirectory() {
+  const char *tmpdir = getenv("TEST_TMPDIR");
+  std::string path = std::string(tmpdir ? tmpdir : "/tmp") + "/blobsXXXXXX";
+  EXPECT_TRUE(mkdtemp(&path[0]) != nullptr);
+  return path;
+}
+
+TEST(DecompressedBlobCacheTest, ValidDigests) {
+  EXPECT_TRUE(DecompressedBlobCache::IsValidDigest(kDigest));
+  EXPECT_FALSE(DecompressedBlobCache::IsValidDigest(""));
+  EXPECT_FALSE(DecompressedBlobCache::IsValidDigest("abc"));
+  std::string bad(kDigest);
+  bad[10] = 'A';
+  EXPECT_FALSE(DecompressedBlobCache::IsValidDigest(bad));
+  bad[10] = '/';
+  EXPECT_FALSE(DecompressedBlobCache::IsValidDigest(bad));
+}
+
+TEST(DecompressedBlobCacheTest, InsertAndLookup) {
+  std::string directory = TempCacheDirectory();
+  DecompressedBlobCache cache(directory);
+  EXPECT_FALSE(cache.Contains(kDigest));
+  EXPECT_EQ(nullptr, cache.Lookup(kDigest));
+  std::string error_text;
+  ASSERT_TRUE(cache.Insert(kDigest, "data1", &error_text)) << error_text;
+  EXPECT_TRUE(cache.Contains(kDigest));
+  auto buffer = cache.Lookup(kDigest);
+  ASSERT_NE(nullptr, buffer);
+  EXPECT_EQ("data1", buffer->getBuffer());
+  EXPECT_EQ('\0', *buffer->getBufferEnd());
+  // Inserting again replaces the blob in place.
+  ASSERT_TRUE(cache.Insert(kDigest, "data1", &error_text)) << error_text;
+  EXPECT_FALSE(cache.Insert("../escape", "data1", &error_text));
+  EXPECT_TRUE(llvm::sys::fs::remove_directories(directory) ==
+              std::error_code());
+}
+
+}  // namespace
+}  // namespace kythe
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
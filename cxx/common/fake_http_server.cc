@@ -0,0 +1,296 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/fake_http_server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "glog/logging.h"
+#include "kythe/cxx/common/json_proto.h"
+#include "kythe/proto/xref.pb.h"
+#include "rapidjson/document.h"
+
+namespace kythe {
+namespace {
+
+/// \brief Writes all of `data` to `fd`.
+bool WriteAll(int fd, const std::string &data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t result = ::send(fd, data.data() + written, data.size() - written,
+                            MSG_NOSIGNAL);
+    if (result <= 0) {
+      return false;
+    }
+    written += result;
+  }
+  return true;
+}
+
+/// \brief Reads from `fd` until `buffer` holds at least `size` bytes.
+bool ReadAtLeast(int fd, size_t size, std::string *buffer) {
+  char chunk[4096];
+  while (buffer->size() < size) {
+    ssize_t result = ::recv(fd, chunk, sizeof(chunk), 0);
+    if (result <= 0) {
+      return false;
+    }
+    buffer->append(chunk, result);
+  }
+  return true;
+}
+
+/// \brief Returns the lowercased value of `header` in `headers`, or "".
+std::string HeaderValue(const std::string &headers, const std::string &header) {
+  std::string lowered(headers);
+  std::transform(lowered.begin(), lowered.end(), lowered.begin(), ::tolower);
+  size_t start = lowered.find("\r\n" + header + ":");
+  if (start == std::string::npos) {
+    return "";
+  }
+  start += header.size() + 3;
+  size_t end = lowered.find("\r\n", start);
+  std::string value = lowered.substr(start, end - start);
+  value.erase(0, value.find_first_not_of(' '));
+  return value;
+}
+
+/// \brief Decodes `body` as a `Request`, passes it to `call` and encodes the
+/// reply.
+/// \param as_proto Decode `body` as a wire-format protobuf (not JSON).
+/// \return the HTTP status code to respond with.
+template <typename Request, typename Reply>
+int ServeXrefsCall(
+    bool as_proto, const std::string &body, std::string *response,
+    std::function<bool(const Request &, Reply *, std::string *)> call) {
+  Request request;
+  if (as_proto) {
+    if (!request.ParseFromString(body)) {
+      return 400;
+    }
+  } else {
+    rapidjson::Document document;
+    document.Parse(body.c_str());
+    if (document.HasParseError() ||
+        !MergeJsonWithMessage(document, &request)) {
+      return 400;
+    }
+  }
+  Reply reply;
+  std::string error_text;
+  if (!call(request, &reply, &error_text) ||
+      !reply.SerializeToString(response)) {
+    return 500;
+  }
+  return 200;
+}
+
+}  // anonymous namespace
+
+FakeHttpServer::FakeHttpServer(Handler handler)
+    : handler_(std::move(handler)) {}
+
+FakeHttpServer::~FakeHttpServer() { Stop(); }
+
+bool FakeHttpServer::Start(std::string *error_text) {
+  listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd_ < 0) {
+    *error_text = std::string("socket: ") + ::strerror(errno);
+    return false;
+  }
+  int enable = 1;
+  ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  sockaddr_in address;
+  ::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+  socklen_t address_length = sizeof(address);
+  if (::bind(listen_fd_, reinterpret_cast<sockaddr *>(&address),
+             sizeof(address)) != 0 ||
+      ::listen(listen_fd_, SOMAXCONN) != 0 ||
+      ::getsockname(listen_fd_, reinterpret_cast<sockaddr *>(&address),
+                    &address_length) != 0) {
+    *error_text = std::string("can't listen: ") + ::strerror(errno);
+    ::close(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  }
+  port_ = ntohs(address.sin_port);
+  accept_thread_ = std::thread([this]() { AcceptConnections(); });
+  return true;
+}
+
+void FakeHttpServer::Stop() {
+  if (listen_fd_ < 0) {
+    return;
+  }
+  stopping_ = true;
+  // Shutting down a socket wakes up any thread blocked on it.
+  ::shutdown(listen_fd_, SHUT_RDWR);
+  accept_thread_.join();
+  ::close(listen_fd_);
+  listen_fd_ = -1;
+  std::lock_guard<std::mutex> lock(connections_mutex_);
+  for (int fd : connection_fds_) {
+    ::shutdown(fd, SHUT_RDWR);
+  }
+  for (auto &thread : connection_threads_) {
+    thread.join();
+  }
+  for (int fd : connection_fds_) {
+    ::close(fd);
+  }
+  connection_fds_.clear();
+  connection_threads_.clear();
+}
+
+std::string FakeHttpServer::base_uri() const {
+  return "http://127.0.0.1:" + std::to_string(port_);
+}
+
+void FakeHttpServer::AcceptConnections() {
+  while (!stopping_) {
+    int fd = ::accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0) {
+      if (stopping_) {
+        return;
+      }
+      continue;
+    }
+    ++connection_count_;
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    connection_fds_.push_back(fd);
+    connection_threads_.emplace_back([this, fd]() { ServeConnection(fd); });
+  }
+}
+
+void FakeHttpServer::ServeConnection(int fd) {
+  std::string buffer;
+  while (!stopping_ && ServeRequest(fd, &buffer)) {
+  }
+  // Let the client see the connection close; Stop() releases the fd.
+  ::shutdown(fd, SHUT_RDWR);
+}
+
+bool FakeHttpServer::ServeRequest(int fd, std::string *buffer) {
+  size_t header_end;
+  while ((header_end = buffer->find("\r\n\r\n")) == std::string::npos) {
+    if (!ReadAtLeast(fd, buffer->size() + 1, buffer)) {
+      return false;
+    }
+  }
+  std::string headers = buffer->substr(0, header_end + 2);
+  buffer->erase(0, header_end + 4);
+  // The request line is "METHOD PATH VERSION".
+  size_t path_start = headers.find(' ');
+  size_t path_end = headers.find(' ', path_start + 1);
+  if (path_start == std::string::npos || path_end == std::string::npos) {
+    return false;
+  }
+  std::string path = headers.substr(path_start + 1, path_end - path_start - 1);
+  if (HeaderValue(headers, "expect") == "100-continue" &&
+      !WriteAll(fd, "HTTP/1.1 100 Continue\r\n\r\n")) {
+    return false;
+  }
+  size_t content_length =
+      ::strtoul(HeaderValue(headers, "content-length").c_str(), nullptr, 10);
+  if (!ReadAtLeast(fd, content_length, buffer)) {
+    return false;
+  }
+  std::string body = buffer->substr(0, content_length);
+  buffer->erase(0, content_length);
+
+  size_t concurrent = ++concurrent_requests_;
+  size_t max_concurrent = max_concurrent_requests_;
+  while (concurrent > max_concurrent &&
+         !max_concurrent_requests_.compare_exchange_weak(max_concurrent,
+                                                         concurrent)) {
+  }
+  if (latency_ms_ > 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(latency_ms_));
+  }
+  std::string response_body;
+  int status =
+      handler_(path, HeaderValue(headers, "content-type"), body, &response_body);
+  --concurrent_requests_;
+  ++request_count_;
+  std::string response = "HTTP/1.1 " + std::to_string(status);
+  switch (status) {
+    case 200:
+      response += " OK\r\n";
+      break;
+    case 400:
+      response += " Bad Request\r\n";
+      break;
+    case 404:
+      response += " Not Found\r\n";
+      break;
+    default:
+      response += " Error\r\n";
+      break;
+  }
+  if (status != 200) {
+    response_body.clear();
+  }
+  response += "Content-Type: application/octet-stream\r\n";
+  response += "Content-Length: " + std::to_string(response_body.size());
+  response += "\r\n\r\n";
+  response += response_body;
+  return WriteAll(fd, response) &&
+         HeaderValue(headers, "connection") != "close";
+}
+
+FakeHttpServer::Handler FakeHttpServer::XrefsHandler(
+    XrefsClient *xrefs, bool decode_proto_requests) {
+  return [xrefs, decode_proto_requests](const std::string &path,
+                                        const std::string &content_type,
+                                        const std::string &body,
+                                        std::string *response) {
+    using namespace std::placeholders;
+    bool as_proto = decode_proto_requests &&
+                    content_type.find("application/x-protobuf") == 0;
+    std::string endpoint = path.substr(0, path.find('?'));
+    if (endpoint == "/nodes") {
+      return ServeXrefsCall<proto::NodesRequest, proto::NodesReply>(
+          as_proto, body, response,
+          std::bind(&XrefsClient::Nodes, xrefs, _1, _2, _3));
+    } else if (endpoint == "/edges") {
+      return ServeXrefsCall<proto::EdgesRequest, proto::EdgesReply>(
+          as_proto, body, response,
+          std::bind(&XrefsClient::Edges, xrefs, _1, _2, _3));
+    } else if (endpoint == "/decorations") {
+      return ServeXrefsCall<proto::DecorationsRequest, proto::DecorationsReply>(
+          as_proto, body, response,
+          std::bind(&XrefsClient::Decorations, xrefs, _1, _2, _3));
+    } else if (endpoint == "/search") {
+      return ServeXrefsCall<proto::SearchRequest, proto::SearchReply>(
+          as_proto, body, response,
+          std::bind(&XrefsClient::Search, xrefs, _1, _2, _3));
+    }
+    return 404;
+  };
+}
+
+}  // namespace kythe
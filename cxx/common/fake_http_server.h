@@ -0,0 +1,122 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_FAKE_HTTP_SERVER_H_
+#define KYTHE_CXX_COMMON_FAKE_HTTP_SERVER_H_
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kythe/cxx/common/net_client.h"
+
+namespace kythe {
+
+/// \brief A minimal in-process HTTP/1.1 server for testing network clients.
+///
+/// Listens on an ephemeral port on the loopback interface. Each connection
+/// is served on its own thread and is kept alive until the client closes it.
+class FakeHttpServer {
+ public:
+  /// \brief Answers a request.
+  /// \param path The request path, including any query string.
+  /// \param content_type The request's Content-Type, or "".
+  /// \param body The request body.
+  /// \param response Set to the response body.
+  /// \return The HTTP status code to respond with (200, 404 and 400 are
+  /// understood).
+  typedef std::function<int(const std::string &path,
+                            const std::string &content_type,
+                            const std::string &body, std::string *response)>
+      Handler;
+
+  /// \param handler Answers every request. Called concurrently from
+  /// connection threads.
+  explicit FakeHttpServer(Handler handler);
+  ~FakeHttpServer();
+
+  /// \brief Starts listening.
+  /// \param error_text Set to a description of any error.
+  /// \return false if the server could not be started.
+  bool Start(std::string *error_text);
+
+  /// \brief Stops listening and closes every connection.
+  void Stop();
+
+  /// \brief Returns the URI to send requests to ("http://127.0.0.1:port").
+  std::string base_uri() const;
+
+  /// \brief Delays every response by `latency`, to model a remote server.
+  void set_latency(std::chrono::milliseconds latency) {
+    latency_ms_ = latency.count();
+  }
+
+  /// \brief Returns the number of connections accepted so far.
+  size_t connection_count() const { return connection_count_; }
+
+  /// \brief Returns the number of requests answered so far.
+  size_t request_count() const { return request_count_; }
+
+  /// \brief Returns the most requests that were being answered at once.
+  size_t max_concurrent_requests() const { return max_concurrent_requests_; }
+
+  /// \brief Returns a handler that answers the xrefs service's requests with
+  /// `xrefs`, replying with wire-format protobufs.
+  /// \param xrefs The xrefs implementation to use. Must be thread-safe and
+  /// outlive the handler.
+  /// \param decode_proto_requests Decode "application/x-protobuf" requests
+  /// as protobufs. If false, every request is read as JSON (as older
+  /// services do).
+  static Handler XrefsHandler(XrefsClient *xrefs,
+                              bool decode_proto_requests = true);
+
+ private:
+  /// \brief Accepts connections until the server is stopped.
+  void AcceptConnections();
+
+  /// \brief Answers requests on `fd` until it is closed.
+  void ServeConnection(int fd);
+
+  /// \brief Reads one request from `fd` and writes its response.
+  /// \param buffer Data read from `fd` but not yet consumed.
+  /// \return false if the connection should be closed.
+  bool ServeRequest(int fd, std::string *buffer);
+
+  Handler handler_;
+  /// The listening socket, or -1.
+  int listen_fd_ = -1;
+  /// The port we're listening on.
+  int port_ = 0;
+  std::atomic<bool> stopping_{false};
+  std::atomic<int64_t> latency_ms_{0};
+  std::atomic<size_t> connection_count_{0};
+  std::atomic<size_t> request_count_{0};
+  std::atomic<size_t> concurrent_requests_{0};
+  std::atomic<size_t> max_concurrent_requests_{0};
+  std::thread accept_thread_;
+  /// Guards `connection_fds_` and `connection_threads_`.
+  std::mutex connections_mutex_;
+  std::vector<int> connection_fds_;
+  std::vector<std::thread> connection_threads_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_FAKE_HTTP_SERVER_H_
@@ -0,0 +1,311 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_digest_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/FileSystem.h"
+
+namespace kythe {
+
+/// A cache entry, as laid out in the file.
+struct FileDigestCache::Slot {
+  uint64_t device;
+  uint64_t inode;
+  uint64_t mtime_seconds;
+  uint64_t mtime_nanoseconds;
+  uint64_t size;
+  unsigned char digest[32];
+  /// A hash of the fields above, or 0 if the slot is empty or being written.
+  uint64_t check;
+};
+
+namespace {
+/// Identifies a file digest cache (and its format version).
+constexpr char kMagic[8] = {'K', 'D', 'I', 'G', 'E', 'S', 'T', '\x01'};
+
+/// The fixed-size prefix of a file digest cache.
+struct Header {
+  char magic[sizeof(kMagic)];
+  uint64_t slot_count;
+};
+
+/// How many slots to try, starting at an identity's home slot.
+constexpr size_t kProbeLength = 4;
+
+constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ULL;
+constexpr uint64_t kFnvPrime = 0x100000001b3ULL;
+
+/// \brief Mixes `size` bytes at `data` into the FNV-1a hash `hash`.
+uint64_t HashBytes(uint64_t hash, const void *data, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * kFnvPrime;
+  }
+  return hash;
+}
+
+uint64_t HashIdentity(const FileIdentity &identity) {
+  uint64_t hash = kFnvOffsetBasis;
+  hash = HashBytes(hash, &identity.device, sizeof(identity.device));
+  hash = HashBytes(hash, &identity.inode, sizeof(identity.inode));
+  hash = HashBytes(hash, &identity.mtime_seconds,
+                   sizeof(identity.mtime_seconds));
+  hash = HashBytes(hash, &identity.mtime_nanoseconds,
+                   sizeof(identity.mtime_nanoseconds));
+  return HashBytes(hash, &identity.size, sizeof(identity.size));
+}
+
+/// \brief Returns the checksum for a slot holding `identity` and `digest`.
+/// Never returns 0.
+uint64_t SlotCheck(const FileIdentity &identity, const unsigned char *digest) {
+  uint64_t check = HashBytes(HashIdentity(identity), digest, 32);
+  return check ? check : 1;
+}
+
+/// \brief Decodes a 64-character lowercase hex digest into 32 bytes.
+bool DecodeDigest(const std::string &hex, unsigned char *bytes) {
+  if (hex.size() != 64) {
+    return false;
+  }
+  for (size_t i = 0; i < 64; ++i) {
+    char c = hex[i];
+    unsigned value;
+    if (c >= '0' && c <= '9') {
+      value = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      value = c - 'a' + 10;
+    } else {
+      return false;
+    }
+    if (i % 2 == 0) {
+      bytes[i / 2] = value << 4;
+    } else {
+      bytes[i / 2] |= value;
+    }
+  }
+  return true;
+}
+
+std::string EncodeDigest(const unsigned char *bytes) {
+  static constexpr char kHexDigits[] = "0123456789abcdef";
+  std::string hex(64, '\0');
+  for (size_t i = 0; i < 32; ++i) {
+    hex[i * 2] = kHexDigits[bytes[i] >> 4];
+    hex[i * 2 + 1] = kHexDigits[bytes[i] & 0xf];
+  }
+  return hex;
+}
+
+/// \brief Creates a `size`-byte cache with `slot_count` slots at `path`
+/// unless some file is already there.
+///
+/// The table is built under a temporary name and linked into place, so no
+/// other process can see it before its header is written.
+bool CreateTable(const std::string &path, uint64_t slot_count, size_t size,
+                 std::string *error_text) {
+  // Extractors take the digests in the table on trust, so nobody else may
+  // write to it.
+  int fd;
+  llvm::SmallString<256> temp_path;
+  if (auto err = llvm::sys::fs::createUniqueFile(
+          llvm::Twine(path) + ".%%%%%%%%.new", fd, temp_path,
+          llvm::sys::fs::owner_read | llvm::sys::fs::owner_write)) {
+    *error_text = "Couldn't create a temporary file for " + path + ": " +
+                  err.message();
+    return false;
+  }
+  Header header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.slot_count = slot_count;
+  bool ok = ::ftruncate(fd, size) == 0 &&
+            ::pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+  if (!ok) {
+    *error_text = "Couldn't initialize " + temp_path.str().str() + ": " +
+                  strerror(errno);
+  }
+  if (::close(fd) != 0 && ok) {
+    *error_text = "Couldn't close " + temp_path.str().str() + ": " +
+                  strerror(errno);
+    ok = false;
+  }
+  // Unlike rename, link won't replace a table that another process created
+  // (and may already be using) in the meantime.
+  if (ok && ::link(temp_path.c_str(), path.c_str()) != 0 && errno != EEXIST) {
+    *error_text = "Couldn't link " + temp_path.str().str() + " to " + path +
+                  ": " + strerror(errno);
+    ok = false;
+  }
+  ::unlink(temp_path.c_str());
+  return ok;
+}
+}  // anonymous namespace
+
+bool IdentifyFile(const std::string &path, FileIdentity *identity) {
+  struct stat info;
+  if (::stat(path.c_str(), &info) != 0) {
+    return false;
+  }
+  identity->device = info.st_dev;
+  identity->inode = info.st_ino;
+  identity->mtime_seconds = info.st_mtime;
+#if defined(__APPLE__)
+  identity->mtime_nanoseconds = info.st_mtimespec.tv_nsec;
+#else
+  identity->mtime_nanoseconds = info.st_mtim.tv_nsec;
+#endif
+  identity->size = info.st_size;
+  return true;
+}
+
+std::unique_ptr<FileDigestCache> FileDigestCache::Open(
+    const std::string &path, size_t slot_count, std::string *error_text) {
+  int fd = ::open(path.c_str(), O_RDWR);
+  if (fd < 0 && errno == ENOENT) {
+    // We're (probably) the first user. If another process creates the cache
+    // first, we'll open its table instead, and the size check below catches
+    // disagreements on `slot_count`.
+    if (!CreateTable(path, slot_count,
+                     sizeof(Header) + slot_count * sizeof(Slot),
+                     error_text)) {
+      return nullptr;
+    }
+    fd = ::open(path.c_str(), O_RDWR);
+  }
+  if (fd < 0) {
+    *error_text = "Couldn't open " + path + ": " + strerror(errno);
+    return nullptr;
+  }
+  struct stat info;
+  if (::fstat(fd, &info) != 0) {
+    *error_text = "Couldn't stat " + path + ": " + strerror(errno);
+    ::close(fd);
+    return nullptr;
+  }
+  if (info.st_uid != ::geteuid() || (info.st_mode & (S_IWGRP | S_IWOTH))) {
+    *error_text = path + " could have been written by another user.";
+    ::close(fd);
+    return nullptr;
+  }
+  size_t size = info.st_size;
+  if (size < sizeof(Header)) {
+    *error_text = path + " is too small to be a file digest cache.";
+    ::close(fd);
+    return nullptr;
+  }
+  void *mapping =
+      ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  // The mapping holds its own reference to the file.
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    *error_text = "Couldn't map " + path + ": " + strerror(errno);
+    return nullptr;
+  }
+  const Header *header = static_cast<const Header *>(mapping);
+  if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->slot_count == 0 ||
+      (size - sizeof(Header)) / sizeof(Slot) != header->slot_count ||
+      (size - sizeof(Header)) % sizeof(Slot) != 0) {
+    *error_text = path + " is not a valid file digest cache.";
+    ::munmap(mapping, size);
+    return nullptr;
+  }
+  // Lookups are random; don't waste effort reading ahead.
+  ::madvise(mapping, size, MADV_RANDOM);
+  Slot *slots = reinterpret_cast<Slot *>(static_cast<char *>(mapping) +
+                                         sizeof(Header));
+  return std::unique_ptr<FileDigestCache>(
+      new FileDigestCache(mapping, size, slots, header->slot_count));
+}
+
+FileDigestCache::~FileDigestCache() { ::munmap(mapping_, mapping_size_); }
+
+bool FileDigestCache::Lookup(const FileIdentity &identity,
+                             std::string *digest) const {
+  size_t home = HashIdentity(identity) % slot_count_;
+  for (size_t probe = 0; probe < kProbeLength; ++probe) {
+    const Slot *slot = &slots_[(home + probe) % slot_count_];
+    uint64_t check = __atomic_load_n(&slot->check, __ATOMIC_ACQUIRE);
+    if (check == 0) {
+      continue;
+    }
+    Slot copy;
+    memcpy(&copy, slot, sizeof(copy));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    // If a writer got in while we were copying, the check will have changed
+    // or won't match the copy.
+    if (__atomic_load_n(&slot->check, __ATOMIC_RELAXED) != check) {
+      continue;
+    }
+    FileIdentity found;
+    found.device = copy.device;
+    found.inode = copy.inode;
+    found.mtime_seconds = copy.mtime_seconds;
+    found.mtime_nanoseconds = copy.mtime_nanoseconds;
+    found.size = copy.size;
+    if (SlotCheck(found, copy.digest) != check) {
+      continue;
+    }
+    if (found.device == identity.device && found.inode == identity.inode &&
+        found.mtime_seconds == identity.mtime_seconds &&
+        found.mtime_nanoseconds == identity.mtime_nanoseconds &&
+        found.size == identity.size) {
+      *digest = EncodeDigest(copy.digest);
+      return true;
+    }
+  }
+  return false;
+}
+
+void FileDigestCache::Insert(const FileIdentity &identity,
+                             const std::string &digest) {
+  Slot slot;
+  if (!DecodeDigest(digest, slot.digest)) {
+    return;
+  }
+  slot.device = identity.device;
+  slot.inode = identity.inode;
+  slot.mtime_seconds = identity.mtime_seconds;
+  slot.mtime_nanoseconds = identity.mtime_nanoseconds;
+  slot.size = identity.size;
+  slot.check = SlotCheck(identity, slot.digest);
+  // Prefer an empty slot in the probe sequence; otherwise, evict whatever
+  // lives in the home slot.
+  size_t home = HashIdentity(identity) % slot_count_;
+  Slot *target = &slots_[home];
+  for (size_t probe = 0; probe < kProbeLength; ++probe) {
+    Slot *candidate = &slots_[(home + probe) % slot_count_];
+    if (__atomic_load_n(&candidate->check, __ATOMIC_RELAXED) == 0) {
+      target = candidate;
+      break;
+    }
+  }
+  // Readers ignore the slot until the new check is published.
+  __atomic_store_n(&target->check, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(target, &slot, offsetof(Slot, check));
+  __atomic_store_n(&target->check, slot.check, __ATOMIC_RELEASE);
+}
+
+}  // namespace kythe
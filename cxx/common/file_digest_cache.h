@@ -0,0 +1,103 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_FILE_DIGEST_CACHE_H_
+#define KYTHE_CXX_COMMON_FILE_DIGEST_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+
+namespace kythe {
+
+/// \brief What a `FileDigestCache` knows about a file on disk. If any of
+/// these change, the file is assumed to have changed.
+struct FileIdentity {
+  uint64_t device = 0;
+  uint64_t inode = 0;
+  uint64_t mtime_seconds = 0;
+  uint64_t mtime_nanoseconds = 0;
+  uint64_t size = 0;
+};
+
+/// \brief Fills `identity` from `stat(path)`.
+/// \return false if `path` couldn't be stat'd.
+bool IdentifyFile(const std::string &path, FileIdentity *identity);
+
+/// \brief A persistent map from file identities to SHA256 digests.
+///
+/// The cache is a fixed-size, memory-mapped hash table that any number of
+/// processes may read and update at once; it's meant to let extractors that
+/// run during the same build skip rehashing the headers they share. Each
+/// slot carries a checksum, so readers ignore slots that another process is
+/// in the middle of writing. When the table is full, new entries replace old
+/// ones.
+///
+/// Digests read from the cache are trusted, so it is private to the user who
+/// created it: `Open` refuses tables that belong to someone else or that
+/// other users may write to.
+class FileDigestCache {
+ public:
+  /// \brief The number of slots in a table created with the default size.
+  static constexpr size_t kDefaultSlotCount = 64 * 1024;
+
+  /// \brief Maps the cache at `path`, creating it with `slot_count` slots if
+  /// it doesn't exist yet.
+  /// \param error_text Non-null; used to return error details.
+  /// \return The cache, or null on error.
+  static std::unique_ptr<FileDigestCache> Open(const std::string &path,
+                                               size_t slot_count,
+                                               std::string *error_text);
+
+  ~FileDigestCache();
+
+  /// \brief Finds the digest of the file with `identity`.
+  /// \param digest Set to the lowercase hex SHA256 digest on success.
+  /// \return true if the digest was found.
+  bool Lookup(const FileIdentity &identity, std::string *digest) const;
+
+  /// \brief Records that the file with `identity` has `digest` (a lowercase
+  /// hex SHA256 digest). Malformed digests are ignored.
+  void Insert(const FileIdentity &identity, const std::string &digest);
+
+  /// \brief Returns the number of slots in this cache.
+  size_t slot_count() const { return slot_count_; }
+
+ private:
+  struct Slot;
+
+  FileDigestCache(void *mapping, size_t mapping_size, Slot *slots,
+                  size_t slot_count)
+      : mapping_(mapping),
+        mapping_size_(mapping_size),
+        slots_(slots),
+        slot_count_(slot_count) {}
+
+  /// The start of the mapped file.
+  void *mapping_;
+  /// The length of the mapped file.
+  size_t mapping_size_;
+  /// The slots in the mapped file.
+  Slot *slots_;
+  /// The number of entries in `slots_`.
+  size_t slot_count_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_FILE_DIGEST_CACHE_H_
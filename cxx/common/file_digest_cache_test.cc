@@ -0,0 +1,201 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_digest_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "google/protobuf/stubs/common.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+const char kDigestA[] =
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+const char kDigestB[] =
+    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef";
+
+/// \brief Returns a fresh path for a temporary cache file. Nothing exists at
+/// the path yet.
+std::string TempCachePath() {
+  const char *tmpdir = getenv("TEST_TMPDIR");
+  std::string path = std::string(tmpdir ? tmpdir : "/tmp") + "/digestXXXXXX";
+  int fd = mkstemp(&path[0]);
+  EXPECT_GE(fd, 0);
+  close(fd);
+  unlink(path.c_str());
+  return path;
+}
+
+FileIdentity MakeIdentity(uint64_t inode) {
+  FileIdentity identity;
+  identity.device = 1;
+  identity.inode = inode;
+  identity.mtime_seconds = 1000;
+  identity.mtime_nanoseconds = 500;
+  identity.size = 42;
+  return identity;
+}
+
+TEST(FileDigestCacheTest, InsertAndLookup) {
+  std::string path = TempCachePath();
+  std::string error_text;
+  auto cache = FileDigestCache::Open(path, 16, &error_text);
+  ASSERT_TRUE(cache != nullptr) << error_text;
+  EXPECT_EQ(16, cache->slot_count());
+  std::string digest;
+  EXPECT_FALSE(cache->Lookup(MakeIdentity(1), &digest));
+  cache->Insert(MakeIdentity(1), kDigestA);
+  cache->Insert(MakeIdentity(2), kDigestB);
+  ASSERT_TRUE(cache->Lookup(MakeIdentity(1), &digest));
+  EXPECT_EQ(kDigestA, digest);
+  ASSERT_TRUE(cache->Lookup(MakeIdentity(2), &digest));
+  EXPECT_EQ(kDigestB, digest);
+  // Any change to the identity is a miss.
+  FileIdentity touched = MakeIdentity(1);
+  touched.mtime_nanoseconds = 501;
+  EXPECT_FALSE(cache->Lookup(touched, &digest));
+  FileIdentity grown = MakeIdentity(1);
+  grown.size = 43;
+  EXPECT_FALSE(cache->Lookup(grown, &digest));
+  // Malformed digests aren't recorded.
+  cache->Insert(MakeIdentity(3), "not a digest");
+  EXPECT_FALSE(cache->Lookup(MakeIdentity(3), &digest));
+  unlink(path.c_str());
+}
+
+TEST(FileDigestCacheTest, SharedBetweenOpens) {
+  std::string path = TempCachePath();
+  std::string error_text;
+  auto writer = FileDigestCache::Open(path, 16, &error_text);
+  ASSERT_TRUE(writer != nullptr) << error_text;
+  // The existing table's size wins over the requested one.
+  auto reader = FileDigestCache::Open(path, 1024, &error_text);
+  ASSERT_TRUE(reader != nullptr) << error_text;
+  EXPECT_EQ(16, reader->slot_count());
+  writer->Insert(MakeIdentity(7), kDigestA);
+  std::string digest;
+  ASSERT_TRUE(reader->Lookup(MakeIdentity(7), &digest));
+  EXPECT_EQ(kDigestA, digest);
+  writer.reset();
+  reader.reset();
+  auto reopened = FileDigestCache::Open(path, 16, &error_text);
+  ASSERT_TRUE(reopened != nullptr) << error_text;
+  ASSERT_TRUE(reopened->Lookup(MakeIdentity(7), &digest));
+  EXPECT_EQ(kDigestA, digest);
+  unlink(path.c_str());
+}
+
+TEST(FileDigestCacheTest, ConcurrentCreation) {
+  std::string path = TempCachePath();
+  // Every opener must see a complete table, whichever of them creates it.
+  std::vector<std::unique_ptr<FileDigestCache>> caches(8);
+  std::vector<std::string> errors(caches.size());
+  std::vector<std::thread> openers;
+  for (size_t i = 0; i < caches.size(); ++i) {
+    openers.emplace_back([&path, &caches, &errors, i]() {
+      caches[i] = FileDigestCache::Open(path, 16, &errors[i]);
+    });
+  }
+  for (auto &opener : openers) {
+    opener.join();
+  }
+  for (size_t i = 0; i < caches.size(); ++i) {
+    ASSERT_TRUE(caches[i] != nullptr) << errors[i];
+    EXPECT_EQ(16, caches[i]->slot_count());
+  }
+  caches[0]->Insert(MakeIdentity(9), kDigestB);
+  std::string digest;
+  ASSERT_TRUE(caches.back()->Lookup(MakeIdentity(9), &digest));
+  EXPECT_EQ(kDigestB, digest);
+  unlink(path.c_str());
+}
+
+TEST(FileDigestCacheTest, EvictsWhenFull) {
+  std::string path = TempCachePath();
+  std::string error_text;
+  auto cache = FileDigestCache::Open(path, 4, &error_text);
+  ASSERT_TRUE(cache != nullptr) << error_text;
+  for (uint64_t inode = 0; inode < 64; ++inode) {
+    cache->Insert(MakeIdentity(inode), kDigestA);
+  }
+  // The most recent insertion always survives.
+  std::string digest;
+  ASSERT_TRUE(cache->Lookup(MakeIdentity(63), &digest));
+  EXPECT_EQ(kDigestA, digest);
+  unlink(path.c_str());
+}
+
+TEST(FileDigestCacheTest, TableIsPrivate) {
+  std::string path = TempCachePath();
+  std::string error_text;
+  mode_t old_mask = umask(0);
+  auto cache = FileDigestCache::Open(path, 16, &error_text);
+  umask(old_mask);
+  ASSERT_TRUE(cache != nullptr) << error_text;
+  struct stat info;
+  ASSERT_EQ(0, stat(path.c_str(), &info));
+  EXPECT_EQ(0600, info.st_mode & 0777);
+  cache.reset();
+  // Tables that others can write to aren't trusted.
+  ASSERT_EQ(0, chmod(path.c_str(), 0666));
+  EXPECT_TRUE(FileDigestCache::Open(path, 16, &error_text) == nullptr);
+  unlink(path.c_str());
+}
+
+TEST(FileDigestCacheTest, RejectsOtherFiles) {
+  std::string path = TempCachePath();
+  FILE *file = fopen(path.c_str(), "w");
+  ASSERT_TRUE(file != nullptr);
+  fputs("not a digest cache, but long enough to have a header", file);
+  fclose(file);
+  std::string error_text;
+  EXPECT_TRUE(FileDigestCache::Open(path, 16, &error_text) == nullptr);
+  EXPECT_FALSE(error_text.empty());
+  unlink(path.c_str());
+}
+
+TEST(FileDigestCacheTest, IdentifyFile) {
+  std::string path = TempCachePath();
+  FILE *file = fopen(path.c_str(), "w");
+  ASSERT_TRUE(file != nullptr);
+  fputs("12345", file);
+  fclose(file);
+  FileIdentity identity;
+  ASSERT_TRUE(IdentifyFile(path, &identity));
+  EXPECT_EQ(5, identity.size);
+  EXPECT_NE(0, identity.inode);
+  unlink(path.c_str());
+  EXPECT_FALSE(IdentifyFile(path, &identity));
+}
+
+}  // namespace
+}  // namespace kythe
+
+int main(int argc, char **argv) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  ::testing::InitGoogleTest(&argc, argv);
+  int result = RUN_ALL_TESTS();
+  return result;
+}
@@ -16,6 +16,8 @@
 
 #include "file_vname_generator.h"
 
+#include <algorithm>
+
 #include "glog/logging.h"
 #include "rapidjson/document.h"
 #include "rapidjson/error/en.h"
@@ -83,8 +85,31 @@ bool FileVNameGenerator::ParseRule(const std::string &rule, int max_capture,
   return true;
 }
 
-kythe::proto::VName FileVNameGenerator::LookupBaseVName(
-    const std::string &path) {
+bool FileVNameGenerator::CompileRuleSet() {
+  RE2::Options options;
+  options.set_max_mem(kRuleSetMaxMem);
+  rule_set_.reset(new RE2::Set(options, RE2::ANCHOR_BOTH));
+  for (const auto &rule : rules_) {
+    std::string error_text;
+    if (rule_set_->Add(rule.pattern->pattern(), &error_text) < 0) {
+      LOG(WARNING) << "Can't add " << rule.pattern->pattern()
+                   << " to the vname rule set: " << error_text;
+      rule_set_.reset();
+      rule_set_failed_ = true;
+      return false;
+    }
+  }
+  if (!rule_set_->Compile()) {
+    LOG(WARNING) << "Can't compile the vname rule set.";
+    rule_set_.reset();
+    rule_set_failed_ = true;
+    return false;
+  }
+  return true;
+}
+
+kythe::proto::VName FileVNameGenerator::ApplyFirstMatchingRule(
+    const std::string &path, size_t first_rule) {
   re2::StringPiece argv[kMaxRegexArgs];
   RE2::Arg args[kMaxRegexArgs];
   RE2::Arg *arg_pointers[kMaxRegexArgs];
@@ -92,7 +117,8 @@ kythe::proto::VName FileVNameGenerator::LookupBaseVName(
     args[n] = &argv[n];
     arg_pointers[n] = &args[n];
   }
-  for (const auto &rule : rules_) {
+  for (size_t index = first_rule; index < rules_.size(); ++index) {
+    const auto &rule = rules_[index];
     // Invariant: capture_groups <= kMaxRegexArgs
     // RE2 will fail to match if we provide more args than there are captures
     // for a given regex.
@@ -114,6 +140,54 @@ kythe::proto::VName FileVNameGenerator::LookupBaseVName(
   return kythe::proto::VName();
 }
 
+void FileVNameGenerator::CacheLookup(const std::string &path,
+                                     const kythe::proto::VName &vname) {
+  if (lookup_cache_size_ == 0) {
+    return;
+  }
+  if (lookup_cache_.size() >= lookup_cache_size_) {
+    lookup_cache_index_.erase(lookup_cache_.back().first);
+    lookup_cache_.pop_back();
+  }
+  lookup_cache_.emplace_front(path, vname);
+  lookup_cache_index_[path] = lookup_cache_.begin();
+}
+
+void FileVNameGenerator::set_lookup_cache_size(size_t size) {
+  lookup_cache_size_ = size;
+  while (lookup_cache_.size() > lookup_cache_size_) {
+    lookup_cache_index_.erase(lookup_cache_.back().first);
+    lookup_cache_.pop_back();
+  }
+}
+
+kythe::proto::VName FileVNameGenerator::LookupBaseVName(
+    const std::string &path) {
+  const auto cached = lookup_cache_index_.find(path);
+  if (cached != lookup_cache_index_.end()) {
+    lookup_cache_.splice(lookup_cache_.begin(), lookup_cache_, cached->second);
+    return cached->second->second;
+  }
+  if (rules_.empty()) {
+    return kythe::proto::VName();
+  }
+  size_t first_rule = 0;
+  if (!rule_set_failed_ && (rule_set_ != nullptr || CompileRuleSet())) {
+    // The set reports every rule that matches; only the earliest one applies.
+    // Match also returns false when the DFA runs out of memory, so a false
+    // result falls back to trying each rule in turn instead of being
+    // remembered as a miss.
+    std::vector<int> matching_rules;
+    if (rule_set_->Match(path, &matching_rules) && !matching_rules.empty()) {
+      first_rule =
+          *std::min_element(matching_rules.begin(), matching_rules.end());
+    }
+  }
+  kythe::proto::VName result = ApplyFirstMatchingRule(path, first_rule);
+  CacheLookup(path, result);
+  return result;
+}
+
 kythe::proto::VName FileVNameGenerator::LookupVName(const std::string &path) {
   kythe::proto::VName vname = LookupBaseVName(path);
   if (vname.path().empty()) {
@@ -140,6 +214,11 @@ bool FileVNameGenerator::LoadJsonString(const std::string &data,
     *error_text = "Root element in JSON was not an array.";
     return false;
   }
+  // Any rules added below invalidate the rule set and earlier lookups.
+  rule_set_.reset();
+  rule_set_failed_ = false;
+  lookup_cache_.clear();
+  lookup_cache_index_.clear();
   for (Value::ConstValueIterator rule = document.Begin();
        rule != document.End(); ++rule) {
     if (!rule->IsObject()) {
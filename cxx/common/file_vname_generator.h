@@ -17,12 +17,16 @@
 #ifndef KYTHE_CXX_COMMON_FILE_VNAME_GENERATOR_H_
 #define KYTHE_CXX_COMMON_FILE_VNAME_GENERATOR_H_
 
+#include <list>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "kythe/proto/storage.pb.h"
 #include "re2/re2.h"
+#include "re2/set.h"
 
 namespace kythe {
 
@@ -44,6 +48,13 @@ class FileVNameGenerator {
   /// \brief Returns a VName for the given file path.
   kythe::proto::VName LookupVName(const std::string &path);
 
+  /// \brief Sets the number of recent `LookupBaseVName` results to remember.
+  /// A size of 0 disables the cache.
+  void set_lookup_cache_size(size_t size);
+
+  /// The default number of cached lookups.
+  static constexpr size_t kDefaultLookupCacheSize = 4096;
+
  private:
   /// \brief A command to use when building a result string.
   struct StringConsNode {
@@ -82,8 +93,35 @@ class FileVNameGenerator {
     /// Substitution pattern used to construct the path.
     StringConsRule path;
   };
+  /// \brief Compiles every pattern in `rules_` into `rule_set_`.
+  /// \return false if the set could not be built.
+  bool CompileRuleSet();
+  /// \brief Finds the first rule at or after `first_rule` that matches `path`
+  /// and applies it.
+  kythe::proto::VName ApplyFirstMatchingRule(const std::string &path,
+                                             size_t first_rule);
+  /// \brief Remembers `vname` as the result for `path`, evicting the least
+  /// recently used entry if the cache is full.
+  void CacheLookup(const std::string &path, const kythe::proto::VName &vname);
   /// The rules to apply to incoming paths. The first one to match is used.
   std::vector<VNameRule> rules_;
+  /// All rule patterns, anchored at both ends, in the same order as `rules_`.
+  /// Null if the set needs to be (re)built or could not be built.
+  std::unique_ptr<RE2::Set> rule_set_;
+  /// Set when `rule_set_` could not be built for the current `rules_`; lookups
+  /// then try each rule in turn without rebuilding it.
+  bool rule_set_failed_ = false;
+  /// The memory budget for `rule_set_`'s automata.
+  static constexpr int64_t kRuleSetMaxMem = 64 << 20;
+  /// Recent lookups, most recently used first.
+  using LookupCacheList =
+      std::list<std::pair<std::string, kythe::proto::VName>>;
+  LookupCacheList lookup_cache_;
+  /// Maps paths to their entries in `lookup_cache_`.
+  std::unordered_map<std::string, LookupCacheList::iterator>
+      lookup_cache_index_;
+  /// The maximum number of entries in `lookup_cache_`.
+  size_t lookup_cache_size_ = kDefaultLookupCacheSize;
   /// Used internally to find substitution markers when compiling rules.
   RE2 substitution_matcher_{"([^@]*)@([^@]+)@"};
 };
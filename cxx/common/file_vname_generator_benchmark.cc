@@ -0,0 +1,165 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// file_vname_generator_benchmark
+//   times FileVNameGenerator lookups over a vnames configuration (by default
+//   the one in kythe/data) against a linear scan of the same patterns.
+
+#include <stdio.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "file_vname_generator.h"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "rapidjson/document.h"
+#include "re2/re2.h"
+
+DEFINE_string(vnames, "kythe/data/vnames.json",
+              "The vnames configuration to benchmark.");
+DEFINE_int32(paths, 2000, "The number of distinct paths to look up.");
+DEFINE_int32(repeats, 50, "The number of times to look up each path.");
+DEFINE_int32(extra_rules, 0,
+             "Prepend this many rules that match none of the paths, to model "
+             "larger configurations.");
+
+namespace {
+
+/// \brief Returns `count` paths shaped like the ones an extractor sees.
+std::vector<std::string> MakePaths(int count) {
+  static const char *const kShapes[] = {
+      "kythe/cxx/indexer/cxx/src%d.cc",
+      "/usr/include/sys/header%d.h",
+      "/usr/include/c++/4.8/bits/header%d.h",
+      "third_party/llvm/lib/clang/3.7.0/include/header%d.h",
+      "/kythe_builtins/include/header%d.h",
+      "bazel-out/local_linux-fastbuild/bin/kythe/java/lib.jar!/com/A%d.class",
+      "third_party/guava/guava.jar!/com/google/common/B%d$Inner.class",
+      "kythe/java/com/google/devtools/kythe/C%d.java",
+  };
+  static const int kShapeCount = sizeof(kShapes) / sizeof(kShapes[0]);
+  std::vector<std::string> paths;
+  paths.reserve(count);
+  char buffer[256];
+  for (int i = 0; i < count; ++i) {
+    snprintf(buffer, sizeof(buffer), kShapes[i % kShapeCount], i);
+    paths.push_back(buffer);
+  }
+  return paths;
+}
+
+/// \brief Returns `config` with `count` extra rules at its front.
+std::string AddExtraRules(const std::string &config, int count) {
+  std::string rules;
+  for (int i = 0; i < count; ++i) {
+    rules += "{\"pattern\": \"unused/project" + std::to_string(i) +
+             "/(.*)\", \"vname\": {\"corpus\": \"project" +
+             std::to_string(i) + "\", \"path\": \"@1@\"}},";
+  }
+  size_t open = config.find('[');
+  CHECK(open != std::string::npos) << "The configuration isn't an array.";
+  return config.substr(0, open + 1) + rules + config.substr(open + 1);
+}
+
+/// \brief Tries each pattern in `patterns` in order, as lookups did before
+/// the rules were compiled into a set, and returns the length of the
+/// captures of the first one that matches.
+size_t MatchLinearly(const std::vector<std::unique_ptr<re2::RE2>> &patterns,
+                     const std::string &path) {
+  re2::StringPiece captures[16];
+  re2::RE2::Arg args[16];
+  re2::RE2::Arg *arg_pointers[16];
+  for (size_t n = 0; n < 16; ++n) {
+    args[n] = &captures[n];
+    arg_pointers[n] = &args[n];
+  }
+  for (const auto &pattern : patterns) {
+    int capture_groups = pattern->NumberOfCapturingGroups();
+    if (re2::RE2::FullMatchN(path, *pattern, arg_pointers, capture_groups)) {
+      size_t length = 0;
+      for (int n = 0; n < capture_groups; ++n) {
+        length += captures[n].ToString().size();
+      }
+      return length;
+    }
+  }
+  return 0;
+}
+
+/// \brief Runs `lookup` on every path `repeats` times and reports the cost.
+template <typename Lookup>
+void Time(const char *label, const std::vector<std::string> &paths,
+          int repeats, Lookup lookup) {
+  size_t checksum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int repeat = 0; repeat < repeats; ++repeat) {
+    for (const auto &path : paths) {
+      checksum += lookup(path);
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  double lookups = static_cast<double>(paths.size()) * repeats;
+  std::cout << label << ": " << elapsed.count() << "s, "
+            << elapsed.count() * 1e9 / lookups << "ns/lookup (checksum "
+            << checksum << ")" << std::endl;
+}
+
+}  // anonymous namespace
+
+int main(int argc, char *argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  google::SetVersionString("0.1");
+  google::SetUsageMessage("file_vname_generator_benchmark [--vnames=file]");
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  std::ifstream config_stream(FLAGS_vnames);
+  CHECK(config_stream.good()) << "Can't open " << FLAGS_vnames;
+  std::stringstream config_text;
+  config_text << config_stream.rdbuf();
+  std::string config = AddExtraRules(config_text.str(), FLAGS_extra_rules);
+  std::string error_text;
+  kythe::FileVNameGenerator cached;
+  CHECK(cached.LoadJsonString(config, &error_text)) << error_text;
+  kythe::FileVNameGenerator uncached;
+  uncached.set_lookup_cache_size(0);
+  CHECK(uncached.LoadJsonString(config, &error_text)) << error_text;
+  rapidjson::Document document;
+  document.Parse(config.c_str());
+  std::vector<std::unique_ptr<re2::RE2>> patterns;
+  for (auto rule = document.Begin(); rule != document.End(); ++rule) {
+    patterns.emplace_back(new re2::RE2((*rule)["pattern"].GetString()));
+  }
+  std::cout << patterns.size() << " rules, " << FLAGS_paths << " paths, "
+            << FLAGS_repeats << " repeats" << std::endl;
+  std::vector<std::string> paths = MakePaths(FLAGS_paths);
+  Time("linear scan", paths, FLAGS_repeats, [&](const std::string &path) {
+    return MatchLinearly(patterns, path);
+  });
+  Time("rule set", paths, FLAGS_repeats, [&](const std::string &path) {
+    return uncached.LookupVName(path).ByteSize();
+  });
+  Time("rule set and cache", paths, FLAGS_repeats,
+       [&](const std::string &path) {
+         return cached.LookupVName(path).ByteSize();
+       });
+  return 0;
+}
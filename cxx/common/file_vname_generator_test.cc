@@ -111,6 +111,62 @@ TEST(FileVNameGenerator, LookupGroups) {
           .DebugString());
 }
 
+TEST(FileVNameGenerator, LookupUnmatched) {
+  FileVNameGenerator generator;
+  std::string error_text;
+  ASSERT_TRUE(generator.LoadJsonString(
+      R"d([{"pattern": "a/(.*)", "vname": {"corpus": "a", "path": "@1@"}}])d",
+      &error_text))
+      << "Couldn't parse: " << error_text;
+  kythe::proto::VName default_vname;
+  EXPECT_EQ(default_vname.DebugString(),
+            generator.LookupBaseVName("b/a/c").DebugString());
+  // Patterns must match the whole path.
+  EXPECT_EQ(default_vname.DebugString(),
+            generator.LookupBaseVName("xa/c").DebugString());
+}
+
+TEST(FileVNameGenerator, LookupSeesNewRules) {
+  FileVNameGenerator generator;
+  std::string error_text;
+  ASSERT_TRUE(generator.LoadJsonString(
+      R"d([{"pattern": "a/.*", "vname": {"corpus": "a"}}])d", &error_text))
+      << "Couldn't parse: " << error_text;
+  kythe::proto::VName default_vname;
+  EXPECT_EQ(default_vname.DebugString(),
+            generator.LookupBaseVName("b/c").DebugString());
+  ASSERT_TRUE(generator.LoadJsonString(
+      R"d([{"pattern": "b/.*", "vname": {"corpus": "b"}}])d", &error_text))
+      << "Couldn't parse: " << error_text;
+  kythe::proto::VName b_vname;
+  b_vname.set_corpus("b");
+  EXPECT_EQ(b_vname.DebugString(),
+            generator.LookupBaseVName("b/c").DebugString());
+}
+
+TEST(FileVNameGenerator, LookupWithSmallCache) {
+  FileVNameGenerator generator;
+  generator.set_lookup_cache_size(1);
+  std::string error_text;
+  ASSERT_TRUE(generator.LoadJsonString(kSharedTestFile, &error_text))
+      << "Couldn't parse: " << error_text;
+  kythe::proto::VName first_vname;
+  first_vname.set_corpus("first");
+  kythe::proto::VName second_vname;
+  second_vname.set_corpus("second");
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(first_vname.DebugString(),
+              generator.LookupBaseVName("dup/path").DebugString());
+    EXPECT_EQ(first_vname.DebugString(),
+              generator.LookupBaseVName("dup/path").DebugString());
+    EXPECT_EQ(second_vname.DebugString(),
+              generator.LookupBaseVName("dup/path2").DebugString());
+  }
+  generator.set_lookup_cache_size(0);
+  EXPECT_EQ(second_vname.DebugString(),
+            generator.LookupBaseVName("dup/path2").DebugString());
+}
+
 TEST(FileVNameGenerator, ActualConfigTests) {
   FileVNameGenerator generator;
   std::string error_text;
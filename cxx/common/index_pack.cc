@@ -19,12 +19,16 @@
 #include <openssl/sha.h>
 #include <uuid/uuid.h>
 
+#include <algorithm>
+#include <atomic>
+
 #include "glog/logging.h"
 #include "google/protobuf/io/coded_stream.h"
-#include "google/protobuf/io/gzip_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
 #include "google/protobuf/message.h"
+#include "kythe/cxx/common/compression.h"
 #include "kythe/cxx/common/json_proto.h"
+#include "kythe/cxx/common/parallel_for.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Path.h"
 
@@ -177,10 +181,9 @@ bool IndexPackPosixFilesystem::ReadFileContent(DataKind data_kind,
     return false;
   }
   google::protobuf::io::FileInputStream file_stream(in_fd);
-  google::protobuf::io::GzipInputStream stream(
-      &file_stream, google::protobuf::io::GzipInputStream::Format::GZIP);
-  bool user_result = callback(&stream, error_text);
-  if (const char *err = stream.ZlibErrorMessage()) {
+  auto stream = NewDecompressingInputStream(&file_stream);
+  bool user_result = callback(stream.get(), error_text);
+  if (const char *err = stream->ErrorMessage()) {
     *error_text = err;
     file_stream.Close();
     return false;
@@ -192,6 +195,13 @@ bool IndexPackPosixFilesystem::ReadFileContent(DataKind data_kind,
   return user_result;
 }
 
+bool IndexPackPosixFilesystem::HasFileContent(DataKind data_kind,
+                                              const std::string &file_name) {
+  std::string error_text;
+  std::string file = GenerateFilenameFor(data_kind, file_name, &error_text);
+  return !file.empty() && llvm::sys::fs::exists(llvm::Twine(file));
+}
+
 bool IndexPackPosixFilesystem::ScanFiles(DataKind data_kind,
                                          ScanCallback callback,
                                          std::string *error_text) {
@@ -241,16 +251,14 @@ bool IndexPackPosixFilesystem::AddFileContent(DataKind data_kind,
     return false;
   }
   google::protobuf::io::FileOutputStream file_stream(temp_fd);
-  google::protobuf::io::GzipOutputStream::Options options;
-  options.format = google::protobuf::io::GzipOutputStream::GZIP;
-  google::protobuf::io::GzipOutputStream stream(&file_stream, options);
+  auto stream = NewCompressingOutputStream(compression_codec_, &file_stream);
   std::string file_hash;
-  auto callback_result = callback(&stream, &file_hash, error_text);
+  auto callback_result = callback(stream.get(), &file_hash, error_text);
   if (!callback_result) {
     return callback_result;
   }
-  if (!stream.Close()) {
-    *error_text = "Couldn't close gzip output stream.";
+  if (!stream->Close()) {
+    *error_text = "Couldn't close compressed output stream.";
     return false;
   }
   if (!file_stream.Close()) {
@@ -313,6 +321,41 @@ bool IndexPack::ReadFileData(const std::string &hash, std::string *out) {
       out);
 }
 
+bool IndexPack::ReadFileDataBatch(
+    const std::vector<std::string> &hashes, size_t max_threads,
+    std::function<bool(size_t index, std::string *data,
+                       std::string *error_text)> callback,
+    std::string *error_text) {
+  // Only failures leave text behind, so this stays small.
+  std::vector<std::string> errors(hashes.size());
+  // vector<bool> packs bits, so threads can't safely write neighbors.
+  std::vector<char> failed(hashes.size(), false);
+  std::atomic<bool> stop(false);
+  ParallelFor(hashes.size(), max_threads, [&](size_t index) {
+    if (stop.load(std::memory_order_relaxed)) {
+      return;
+    }
+    std::string data;
+    if (!ReadFileData(hashes[index], &data)) {
+      // ReadFileData leaves its error text in the output string.
+      errors[index] = "Could not read " + hashes[index] + ": " + data;
+    } else if (!callback(index, &data, &errors[index])) {
+      errors[index] = "Could not handle " + hashes[index] + ": " + errors[index];
+    } else {
+      return;
+    }
+    failed[index] = true;
+    stop.store(true, std::memory_order_relaxed);
+  });
+  for (size_t index = 0; index < hashes.size(); ++index) {
+    if (failed[index]) {
+      *error_text = errors[index];
+      return false;
+    }
+  }
+  return true;
+}
+
 bool IndexPack::ReadCompilationUnit(const std::string &hash,
                                     kythe::proto::CompilationUnit *unit,
                                     std::string *error_text) {
@@ -368,6 +411,25 @@ bool IndexPack::AddFileData(const kythe::proto::FileData &content,
                    error_text, digest.empty() ? nullptr : &digest);
 }
 
+bool IndexPack::AddCompilationUnitWithInputs(
+    const kythe::proto::CompilationUnit &unit,
+    const std::vector<kythe::proto::FileData> &inputs, size_t max_threads,
+    std::string *error_text) {
+  std::vector<std::string> input_errors(inputs.size());
+  std::vector<char> write_ok(inputs.size(), false);
+  ParallelFor(inputs.size(), max_threads, [&](size_t index) {
+    write_ok[index] = AddFileData(inputs[index], &input_errors[index]);
+  });
+  for (size_t index = 0; index < inputs.size(); ++index) {
+    if (!write_ok[index]) {
+      *error_text = "Could not write " + inputs[index].info().path() + ": " +
+                    input_errors[index];
+      return false;
+    }
+  }
+  return AddCompilationUnit(unit, error_text);
+}
+
 bool IndexPack::WriteMessage(IndexPackFilesystem::DataKind kind,
                              const google::protobuf::Message &message,
                              std::string *error_text) {
@@ -388,6 +450,11 @@ bool IndexPack::WriteData(IndexPackFilesystem::DataKind kind, const char *data,
                           size_t size, std::string *error_text,
                           std::string *sha_in) {
   std::string sha = sha_in ? *sha_in : Sha256(data, size);
+  // Content is named by its digest, so there's no need to compress and
+  // write it again. This is the common case for headers shared by many units.
+  if (filesystem_->HasFileContent(kind, sha)) {
+    return true;
+  }
   return filesystem_->AddFileContent(
       kind,
       [data, size, &sha](google::protobuf::io::ZeroCopyOutputStream *stream,
@@ -17,10 +17,13 @@
 #ifndef KYTHE_CXX_COMMON_INDEX_PACK_H_
 #define KYTHE_CXX_COMMON_INDEX_PACK_H_
 
+#include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "google/protobuf/io/zero_copy_stream.h"
+#include "kythe/cxx/common/compression.h"
 #include "kythe/proto/analysis.pb.h"
 
 namespace kythe {
@@ -78,6 +81,16 @@ class IndexPackFilesystem {
     return false;
   }
 
+  /// \brief Checks whether file content is already present.
+  /// \param data_kind The kind of data to look for.
+  /// \param file_name The name of the file (without extension).
+  /// \return true if the file exists. Filesystems that can't tell cheaply
+  /// may always return false.
+  virtual bool HasFileContent(DataKind data_kind,
+                              const std::string &file_name) {
+    return false;
+  }
+
   /// \brief A callback to provide a filename during a scan.
   /// \param file_name The name of the next file (without extension).
   /// \return true to continue scanning; false to stop.
@@ -135,12 +148,21 @@ class IndexPackPosixFilesystem : public IndexPackFilesystem {
     return open_mode_;
   }
 
+  /// \brief Sets the codec used to compress data added from now on. Data
+  /// in any codec can be read regardless of this setting.
+  void set_compression_codec(CompressionCodec codec) {
+    compression_codec_ = codec;
+  }
+
   bool AddFileContent(DataKind data_kind, WriteCallback callback,
                       std::string *error_text) override;
 
   bool ReadFileContent(DataKind data_kind, const std::string &file_name,
                        ReadCallback callback, std::string *error_text) override;
 
+  bool HasFileContent(DataKind data_kind,
+                      const std::string &file_name) override;
+
   bool ScanFiles(DataKind data_kind, ScanCallback callback,
                  std::string *error_text) override;
 
@@ -176,6 +198,8 @@ class IndexPackPosixFilesystem : public IndexPackFilesystem {
   std::string data_directory_;
   /// The path to the unit directory (absolute).
   std::string unit_directory_;
+  /// The codec used to compress new data.
+  CompressionCodec compression_codec_ = CompressionCodec::kGzip;
 };
 
 /// \brief A collection of compilation units and associated file data.
@@ -200,9 +224,27 @@ class IndexPack {
   ///
   /// If the digest of `content` is set, it will not be recomputed.
   /// Fields besides `content` and `digest` on `content` are ignored.
+  /// Content whose digest is already in the pack isn't written again.
   bool AddFileData(const kythe::proto::FileData &content,
                    std::string *error_text);
 
+  /// \brief Adds a `CompilationUnit` and the content of its inputs.
+  /// \param unit The `CompilationUnit` to add.
+  /// \param inputs The content to add, as for `AddFileData`.
+  /// \param max_threads The most threads to write `inputs` with, including
+  /// the calling thread.
+  /// \param error_text Set if the return value is false.
+  /// \return false on failure and true on success.
+  ///
+  /// The unit is written only after all of its inputs have been, so readers
+  /// that find the unit can also find its inputs. The underlying
+  /// `IndexPackFilesystem` must support concurrent writes (as
+  /// `IndexPackPosixFilesystem` does).
+  bool AddCompilationUnitWithInputs(
+      const kythe::proto::CompilationUnit &unit,
+      const std::vector<kythe::proto::FileData> &inputs, size_t max_threads,
+      std::string *error_text);
+
   /// \brief Reads file data from the index pack.
   /// \param hash The hash of the file to read.
   /// \param out Non-null. On success, contains the file data. On failure,
@@ -210,6 +252,28 @@ class IndexPack {
   /// \return true on success; false on failure.
   bool ReadFileData(const std::string &hash, std::string *out);
 
+  /// \brief Reads and decompresses several files concurrently, handing each
+  /// to `callback` as soon as it has been read.
+  /// \param hashes The hashes of the files to read.
+  /// \param max_threads The most threads to read with, including the
+  /// calling thread.
+  /// \param callback Called on a reading thread with the index into `hashes`
+  /// and the data of each file that was read; it may take the data. Must be
+  /// safe to call concurrently. Return false (and set the error text) to stop
+  /// reading.
+  /// \param error_text Non-null. On failure, describes the first file that
+  /// couldn't be read or handled.
+  /// \return true if every file was read and handled; false otherwise.
+  ///
+  /// Only one file per thread is held in memory at once. The underlying
+  /// `IndexPackFilesystem` must support concurrent reads (as
+  /// `IndexPackPosixFilesystem` does).
+  bool ReadFileDataBatch(
+      const std::vector<std::string> &hashes, size_t max_threads,
+      std::function<bool(size_t index, std::string *data,
+                         std::string *error_text)> callback,
+      std::string *error_text);
+
   /// \brief Reads a `CompilationUnit` from the index pack.
   /// \param hash The hash of the unit to read.
   /// \param out Non-null. On success, becomes the unit read from the pack.
@@ -236,7 +300,8 @@ class IndexPack {
                     const google::protobuf::Message &message,
                     std::string *error_text);
 
-  /// \brief Write data of kind `kind` with some raw payload.
+  /// \brief Write data of kind `kind` with some raw payload, unless data
+  /// with the same digest is already present.
   /// \param sha If null, recalculates the SHA256 digest of the data.
   /// \return false on failure and true on success.
   bool WriteData(IndexPackFilesystem::DataKind kind, const char *bytes,
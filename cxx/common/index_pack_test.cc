@@ -15,6 +15,9 @@
  */
 
 #include "index_pack.h"
+
+#include <mutex>
+
 #include "glog/logging.h"
 #include "google/protobuf/io/gzip_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
@@ -39,21 +42,37 @@ class InMemoryIndexPackFilesystem : public IndexPackFilesystem {
         return result;
       }
     }
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++add_count_;
     files_[data_kind].emplace(file_name, file_data);
     return true;
   }
 
+  bool HasFileContent(DataKind data_kind,
+                      const std::string &file_name) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return files_[data_kind].count(file_name) != 0;
+  }
+
   bool ReadFileContent(DataKind data_kind, const std::string &file_name,
                        ReadCallback callback,
                        std::string *error_text) override {
-    auto record = files_[data_kind].find(file_name);
-    if (record == files_[data_kind].end()) {
-      *error_text = "file not found";
-      return false;
+    const std::string *content;
+    {
+      // Files are never changed or removed once added, so `content` stays
+      // valid after the lock is released.
+      std::lock_guard<std::mutex> lock(mutex_);
+      const auto &files = files_[data_kind];
+      auto record = files.find(file_name);
+      if (record == files.end()) {
+        *error_text = "file not found";
+        return false;
+      }
+      content = &record->second;
     }
     // Use a weird block size to shake out errors.
-    google::protobuf::io::ArrayInputStream stream(record->second.data(),
-                                                  record->second.size(), 3);
+    google::protobuf::io::ArrayInputStream stream(content->data(),
+                                                  content->size(), 3);
     return callback(&stream, error_text);
   }
 
@@ -71,6 +90,11 @@ class InMemoryIndexPackFilesystem : public IndexPackFilesystem {
 
   /// Maps from data kinds to (maps from hashes to file content).
   std::map<DataKind, std::map<std::string, std::string>> files_;
+  /// The number of times `AddFileContent` has stored a file.
+  int add_count_ = 0;
+  /// Guards `files_` and `add_count_` against concurrent readers and
+  /// writers.
+  std::mutex mutex_;
 };
 
 TEST(IndexPack, AddCompilationUnit) {
@@ -94,6 +118,51 @@ TEST(IndexPack, AddFileData) {
   EXPECT_TRUE(pack.AddFileData(file_data, &error_text));
 }
 
+TEST(IndexPack, AddFileDataSkipsExistingContent) {
+  auto filesystem = std::unique_ptr<InMemoryIndexPackFilesystem>(
+      new InMemoryIndexPackFilesystem());
+  auto *files = filesystem.get();
+  IndexPack pack(std::move(filesystem));
+  kythe::proto::FileData file_data;
+  file_data.set_content("test");
+  file_data.mutable_info()->set_digest("fakehash");
+  std::string error_text;
+  EXPECT_TRUE(pack.AddFileData(file_data, &error_text));
+  EXPECT_EQ(1, files->add_count_);
+  EXPECT_TRUE(pack.AddFileData(file_data, &error_text));
+  EXPECT_EQ(1, files->add_count_);
+}
+
+TEST(IndexPack, AddCompilationUnitWithInputs) {
+  auto filesystem = std::unique_ptr<InMemoryIndexPackFilesystem>(
+      new InMemoryIndexPackFilesystem());
+  auto *files = filesystem.get();
+  IndexPack pack(std::move(filesystem));
+  kythe::proto::CompilationUnit unit;
+  std::vector<kythe::proto::FileData> inputs;
+  for (int i = 0; i < 20; ++i) {
+    kythe::proto::FileData file_data;
+    // Every other input repeats the one before it.
+    file_data.set_content("data" + std::to_string(i / 2));
+    file_data.mutable_info()->set_path("file" + std::to_string(i));
+    file_data.mutable_info()->set_digest("hash" + std::to_string(i / 2));
+    inputs.push_back(file_data);
+  }
+  std::string error_text;
+  ASSERT_TRUE(pack.AddCompilationUnitWithInputs(unit, inputs, 4, &error_text))
+      << error_text;
+  const auto &stored = files->files_[IndexPackFilesystem::DataKind::kFileData];
+  EXPECT_EQ(10, stored.size());
+  for (int i = 0; i < 10; ++i) {
+    const auto &name = "hash" + std::to_string(i);
+    ASSERT_EQ(1, stored.count(name));
+    // The in-memory filesystem doesn't compress.
+    EXPECT_EQ("data" + std::to_string(i), stored.find(name)->second);
+  }
+  EXPECT_EQ(
+      1, files->files_[IndexPackFilesystem::DataKind::kCompilationUnit].size());
+}
+
 TEST(IndexPack, ScanData) {
   auto filesystem = std::unique_ptr<InMemoryIndexPackFilesystem>(
       new InMemoryIndexPackFilesystem());
@@ -174,6 +243,44 @@ TEST(IndexPack, ReadFileData) {
   EXPECT_FALSE(file_content.empty());
 }
 
+TEST(IndexPack, ReadFileDataBatch) {
+  auto filesystem = std::unique_ptr<InMemoryIndexPackFilesystem>(
+      new InMemoryIndexPackFilesystem());
+  std::vector<std::string> hashes;
+  for (int i = 0; i < 20; ++i) {
+    std::string hash = "hash" + std::to_string(i);
+    filesystem->files_[IndexPackFilesystem::DataKind::kFileData][hash] =
+        "data" + std::to_string(i);
+    hashes.push_back(hash);
+  }
+  IndexPack pack(std::move(filesystem));
+  std::vector<std::string> contents(hashes.size());
+  auto collect = [&contents](size_t index, std::string *data,
+                             std::string *error_text) {
+    contents[index] = std::move(*data);
+    return true;
+  };
+  std::string error_text;
+  ASSERT_TRUE(pack.ReadFileDataBatch(hashes, 4, collect, &error_text))
+      << error_text;
+  for (size_t i = 0; i < contents.size(); ++i) {
+    EXPECT_EQ("data" + std::to_string(i), contents[i]);
+  }
+  EXPECT_FALSE(pack.ReadFileDataBatch(
+      hashes, 4,
+      [](size_t index, std::string *data, std::string *error_text) {
+        *error_text = "rejected";
+        return index != 7;
+      },
+      &error_text));
+  EXPECT_NE(std::string::npos, error_text.find("hash7"));
+  EXPECT_NE(std::string::npos, error_text.find("rejected"));
+  hashes.push_back("notafile");
+  contents.resize(hashes.size());
+  EXPECT_FALSE(pack.ReadFileDataBatch(hashes, 4, collect, &error_text));
+  EXPECT_NE(std::string::npos, error_text.find("notafile"));
+}
+
 TEST(IndexPack, ReadCompilationUnit) {
   auto filesystem = std::unique_ptr<InMemoryIndexPackFilesystem>(
       new InMemoryIndexPackFilesystem());
@@ -537,6 +644,43 @@ TEST(IndexPack, PosixAddContent) {
   EXPECT_TRUE(files.Cleanup());
 }
 
+TEST(IndexPack, PosixAddSnappyContent) {
+  TemporaryFilesystem files;
+  std::string error_text;
+  auto posix = IndexPackPosixFilesystem::Open(
+      files.root(), IndexPackFilesystem::OpenMode::kReadWrite, &error_text);
+  ASSERT_NE(nullptr, posix);
+  posix->set_compression_codec(CompressionCodec::kSnappy);
+  EXPECT_TRUE(posix->AddFileContent(
+      IndexPackFilesystem::DataKind::kFileData,
+      [](google::protobuf::io::ZeroCopyOutputStream *stream,
+         std::string *file_name, std::string *error_text) {
+        *file_name = kData1Sha;
+        return TemporaryFilesystem::WriteToStream("data1", stream);
+      },
+      &error_text))
+      << error_text;
+  // Readers detect the codec on their own.
+  auto second_posix = IndexPackPosixFilesystem::Open(
+      files.root(), IndexPackFilesystem::OpenMode::kReadOnly, &error_text);
+  ASSERT_NE(nullptr, second_posix);
+  std::string content;
+  EXPECT_TRUE(second_posix->ReadFileContent(
+      IndexPackFilesystem::DataKind::kFileData, kData1Sha,
+      [&content](google::protobuf::io::ZeroCopyInputStream *stream,
+                 std::string *error_text) {
+        return TemporaryFilesystem::ReadFromStream(stream, &content);
+      },
+      &error_text))
+      << error_text;
+  EXPECT_EQ("data1", content);
+  EXPECT_TRUE(
+      files.RemoveFileIfExists("files", std::string(kData1Sha) + ".data"));
+  EXPECT_TRUE(files.RemoveDirectoryIfExists("units"));
+  EXPECT_TRUE(files.RemoveDirectoryIfExists("files"));
+  EXPECT_TRUE(files.Cleanup());
+}
+
 }  // namespace
 }  // namespace kythe
 
@@ -16,13 +16,18 @@
 
 #include "json_proto.h"
 
-#include <openssl/bio.h>
-#include <openssl/err.h>
-#include <openssl/evp.h>
-#include <openssl/sha.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "rapidjson/document.h"
 #include "rapidjson/filewritestream.h"
+#include "rapidjson/reader.h"
 #include "rapidjson/stringbuffer.h"
 #include "rapidjson/writer.h"
 #include "glog/logging.h"
@@ -31,117 +36,268 @@
 #include "google/protobuf/message.h"
 
 namespace kythe {
+namespace {
 
-bool DecodeBase64(const google::protobuf::string &data,
-                  google::protobuf::string *decoded) {
-  // Defensively empty the OpenSSL error queue.
-  while (::ERR_get_error())
-    ;
+const char kBase64Alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/// Entries in `Base64DecodeTable` that aren't digit values.
+enum : unsigned char {
+  kBase64Pad = 0xFD,      ///< The '=' padding character.
+  kBase64Space = 0xFE,    ///< Whitespace, which is ignored.
+  kBase64Invalid = 0xFF,  ///< Anything else.
+};
+
+/// \brief Returns a table mapping each byte to its base64 digit value (or to
+/// one of `kBase64Pad`, `kBase64Space` or `kBase64Invalid`).
+const unsigned char *Base64DecodeTable() {
+  static const struct Table {
+    Table() {
+      memset(values, kBase64Invalid, sizeof(values));
+      for (unsigned char digit = 0; digit < 64; ++digit) {
+        values[static_cast<unsigned char>(kBase64Alphabet[digit])] = digit;
+      }
+      values[static_cast<unsigned char>('=')] = kBase64Pad;
+      for (char space : {' ', '\t', '\r', '\n'}) {
+        values[static_cast<unsigned char>(space)] = kBase64Space;
+      }
+    }
+    unsigned char values[256];
+  } table;
+  return table.values;
+}
 
-  // Estimate the decoded size of the data (round up the encoded length
-  // to the nearest multiple of 4, then divide by 4 and multiply by 3).
-  size_t expected_size = ((data.size() + 3) & ~(size_t)3) / 4 * 3;
+/// \brief Everything we need to know about a field to convert it.
+struct FieldInfo {
+  const google::protobuf::FieldDescriptor *field;
+  /// The field's name, as used for JSON keys.
+  std::string name;
+  google::protobuf::FieldDescriptor::CppType cpp_type;
+  bool is_repeated;
+  /// Whether this is a bytes field (which is base64-encoded in JSON).
+  bool is_bytes;
+};
 
-  if (expected_size == 0) {
-    decoded->clear();
+/// \brief The fields of a message type.
+struct MessageFields {
+  /// Every field, in order of field number (as `Reflection::ListFields`
+  /// would return them).
+  std::vector<FieldInfo> by_number;
+  /// Maps field names to entries in `by_number`.
+  std::unordered_map<std::string, const FieldInfo *> by_name;
+};
+
+/// \brief Builds the field table for `descriptor`.
+std::unique_ptr<MessageFields> BuildFields(
+    const google::protobuf::Descriptor *descriptor) {
+  std::unique_ptr<MessageFields> fields(new MessageFields());
+  for (int i = 0; i < descriptor->field_count(); ++i) {
+    const auto *field = descriptor->field(i);
+    fields->by_number.push_back(FieldInfo{
+        field, field->name(), field->cpp_type(), field->is_repeated(),
+        field->type() == google::protobuf::FieldDescriptor::TYPE_BYTES});
+  }
+  std::sort(fields->by_number.begin(), fields->by_number.end(),
+            [](const FieldInfo &lhs, const FieldInfo &rhs) {
+              return lhs.field->number() < rhs.field->number();
+            });
+  for (const auto &info : fields->by_number) {
+    fields->by_name[info.name] = &info;
+  }
+  return fields;
+}
+
+/// \brief Returns the (cached) field table for `descriptor`.
+///
+/// Tables are built once under a lock and never freed. Each thread keeps its
+/// own index of the tables it has used, so only a thread's first use of a
+/// message type takes the lock.
+const MessageFields &FieldsFor(const google::protobuf::Descriptor *descriptor) {
+  static thread_local std::unordered_map<const google::protobuf::Descriptor *,
+                                         const MessageFields *>
+      local_cache;
+  auto found = local_cache.find(descriptor);
+  if (found != local_cache.end()) {
+    return *found->second;
+  }
+  static std::mutex *cache_mutex = new std::mutex();
+  static auto *cache = new std::unordered_map<
+      const google::protobuf::Descriptor *, std::unique_ptr<MessageFields>>();
+  const MessageFields *fields;
+  {
+    std::lock_guard<std::mutex> lock(*cache_mutex);
+    auto &shared = (*cache)[descriptor];
+    if (shared == nullptr) {
+      shared = BuildFields(descriptor);
+    }
+    fields = shared.get();
+  }
+  local_cache.emplace(descriptor, fields);
+  return *fields;
+}
+
+/// \brief Returns the length of the base64 encoding of `size` bytes.
+size_t Base64Size(size_t size) { return (size + 2) / 3 * 4; }
+
+/// \brief Writes the base64 encoding of `data` to `out`, which must have
+/// room for `Base64Size(size)` characters.
+void EncodeBase64To(const char *data, size_t size, char *out) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+  size_t i = 0;
+  for (; i + 3 <= size; i += 3) {
+    uint32_t triple = (bytes[i] << 16) | (bytes[i + 1] << 8) | bytes[i + 2];
+    *out++ = kBase64Alphabet[(triple >> 18) & 0x3F];
+    *out++ = kBase64Alphabet[(triple >> 12) & 0x3F];
+    *out++ = kBase64Alphabet[(triple >> 6) & 0x3F];
+    *out++ = kBase64Alphabet[triple & 0x3F];
+  }
+  if (i < size) {
+    uint32_t triple = bytes[i] << 16;
+    if (i + 1 < size) {
+      triple |= bytes[i + 1] << 8;
+    }
+    *out++ = kBase64Alphabet[(triple >> 18) & 0x3F];
+    *out++ = kBase64Alphabet[(triple >> 12) & 0x3F];
+    *out++ = i + 1 < size ? kBase64Alphabet[(triple >> 6) & 0x3F] : '=';
+    *out++ = '=';
+  }
+}
+
+/// \brief A `rapidjson::Writer` that can also write base64 strings.
+class JsonWriter : public rapidjson::Writer<rapidjson::StringBuffer> {
+ public:
+  explicit JsonWriter(rapidjson::StringBuffer &buffer)
+      : rapidjson::Writer<rapidjson::StringBuffer>(buffer) {}
+
+  /// \brief Writes the base64 encoding of `data` as a string value.
+  ///
+  /// Base64 digits never need escaping, so this encodes straight into the
+  /// output instead of making `String` scan the encoding again.
+  bool Base64String(const char *data, size_t size) {
+    Prefix(rapidjson::kStringType);
+    os_->Put('\"');
+    EncodeBase64To(data, size, os_->Push(Base64Size(size)));
+    os_->Put('\"');
     return true;
   }
+};
 
-  ::BIO *base64 = ::BIO_new(BIO_f_base64());
-  ::BIO *stream =
-      ::BIO_new_mem_buf(const_cast<char *>(data.c_str()), data.size());
-  CHECK(base64 != nullptr && stream != nullptr);
-  stream = ::BIO_push(base64, stream);
-  CHECK(stream != nullptr);
-  ::BIO_set_flags(stream, BIO_FLAGS_BASE64_NO_NL);
-
-  decoded->resize(expected_size);
-  size_t accumulated = 0;
-  for (;;) {
-    long l =
-        ::BIO_read(stream, const_cast<char *>(decoded->c_str() + accumulated),
-                   decoded->size() - accumulated);
-    accumulated += l;
-    if (l < decoded->size() - accumulated - l) {
-      // We're sure there's no more data to read (otherwise, ::BIO_read would
-      // have filled all of the space available to it).
+/// \brief Decodes base64 `data` into `decoded`.
+/// \return false if `data` isn't valid base64.
+bool DecodeBase64Bytes(const char *data, size_t size,
+                       google::protobuf::string *decoded) {
+  const unsigned char *table = Base64DecodeTable();
+  const unsigned char *in = reinterpret_cast<const unsigned char *>(data);
+  decoded->resize(size / 4 * 3 + 3);
+  char *out = &(*decoded)[0];
+  size_t i = 0;
+  // Decode whole quanta of four digits until something else turns up.
+  for (; i + 4 <= size; i += 4) {
+    uint32_t a = table[in[i]], b = table[in[i + 1]], c = table[in[i + 2]],
+             d = table[in[i + 3]];
+    if ((a | b | c | d) >= 64) {
       break;
     }
-    decoded->resize(decoded->size() * 2);
+    uint32_t triple = (a << 18) | (b << 12) | (c << 6) | d;
+    *out++ = static_cast<char>(triple >> 16);
+    *out++ = static_cast<char>(triple >> 8);
+    *out++ = static_cast<char>(triple);
+  }
+  // Finish a digit at a time, dealing with whitespace and padding.
+  uint32_t accumulator = 0;
+  int digits = 0;
+  int padding = 0;
+  for (; i < size; ++i) {
+    unsigned char value = table[in[i]];
+    if (value < 64) {
+      if (padding) {
+        return false;  // Digits can't follow padding.
+      }
+      accumulator = (accumulator << 6) | value;
+      if (++digits == 4) {
+        *out++ = static_cast<char>(accumulator >> 16);
+        *out++ = static_cast<char>(accumulator >> 8);
+        *out++ = static_cast<char>(accumulator);
+        accumulator = 0;
+        digits = 0;
+      }
+    } else if (value == kBase64Pad) {
+      ++padding;
+    } else if (value != kBase64Space) {
+      return false;
+    }
+  }
+  // Unpadded trailing digits are accepted; a single leftover digit (or more
+  // padding than the digits call for) is not.
+  if (digits == 1 || padding > 2 || (padding && digits + padding != 4)) {
+    return false;
+  }
+  if (digits == 2) {
+    *out++ = static_cast<char>(accumulator >> 4);
+  } else if (digits == 3) {
+    *out++ = static_cast<char>(accumulator >> 10);
+    *out++ = static_cast<char>(accumulator >> 2);
   }
-  decoded->resize(accumulated);
-  ::BIO_free_all(stream);
+  decoded->resize(out - decoded->data());
+  return true;
+}
+
+}  // anonymous namespace
 
-  // Check for new errors.
-  return ::ERR_get_error() == 0;
+bool DecodeBase64(const google::protobuf::string &data,
+                  google::protobuf::string *decoded) {
+  return DecodeBase64Bytes(data.data(), data.size(), decoded);
 }
 
 google::protobuf::string EncodeBase64(const google::protobuf::string &data) {
-  std::string encoded;
-  ::BIO *base64 = BIO_new(BIO_f_base64());
-  ::BIO *stream = BIO_new(BIO_s_mem());
-  CHECK(base64 != nullptr && stream != nullptr);
-  stream = ::BIO_push(base64, stream);
-  CHECK(stream != nullptr);
-  ::BIO_set_flags(stream, BIO_FLAGS_BASE64_NO_NL);
-  ::BIO_write(stream, data.c_str(), data.size());
-  (void)BIO_flush(stream);
-  char *buffer = nullptr;
-  long size = ::BIO_get_mem_data(stream, &buffer);
-  if (buffer == nullptr) {
-    CHECK(size == 0);
-  } else {
-    CHECK(size > 0);
-    encoded.assign(buffer, size);
-  }
-  ::BIO_free_all(stream);
+  google::protobuf::string encoded(Base64Size(data.size()), '\0');
+  EncodeBase64To(data.data(), data.size(), &encoded[0]);
   return encoded;
 }
 
-/// \tparam W A RapidJSON Writer.
-template <typename W>
-bool JsonOfMessage(const google::protobuf::Message &message, W *writer);
+bool JsonOfMessage(const google::protobuf::Message &message,
+                   JsonWriter *writer);
 
-/// \tparam W A RapidJSON Writer.
-template <typename W>
-bool JsonOfValue(const google::protobuf::FieldDescriptor *field,
+bool JsonOfValue(const FieldInfo &info,
                  const google::protobuf::Message &message,
-                 const google::protobuf::Reflection *reflection, W *writer) {
+                 const google::protobuf::Reflection *reflection,
+                 JsonWriter *writer) {
   using namespace google::protobuf;
-  int count = field->is_repeated() ? reflection->FieldSize(message, field) : 1;
-  if (field->is_repeated()) {
+  const FieldDescriptor *field = info.field;
+  int count = info.is_repeated ? reflection->FieldSize(message, field) : 1;
+  if (info.is_repeated) {
     if (count == 0) {
       return true;  // Do not emit anything for empty repeated fields.
     }
-    writer->Key(field->name().c_str());
+    writer->Key(info.name.data(), info.name.size());
     writer->StartArray();
   } else {
-    writer->Key(field->name().c_str());
+    writer->Key(info.name.data(), info.name.size());
   }
 
   for (int i = 0; i < count; ++i) {
-    switch (field->cpp_type()) {
+    switch (info.cpp_type) {
       case FieldDescriptor::CPPTYPE_STRING: {
         google::protobuf::string scratch;
         const auto &value =
-            field->is_repeated()
+            info.is_repeated
                 ? reflection->GetRepeatedStringReference(message, field, i,
                                                          &scratch)
                 : reflection->GetStringReference(message, field, &scratch);
-        if (field->type() == FieldDescriptor::TYPE_BYTES) {
-          writer->String(EncodeBase64(value).c_str());
+        if (info.is_bytes) {
+          writer->Base64String(value.data(), value.size());
         } else {
-          writer->String(value.c_str());
+          writer->String(value.data(), value.size());
         }
       } break;
       case FieldDescriptor::CPPTYPE_BOOL: {
-        writer->Bool(field->is_repeated()
+        writer->Bool(info.is_repeated
                          ? reflection->GetRepeatedBool(message, field, i)
                          : reflection->GetBool(message, field));
       } break;
       case FieldDescriptor::CPPTYPE_MESSAGE: {
         if (!JsonOfMessage(
-                field->is_repeated()
+                info.is_repeated
                     ? reflection->GetRepeatedMessage(message, field, i)
                     : reflection->GetMessage(message, field),
                 writer)) {
@@ -149,7 +305,7 @@ bool JsonOfValue(const google::protobuf::FieldDescriptor *field,
         }
       } break;
       case FieldDescriptor::CPPTYPE_INT32: {
-        writer->Int(field->is_repeated()
+        writer->Int(info.is_repeated
                         ? reflection->GetRepeatedInt32(message, field, i)
                         : reflection->GetInt32(message, field));
       } break;
@@ -157,32 +313,23 @@ bool JsonOfValue(const google::protobuf::FieldDescriptor *field,
         return false;
     }
   }
-  if (field->is_repeated()) {
+  if (info.is_repeated) {
     writer->EndArray();
   }
   return true;
 }
 
-/// \tparam W A RapidJSON Writer.
-template <typename W>
-bool JsonOfMessage(const google::protobuf::Message &message, W *writer) {
-  using namespace google::protobuf;
+bool JsonOfMessage(const google::protobuf::Message &message,
+                   JsonWriter *writer) {
   writer->StartObject();
-  auto *descriptor = message.GetDescriptor();
+  const auto &fields = FieldsFor(message.GetDescriptor());
   auto *reflection = message.GetReflection();
-  std::vector<const FieldDescriptor *> fields;
-  reflection->ListFields(message, &fields);
-  for (int i = 0; i < descriptor->field_count(); ++i) {
-    auto *field = descriptor->field(i);
-    if (field->is_repeated() && reflection->FieldSize(message, field) == 0) {
-      fields.push_back(field);
-    }
-  }
-  for (auto *field : fields) {
-    if (!field->is_repeated() && !reflection->HasField(message, field)) {
+  for (const auto &info : fields.by_number) {
+    if (info.is_repeated ? reflection->FieldSize(message, info.field) == 0
+                         : !reflection->HasField(message, info.field)) {
       continue;
     }
-    if (!JsonOfValue(field, message, reflection, writer)) {
+    if (!JsonOfValue(info, message, reflection, writer)) {
       return false;
     }
   }
@@ -193,11 +340,11 @@ bool JsonOfMessage(const google::protobuf::Message &message, W *writer) {
 bool WriteMessageAsJsonToString(const google::protobuf::Message &message,
                                 std::string *out) {
   rapidjson::StringBuffer buffer;
-  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+  JsonWriter writer(buffer);
   if (!JsonOfMessage(message, &writer)) {
     return false;
   }
-  *out = buffer.GetString();
+  out->assign(buffer.GetString(), buffer.GetSize());
   return true;
 }
 
@@ -205,7 +352,7 @@ bool WriteMessageAsJsonToString(const google::protobuf::Message &message,
                                 const std::string &format_key,
                                 std::string *out) {
   rapidjson::StringBuffer buffer;
-  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+  JsonWriter writer(buffer);
   writer.StartObject();
   writer.Key("format");
   writer.String(format_key.c_str());
@@ -214,136 +361,318 @@ bool WriteMessageAsJsonToString(const google::protobuf::Message &message,
     return false;
   }
   writer.EndObject();
-  *out = buffer.GetString();
+  out->assign(buffer.GetString(), buffer.GetSize());
   return true;
 }
 
-bool MessageOfJson(const rapidjson::Value &value,
-                   google::protobuf::Message *message) {
-  using namespace rapidjson;
-  using namespace google::protobuf;
-  auto *descriptor = message->GetDescriptor();
-  auto *reflection = message->GetReflection();
-  if (!value.IsObject()) {
-    return false;
+namespace {
+
+/// \brief Merges JSON into a message as rapidjson's SAX reader parses it
+/// (or as a `rapidjson::Document` is walked), without building a
+/// `rapidjson::Document` first.
+///
+/// Unknown fields are skipped, and values of the wrong type are errors.
+class JsonMessageReader
+    : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>,
+                                          JsonMessageReader> {
+ public:
+  /// \param message The message to merge into.
+  /// \param wrapped If true, expect the message inside a format wrapper
+  /// (`{"format": "kythe", "content": {...}}`).
+  JsonMessageReader(google::protobuf::Message *message, bool wrapped)
+      : message_(message), wrapped_(wrapped) {}
+
+  /// \brief Finishes merging after the reader succeeds.
+  /// \param format_key If non-null and the input was wrapped, set to the
+  /// wrapper's format.
+  /// \return false if the input wasn't a complete, supported message.
+  bool Finish(std::string *format_key) {
+    if (!wrapped_) {
+      if (!content_) {
+        return false;
+      }
+      message_->MergeFrom(*content_);
+      return true;
+    }
+    if (!saw_format_ || !saw_content_) {
+      return false;
+    }
+    if (format_key) {
+      *format_key = format_;
+    }
+    if (format_ != "kythe") {
+      return false;
+    }
+    message_->MergeFrom(*content_);
+    return true;
   }
-  for (auto field = value.MemberBegin(); field != value.MemberEnd(); ++field) {
-    const Value &field_name = field->name;
-    if (!field_name.IsString()) {
+
+  bool Null() { return NextSlot() == Slot::kIgnore; }
+  bool Int64(int64_t) { return NextSlot() == Slot::kIgnore; }
+  bool Uint64(uint64_t) { return NextSlot() == Slot::kIgnore; }
+  bool Double(double) { return NextSlot() == Slot::kIgnore; }
+
+  bool Bool(bool value) {
+    using google::protobuf::FieldDescriptor;
+    Slot slot = NextSlot();
+    if (slot == Slot::kIgnore) {
+      return true;
+    }
+    if (!IsFieldSlot(slot) ||
+        field_->cpp_type != FieldDescriptor::CPPTYPE_BOOL) {
       return false;
     }
-    const auto *proto_field =
-        descriptor->FindFieldByName(field_name.GetString());
-    if (!proto_field) {
-      // Ignore unknown fields.
-      continue;
+    auto *message = frames_.back().message;
+    if (slot == Slot::kElement) {
+      message->GetReflection()->AddBool(message, field_->field, value);
+    } else {
+      message->GetReflection()->SetBool(message, field_->field, value);
+    }
+    return true;
+  }
+
+  bool Int(int value) {
+    using google::protobuf::FieldDescriptor;
+    Slot slot = NextSlot();
+    if (slot == Slot::kIgnore) {
+      return true;
+    }
+    if (!IsFieldSlot(slot) ||
+        field_->cpp_type != FieldDescriptor::CPPTYPE_INT32) {
+      return false;
     }
-    if (proto_field->is_repeated()) {
-      if (!field->value.IsArray()) {
+    auto *message = frames_.back().message;
+    if (slot == Slot::kElement) {
+      message->GetReflection()->AddInt32(message, field_->field, value);
+    } else {
+      message->GetReflection()->SetInt32(message, field_->field, value);
+    }
+    return true;
+  }
+
+  bool Uint(unsigned value) {
+    if (value > static_cast<unsigned>(std::numeric_limits<int>::max())) {
+      return NextSlot() == Slot::kIgnore;
+    }
+    return Int(static_cast<int>(value));
+  }
+
+  bool String(const char *value, rapidjson::SizeType length, bool) {
+    using google::protobuf::FieldDescriptor;
+    Slot slot = NextSlot();
+    if (slot == Slot::kIgnore) {
+      return true;
+    }
+    if (slot == Slot::kFormat) {
+      saw_format_ = true;
+      format_.assign(value, length);
+      return true;
+    }
+    if (!IsFieldSlot(slot) ||
+        field_->cpp_type != FieldDescriptor::CPPTYPE_STRING) {
+      return false;
+    }
+    if (field_->is_bytes) {
+      if (!DecodeBase64Bytes(value, length, &scratch_)) {
         return false;
       }
-      for (auto data = field->value.Begin(); data != field->value.End();
-           ++data) {
-        switch (proto_field->cpp_type()) {
-          case FieldDescriptor::CPPTYPE_INT32:
-            if (!data->IsInt()) {
-              return false;
-            }
-            reflection->AddInt32(message, proto_field, data->GetInt());
-            break;
-          case FieldDescriptor::CPPTYPE_STRING:
-            if (!data->IsString()) {
-              return false;
-            }
-            if (proto_field->type() == FieldDescriptor::TYPE_BYTES) {
-              google::protobuf::string buffer;
-              if (!DecodeBase64(data->GetString(), &buffer)) {
-                return false;
-              }
-              reflection->AddString(message, proto_field, buffer);
-            } else {
-              reflection->AddString(message, proto_field, data->GetString());
-            }
-            break;
-          case FieldDescriptor::CPPTYPE_BOOL:
-            if (!data->IsBool()) {
-              return false;
-            }
-            reflection->AddBool(message, proto_field, data->GetBool());
-            break;
-          case FieldDescriptor::CPPTYPE_MESSAGE:
-            if (!MessageOfJson(*data,
-                               reflection->AddMessage(message, proto_field))) {
-              return false;
-            }
-            break;
-          default:
-            return false;
-        }
-      }
     } else {
-      switch (proto_field->cpp_type()) {
-        case FieldDescriptor::CPPTYPE_STRING:
-          if (!field->value.IsString()) {
-            return false;
-          }
-          if (proto_field->type() == FieldDescriptor::TYPE_BYTES) {
-            google::protobuf::string buffer;
-            if (!DecodeBase64(field->value.GetString(), &buffer)) {
-              return false;
-            }
-            reflection->SetString(message, proto_field, buffer);
-          } else {
-            reflection->SetString(message, proto_field,
-                                  field->value.GetString());
-          }
-          break;
-        case FieldDescriptor::CPPTYPE_BOOL:
-          if (!field->value.IsBool()) {
-            return false;
-          }
-          reflection->SetBool(message, proto_field, field->value.GetBool());
-          break;
-        case FieldDescriptor::CPPTYPE_INT32:
-          if (!field->value.IsInt()) {
-            return false;
-          }
-          reflection->SetInt32(message, proto_field, field->value.GetInt());
-          break;
-        case FieldDescriptor::CPPTYPE_MESSAGE:
-          if (!MessageOfJson(field->value, reflection->MutableMessage(
-                                               message, proto_field))) {
-            return false;
-          }
-          break;
-        default:
+      scratch_.assign(value, length);
+    }
+    auto *message = frames_.back().message;
+    if (slot == Slot::kElement) {
+      message->GetReflection()->AddString(message, field_->field, scratch_);
+    } else {
+      message->GetReflection()->SetString(message, field_->field, scratch_);
+    }
+    return true;
+  }
+
+  bool Key(const char *key, rapidjson::SizeType length, bool) {
+    const Frame &frame = frames_.back();
+    key_.assign(key, length);
+    if (frame.kind == Frame::Kind::kMessage) {
+      const auto found = frame.fields->by_name.find(key_);
+      field_ = found == frame.fields->by_name.end() ? nullptr : found->second;
+    }
+    return true;
+  }
+
+  bool StartObject() {
+    using google::protobuf::FieldDescriptor;
+    Slot slot = NextSlot();
+    google::protobuf::Message *message = nullptr;
+    switch (slot) {
+      case Slot::kIgnore:
+        frames_.push_back(
+            Frame{Frame::Kind::kSkip, nullptr, nullptr, nullptr});
+        return true;
+      case Slot::kRoot:
+        if (wrapped_) {
+          frames_.push_back(
+              Frame{Frame::Kind::kWrapper, nullptr, nullptr, nullptr});
+          return true;
+        }
+        // As with wrapped content, merge only once the input is accepted.
+        content_.reset(message_->New());
+        message = content_.get();
+        break;
+      case Slot::kContent:
+        if (saw_content_) {
           return false;
-      }
+        }
+        if (saw_format_ && format_ != "kythe") {
+          return false;
+        }
+        saw_content_ = true;
+        // Leave `message_` alone until the whole input has been accepted.
+        content_.reset(message_->New());
+        message = content_.get();
+        break;
+      case Slot::kField:
+      case Slot::kElement: {
+        if (field_->cpp_type != FieldDescriptor::CPPTYPE_MESSAGE) {
+          return false;
+        }
+        auto *parent = frames_.back().message;
+        auto *reflection = parent->GetReflection();
+        message = slot == Slot::kElement
+                      ? reflection->AddMessage(parent, field_->field)
+                      : reflection->MutableMessage(parent, field_->field);
+      } break;
+      default:
+        return false;
+    }
+    frames_.push_back(Frame{Frame::Kind::kMessage, message,
+                            &FieldsFor(message->GetDescriptor()), nullptr});
+    return true;
+  }
+
+  bool EndObject(rapidjson::SizeType) {
+    frames_.pop_back();
+    return true;
+  }
+
+  bool StartArray() {
+    if (frames_.empty()) {
+      return false;
+    }
+    const Frame &frame = frames_.back();
+    if (frame.kind == Frame::Kind::kSkip ||
+        (frame.kind == Frame::Kind::kWrapper && key_ != "format" &&
+         key_ != "content") ||
+        (frame.kind == Frame::Kind::kMessage && field_ == nullptr)) {
+      frames_.push_back(
+          Frame{Frame::Kind::kSkip, nullptr, nullptr, nullptr});
+      return true;
+    }
+    if (frame.kind != Frame::Kind::kMessage || !field_->is_repeated) {
+      return false;
     }
+    frames_.push_back(
+        Frame{Frame::Kind::kArray, frame.message, frame.fields, field_});
+    return true;
   }
-  return true;
-}
 
-bool MergeJsonWithMessage(const std::string &in, std::string *format_key,
-                          google::protobuf::Message *message) {
-  rapidjson::Document document;
-  document.Parse(in.c_str());
-  if (document.HasParseError()) {
-    return false;
+  bool EndArray(rapidjson::SizeType) {
+    frames_.pop_back();
+    return true;
   }
-  if (!document.IsObject() || !document.HasMember("format") ||
-      !document.HasMember("content") || !document["format"].IsString() ||
-      !document["content"].IsObject()) {
-    return false;
+
+ private:
+  /// \brief Where the next value goes.
+  enum class Slot {
+    kRoot,     ///< It's the whole document.
+    kFormat,   ///< It's the wrapper's format.
+    kContent,  ///< It's the wrapper's content.
+    kField,    ///< It's the value of the non-repeated `field_`.
+    kElement,  ///< It's an element of the repeated `field_`.
+    kIgnore,   ///< It should be skipped.
+    kInvalid   ///< It isn't allowed here.
+  };
+
+  /// \brief An object or array we're inside of.
+  struct Frame {
+    enum class Kind { kWrapper, kMessage, kArray, kSkip } kind;
+    /// For kMessage, the message being filled; for kArray, the message
+    /// holding the array.
+    google::protobuf::Message *message;
+    /// The fields of `message`.
+    const MessageFields *fields;
+    /// For kArray, the repeated field being filled.
+    const FieldInfo *field;
+  };
+
+  static bool IsFieldSlot(Slot slot) {
+    return slot == Slot::kField || slot == Slot::kElement;
   }
-  std::string in_format = document["format"].GetString();
-  if (format_key) {
-    *format_key = in_format;
+
+  /// \brief Figures out where the value that's starting goes, setting
+  /// `field_` for field slots.
+  Slot NextSlot() {
+    if (frames_.empty()) {
+      return Slot::kRoot;
+    }
+    const Frame &frame = frames_.back();
+    switch (frame.kind) {
+      case Frame::Kind::kSkip:
+        return Slot::kIgnore;
+      case Frame::Kind::kWrapper:
+        if (key_ == "format") {
+          return Slot::kFormat;
+        }
+        return key_ == "content" ? Slot::kContent : Slot::kIgnore;
+      case Frame::Kind::kArray:
+        field_ = frame.field;
+        return Slot::kElement;
+      case Frame::Kind::kMessage:
+        if (field_ == nullptr) {
+          return Slot::kIgnore;
+        }
+        // Repeated fields must be given as arrays (see StartArray).
+        return field_->is_repeated ? Slot::kInvalid : Slot::kField;
+    }
+    return Slot::kInvalid;
   }
-  if (in_format == "kythe") {
-    return MessageOfJson(document["content"], message);
+
+  /// The message to merge into.
+  google::protobuf::Message *message_;
+  /// Whether to expect a format wrapper.
+  bool wrapped_;
+  /// The objects and arrays we're inside of, innermost last.
+  std::vector<Frame> frames_;
+  /// The most recent key.
+  std::string key_;
+  /// The field the next value belongs to (or null if it's unknown).
+  const FieldInfo *field_ = nullptr;
+  /// The wrapper's format.
+  std::string format_;
+  bool saw_format_ = false;
+  bool saw_content_ = false;
+  /// The wrapper's content (or the root object if there is no wrapper),
+  /// which is merged into `message_` by `Finish`.
+  std::unique_ptr<google::protobuf::Message> content_;
+  /// Holds string values while they're copied into messages.
+  google::protobuf::string scratch_;
+};
+
+}  // anonymous namespace
+
+bool MergeJsonWithMessage(const std::string &in, std::string *format_key,
+                          google::protobuf::Message *message) {
+  JsonMessageReader handler(message, true);
+  rapidjson::Reader reader;
+  rapidjson::StringStream stream(in.c_str());
+  if (reader.Parse(stream, handler).IsError()) {
+    return false;
   }
-  return false;
+  return handler.Finish(format_key);
+}
+
+bool MergeJsonWithMessage(const rapidjson::Document &document,
+                          google::protobuf::Message *message) {
+  JsonMessageReader handler(message, false);
+  return document.Accept(handler) && handler.Finish(nullptr);
 }
 
 void PackAny(const google::protobuf::Message &message, const char *type_uri,
@@ -16,6 +16,9 @@
 
 #include "json_proto.h"
 
+#include <thread>
+#include <vector>
+
 #include "glog/logging.h"
 #include "gtest/gtest.h"
 #include "kythe/proto/analysis.pb.h"
@@ -83,6 +86,146 @@ TEST(JsonProto, Deserialize) {
   EXPECT_EQ("2", has_repeated_field.ticket(1));
 }
 
+TEST(JsonProto, DeserializeContentBeforeFormat) {
+  proto::FileData file_data;
+  std::string format_string;
+  ASSERT_TRUE(MergeJsonWithMessage(
+      "{\"content\":{\"info\":{\"path\":\"here\"}},\"format\":\"kythe\"}",
+      &format_string, &file_data));
+  EXPECT_EQ("kythe", format_string);
+  EXPECT_EQ("here", file_data.info().path());
+  proto::FileData untouched;
+  ASSERT_FALSE(MergeJsonWithMessage(
+      "{\"content\":{\"info\":{\"path\":\"here\"}},\"format\":\"wrong\"}",
+      &format_string, &untouched));
+  EXPECT_EQ("wrong", format_string);
+  EXPECT_FALSE(untouched.has_info());
+}
+
+TEST(JsonProto, DeserializeLeavesMessageAloneOnFailure) {
+  proto::FileData file_data;
+  file_data.mutable_info()->set_path("before");
+  std::string format_string;
+  EXPECT_FALSE(MergeJsonWithMessage(
+      "{\"format\":\"wrong\",\"content\":{\"info\":{\"path\":\"here\"},"
+      "\"content\":\"AAAA\"}}",
+      &format_string, &file_data));
+  EXPECT_EQ("before", file_data.info().path());
+  EXPECT_TRUE(file_data.content().empty());
+  EXPECT_FALSE(MergeJsonWithMessage(
+      "{\"format\":\"kythe\",\"content\":{\"info\":{\"path\":\"here\"},"
+      "\"content\":7}}",
+      &format_string, &file_data));
+  EXPECT_EQ("before", file_data.info().path());
+  EXPECT_TRUE(file_data.content().empty());
+}
+
+TEST(JsonProto, DeserializeDocument) {
+  rapidjson::Document document;
+  document.Parse("{\"info\":{\"path\":\"here\"},\"unknown\":[1,{}]}");
+  ASSERT_FALSE(document.HasParseError());
+  proto::FileData file_data;
+  ASSERT_TRUE(MergeJsonWithMessage(document, &file_data));
+  EXPECT_EQ("here", file_data.info().path());
+  document.Parse("[]");
+  EXPECT_FALSE(MergeJsonWithMessage(document, &file_data));
+  document.Parse("{\"info\":{\"path\":7}}");
+  EXPECT_FALSE(MergeJsonWithMessage(document, &file_data));
+  document.Parse("{\"info\":{\"path\":\"there\"},\"content\":7}");
+  EXPECT_FALSE(MergeJsonWithMessage(document, &file_data));
+  EXPECT_EQ("here", file_data.info().path());
+}
+
+TEST(JsonProto, DeserializeSkipsUnknownFields) {
+  proto::CompilationUnit unit;
+  std::string format_string;
+  ASSERT_TRUE(MergeJsonWithMessage(
+      "{\"extra\":[1,{\"a\":null}],\"format\":\"kythe\",\"content\":{"
+      "\"unknown\":{\"argument\":[1.5,true,{\"x\":[]}]},"
+      "\"has_compile_errors\":true,"
+      "\"argument\":[\"-c\",\"a.cc\"],"
+      "\"required_input\":[{\"info\":{\"path\":\"a.h\"},\"context\":[{"
+      "\"column\":[{\"offset\":42,\"linked_context\":\"x\"}]}]}]}}",
+      &format_string, &unit));
+  EXPECT_TRUE(unit.has_compile_errors());
+  ASSERT_EQ(2, unit.argument_size());
+  EXPECT_EQ("a.cc", unit.argument(1));
+  ASSERT_EQ(1, unit.required_input_size());
+  EXPECT_EQ("a.h", unit.required_input(0).info().path());
+  ASSERT_EQ(1, unit.required_input(0).context_size());
+  ASSERT_EQ(1, unit.required_input(0).context(0).column_size());
+  EXPECT_EQ(42, unit.required_input(0).context(0).column(0).offset());
+}
+
+TEST(JsonProto, DeserializeRejectsMismatchedTypes) {
+  std::string format_string;
+  for (const char *content :
+       {"{\"argument\":\"-c\"}", "{\"argument\":[1]}",
+        "{\"has_compile_errors\":1}", "{\"v_name\":\"x\"}",
+        "{\"v_name\":{\"path\":7}}", "{\"v_name\":{\"path\":null}}",
+        "{\"required_input\":{}}", "{\"required_input\":[[]]}"}) {
+    proto::CompilationUnit unit;
+    EXPECT_FALSE(MergeJsonWithMessage(
+        std::string("{\"format\":\"kythe\",\"content\":") + content + "}",
+        &format_string, &unit))
+        << content;
+  }
+  proto::FileData file_data;
+  EXPECT_FALSE(MergeJsonWithMessage(
+      "{\"format\":\"kythe\",\"content\":{\"content\":\"!!!!\"}}",
+      &format_string, &file_data));
+  EXPECT_FALSE(MergeJsonWithMessage("[]", &format_string, &file_data));
+  EXPECT_FALSE(MergeJsonWithMessage(
+      "{\"format\":\"kythe\",\"content\":{}", &format_string, &file_data));
+}
+
+TEST(JsonProto, RoundTripPreservesEmbeddedNuls) {
+  proto::FileData file_data;
+  file_data.mutable_info()->set_path(std::string("a\0b", 3));
+  std::string content;
+  for (int i = 0; i < 256; ++i) {
+    content.push_back(static_cast<char>(i));
+  }
+  file_data.set_content(content);
+  std::string json;
+  ASSERT_TRUE(WriteMessageAsJsonToString(file_data, "kythe", &json));
+  proto::FileData read_back;
+  std::string format_string;
+  ASSERT_TRUE(MergeJsonWithMessage(json, &format_string, &read_back));
+  EXPECT_EQ(std::string("a\0b", 3), read_back.info().path());
+  EXPECT_EQ(content, read_back.content());
+}
+
+TEST(JsonProto, ConcurrentRoundTrips) {
+  // Each thread warms its own view of the field tables.
+  std::vector<std::thread> threads;
+  std::vector<int> failures(8, 0);
+  for (size_t t = 0; t < failures.size(); ++t) {
+    threads.emplace_back([t, &failures]() {
+      for (int i = 0; i < 100; ++i) {
+        proto::FileData file_data;
+        file_data.mutable_info()->set_path(std::to_string(t));
+        file_data.set_content(std::to_string(i));
+        std::string json;
+        proto::FileData read_back;
+        std::string format_string;
+        if (!WriteMessageAsJsonToString(file_data, "kythe", &json) ||
+            !MergeJsonWithMessage(json, &format_string, &read_back) ||
+            read_back.info().path() != file_data.info().path() ||
+            read_back.content() != file_data.content()) {
+          ++failures[t];
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (int count : failures) {
+    EXPECT_EQ(0, count);
+  }
+}
+
 TEST(JsonProto, Encode64) {
   EXPECT_EQ("aGVsbG8K", EncodeBase64("hello\n"));
   EXPECT_EQ("", EncodeBase64(""));
@@ -98,11 +241,26 @@ TEST(JsonProto, Decode64) {
   EXPECT_EQ("ciao\n", buffer);
   EXPECT_TRUE(DecodeBase64("", &buffer));
   EXPECT_EQ("", buffer);
-  // Check to make sure that the function tolerates bad input.
-  DecodeBase64("==", &buffer);
-  DecodeBase64("=", &buffer);
-  DecodeBase64("===", &buffer);
-  DecodeBase64("!", &buffer);
+  EXPECT_TRUE(DecodeBase64("YnllCg", &buffer));
+  EXPECT_EQ("bye\n", buffer);
+  EXPECT_TRUE(DecodeBase64("aGVs\nbG8K", &buffer));
+  EXPECT_EQ("hello\n", buffer);
+  EXPECT_FALSE(DecodeBase64("==", &buffer));
+  EXPECT_FALSE(DecodeBase64("=", &buffer));
+  EXPECT_FALSE(DecodeBase64("===", &buffer));
+  EXPECT_FALSE(DecodeBase64("!", &buffer));
+  EXPECT_FALSE(DecodeBase64("Y", &buffer));
+  EXPECT_FALSE(DecodeBase64("YnllCg==YnllCg==", &buffer));
+}
+
+TEST(JsonProto, Base64RoundTrip) {
+  std::string bytes;
+  google::protobuf::string buffer;
+  for (int i = 0; i < 256; ++i) {
+    bytes.push_back(static_cast<char>(255 - i));
+    ASSERT_TRUE(DecodeBase64(EncodeBase64(bytes), &buffer));
+    EXPECT_EQ(bytes, buffer);
+  }
 }
 
 }  // namespace
@@ -18,6 +18,8 @@
 
 #include <curl/curl.h>
 
+#include <algorithm>
+
 #include "glog/logging.h"
 #include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
@@ -93,6 +95,13 @@ bool JsonClient::Request(const std::string &uri, bool post,
 
 bool JsonClient::Request(const std::string &uri, bool post,
                          const std::string &request, std::string *response) {
+  return Request(uri, post, "application/json", request, response);
+}
+
+bool JsonClient::Request(const std::string &uri, bool post,
+                         const std::string &content_type,
+                         const std::string &request, std::string *response) {
+  last_response_code_ = 0;
   to_send_ = request;
   send_head_ = 0;
   received_.clear();
@@ -105,7 +114,8 @@ bool JsonClient::Request(const std::string &uri, bool post,
   ::curl_easy_setopt(curl_, CURLOPT_WRITEDATA, this);
   ::curl_slist *headers = nullptr;
   if (post) {
-    headers = ::curl_slist_append(headers, "Content-Type: application/json");
+    headers = ::curl_slist_append(
+        headers, ("Content-Type: " + content_type).c_str());
     ::curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, headers);
     ::curl_easy_setopt(curl_, CURLOPT_POSTFIELDSIZE, request.size());
   }
@@ -124,6 +134,7 @@ bool JsonClient::Request(const std::string &uri, bool post,
     LOG(ERROR) << "(uri: " << uri << "): " << ::curl_easy_strerror(res);
     return false;
   }
+  last_response_code_ = response_code;
   if (response_code != 200) {
     LOG(ERROR) << "(uri: " << uri << "): response " << response_code;
     return false;
@@ -134,6 +145,211 @@ bool JsonClient::Request(const std::string &uri, bool post,
   return true;
 }
 
+constexpr size_t AsyncJsonClient::kDefaultMaxInFlight;
+
+AsyncJsonClient::AsyncJsonClient(size_t max_in_flight)
+    : multi_(::curl_multi_init()), max_in_flight_(max_in_flight) {
+  CHECK(multi_ != nullptr);
+  CHECK_GT(max_in_flight_, 0);
+#ifdef CURLPIPE_MULTIPLEX
+  ::curl_multi_setopt(multi_, CURLMOPT_PIPELINING,
+                      CURLPIPE_HTTP1 | CURLPIPE_MULTIPLEX);
+#else
+  ::curl_multi_setopt(multi_, CURLMOPT_PIPELINING, 1L);
+#endif
+  // Keep enough connections around to serve every slot without reconnecting.
+  ::curl_multi_setopt(multi_, CURLMOPT_MAXCONNECTS,
+                      static_cast<long>(max_in_flight_));
+  ::curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS,
+                      static_cast<long>(max_in_flight_));
+}
+
+AsyncJsonClient::~AsyncJsonClient() {
+  for (CURL *curl : idle_handles_) {
+    ::curl_easy_cleanup(curl);
+  }
+  idle_handles_.clear();
+  ::curl_multi_cleanup(multi_);
+  multi_ = nullptr;
+}
+
+size_t AsyncJsonClient::CurlWriteCallback(void *data, size_t size,
+                                          size_t nmemb, void *user) {
+  Transfer *transfer = static_cast<Transfer *>(user);
+  transfer->received.append(static_cast<const char *>(data), size * nmemb);
+  return size * nmemb;
+}
+
+size_t AsyncJsonClient::CurlReadCallback(void *data, size_t size, size_t nmemb,
+                                         void *user) {
+  Transfer *transfer = static_cast<Transfer *>(user);
+  if (transfer->send_head >= transfer->to_send.size()) {
+    return 0;
+  }
+  size_t bytes_to_send = std::min(
+      size * nmemb, transfer->to_send.size() - transfer->send_head);
+  ::memcpy(data, transfer->to_send.data() + transfer->send_head,
+           bytes_to_send);
+  transfer->send_head += bytes_to_send;
+  return bytes_to_send;
+}
+
+void AsyncJsonClient::Request(const std::string &uri, bool post,
+                              const std::string &request, Callback done) {
+  Request(uri, post, "application/json", request, std::move(done));
+}
+
+void AsyncJsonClient::Request(const std::string &uri, bool post,
+                              const std::string &content_type,
+                              const std::string &request, Callback done) {
+  std::unique_ptr<Transfer> transfer(new Transfer());
+  transfer->uri = uri;
+  transfer->post = post;
+  transfer->content_type = content_type;
+  transfer->to_send = request;
+  transfer->done = std::move(done);
+  transfer->queued_at = std::chrono::steady_clock::now();
+  queued_.push_back(std::move(transfer));
+}
+
+void AsyncJsonClient::StartTransfers() {
+  while (in_flight_ < max_in_flight_ && !queued_.empty()) {
+    Transfer *transfer = queued_.front().release();
+    queued_.pop_front();
+    if (idle_handles_.empty()) {
+      transfer->curl = ::curl_easy_init();
+      CHECK(transfer->curl != nullptr);
+    } else {
+      // Reusing a handle lets curl pick up its kept-alive connection.
+      transfer->curl = idle_handles_.back();
+      idle_handles_.pop_back();
+      ::curl_easy_reset(transfer->curl);
+    }
+    CURL *curl = transfer->curl;
+    ::curl_easy_setopt(curl, CURLOPT_URL, transfer->uri.c_str());
+    ::curl_easy_setopt(curl, CURLOPT_POST, transfer->post ? 1L : 0L);
+    ::curl_easy_setopt(curl, CURLOPT_READFUNCTION, CurlReadCallback);
+    ::curl_easy_setopt(curl, CURLOPT_READDATA, transfer);
+    ::curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CurlWriteCallback);
+    ::curl_easy_setopt(curl, CURLOPT_WRITEDATA, transfer);
+    ::curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer);
+    ::curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+#ifdef CURLPIPE_MULTIPLEX
+    // Prefer waiting for a connection that can take another request over
+    // opening a new one.
+    ::curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+    if (transfer->post) {
+      transfer->headers = ::curl_slist_append(
+          transfer->headers,
+          ("Content-Type: " + transfer->content_type).c_str());
+      // Don't spend a round trip asking whether the server wants the body.
+      transfer->headers = ::curl_slist_append(transfer->headers, "Expect:");
+      ::curl_easy_setopt(curl, CURLOPT_HTTPHEADER, transfer->headers);
+      ::curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE,
+                         static_cast<long>(transfer->to_send.size()));
+    }
+    transfer->started_at = std::chrono::steady_clock::now();
+    CHECK_EQ(CURLM_OK, ::curl_multi_add_handle(multi_, curl));
+    ++in_flight_;
+  }
+}
+
+void AsyncJsonClient::FinishTransfer(Transfer *transfer, ::CURLcode result) {
+  std::unique_ptr<Transfer> owned_transfer(transfer);
+  ::curl_multi_remove_handle(multi_, transfer->curl);
+  --in_flight_;
+  RequestStats stats;
+  std::chrono::duration<double> queued =
+      transfer->started_at - transfer->queued_at;
+  std::chrono::duration<double> latency =
+      std::chrono::steady_clock::now() - transfer->started_at;
+  stats.queued_seconds = queued.count();
+  stats.latency_seconds = latency.count();
+  if (result != CURLE_OK) {
+    LOG(ERROR) << "(uri: " << transfer->uri
+               << "): " << ::curl_easy_strerror(result);
+  } else {
+    ::curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE,
+                        &stats.response_code);
+    if (stats.response_code != 200) {
+      LOG(ERROR) << "(uri: " << transfer->uri << "): response "
+                 << stats.response_code;
+    }
+  }
+  stats.succeeded = result == CURLE_OK && stats.response_code == 200;
+  ::curl_slist_free_all(transfer->headers);
+  transfer->headers = nullptr;
+  idle_handles_.push_back(transfer->curl);
+  latencies_.push_back(stats.latency_seconds);
+  if (!stats.succeeded) {
+    ++failed_count_;
+  }
+  if (transfer->done) {
+    transfer->done(stats, transfer->received);
+  }
+}
+
+void AsyncJsonClient::Wait() {
+  StartTransfers();
+  while (in_flight_ > 0) {
+    int running = 0;
+    ::curl_multi_perform(multi_, &running);
+    int messages_left = 0;
+    while (::CURLMsg *message =
+               ::curl_multi_info_read(multi_, &messages_left)) {
+      if (message->msg != CURLMSG_DONE) {
+        continue;
+      }
+      Transfer *transfer = nullptr;
+      ::curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &transfer);
+      FinishTransfer(transfer, message->data.result);
+    }
+    // Fill the slots that just opened up (including with any requests that
+    // callbacks queued).
+    StartTransfers();
+    if (in_flight_ > 0) {
+      ::curl_multi_wait(multi_, nullptr, 0, 100, nullptr);
+    }
+  }
+}
+
+double AsyncJsonClient::LatencyPercentile(double fraction) const {
+  if (latencies_.empty()) {
+    return 0.0;
+  }
+  std::vector<double> sorted(latencies_);
+  std::sort(sorted.begin(), sorted.end());
+  size_t index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+namespace {
+
+/// \brief Decodes a wire-format xrefs reply.
+/// \param response_buffer The body of the service's response.
+/// \param response If non-null, merged with the decoded reply.
+/// \param error_text On failure, will be set to an error description.
+/// \return true on success, false on failure.
+bool DecodeXrefsReply(const std::string &response_buffer,
+                      google::protobuf::Message *response,
+                      std::string *error_text) {
+  if (response) {
+    google::protobuf::io::ArrayInputStream stream(response_buffer.data(),
+                                                  response_buffer.size());
+    google::protobuf::io::CodedInputStream coded_stream(&stream);
+    if (!response->ParseFromCodedStream(&coded_stream)) {
+      if (error_text) {
+        *error_text = "Error decoding response protobuf.";
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // anonymous namespace
+
 bool XrefsJsonClient::Roundtrip(const std::string &endpoint,
                                 const google::protobuf::Message &request,
                                 google::protobuf::Message *response,
@@ -152,17 +368,129 @@ bool XrefsJsonClient::Roundtrip(const std::string &endpoint,
     }
     return false;
   }
-  if (response) {
-    google::protobuf::io::ArrayInputStream stream(response_buffer.data(),
-                                                  response_buffer.size());
-    google::protobuf::io::CodedInputStream coded_stream(&stream);
-    if (!response->ParseFromCodedStream(&coded_stream)) {
+  return DecodeXrefsReply(response_buffer, response, error_text);
+}
+
+bool XrefsProtoClient::Send(const std::string &endpoint,
+                            const google::protobuf::Message &request,
+                            bool as_json, std::string *response_buffer,
+                            std::string *error_text) {
+  std::string request_buffer;
+  bool serialized = as_json
+                        ? WriteMessageAsJsonToString(request, &request_buffer)
+                        : request.SerializeToString(&request_buffer);
+  if (!serialized) {
+    if (error_text) {
+      *error_text = "Couldn't serialize message.";
+    }
+    return false;
+  }
+  if (!client_->Request(endpoint, true,
+                        as_json ? "application/json" : "application/x-protobuf",
+                        request_buffer, response_buffer)) {
+    if (error_text) {
+      *error_text = "Network client error.";
+    }
+    return false;
+  }
+  return true;
+}
+
+bool XrefsProtoClient::Roundtrip(const std::string &endpoint,
+                                 const google::protobuf::Message &request,
+                                 google::protobuf::Message *response,
+                                 std::string *error_text) {
+  bool as_json = encoding_ == Encoding::kJson;
+  std::string response_buffer;
+  if (Send(endpoint, request, as_json, &response_buffer, error_text)) {
+    if (!as_json) {
+      encoding_ = Encoding::kProtobuf;
+    }
+    return DecodeXrefsReply(response_buffer, response, error_text);
+  }
+  if (encoding_ != Encoding::kUnknown ||
+      client_->last_response_code() != 400) {
+    return false;
+  }
+  // Either the service can't read protobuf requests (older services only
+  // read JSON) or this request is bad. Asking again as JSON tells them apart.
+  if (!Send(endpoint, request, true, &response_buffer, error_text)) {
+    LOG(WARNING) << "(uri: " << endpoint
+                 << "): request rejected as protobuf and as JSON; "
+                    "still sending protobuf.";
+    return false;
+  }
+  LOG(WARNING) << "(uri: " << endpoint
+               << "): protobuf request rejected but JSON accepted; "
+                  "falling back to JSON.";
+  encoding_ = Encoding::kJson;
+  return DecodeXrefsReply(response_buffer, response, error_text);
+}
+
+void XrefsProtoClient::SearchAll(
+    const std::vector<proto::SearchRequest> &requests,
+    std::vector<proto::SearchReply> *replies, std::vector<bool> *succeeded,
+    std::string *error_text) {
+  if (!async_client_) {
+    XrefsClient::SearchAll(requests, replies, succeeded, error_text);
+    return;
+  }
+  replies->resize(requests.size());
+  succeeded->assign(requests.size(), false);
+  // Queues the request at `index`. A protobuf request that the service
+  // rejects before any protobuf request has succeeded is queued again as
+  // JSON (with `is_retry` set) from its callback, as in `Roundtrip`.
+  std::function<void(size_t, bool, bool)> issue = [&](size_t index,
+                                                      bool as_json,
+                                                      bool is_retry) {
+    std::string request_buffer;
+    bool serialized =
+        as_json ? WriteMessageAsJsonToString(requests[index], &request_buffer)
+                : requests[index].SerializeToString(&request_buffer);
+    if (!serialized) {
       if (error_text) {
-        *error_text = "Error decoding response protobuf.";
+        *error_text = "Couldn't serialize message.";
       }
-      return false;
+      return;
     }
+    async_client_->Request(
+        search_uri_, true,
+        as_json ? "application/json" : "application/x-protobuf",
+        request_buffer, [&, index, as_json, is_retry](
+                            const RequestStats &stats,
+                            const std::string &response) {
+          if (!stats.succeeded) {
+            if (!as_json && stats.response_code == 400 &&
+                encoding_ == Encoding::kUnknown) {
+              issue(index, true, true);
+              return;
+            }
+            if (is_retry) {
+              LOG(WARNING) << "(uri: " << search_uri_
+                           << "): request rejected as protobuf and as JSON; "
+                              "still sending protobuf.";
+            }
+            if (error_text) {
+              *error_text = "Network client error.";
+            }
+            return;
+          }
+          if (!as_json && encoding_ == Encoding::kUnknown) {
+            encoding_ = Encoding::kProtobuf;
+          } else if (is_retry && encoding_ == Encoding::kUnknown) {
+            LOG(WARNING) << "(uri: " << search_uri_
+                         << "): protobuf request rejected but JSON accepted; "
+                            "falling back to JSON.";
+            encoding_ = Encoding::kJson;
+          }
+          (*succeeded)[index] =
+              DecodeXrefsReply(response, &(*replies)[index], error_text);
+        });
+  };
+  for (size_t index = 0; index < requests.size(); ++index) {
+    issue(index, encoding_ == Encoding::kJson, false);
   }
-  return true;
+  async_client_->Wait();
 }
+
 }  // namespace kythe
@@ -17,8 +17,12 @@
 #ifndef KYTHE_CXX_COMMON_NET_CLIENT_H_
 #define KYTHE_CXX_COMMON_NET_CLIENT_H_
 
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <curl/curl.h>
 
@@ -67,6 +71,21 @@ class JsonClient {
   bool Request(const std::string &uri, bool post, const std::string &request,
                std::string *response);
 
+  /// \brief Issue a request.
+  /// \param uri The URI to request.
+  /// \param post Issue this request as a post?
+  /// \param content_type The Content-Type of `request` (if `post`).
+  /// \param request The string to issue as the request.
+  /// \param response The raw string to fill with the response.
+  /// \return true on success and false on failure
+  bool Request(const std::string &uri, bool post,
+               const std::string &content_type, const std::string &request,
+               std::string *response);
+
+  /// \brief Returns the HTTP response code of the last request, or 0 if it
+  /// got no response.
+  long last_response_code() const { return last_response_code_; }
+
  private:
   static size_t CurlWriteCallback(void *data, size_t size, size_t nmemb,
                                   void *user);
@@ -81,6 +100,124 @@ class JsonClient {
   size_t send_head_;
   /// A buffer used for communications.
   std::string received_;
+  /// The response code of the last request.
+  long last_response_code_ = 0;
+};
+
+/// \brief Describes how a single request made by an `AsyncJsonClient` went.
+struct RequestStats {
+  /// Whether the request completed with an HTTP 200 response.
+  bool succeeded = false;
+  /// The HTTP response code, or 0 if there was no response.
+  long response_code = 0;
+  /// How long the request waited for a free slot before it was started.
+  double queued_seconds = 0.0;
+  /// How long the request took from when it was started until it finished.
+  double latency_seconds = 0.0;
+};
+
+/// \brief Issues JSON-formatted RPCs concurrently.
+///
+/// Requests are queued with `Request` and run when `Wait` is called. At most
+/// `max_in_flight` requests run at once; connections are kept alive and
+/// reused between requests (and pipelined or multiplexed where the server
+/// supports it).
+///
+/// AsyncJsonClient is not thread-safe.
+class AsyncJsonClient {
+ public:
+  /// \brief Called when a request finishes.
+  /// \param stats The outcome of the request.
+  /// \param response The body of the response (if `stats.succeeded`).
+  typedef std::function<void(const RequestStats &stats,
+                             const std::string &response)> Callback;
+
+  /// The default number of requests to run at once.
+  static constexpr size_t kDefaultMaxInFlight = 8;
+
+  /// \param max_in_flight The most requests to run at once. Must be > 0.
+  explicit AsyncJsonClient(size_t max_in_flight = kDefaultMaxInFlight);
+  ~AsyncJsonClient();
+
+  /// \brief Queue a request. Call `JsonClient::InitNetwork` first.
+  /// \param uri The URI to request.
+  /// \param post Issue this request as a post?
+  /// \param request The string to issue as the request.
+  /// \param done Called with the response once the request finishes.
+  void Request(const std::string &uri, bool post, const std::string &request,
+               Callback done);
+
+  /// \brief Queue a request. Call `JsonClient::InitNetwork` first.
+  /// \param uri The URI to request.
+  /// \param post Issue this request as a post?
+  /// \param content_type The Content-Type of `request` (if `post`).
+  /// \param request The string to issue as the request.
+  /// \param done Called with the response once the request finishes.
+  void Request(const std::string &uri, bool post,
+               const std::string &content_type, const std::string &request,
+               Callback done);
+
+  /// \brief Runs until every queued request has finished and its callback
+  /// has returned. Callbacks may queue more requests.
+  void Wait();
+
+  /// \brief Returns the number of requests that have finished.
+  size_t finished_count() const { return latencies_.size(); }
+
+  /// \brief Returns the number of finished requests that did not succeed.
+  size_t failed_count() const { return failed_count_; }
+
+  /// \brief Returns the latency below which `fraction` of the finished
+  /// requests completed (so 0.5 is the median), or 0 if none have finished.
+  double LatencyPercentile(double fraction) const;
+
+ private:
+  /// \brief A request that has been queued or started.
+  struct Transfer {
+    std::string uri;
+    bool post;
+    /// The Content-Type of `to_send`.
+    std::string content_type;
+    /// The body to send.
+    std::string to_send;
+    /// How much of `to_send` has been sent.
+    size_t send_head = 0;
+    /// The response received so far.
+    std::string received;
+    Callback done;
+    /// The handle running this transfer, once started.
+    CURL *curl = nullptr;
+    /// Headers for `curl`. Owned.
+    ::curl_slist *headers = nullptr;
+    std::chrono::steady_clock::time_point queued_at;
+    std::chrono::steady_clock::time_point started_at;
+  };
+
+  static size_t CurlWriteCallback(void *data, size_t size, size_t nmemb,
+                                  void *user);
+  static size_t CurlReadCallback(void *data, size_t size, size_t nmemb,
+                                 void *user);
+
+  /// \brief Starts queued transfers until `max_in_flight_` are running.
+  void StartTransfers();
+
+  /// \brief Reports on a transfer and releases its resources.
+  void FinishTransfer(Transfer *transfer, ::CURLcode result);
+
+  /// The multi handle driving every transfer.
+  CURLM *multi_;
+  /// Easy handles not currently in use. Owned.
+  std::vector<CURL *> idle_handles_;
+  /// Requests waiting for a free slot.
+  std::deque<std::unique_ptr<Transfer>> queued_;
+  /// The number of transfers attached to `multi_`.
+  size_t in_flight_ = 0;
+  /// The most transfers to attach to `multi_` at once.
+  size_t max_in_flight_;
+  /// The latency of each finished request, in seconds.
+  std::vector<double> latencies_;
+  /// The number of finished requests that failed.
+  size_t failed_count_ = 0;
 };
 
 /// \brief A client for a Kythe xrefs service.
@@ -140,6 +277,27 @@ class XrefsClient {
     }
     return false;
   }
+
+  /// \brief Issues several Search calls. By default they are issued one at a
+  /// time; clients that can will run them concurrently.
+  /// \param requests The requests to send.
+  /// \param replies Resized to match `requests`. Each reply is merged into
+  /// the element with the same index as its request.
+  /// \param succeeded Resized to match `requests`. Each element is set to
+  /// whether the request with the same index succeeded.
+  /// \param error_text If any request fails, will be set to an error
+  /// description.
+  virtual void SearchAll(const std::vector<proto::SearchRequest> &requests,
+                         std::vector<proto::SearchReply> *replies,
+                         std::vector<bool> *succeeded,
+                         std::string *error_text) {
+    replies->resize(requests.size());
+    succeeded->assign(requests.size(), false);
+    for (size_t index = 0; index < requests.size(); ++index) {
+      (*succeeded)[index] =
+          Search(requests[index], &(*replies)[index], error_text);
+    }
+  }
 };
 
 /// \brief A client for a Kythe xrefs service that talks JSON.
@@ -183,6 +341,89 @@ class XrefsJsonClient : public XrefsClient {
   std::string decorations_uri_;
   std::string search_uri_;
 };
+
+/// \brief A client for a Kythe xrefs service that sends requests and
+/// receives replies as wire-format protobufs.
+///
+/// If the service answers a protobuf request with a 400 before it has
+/// accepted any, this client asks again in JSON. If the JSON request
+/// succeeds, the service can't decode protobuf requests, and this client
+/// sends JSON requests from then on; otherwise the request itself was bad.
+class XrefsProtoClient : public XrefsClient {
+ public:
+  /// \param client The JsonClient to use.
+  /// \param base_uri The base URI of the service ("http://localhost:8080")
+  XrefsProtoClient(std::unique_ptr<JsonClient> client,
+                   const std::string &base_uri)
+      : XrefsProtoClient(std::move(client), nullptr, base_uri) {}
+
+  /// \param client The JsonClient to use.
+  /// \param async_client If non-null, used to run `SearchAll` requests
+  /// concurrently.
+  /// \param base_uri The base URI of the service ("http://localhost:8080")
+  XrefsProtoClient(std::unique_ptr<JsonClient> client,
+                   std::unique_ptr<AsyncJsonClient> async_client,
+                   const std::string &base_uri)
+      : client_(std::move(client)),
+        async_client_(std::move(async_client)),
+        nodes_uri_(base_uri + "/nodes?proto=1"),
+        edges_uri_(base_uri + "/edges?proto=1"),
+        decorations_uri_(base_uri + "/decorations?proto=1"),
+        search_uri_(base_uri + "/search?proto=1") {}
+  bool Nodes(const proto::NodesRequest &request, proto::NodesReply *reply,
+             std::string *error_text) override {
+    return Roundtrip(nodes_uri_, request, reply, error_text);
+  }
+  bool Edges(const proto::EdgesRequest &request, proto::EdgesReply *reply,
+             std::string *error_text) override {
+    return Roundtrip(edges_uri_, request, reply, error_text);
+  }
+  bool Decorations(const proto::DecorationsRequest &request,
+                   proto::DecorationsReply *reply,
+                   std::string *error_text) override {
+    return Roundtrip(decorations_uri_, request, reply, error_text);
+  }
+  bool Search(const proto::SearchRequest &request, proto::SearchReply *reply,
+              std::string *error_text) override {
+    return Roundtrip(search_uri_, request, reply, error_text);
+  }
+  void SearchAll(const std::vector<proto::SearchRequest> &requests,
+                 std::vector<proto::SearchReply> *replies,
+                 std::vector<bool> *succeeded,
+                 std::string *error_text) override;
+
+  /// \brief Returns true if this client has fallen back to JSON requests.
+  bool sends_json() const { return encoding_ == Encoding::kJson; }
+
+ private:
+  /// What this client knows about the encodings the service reads.
+  enum class Encoding {
+    kUnknown,   ///< No request has succeeded yet.
+    kProtobuf,  ///< The service has accepted a protobuf request.
+    kJson       ///< The service rejected a protobuf request but accepted it
+                ///< as JSON.
+  };
+
+  /// \brief Sends `request` to `endpoint` encoded as JSON or protobuf.
+  /// \return true if the service answered with a 200.
+  bool Send(const std::string &endpoint,
+            const google::protobuf::Message &request, bool as_json,
+            std::string *response_buffer, std::string *error_text);
+
+  bool Roundtrip(const std::string &endpoint,
+                 const google::protobuf::Message &request,
+                 google::protobuf::Message *response, std::string *error_text);
+
+  std::unique_ptr<JsonClient> client_;
+  /// Runs `SearchAll` requests, if set.
+  std::unique_ptr<AsyncJsonClient> async_client_;
+  std::string nodes_uri_;
+  std::string edges_uri_;
+  std::string decorations_uri_;
+  std::string search_uri_;
+  /// The encoding to use for requests.
+  Encoding encoding_ = Encoding::kUnknown;
+};
 }
 
 #endif  // KYTHE_CXX_COMMON_NET_CLIENT_H_
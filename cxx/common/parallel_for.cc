@@ -0,0 +1,57 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "parallel_for.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace kythe {
+
+size_t ParallelForThreadCount(size_t count, size_t max_threads) {
+  return std::min(std::max<size_t>(max_threads, 1), count);
+}
+
+void ParallelFor(size_t count, size_t max_threads,
+                 const std::function<void(size_t index)> &body) {
+  ParallelForWithThreadIndex(
+      count, max_threads,
+      [&body](size_t thread, size_t index) { body(index); });
+}
+
+void ParallelForWithThreadIndex(
+    size_t count, size_t max_threads,
+    const std::function<void(size_t thread, size_t index)> &body) {
+  std::atomic<size_t> next_index(0);
+  auto worker = [count, &body, &next_index](size_t thread) {
+    for (size_t index = next_index++; index < count; index = next_index++) {
+      body(thread, index);
+    }
+  };
+  size_t thread_count = ParallelForThreadCount(count, max_threads);
+  std::vector<std::thread> threads;
+  for (size_t thread = 1; thread < thread_count; ++thread) {
+    threads.emplace_back(worker, thread);
+  }
+  worker(0);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+}  // namespace kythe
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_PARALLEL_FOR_H_
+#define KYTHE_CXX_COMMON_PARALLEL_FOR_H_
+
+#include <stddef.h>
+
+#include <functional>
+
+namespace kythe {
+/// \brief Calls `body(index)` once for each `index` in `[0, count)`.
+///
+/// The calls are spread over at most `max_threads` threads, one of which
+/// is the calling thread. Each thread takes the lowest index that no thread
+/// has taken yet. Returns after every call has returned.
+///
+/// \param count The number of indices.
+/// \param max_threads The most threads to use. 0 is treated as 1.
+/// \param body Called with each index. Must be safe to call concurrently.
+void ParallelFor(size_t count, size_t max_threads,
+                 const std::function<void(size_t index)> &body);
+
+/// \brief Like `ParallelFor`, but also passes `body` the number of the
+/// thread making the call.
+///
+/// Thread numbers are in `[0, ParallelForThreadCount(count, max_threads))`,
+/// and no two threads share one, so callers can keep per-thread state in a
+/// vector of that size.
+void ParallelForWithThreadIndex(
+    size_t count, size_t max_threads,
+    const std::function<void(size_t thread, size_t index)> &body);
+
+/// \brief Returns how many threads `ParallelFor` uses for `count` indices.
+size_t ParallelForThreadCount(size_t count, size_t max_threads);
+}
+
+#endif  // KYTHE_CXX_COMMON_PARALLEL_FOR_H_
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "parallel_for.h"
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+TEST(ParallelForTest, CallsEachIndexOnce) {
+  std::vector<std::atomic<int>> calls(1000);
+  for (auto &count : calls) {
+    count = 0;
+  }
+  ParallelFor(calls.size(), 8, [&calls](size_t index) { ++calls[index]; });
+  for (size_t index = 0; index < calls.size(); ++index) {
+    EXPECT_EQ(1, calls[index]) << "index " << index;
+  }
+}
+
+TEST(ParallelForTest, HandlesNoIndices) {
+  bool called = false;
+  ParallelFor(0, 8, [&called](size_t index) { called = true; });
+  EXPECT_FALSE(called);
+}
+
+TEST(ParallelForTest, UsesCallingThreadForOneThread) {
+  std::thread::id caller = std::this_thread::get_id();
+  std::vector<size_t> order;
+  ParallelFor(5, 0, [&](size_t index) {
+    EXPECT_EQ(caller, std::this_thread::get_id());
+    order.push_back(index);
+  });
+  EXPECT_EQ(std::vector<size_t>({0, 1, 2, 3, 4}), order);
+}
+
+TEST(ParallelForTest, ThreadCountIsBounded) {
+  EXPECT_EQ(1, ParallelForThreadCount(10, 0));
+  EXPECT_EQ(4, ParallelForThreadCount(10, 4));
+  EXPECT_EQ(3, ParallelForThreadCount(3, 4));
+  EXPECT_EQ(0, ParallelForThreadCount(0, 4));
+}
+
+TEST(ParallelForTest, ThreadIndicesAreDistinctPerThread) {
+  const size_t kThreads = 4;
+  std::mutex mutex;
+  std::vector<std::set<std::thread::id>> ids(kThreads);
+  ParallelForWithThreadIndex(100, kThreads, [&](size_t thread, size_t index) {
+    ASSERT_LT(thread, kThreads);
+    std::lock_guard<std::mutex> lock(mutex);
+    ids[thread].insert(std::this_thread::get_id());
+  });
+  std::set<std::thread::id> all_ids;
+  for (const auto &thread_ids : ids) {
+    EXPECT_LE(thread_ids.size(), 1);
+    all_ids.insert(thread_ids.begin(), thread_ids.end());
+  }
+  size_t used_threads = 0;
+  for (const auto &thread_ids : ids) {
+    used_threads += thread_ids.size();
+  }
+  EXPECT_EQ(used_threads, all_ids.size());
+}
+
+}  // namespace
+}  // namespace kythe
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
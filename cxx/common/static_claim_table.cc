@@ -0,0 +1,224 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "static_claim_table.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/FileSystem.h"
+
+namespace kythe {
+namespace {
+/// Identifies a static claim table (and its format version).
+constexpr char kMagic[8] = {'K', 'C', 'L', 'A', 'I', 'M', 'T', '\x01'};
+
+/// The fixed-size prefix of a static claim table.
+struct Header {
+  char magic[sizeof(kMagic)];
+  uint64_t entry_count;
+};
+
+constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ULL;
+constexpr uint64_t kFnvPrime = 0x100000001b3ULL;
+
+/// \brief Mixes `size` bytes at `data` into the FNV-1a hash `hash`.
+uint64_t HashBytes(uint64_t hash, const void *data, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * kFnvPrime;
+  }
+  return hash;
+}
+
+/// \brief Mixes `field` and its length into `hash`, so that adjacent fields
+/// can't run into one another.
+uint64_t HashField(uint64_t hash, const std::string &field) {
+  uint64_t size = field.size();
+  hash = HashBytes(hash, &size, sizeof(size));
+  return HashBytes(hash, field.data(), field.size());
+}
+
+/// \brief Writes `size` bytes from `data` to `fd`, retrying short writes.
+bool WriteAll(int fd, const void *data, size_t size) {
+  const char *bytes = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t written = ::write(fd, bytes, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    bytes += written;
+    size -= written;
+  }
+  return true;
+}
+}  // anonymous namespace
+
+uint64_t FingerprintVName(const proto::VName &vname) {
+  uint64_t hash = kFnvOffsetBasis;
+  hash = HashField(hash, vname.signature());
+  hash = HashField(hash, vname.corpus());
+  hash = HashField(hash, vname.root());
+  hash = HashField(hash, vname.path());
+  return HashField(hash, vname.language());
+}
+
+void StaticClaimTableBuilder::AddClaim(const proto::VName &claimable,
+                                       const proto::VName &claimant) {
+  claims_.emplace_back(FingerprintVName(claimable),
+                       FingerprintVName(claimant));
+}
+
+bool StaticClaimTableBuilder::WriteToFile(const std::string &path,
+                                          std::string *error_text) {
+  std::sort(claims_.begin(), claims_.end());
+  for (size_t i = 1; i < claims_.size(); ++i) {
+    if (claims_[i - 1].first == claims_[i].first) {
+      *error_text = "Two claimables have the same fingerprint.";
+      return false;
+    }
+  }
+  // Build the table next to `path` and move it into place, so readers
+  // (and an indexer that opens the table mid-write) never see a partial one.
+  int fd;
+  llvm::SmallString<256> temp_path;
+  if (auto err = llvm::sys::fs::createUniqueFile(
+          llvm::Twine(path) + ".%%%%%%%%.new", fd, temp_path)) {
+    *error_text = "Couldn't create a temporary file for " + path + ": " +
+                  err.message();
+    return false;
+  }
+  Header header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.entry_count = claims_.size();
+  bool ok = WriteAll(fd, &header, sizeof(header));
+  // Write in chunks to bound the staging buffer.
+  std::vector<uint64_t> chunk;
+  for (size_t i = 0; ok && i < claims_.size(); i += 4096) {
+    size_t end = std::min(claims_.size(), i + 4096);
+    chunk.clear();
+    for (size_t j = i; j < end; ++j) {
+      chunk.push_back(claims_[j].first);
+      chunk.push_back(claims_[j].second);
+    }
+    ok = WriteAll(fd, chunk.data(), chunk.size() * sizeof(uint64_t));
+  }
+  if (!ok) {
+    *error_text = "Couldn't write " + temp_path.str().str() + ": " +
+                  strerror(errno);
+  }
+  if (::close(fd) != 0 && ok) {
+    *error_text = "Couldn't close " + temp_path.str().str() + ": " +
+                  strerror(errno);
+    ok = false;
+  }
+  if (ok) {
+    if (auto err =
+            llvm::sys::fs::rename(llvm::Twine(temp_path), llvm::Twine(path))) {
+      *error_text = "Couldn't rename " + temp_path.str().str() + " to " +
+                    path + ": " + err.message();
+      ok = false;
+    }
+  }
+  if (!ok) {
+    llvm::sys::fs::remove(llvm::Twine(temp_path));
+  }
+  return ok;
+}
+
+std::unique_ptr<StaticClaimTable> StaticClaimTable::Open(
+    const std::string &path, std::string *error_text) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    *error_text = "Couldn't open " + path + ": " + strerror(errno);
+    return nullptr;
+  }
+  struct stat info;
+  if (::fstat(fd, &info) != 0) {
+    *error_text = "Couldn't stat " + path + ": " + strerror(errno);
+    ::close(fd);
+    return nullptr;
+  }
+  size_t size = info.st_size;
+  if (size < sizeof(Header)) {
+    *error_text = path + " is too small to be a static claim table.";
+    ::close(fd);
+    return nullptr;
+  }
+  void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping holds its own reference to the file.
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    *error_text = "Couldn't map " + path + ": " + strerror(errno);
+    return nullptr;
+  }
+  const Header *header = static_cast<const Header *>(mapping);
+  if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      (size - sizeof(Header)) / sizeof(Entry) != header->entry_count ||
+      (size - sizeof(Header)) % sizeof(Entry) != 0) {
+    *error_text = path + " is not a valid static claim table.";
+    ::munmap(mapping, size);
+    return nullptr;
+  }
+  // Lookups are random; don't waste effort reading ahead.
+  ::madvise(mapping, size, MADV_RANDOM);
+  const Entry *entries = reinterpret_cast<const Entry *>(header + 1);
+  return std::unique_ptr<StaticClaimTable>(
+      new StaticClaimTable(mapping, size, entries, header->entry_count));
+}
+
+bool StaticClaimTable::IsStaticClaimTable(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  char magic[sizeof(kMagic)];
+  bool matches = ::read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+                 memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+  ::close(fd);
+  return matches;
+}
+
+StaticClaimTable::~StaticClaimTable() {
+  ::munmap(const_cast<void *>(mapping_), mapping_size_);
+}
+
+bool StaticClaimTable::Lookup(const proto::VName &claimable,
+                              uint64_t *claimant_fingerprint) const {
+  uint64_t key = FingerprintVName(claimable);
+  const Entry *end = entries_ + entry_count_;
+  const Entry *found = std::lower_bound(
+      entries_, end, key,
+      [](const Entry &entry, uint64_t key) { return entry.claimable < key; });
+  if (found == end || found->claimable != key) {
+    return false;
+  }
+  *claimant_fingerprint = found->claimant;
+  return true;
+}
+
+}  // namespace kythe
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_STATIC_CLAIM_TABLE_H_
+#define KYTHE_CXX_COMMON_STATIC_CLAIM_TABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "kythe/proto/storage.pb.h"
+
+namespace kythe {
+
+/// \brief Returns the 64-bit fingerprint used to key `vname` in a
+/// `StaticClaimTable`.
+///
+/// The fingerprint depends only on the contents of `vname`'s fields, so it is
+/// stable across processes and machines.
+uint64_t FingerprintVName(const proto::VName &vname);
+
+/// \brief Builds the binary form of a static claim assignment.
+///
+/// The table is a short header followed by (claimable, claimant) fingerprint
+/// pairs sorted by claimable. It is written in native byte order and is meant
+/// to be memory-mapped by `StaticClaimTable` on machines of the same kind.
+class StaticClaimTableBuilder {
+ public:
+  /// \brief Records that `claimant` is responsible for `claimable`.
+  void AddClaim(const proto::VName &claimable, const proto::VName &claimant);
+
+  /// \brief Writes the table to `path`, replacing any existing file.
+  /// \param error_text Non-null; used to return error details.
+  /// \return false on failure (including two claimables whose fingerprints
+  /// collide) and true on success.
+  bool WriteToFile(const std::string &path, std::string *error_text);
+
+ private:
+  /// (claimable, claimant) fingerprint pairs in the order they were added.
+  std::vector<std::pair<uint64_t, uint64_t>> claims_;
+};
+
+/// \brief A read-only, memory-mapped static claim assignment.
+///
+/// Opening a table costs a single `mmap`; pages are faulted in as lookups
+/// touch them and are shared between all processes that map the same file.
+class StaticClaimTable {
+ public:
+  /// \brief Maps the table stored at `path`.
+  /// \param error_text Non-null; used to return error details.
+  /// \return The table, or null on error.
+  static std::unique_ptr<StaticClaimTable> Open(const std::string &path,
+                                                std::string *error_text);
+
+  /// \brief Checks whether the file at `path` starts like a claim table
+  /// written by `StaticClaimTableBuilder`.
+  static bool IsStaticClaimTable(const std::string &path);
+
+  ~StaticClaimTable();
+
+  /// \brief Finds the claimant responsible for `claimable`.
+  /// \param claimant_fingerprint Set to the `FingerprintVName` of the
+  /// responsible claimant if one was found.
+  /// \return true if `claimable` has an assigned claimant.
+  bool Lookup(const proto::VName &claimable,
+              uint64_t *claimant_fingerprint) const;
+
+  /// \brief Returns the number of claimables in this table.
+  size_t size() const { return entry_count_; }
+
+ private:
+  /// A (claimable, claimant) fingerprint pair, as laid out in the file.
+  struct Entry {
+    uint64_t claimable;
+    uint64_t claimant;
+  };
+
+  StaticClaimTable(const void *mapping, size_t mapping_size,
+                   const Entry *entries, size_t entry_count)
+      : mapping_(mapping),
+        mapping_size_(mapping_size),
+        entries_(entries),
+        entry_count_(entry_count) {}
+
+  /// The start of the mapped file.
+  const void *mapping_;
+  /// The length of the mapped file.
+  size_t mapping_size_;
+  /// The entries in the mapped file, sorted by claimable fingerprint.
+  const Entry *entries_;
+  /// The number of entries in `entries_`.
+  size_t entry_count_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_STATIC_CLAIM_TABLE_H_
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "static_claim_table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "kythe/proto/storage.pb.h"
+
+namespace kythe {
+namespace {
+
+proto::VName MakeVName(const std::string &signature, const std::string &path) {
+  proto::VName vname;
+  vname.set_signature(signature);
+  vname.set_corpus("corpus");
+  vname.set_path(path);
+  return vname;
+}
+
+/// \brief Returns a fresh path for a temporary claim table.
+std::string TempTablePath() {
+  const char *tmpdir = getenv("TEST_TMPDIR");
+  std::string path = std::string(tmpdir ? tmpdir : "/tmp") + "/claimXXXXXX";
+  int fd = mkstemp(&path[0]);
+  EXPECT_GE(fd, 0);
+  close(fd);
+  return path;
+}
+
+TEST(StaticClaimTableTest, FingerprintDependsOnEveryField) {
+  proto::VName base = MakeVName("sig", "path");
+  uint64_t fingerprint = FingerprintVName(base);
+  EXPECT_EQ(fingerprint, FingerprintVName(MakeVName("sig", "path")));
+  proto::VName changed = base;
+  changed.set_root("root");
+  EXPECT_NE(fingerprint, FingerprintVName(changed));
+  changed = base;
+  changed.set_language("c++");
+  EXPECT_NE(fingerprint, FingerprintVName(changed));
+  // Moving bytes between fields changes the fingerprint.
+  EXPECT_NE(fingerprint, FingerprintVName(MakeVName("sigp", "ath")));
+}
+
+TEST(StaticClaimTableTest, RoundTrip) {
+  proto::VName unit_a = MakeVName("", "a.cc");
+  proto::VName unit_b = MakeVName("", "b.cc");
+  StaticClaimTableBuilder builder;
+  for (int i = 0; i < 100; ++i) {
+    builder.AddClaim(MakeVName("ctx", "header" + std::to_string(i) + ".h"),
+                     i % 2 ? unit_a : unit_b);
+  }
+  std::string path = TempTablePath();
+  std::string error_text;
+  ASSERT_TRUE(builder.WriteToFile(path, &error_text)) << error_text;
+  EXPECT_TRUE(StaticClaimTable::IsStaticClaimTable(path));
+  auto table = StaticClaimTable::Open(path, &error_text);
+  ASSERT_TRUE(table != nullptr) << error_text;
+  EXPECT_EQ(100, table->size());
+  uint64_t claimant = 0;
+  ASSERT_TRUE(table->Lookup(MakeVName("ctx", "header7.h"), &claimant));
+  EXPECT_EQ(FingerprintVName(unit_a), claimant);
+  ASSERT_TRUE(table->Lookup(MakeVName("ctx", "header42.h"), &claimant));
+  EXPECT_EQ(FingerprintVName(unit_b), claimant);
+  EXPECT_FALSE(table->Lookup(MakeVName("", "header7.h"), &claimant));
+  EXPECT_FALSE(table->Lookup(MakeVName("ctx", "header100.h"), &claimant));
+  unlink(path.c_str());
+}
+
+TEST(StaticClaimTableTest, RejectsOtherFiles) {
+  std::string path = TempTablePath();
+  FILE *file = fopen(path.c_str(), "w");
+  ASSERT_TRUE(file != nullptr);
+  fputs("not a claim table", file);
+  fclose(file);
+  EXPECT_FALSE(StaticClaimTable::IsStaticClaimTable(path));
+  std::string error_text;
+  EXPECT_TRUE(StaticClaimTable::Open(path, &error_text) == nullptr);
+  EXPECT_FALSE(error_text.empty());
+  unlink(path.c_str());
+}
+
+}  // namespace
+}  // namespace kythe
+
+int main(int argc, char **argv) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  ::testing::InitGoogleTest(&argc, argv);
+  int result = RUN_ALL_TESTS();
+  return result;
+}
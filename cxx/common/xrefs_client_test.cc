@@ -0,0 +1,264 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "kythe/cxx/common/fake_http_server.h"
+#include "kythe/cxx/common/net_client.h"
+#include "kythe/proto/xref.pb.h"
+
+namespace kythe {
+namespace {
+
+/// \brief Knows about one node.
+class OneNodeXrefs : public XrefsClient {
+ public:
+  bool Nodes(const proto::NodesRequest &request, proto::NodesReply *reply,
+             std::string *error_text) override {
+    for (const auto &ticket : request.ticket()) {
+      if (ticket == "kythe:#node") {
+        auto *node = reply->add_node();
+        node->set_ticket(ticket);
+        auto *fact = node->add_fact();
+        fact->set_name("/kythe/node/kind");
+        fact->set_value("file");
+      }
+    }
+    return true;
+  }
+};
+
+/// \brief Answers a search for signature `s` with the ticket "kythe:#s".
+class EchoSearchXrefs : public XrefsClient {
+ public:
+  bool Search(const proto::SearchRequest &request, proto::SearchReply *reply,
+              std::string *error_text) override {
+    reply->add_ticket("kythe:#" + request.partial().signature());
+    return true;
+  }
+};
+
+/// \brief Checks that `client` answers a batch of searches for
+/// `EchoSearchXrefs`.
+void ExpectSearchAll(XrefsClient *client) {
+  std::vector<proto::SearchRequest> requests(10);
+  for (size_t i = 0; i < requests.size(); ++i) {
+    requests[i].mutable_partial()->set_signature(std::to_string(i));
+  }
+  std::vector<proto::SearchReply> replies;
+  std::vector<bool> succeeded;
+  std::string error_text;
+  client->SearchAll(requests, &replies, &succeeded, &error_text);
+  ASSERT_EQ(requests.size(), replies.size());
+  ASSERT_EQ(requests.size(), succeeded.size());
+  for (size_t i = 0; i < requests.size(); ++i) {
+    EXPECT_TRUE(succeeded[i]) << error_text;
+    ASSERT_EQ(1, replies[i].ticket_size());
+    EXPECT_EQ("kythe:#" + std::to_string(i), replies[i].ticket(0));
+  }
+}
+
+/// \brief Checks that `client` finds the node `OneNodeXrefs` knows about.
+void ExpectOneNode(XrefsClient *client) {
+  proto::NodesRequest request;
+  request.add_ticket("kythe:#node");
+  request.add_ticket("kythe:#other");
+  proto::NodesReply reply;
+  std::string error_text;
+  ASSERT_TRUE(client->Nodes(request, &reply, &error_text)) << error_text;
+  ASSERT_EQ(1, reply.node_size());
+  EXPECT_EQ("kythe:#node", reply.node(0).ticket());
+  EXPECT_EQ("file", reply.node(0).fact(0).value());
+}
+
+TEST(XrefsJsonClientTest, RoundTrips) {
+  OneNodeXrefs xrefs;
+  FakeHttpServer server(FakeHttpServer::XrefsHandler(&xrefs));
+  std::string error_text;
+  ASSERT_TRUE(server.Start(&error_text)) << error_text;
+  XrefsJsonClient client(std::unique_ptr<JsonClient>(new JsonClient()),
+                         server.base_uri());
+  ExpectOneNode(&client);
+  proto::EdgesRequest edges_request;
+  edges_request.add_ticket("kythe:#node");
+  proto::EdgesReply edges_reply;
+  EXPECT_FALSE(client.Edges(edges_request, &edges_reply, &error_text));
+}
+
+TEST(XrefsProtoClientTest, SendsProtobufs) {
+  OneNodeXrefs xrefs;
+  auto handler = FakeHttpServer::XrefsHandler(&xrefs);
+  std::mutex content_types_mutex;
+  std::vector<std::string> content_types;
+  FakeHttpServer server([&](const std::string &path,
+                            const std::string &content_type,
+                            const std::string &body, std::string *response) {
+    {
+      std::lock_guard<std::mutex> lock(content_types_mutex);
+      content_types.push_back(content_type);
+    }
+    return handler(path, content_type, body, response);
+  });
+  std::string error_text;
+  ASSERT_TRUE(server.Start(&error_text)) << error_text;
+  XrefsProtoClient client(std::unique_ptr<JsonClient>(new JsonClient()),
+                          server.base_uri());
+  ExpectOneNode(&client);
+  ExpectOneNode(&client);
+  EXPECT_FALSE(client.sends_json());
+  server.Stop();
+  ASSERT_EQ(2, content_types.size());
+  EXPECT_EQ("application/x-protobuf", content_types[0]);
+  EXPECT_EQ("application/x-protobuf", content_types[1]);
+}
+
+TEST(XrefsProtoClientTest, FallsBackToJson) {
+  OneNodeXrefs xrefs;
+  FakeHttpServer server(
+      FakeHttpServer::XrefsHandler(&xrefs, /* decode_proto_requests */ false));
+  std::string error_text;
+  ASSERT_TRUE(server.Start(&error_text)) << error_text;
+  XrefsProtoClient client(std::unique_ptr<JsonClient>(new JsonClient()),
+                          server.base_uri());
+  ExpectOneNode(&client);
+  EXPECT_TRUE(client.sends_json());
+  ExpectOneNode(&client);
+  // The first protobuf request, its JSON retry, and one more JSON request.
+  EXPECT_EQ(3, server.request_count());
+}
+
+/// \brief Wraps `handler`, recording the content type of each request and
+/// answering every request to /edges with a 400.
+FakeHttpServer::Handler RejectEdges(FakeHttpServer::Handler handler,
+                                    std::mutex *mutex,
+                                    std::vector<std::string> *content_types) {
+  return [handler, mutex, content_types](const std::string &path,
+                                         const std::string &content_type,
+                                         const std::string &body,
+                                         std::string *response) {
+    {
+      std::lock_guard<std::mutex> lock(*mutex);
+      content_types->push_back(content_type);
+    }
+    if (path.find("/edges") == 0) {
+      return 400;
+    }
+    return handler(path, content_type, body, response);
+  };
+}
+
+TEST(XrefsProtoClientTest, KeepsProtobufsForBadFirstRequest) {
+  OneNodeXrefs xrefs;
+  std::mutex content_types_mutex;
+  std::vector<std::string> content_types;
+  FakeHttpServer server(RejectEdges(FakeHttpServer::XrefsHandler(&xrefs),
+                                    &content_types_mutex, &content_types));
+  std::string error_text;
+  ASSERT_TRUE(server.Start(&error_text)) << error_text;
+  XrefsProtoClient client(std::unique_ptr<JsonClient>(new JsonClient()),
+                          server.base_uri());
+  proto::EdgesRequest edges_request;
+  edges_request.add_ticket("kythe:#node");
+  proto::EdgesReply edges_reply;
+  // The JSON retry is rejected too, so the request (not the encoding) is bad.
+  EXPECT_FALSE(client.Edges(edges_request, &edges_reply, &error_text));
+  EXPECT_FALSE(client.sends_json());
+  ExpectOneNode(&client);
+  server.Stop();
+  ASSERT_EQ(3, content_types.size());
+  EXPECT_EQ("application/x-protobuf", content_types[0]);
+  EXPECT_EQ("application/json", content_types[1]);
+  EXPECT_EQ("application/x-protobuf", content_types[2]);
+}
+
+TEST(XrefsProtoClientTest, DoesNotRetryOnceProtobufsWork) {
+  OneNodeXrefs xrefs;
+  std::mutex content_types_mutex;
+  std::vector<std::string> content_types;
+  FakeHttpServer server(RejectEdges(FakeHttpServer::XrefsHandler(&xrefs),
+                                    &content_types_mutex, &content_types));
+  std::string error_text;
+  ASSERT_TRUE(server.Start(&error_text)) << error_text;
+  XrefsProtoClient client(std::unique_ptr<JsonClient>(new JsonClient()),
+                          server.base_uri());
+  ExpectOneNode(&client);
+  proto::EdgesRequest edges_request;
+  edges_request.add_ticket("kythe:#node");
+  proto::EdgesReply edges_reply;
+  EXPECT_FALSE(client.Edges(edges_request, &edges_reply, &error_text));
+  EXPECT_FALSE(client.sends_json());
+  server.Stop();
+  ASSERT_EQ(2, content_types.size());
+  EXPECT_EQ("application/x-protobuf", content_types[1]);
+}
+
+TEST(XrefsProtoClientTest, SearchesConcurrently) {
+  EchoSearchXrefs xrefs;
+  FakeHttpServer server(FakeHttpServer::XrefsHandler(&xrefs));
+  server.set_latency(std::chrono::milliseconds(20));
+  std::string error_text;
+  ASSERT_TRUE(server.Start(&error_text)) << error_text;
+  XrefsProtoClient client(
+      std::unique_ptr<JsonClient>(new JsonClient()),
+      std::unique_ptr<AsyncJsonClient>(new AsyncJsonClient(4)),
+      server.base_uri());
+  ExpectSearchAll(&client);
+  EXPECT_FALSE(client.sends_json());
+  EXPECT_EQ(10, server.request_count());
+  EXPECT_GT(server.max_concurrent_requests(), 1);
+  EXPECT_LE(server.max_concurrent_requests(), 4);
+}
+
+TEST(XrefsProtoClientTest, SearchAllFallsBackToJson) {
+  EchoSearchXrefs xrefs;
+  FakeHttpServer server(
+      FakeHttpServer::XrefsHandler(&xrefs, /* decode_proto_requests */ false));
+  std::string error_text;
+  ASSERT_TRUE(server.Start(&error_text)) << error_text;
+  XrefsProtoClient client(
+      std::unique_ptr<JsonClient>(new JsonClient()),
+      std::unique_ptr<AsyncJsonClient>(new AsyncJsonClient(4)),
+      server.base_uri());
+  ExpectSearchAll(&client);
+  EXPECT_TRUE(client.sends_json());
+}
+
+TEST(XrefsProtoClientTest, SearchAllWithoutAsyncClient) {
+  EchoSearchXrefs xrefs;
+  FakeHttpServer server(FakeHttpServer::XrefsHandler(&xrefs));
+  std::string error_text;
+  ASSERT_TRUE(server.Start(&error_text)) << error_text;
+  XrefsProtoClient client(std::unique_ptr<JsonClient>(new JsonClient()),
+                          server.base_uri());
+  ExpectSearchAll(&client);
+  EXPECT_EQ(1, server.max_concurrent_requests());
+}
+
+}  // namespace
+}  // namespace kythe
+
+int main(int argc, char **argv) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  kythe::JsonClient::InitNetwork();
+  ::testing::InitGoogleTest(&argc, argv);
+  int result = RUN_ALL_TESTS();
+  return result;
+}
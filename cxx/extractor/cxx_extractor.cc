@@ -16,13 +16,18 @@
 
 #include "cxx_extractor.h"
 
+#include <algorithm>
+#include <set>
 #include <type_traits>
 #include <unordered_map>
 
 #include <fcntl.h>
 #include <openssl/sha.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "clang/Basic/FileSystemStatCache.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Lex/HeaderSearch.h"
@@ -37,6 +42,9 @@
 #include "kythe/cxx/common/proto_conversions.h"
 #include "kythe/proto/analysis.pb.h"
 #include "kythe/proto/cxx.pb.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 #include "third_party/llvm/src/clang_builtin_headers.h"
 #include "third_party/llvm/src/cxx_extractor_preprocessor_utils.h"
 
@@ -46,6 +54,10 @@ namespace {
 // We need "the lowercase ascii hex SHA-256 digest of the file contents."
 static constexpr char kHexDigits[] = "0123456789abcdef";
 
+/// The number of threads an `IndexPackWriterSink` uses to write a unit's
+/// inputs. Most of the work is compressing headers that aren't in the pack.
+static constexpr size_t kPackWriteThreads = 4;
+
 /// \brief Lowercase-string-hex-encodes the array sha_buf.
 /// \param sha_buf The bytes of the hash.
 static std::string LowercaseStringHexEncodeSha(
@@ -117,6 +129,101 @@ static std::string Sha256(const void* bytes, size_t length) {
   return LowercaseStringHexEncodeSha(sha_buf);
 }
 
+/// Files modified less than this many seconds ago may be modified again
+/// without changing their mtime, so we don't cache their digests.
+static constexpr uint64_t kRacyModificationSeconds = 2;
+
+/// \brief Returns true if the file with `identity` has gone long enough
+/// without modification that its digest may be cached.
+static bool IsSettled(const FileIdentity& identity) {
+  return identity.mtime_seconds + kRacyModificationSeconds <
+         static_cast<uint64_t>(time(nullptr));
+}
+
+/// Environment variables that change where Clang looks for headers (and so
+/// which unit it produces) without showing up in its arguments.
+static const char* const kDigestedEnvironmentVariables[] = {
+    "CPATH", "C_INCLUDE_PATH", "CPLUS_INCLUDE_PATH", "OBJC_INCLUDE_PATH",
+    "OBJCPLUS_INCLUDE_PATH", "SDKROOT"};
+
+/// \brief Checks whether the kindex file at `path` holds the unit with
+/// `signature`. Only the file's header is read.
+static bool KindexHoldsUnit(const std::string& path,
+                            const std::string& signature) {
+  using namespace google::protobuf::io;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  kythe::proto::CompilationUnit unit;
+  bool parsed = false;
+  {
+    FileInputStream file_stream(fd);
+    auto decompressed_stream = NewDecompressingInputStream(&file_stream);
+    CodedInputStream coded_stream(decompressed_stream.get());
+    google::protobuf::uint32 byte_size;
+    if (coded_stream.ReadVarint32(&byte_size)) {
+      auto limit = coded_stream.PushLimit(byte_size);
+      parsed = unit.ParseFromCodedStream(&coded_stream);
+      coded_stream.PopLimit(limit);
+    }
+  }
+  close(fd);
+  return parsed && unit.v_name().signature() == signature;
+}
+
+/// The type URI for the paths an incremental record says were missing.
+static const char kCxxMissingPathDetailsURI[] =
+    "kythe.io/proto/kythe.proto.CxxMissingPathDetails";
+
+/// \brief Remembers every path that the `FileManager` looked for and didn't
+/// find, including header search probes, `__has_include` and
+/// `#include_next`. If one of them appears later, the same arguments may
+/// select different files.
+class MissingPathRecorder : public clang::FileSystemStatCache {
+ public:
+  /// \param missing_paths Receives the missing paths; must outlive this
+  /// object.
+  explicit MissingPathRecorder(std::set<std::string>* missing_paths)
+      : missing_paths_(missing_paths) {}
+
+ protected:
+  LookupResult getStat(const char* path, clang::FileData& data, bool is_file,
+                       std::unique_ptr<clang::vfs::File>* file,
+                       clang::vfs::FileSystem& file_system) override {
+    LookupResult result = statChained(path, data, is_file, file, file_system);
+    if (result == CacheMissing) {
+      missing_paths_->insert(path);
+    }
+    return result;
+  }
+
+ private:
+  std::set<std::string>* missing_paths_;
+};
+
+/// \brief Atomically replaces the file at `path` with the serialized `unit`.
+/// Failures are logged, but are otherwise harmless.
+static void WriteUnitRecord(const std::string& path,
+                            const kythe::proto::CompilationUnit& unit) {
+  std::string temp_path = path + ".XXXXXX";
+  int fd = mkstemp(&temp_path[0]);
+  if (fd < 0) {
+    LOG(WARNING) << "Couldn't create a temporary file for " << path;
+    return;
+  }
+  bool ok;
+  {
+    google::protobuf::io::FileOutputStream stream(fd);
+    ok = unit.SerializeToZeroCopyStream(&stream) && stream.Flush();
+  }
+  ok = (close(fd) == 0) && ok;
+  if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+    LOG(WARNING) << "Couldn't record the extracted unit in " << path;
+    unlink(temp_path.c_str());
+  }
+}
+
 /// \brief The state shared among the extractor's various moving parts.
 ///
 /// None of the fields in this struct are owned by the struct.
@@ -397,6 +504,8 @@ void ExtractorPPCallbacks::AddFile(const clang::FileEntry* file,
         source_manager_->getMemoryBufferForFile(file);
     contents.first->second.file_content.assign(buffer->getBufferStart(),
                                                buffer->getBufferEnd());
+    contents.first->second.digest =
+        index_writer_->DigestFile(file, buffer->getBuffer());
     contents.first->second.vname.CopyFrom(index_writer_->VNameForPath(
         RelativizePath(path, index_writer_->root_directory())));
     LOG(INFO) << "added content for " << path << "\n";
@@ -726,21 +835,28 @@ void IndexPackWriterSink::OpenIndex(const std::string& path,
       path, IndexPackFilesystem::OpenMode::kReadWrite, &error_text);
   CHECK(filesystem) << "Couldn't open index pack in " << path << ": "
                     << error_text;
+  filesystem->set_compression_codec(codec_);
   pack_.reset(new IndexPack(std::move(filesystem)));
 }
 
 void IndexPackWriterSink::WriteHeader(
     const kythe::proto::CompilationUnit& header) {
   CHECK(pack_) << "Index pack not opened.";
-  std::string error_text;
-  CHECK(pack_->AddCompilationUnit(header, &error_text)) << error_text;
+  unit_.CopyFrom(header);
 }
 
 void IndexPackWriterSink::WriteFileContent(
     const kythe::proto::FileData& content) {
   CHECK(pack_) << "Index pack not opened.";
-  std::string error_text;
-  CHECK(pack_->AddFileData(content, &error_text)) << error_text;
+  inputs_.push_back(content);
+}
+
+bool IndexPackWriterSink::Finish(std::string* error_text) {
+  if (!pack_) {
+    return true;
+  }
+  return pack_->AddCompilationUnitWithInputs(unit_, inputs_, kPackWriteThreads,
+                                             error_text);
 }
 
 void KindexWriterSink::OpenIndex(const std::string& directory,
@@ -756,18 +872,17 @@ void KindexWriterSink::OpenIndex(const std::string& directory,
   CHECK_GE(fd_, 0) << "Couldn't open output file " << file_path;
   open_path_ = file_path;
   file_stream_.reset(new FileOutputStream(fd_));
-  GzipOutputStream::Options options;
-  // Accept the default compression level and compression strategy.
-  options.format = GzipOutputStream::GZIP;
-  gzip_stream_.reset(new GzipOutputStream(file_stream_.get(), options));
-  coded_stream_.reset(new CodedOutputStream(gzip_stream_.get()));
+  compressed_stream_ = NewCompressingOutputStream(codec_, file_stream_.get());
+  coded_stream_.reset(new CodedOutputStream(compressed_stream_.get()));
 }
 
 KindexWriterSink::~KindexWriterSink() {
   CHECK(!coded_stream_->HadError()) << "Errors encountered writing to "
                                     << open_path_;
   coded_stream_.reset(nullptr);
-  gzip_stream_.reset(nullptr);
+  CHECK(compressed_stream_->Close()) << "Couldn't finish writing "
+                                     << open_path_;
+  compressed_stream_.reset(nullptr);
   file_stream_.reset(nullptr);
   close(fd_);
 }
@@ -816,8 +931,11 @@ void IndexWriter::FillFileInput(
   // it. (clang also refers to standard input as <stdin>, so we're
   // consistent there.)
   file_info->set_path(clang_path == "-" ? "<stdin>" : clang_path);
-  file_info->set_digest(Sha256(source_file.file_content.c_str(),
-                               source_file.file_content.size()));
+  file_info->set_digest(
+      source_file.digest.empty()
+          ? Sha256(source_file.file_content.c_str(),
+                   source_file.file_content.size())
+          : source_file.digest);
   for (const auto& row : source_file.include_history) {
     auto* row_pb = file_input->add_context();
     row_pb->set_source_context(row.first);
@@ -832,11 +950,36 @@ void IndexWriter::FillFileInput(
   }
 }
 
-void IndexWriter::WriteIndex(
+std::string IndexWriter::DigestFile(const clang::FileEntry* file,
+                                    llvm::StringRef content) {
+  if (digest_cache_ == nullptr) {
+    return Sha256(content.data(), content.size());
+  }
+  // Only trust the cache for files that are still on disk in the same state
+  // that Clang saw them (which rules out, e.g., our builtin headers).
+  FileIdentity identity;
+  if (!IdentifyFile(file->getName(), &identity) ||
+      identity.device != file->getUniqueID().getDevice() ||
+      identity.inode != file->getUniqueID().getFile() ||
+      identity.mtime_seconds !=
+          static_cast<uint64_t>(file->getModificationTime()) ||
+      identity.size != content.size() || !IsSettled(identity)) {
+    return Sha256(content.data(), content.size());
+  }
+  std::string digest;
+  if (!digest_cache_->Lookup(identity, &digest)) {
+    digest = Sha256(content.data(), content.size());
+    digest_cache_->Insert(identity, digest);
+  }
+  return digest;
+}
+
+bool IndexWriter::WriteIndex(
     std::unique_ptr<IndexWriterSink> sink, const std::string& main_source_file,
     const std::string& entry_context,
     const std::unordered_map<std::string, SourceFile>& source_files,
-    const HeaderSearchInfo& header_search_info, bool had_errors) {
+    const HeaderSearchInfo& header_search_info, bool had_errors,
+    kythe::proto::CompilationUnit* written_unit) {
   kythe::proto::CompilationUnit unit;
   std::string identifying_blob;
   identifying_blob.append(corpus_);
@@ -889,6 +1032,18 @@ void IndexWriter::WriteIndex(
         unit.required_input(info_index++).info());
     sink->WriteFileContent(file_content);
   }
+  std::string error_text;
+  if (!sink->Finish(&error_text)) {
+    LOG(ERROR) << "Couldn't write the unit for " << main_source_file << ": "
+               << error_text;
+    return false;
+  }
+  // Some sinks only finish writing when they're destroyed.
+  sink.reset();
+  if (written_unit != nullptr) {
+    written_unit->Swap(&unit);
+  }
+  return true;
 }
 
 std::unique_ptr<clang::FrontendAction> NewExtractor(
@@ -928,7 +1083,8 @@ static std::string LoadFileOrDie(const std::string& file) {
 constexpr char kBuiltinResourceDirectory[] = "/kythe_builtins";
 
 void ExtractorConfiguration::SetVNameConfig(const std::string& path) {
-  if (!index_writer_.SetVNameConfiguration(LoadFileOrDie(path))) {
+  vname_config_ = LoadFileOrDie(path);
+  if (!index_writer_.SetVNameConfiguration(vname_config_)) {
     fprintf(stderr, "Couldn't configure vnames from %s\n", path.c_str());
     exit(1);
   }
@@ -975,25 +1131,224 @@ void ExtractorConfiguration::InitializeFromEnvironment() {
   if (const char* env_output_directory = getenv("KYTHE_OUTPUT_DIRECTORY")) {
     index_writer_.set_output_directory(env_output_directory);
   }
+  if (const char* env_compression = getenv("KYTHE_COMPRESSION")) {
+    CHECK(ParseCompressionCodec(env_compression, &compression_codec_))
+        << "Unknown KYTHE_COMPRESSION codec " << env_compression;
+  }
+  if (const char* env_digest_cache = getenv("KYTHE_DIGEST_CACHE")) {
+    std::string error_text;
+    digest_cache_ = FileDigestCache::Open(
+        env_digest_cache, FileDigestCache::kDefaultSlotCount, &error_text);
+    if (digest_cache_ == nullptr) {
+      LOG(WARNING) << "Not using digest cache: " << error_text;
+    }
+    index_writer_.set_digest_cache(digest_cache_.get());
+  }
+  if (const char* env_incremental_directory =
+          getenv("KYTHE_INCREMENTAL_DIRECTORY")) {
+    SetIncrementalDirectory(env_incremental_directory);
+  }
 }
 
-void ExtractorConfiguration::Extract() {
+std::string ExtractorConfiguration::ConfigurationDigest() const {
+  std::string blob;
+  // Prefix each field with its length so adjacent fields can't run together.
+  auto append_field = [&blob](const std::string& field) {
+    blob.append(std::to_string(field.size()));
+    blob.push_back(':');
+    blob.append(field);
+  };
+  append_field(index_writer_.corpus());
+  append_field(index_writer_.root_directory());
+  append_field(index_writer_.output_directory());
+  append_field(vname_config_);
+  append_field(kindex_path_);
+  append_field(using_index_packs_ ? "pack" : "kindex");
+  append_field(std::to_string(static_cast<int>(compression_codec_)));
+  for (const auto& arg : final_args_) {
+    append_field(arg);
+  }
+  for (const char* name : kDigestedEnvironmentVariables) {
+    // Tell unset variables apart from empty ones.
+    const char* value = getenv(name);
+    append_field(value ? std::string("=") + value : std::string());
+  }
+  // Relative paths in the arguments are resolved from here.
+  llvm::SmallString<1024> working_directory;
+  if (!llvm::sys::fs::current_path(working_directory)) {
+    append_field(working_directory.str());
+  }
+  return Sha256(blob.c_str(), blob.size());
+}
+
+bool ExtractorConfiguration::DigestCurrentInput(const std::string& clang_path,
+                                                std::string* digest) {
+  if (map_builtin_resources_ &&
+      llvm::StringRef(clang_path).startswith(kBuiltinResourceDirectory)) {
+    // These files live in our own binary; see `MapCompilerResources`.
+    for (const auto* file = builtin_headers_create(); file->name; ++file) {
+      llvm::SmallString<1024> builtin_path(kBuiltinResourceDirectory);
+      llvm::sys::path::append(builtin_path, "include");
+      llvm::sys::path::append(builtin_path, file->name);
+      if (builtin_path.str() == clang_path) {
+        *digest = Sha256(file->data, strlen(file->data));
+        return true;
+      }
+    }
+    return false;
+  }
+  std::string path = clang_path;
+  if (!file_system_options_.WorkingDir.empty() &&
+      llvm::sys::path::is_relative(path)) {
+    llvm::SmallString<1024> absolute_path(file_system_options_.WorkingDir);
+    llvm::sys::path::append(absolute_path, path);
+    path = absolute_path.str();
+  }
+  FileIdentity identity;
+  if (!IdentifyFile(path, &identity)) {
+    return false;
+  }
+  bool cacheable = digest_cache_ != nullptr && IsSettled(identity);
+  if (cacheable && digest_cache_->Lookup(identity, digest)) {
+    return true;
+  }
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (!buffer) {
+    return false;
+  }
+  *digest = Sha256((*buffer)->getBufferStart(), (*buffer)->getBufferSize());
+  if (cacheable && (*buffer)->getBufferSize() == identity.size) {
+    digest_cache_->Insert(identity, *digest);
+  }
+  return true;
+}
+
+bool ExtractorConfiguration::RecordedUnitIsCurrent(
+    const std::string& record_path) {
+  int fd = open(record_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  kythe::proto::CompilationUnit unit;
+  bool parsed;
+  {
+    google::protobuf::io::FileInputStream stream(fd);
+    parsed = unit.ParseFromZeroCopyStream(&stream);
+  }
+  close(fd);
+  if (!parsed ||
+      unit.argument_size() != static_cast<int>(final_args_.size()) ||
+      !std::equal(final_args_.begin(), final_args_.end(),
+                  unit.argument().begin())) {
+    return false;
+  }
+  // The preprocessor transcripts recorded in the unit's contexts depend only
+  // on the arguments (checked above), on the contents of the files it read
+  // and on which files exist. If none of the files it read have changed and
+  // none of the paths it looked for and didn't find have appeared, header
+  // search will find the same files and the unit will be the same.
+  for (const auto& input : unit.required_input()) {
+    std::string digest;
+    if (!DigestCurrentInput(input.info().path(), &digest) ||
+        digest != input.info().digest()) {
+      return false;
+    }
+  }
+  bool has_missing_paths = false;
+  for (const auto& any : unit.details()) {
+    if (any.type_uri() != kCxxMissingPathDetailsURI) {
+      continue;
+    }
+    kythe::proto::CxxMissingPathDetails missing;
+    if (!UnpackAny(any, &missing)) {
+      return false;
+    }
+    for (const auto& path : missing.path()) {
+      if (access(path.c_str(), F_OK) == 0) {
+        return false;
+      }
+    }
+    has_missing_paths = true;
+  }
+  if (!has_missing_paths) {
+    // Records without the missing paths can't be checked.
+    return false;
+  }
+  // Index packs only ever grow, so a unit that was written to one is still
+  // there. A kindex file might have been deleted.
+  if (!using_index_packs_) {
+    const std::string& signature = unit.v_name().signature();
+    if (signature.compare(0, 3, "cu#") != 0) {
+      return false;
+    }
+    if (!kindex_path_.empty()) {
+      // Any unit may have been written to a fixed path since, so look at
+      // which one is there now.
+      return KindexHoldsUnit(kindex_path_, signature);
+    }
+    // Kindex files in the output directory are named by their unit's hash.
+    std::string kindex_path = index_writer_.output_directory() + "/" +
+                              signature.substr(3) + ".kindex";
+    if (access(kindex_path.c_str(), F_OK) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ExtractorConfiguration::Extract() {
+  std::string record_path;
+  if (!incremental_directory_.empty()) {
+    record_path =
+        incremental_directory_ + "/" + ConfigurationDigest() + ".kunit";
+    if (RecordedUnitIsCurrent(record_path)) {
+      LOG(INFO) << "Inputs are unchanged since " << record_path
+                << " was written; skipping extraction.";
+      return true;
+    }
+  }
+  bool wrote_index = true;
+  std::set<std::string> missing_paths;
   llvm::IntrusiveRefCntPtr<clang::FileManager> file_manager(
       new clang::FileManager(file_system_options_));
+  if (!record_path.empty()) {
+    file_manager->addStatCache(
+        llvm::make_unique<MissingPathRecorder>(&missing_paths));
+  }
   auto extractor = NewExtractor(
       &index_writer_,
-      [this](const std::string& main_source_file,
-             const PreprocessorTranscript& transcript,
-             const std::unordered_map<std::string, SourceFile>& source_files,
-             const HeaderSearchInfo& header_search_info, bool had_errors) {
+      [this, &record_path, &wrote_index, &missing_paths](
+          const std::string& main_source_file,
+          const PreprocessorTranscript& transcript,
+          const std::unordered_map<std::string, SourceFile>& source_files,
+          const HeaderSearchInfo& header_search_info, bool had_errors) {
         std::unique_ptr<IndexWriterSink> sink;
         if (using_index_packs_) {
-          sink.reset(new IndexPackWriterSink());
+          sink.reset(new IndexPackWriterSink(compression_codec_));
         } else {
-          sink.reset(new KindexWriterSink(kindex_path_));
+          sink.reset(new KindexWriterSink(kindex_path_, compression_codec_));
+        }
+        kythe::proto::CompilationUnit unit;
+        // Don't record a unit that didn't make it into the output.
+        if (!index_writer_.WriteIndex(std::move(sink), main_source_file,
+                                      transcript, source_files,
+                                      header_search_info, had_errors, &unit)) {
+          wrote_index = false;
+          return;
+        }
+        if (!record_path.empty()) {
+          // Only the record needs these, so they aren't in the written unit.
+          kythe::proto::CxxMissingPathDetails missing;
+          for (const auto& path : missing_paths) {
+            // The builtin headers never change, so there's no point checking
+            // for new ones.
+            if (!llvm::StringRef(path).startswith(kBuiltinResourceDirectory)) {
+              missing.add_path(path);
+            }
+          }
+          PackAny(missing, kCxxMissingPathDetailsURI, unit.add_details());
+          WriteUnitRecord(record_path, unit);
         }
-        index_writer_.WriteIndex(std::move(sink), main_source_file, transcript,
-                                 source_files, header_search_info, had_errors);
       });
   clang::tooling::ToolInvocation invocation(final_args_, extractor.release(),
                                             file_manager.get());
@@ -1001,6 +1356,7 @@ void ExtractorConfiguration::Extract() {
     MapCompilerResources(&invocation, kBuiltinResourceDirectory);
   }
   invocation.run();
+  return wrote_index;
 }
 
 }  // namespace kythe
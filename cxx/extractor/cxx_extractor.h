@@ -20,20 +20,23 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "clang/Tooling/Tooling.h"
 #include "glog/logging.h"
 #include "google/protobuf/io/coded_stream.h"
-#include "google/protobuf/io/gzip_stream.h"
 #include "google/protobuf/io/zero_copy_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "kythe/cxx/common/compression.h"
 #include "kythe/cxx/common/cxx_details.h"
+#include "kythe/cxx/common/file_digest_cache.h"
 #include "kythe/cxx/common/file_vname_generator.h"
 #include "kythe/cxx/common/index_pack.h"
 #include "kythe/proto/analysis.pb.h"
 
 namespace clang {
 class FrontendAction;
+class FileEntry;
 class FileManager;
 }
 
@@ -62,6 +65,8 @@ enum class ClaimDirective {
 /// \brief A record for a single source file.
 struct SourceFile {
   std::string file_content;  ///< The full uninterpreted file content.
+  /// The SHA256 digest of `file_content`, or empty if it hasn't been computed.
+  std::string digest;
   struct FileHandlingAnnotations {
     ClaimDirective default_claim;  ///< Claiming behavior for this version.
     /// The (include-#-offset, that-version) components of the tuple set
@@ -109,28 +114,49 @@ class IndexWriterSink {
   virtual void WriteHeader(const kythe::proto::CompilationUnit &header) = 0;
   /// \brief Writes a `FileData` record to the indexfile.
   virtual void WriteFileContent(const kythe::proto::FileData &content) = 0;
+  /// \brief Called after the last `WriteFileContent`. Sinks that buffer
+  /// their input write it out here.
+  /// \param error_text Set to a description of any error.
+  /// \return false if the index could not be written.
+  virtual bool Finish(std::string *error_text) { return true; }
   virtual ~IndexWriterSink() {}
 };
 
 /// \brief Writes extracted data to an index pack.
+///
+/// Data is buffered until `Finish` is called, at which point the inputs
+/// are written concurrently (skipping those already in the pack) and the
+/// unit is written after them.
 class IndexPackWriterSink : public IndexWriterSink {
  public:
+  /// \param codec The codec used to compress new entries in the pack.
+  explicit IndexPackWriterSink(CompressionCodec codec = CompressionCodec::kGzip)
+      : codec_(codec) {}
   void OpenIndex(const std::string &path,
                  const std::string &unit_hash) override;
   void WriteHeader(const kythe::proto::CompilationUnit &header) override;
   void WriteFileContent(const kythe::proto::FileData &content) override;
+  bool Finish(std::string *error_text) override;
 
  private:
   /// The open index pack, if any.
   std::unique_ptr<IndexPack> pack_;
+  /// The unit passed to `WriteHeader`.
+  kythe::proto::CompilationUnit unit_;
+  /// The content passed to `WriteFileContent`.
+  std::vector<kythe::proto::FileData> inputs_;
+  /// The codec used to compress new entries in the pack.
+  CompressionCodec codec_;
 };
 
 /// \brief An `IndexWriterSink` that writes to physical .kindex files.
 class KindexWriterSink : public IndexWriterSink {
  public:
   /// \param force_path If nonempty, will always write to this file.
-  explicit KindexWriterSink(const std::string &force_path)
-      : force_path_(force_path) {}
+  /// \param codec The codec used to compress the file.
+  explicit KindexWriterSink(const std::string &force_path,
+                            CompressionCodec codec = CompressionCodec::kGzip)
+      : force_path_(force_path), codec_(codec) {}
   void OpenIndex(const std::string &path,
                  const std::string &unit_hash) override;
   void WriteHeader(const kythe::proto::CompilationUnit &header) override;
@@ -141,16 +167,18 @@ class KindexWriterSink : public IndexWriterSink {
   /// The file descriptor in use, opened in `OpenIndex` and closed in the dtor
   /// after `file_stream_` is destroyed. Owned by this object.
   int fd_ = -1;
-  /// Wraps `fd_`. Destroyed after `gzip_stream_`.
+  /// Wraps `fd_`. Destroyed after `compressed_stream_`.
   std::unique_ptr<google::protobuf::io::FileOutputStream> file_stream_;
   /// Wraps `file_stream_`. Destroyed after `coded_stream_`.
-  std::unique_ptr<google::protobuf::io::GzipOutputStream> gzip_stream_;
-  /// Wraps `gzip_stream_`. Destroyed first in the destructor.
+  std::unique_ptr<CompressingOutputStream> compressed_stream_;
+  /// Wraps `compressed_stream_`. Destroyed first in the destructor.
   std::unique_ptr<google::protobuf::io::CodedOutputStream> coded_stream_;
   /// The path to the file whose handle is held by `fd_`.
   std::string open_path_;
   /// If nonempty, the path to use.
   std::string force_path_;
+  /// The codec used to compress the file.
+  CompressionCodec codec_;
 };
 
 /// \brief Collects information about compilation arguments and targets and
@@ -165,20 +193,31 @@ class IndexWriter {
   void set_args(const std::vector<std::string> &args) { args_ = args; }
   /// \brief Configure the default corpus.
   void set_corpus(const std::string &corpus) { corpus_ = corpus; }
+  const std::string &corpus() const { return corpus_; }
   /// \brief Configure vname generation using some JSON string.
   /// \return true on success, false on failure
   bool SetVNameConfiguration(const std::string &json_string);
   /// \brief Configure where the indexer will output files.
   void set_output_directory(const std::string &dir) { output_directory_ = dir; }
+  const std::string &output_directory() const { return output_directory_; }
   /// \brief Configure the path used for the root.
   void set_root_directory(const std::string &dir) { root_directory_ = dir; }
   const std::string &root_directory() const { return root_directory_; }
+  /// \brief Use `cache` (which must outlive this object) to avoid rehashing
+  /// files that haven't changed since they were last extracted. May be null.
+  void set_digest_cache(FileDigestCache *cache) { digest_cache_ = cache; }
+  /// \brief Returns the SHA256 digest of `content`, which Clang read from
+  /// `file`.
+  std::string DigestFile(const clang::FileEntry *file, llvm::StringRef content);
   /// \brief Write the index file to `sink`, consuming the sink in the process.
-  void WriteIndex(
+  /// \param written_unit If non-null, receives a copy of the unit written.
+  /// \return false if the sink failed to write the index.
+  bool WriteIndex(
       std::unique_ptr<IndexWriterSink> sink,
       const std::string &main_source_file, const std::string &entry_context,
       const std::unordered_map<std::string, SourceFile> &source_files,
-      const HeaderSearchInfo &header_search_info, bool had_errors);
+      const HeaderSearchInfo &header_search_info, bool had_errors,
+      kythe::proto::CompilationUnit *written_unit = nullptr);
   /// \brief Set the fields of `file_input` for the given file.
   /// \param clang_path A path to the file as seen by clang.
   /// \param source_file The `SourceFile` to configure `file_input` with.
@@ -202,6 +241,8 @@ class IndexWriter {
   std::string output_directory_ = ".";
   /// The directory to use to generate relative paths.
   std::string root_directory_ = ".";
+  /// Digests of files we've seen before, or null.
+  FileDigestCache *digest_cache_ = nullptr;
 };
 
 /// \brief Creates a `FrontendAction` that records information about a
@@ -229,10 +270,31 @@ class ExtractorConfiguration {
   void SetVNameConfig(const std::string &path);
   /// \brief If a kindex file will be written, write it here.
   void SetKindexOutputFile(const std::string &path) { kindex_path_ = path; }
+  /// \brief Record extracted units in `dir` and skip extraction when the
+  /// unit recorded by an earlier run with the same configuration is still
+  /// current.
+  void SetIncrementalDirectory(const std::string &dir) {
+    incremental_directory_ = dir;
+  }
   /// \brief Execute the extractor with this configuration.
-  void Extract();
+  /// \return false if the extracted unit couldn't be written.
+  bool Extract();
 
  private:
+  /// \brief Returns a digest of everything besides the inputs themselves
+  /// that determines the unit we will write.
+  std::string ConfigurationDigest() const;
+  /// \brief Checks whether the unit recorded at `record_path` was written
+  /// with our arguments, whether all of its required inputs still have the
+  /// digests they had then, whether every path it looked for and didn't find
+  /// is still missing, and whether its output is still present (and, for a
+  /// fixed kindex path, still holds this unit).
+  bool RecordedUnitIsCurrent(const std::string &record_path);
+  /// \brief Finds the digest that the file Clang will see at `clang_path`
+  /// has now.
+  /// \return false if the file can't be read.
+  bool DigestCurrentInput(const std::string &clang_path, std::string *digest);
+
   /// The argument list to pass to Clang.
   std::vector<std::string> final_args_;
   /// The FileSystemOptions to use during extraction.
@@ -245,6 +307,14 @@ class ExtractorConfiguration {
   bool using_index_packs_ = false;
   /// If nonempty, emit kindex files to this exact path.
   std::string kindex_path_;
+  /// If nonempty, where to record units for incremental extraction.
+  std::string incremental_directory_;
+  /// The VName configuration we loaded, if any.
+  std::string vname_config_;
+  /// The codec used to compress kindex files and index pack entries.
+  CompressionCodec compression_codec_ = CompressionCodec::kGzip;
+  /// The cache of file digests shared with other extractors, if any.
+  std::unique_ptr<FileDigestCache> digest_cache_;
 };
 
 }  // namespace kythe
@@ -69,7 +69,7 @@ int main(int argc, char *argv[]) {
   config.SetKindexOutputFile(output_file);
   config.SetArgs(args);
   config.SetVNameConfig(vname_config);
-  config.Extract();
+  bool wrote_index = config.Extract();
   google::protobuf::ShutdownProtobufLibrary();
-  return 0;
+  return wrote_index ? 0 : 1;
 }
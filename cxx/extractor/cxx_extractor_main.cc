@@ -28,6 +28,29 @@
 // KYTHE_OUTPUT_DIRECTORY as an index pack. Instead of emitting kindex files,
 // it will instead follow the index pack protocol.
 //
+// KYTHE_COMPRESSION may be set to "gzip" (the default) or "snappy" to choose
+// how kindex files and index pack entries are compressed. Snappy output is
+// much cheaper for the C++ indexer to read, but only the C++ tools accept it.
+//
+// If KYTHE_DIGEST_CACHE is set, it names a file (created if necessary) that
+// remembers the digests of the files extractors have read, keyed by inode and
+// mtime. Extractors that run in the same build can share it to avoid rehashing
+// common headers. Because its digests are trusted, the cache is only used if
+// it belongs to the user running the extractor and no one else can write it.
+//
+// If KYTHE_INCREMENTAL_DIRECTORY is set, the extractor records each unit it
+// writes there. When it is later run from the same working directory with the
+// same arguments, KYTHE_* settings and header search variables (CPATH,
+// C_INCLUDE_PATH, CPLUS_INCLUDE_PATH, OBJC_INCLUDE_PATH, OBJCPLUS_INCLUDE_PATH
+// and SDKROOT), none of the files the recorded unit required have changed,
+// none of the paths that header search (including __has_include and
+// #include_next) looked for and didn't find have since been created, and its
+// output still exists, it exits without running the preprocessor. Other
+// environment variables are not considered.
+//
+// The extractor exits with a nonzero status if it couldn't write the unit it
+// extracted.
+//
 // If the first two arguments are --with_executable /foo/bar, the extractor
 // will consider /foo/bar to be the executable it was called as for purposes
 // of argument interpretation. These arguments are then stripped.
@@ -49,7 +72,7 @@ int main(int argc, char* argv[]) {
   kythe::ExtractorConfiguration config;
   config.SetArgs(args);
   config.InitializeFromEnvironment();
-  config.Extract();
+  bool wrote_index = config.Extract();
   google::protobuf::ShutdownProtobufLibrary();
-  return 0;
+  return wrote_index ? 0 : 1;
 }
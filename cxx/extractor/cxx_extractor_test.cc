@@ -16,12 +16,19 @@
 
 #include "cxx_extractor.h"
 
+#include <fcntl.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
 #include <map>
+#include <sstream>
 
 #include "clang/Frontend/FrontendActions.h"
 #include "clang/Tooling/Tooling.h"
 #include "glog/logging.h"
 #include "gtest/gtest.h"
+#include "kythe/cxx/common/compression.h"
 #include "kythe/proto/analysis.pb.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Path.h"
@@ -259,6 +266,39 @@ class CxxExtractorTest : public testing::Test {
     FillAndVerifyCompilationUnit(path, arguments, required_inputs, 1);
   }
 
+  /// \brief Returns the paths of the files in `directory` whose names end
+  /// with `suffix`, marking them for cleanup.
+  std::vector<std::string> FilesIn(const std::string &directory,
+                                   const std::string &suffix) {
+    std::vector<std::string> files;
+    std::error_code err;
+    for (llvm::sys::fs::directory_iterator file(directory, err), end;
+         !err && file != end; file.increment(err)) {
+      if (llvm::StringRef(file->path()).endswith(suffix)) {
+        files.push_back(file->path());
+        files_to_remove_.insert(file->path());
+      }
+    }
+    return files;
+  }
+
+  /// \brief Runs the extractor the way cxx_extractor does on `source` (a
+  /// path relative to the test root) with the extra `arguments`.
+  /// \param kindex_path If nonempty, the fixed path to write the kindex to.
+  void RunExtractor(const std::string &source,
+                    const std::vector<std::string> &arguments,
+                    const std::string &kindex_path) {
+    std::vector<std::string> args = {"clang++", "-c", GetRootedPath(source)};
+    args.insert(args.end(), arguments.begin(), arguments.end());
+    ExtractorConfiguration config;
+    config.SetArgs(args);
+    config.InitializeFromEnvironment();
+    if (!kindex_path.empty()) {
+      config.SetKindexOutputFile(kindex_path);
+    }
+    ASSERT_TRUE(config.Extract());
+  }
+
   /// Path to a directory for test files.
   llvm::SmallString<256> root_;
   /// Files to clean up after the test ends.
@@ -348,6 +388,153 @@ TEST_F(CxxExtractorTest, DoesNotBreakForCompilerErrors) {
   FillAndVerifyCompilationUnit("b.cc", {}, {"./b.h", "b.cc"});
 }
 
+/// \brief Runs the extractor with KYTHE_INCREMENTAL_DIRECTORY set.
+class CxxExtractorIncrementalTest : public CxxExtractorTest {
+ protected:
+  CxxExtractorIncrementalTest()
+      : output_directory_(GetRootedPath("out")),
+        record_directory_(GetRootedPath("record")) {
+    UndoableCreateDirectories(output_directory_);
+    UndoableCreateDirectories(record_directory_);
+    AddSourceFile("inc.cc", "#include \"inc.h\"\nint main() { return x; }\n");
+    AddSourceFile("inc.h", "int x;\n");
+    setenv("KYTHE_OUTPUT_DIRECTORY", output_directory_.c_str(), 1);
+    setenv("KYTHE_INCREMENTAL_DIRECTORY", record_directory_.c_str(), 1);
+  }
+
+  ~CxxExtractorIncrementalTest() {
+    unsetenv("KYTHE_OUTPUT_DIRECTORY");
+    unsetenv("KYTHE_INCREMENTAL_DIRECTORY");
+    unsetenv("CPATH");
+    // Mark whatever the extractor wrote for cleanup.
+    FilesIn(output_directory_, "");
+    FilesIn(record_directory_, "");
+  }
+
+  /// \brief Runs the extractor on inc.cc with the extra `arguments`.
+  /// \return true if it wrote a kindex file to the output directory; false
+  /// if it skipped extraction.
+  bool Extracts(const std::vector<std::string> &arguments) {
+    // An earlier unit's kindex only has to exist for extraction to be
+    // skipped, so overwrite each one to see whether it's written again.
+    for (const auto &kindex : FilesIn(output_directory_, ".kindex")) {
+      std::ofstream(kindex) << "stale";
+    }
+    RunExtractor("inc.cc", arguments, "");
+    for (const auto &kindex : FilesIn(output_directory_, ".kindex")) {
+      std::stringstream content;
+      content << std::ifstream(kindex).rdbuf();
+      if (content.str() != "stale") {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// \brief Reads the unit at the start of the kindex file at `path`.
+  kythe::proto::CompilationUnit ReadKindexUnit(const std::string &path) {
+    using namespace google::protobuf::io;
+    kythe::proto::CompilationUnit unit;
+    int fd = open(path.c_str(), O_RDONLY);
+    EXPECT_GE(fd, 0) << path;
+    {
+      FileInputStream file_stream(fd);
+      auto decompressed_stream = NewDecompressingInputStream(&file_stream);
+      CodedInputStream coded_stream(decompressed_stream.get());
+      google::protobuf::uint32 byte_size;
+      EXPECT_TRUE(coded_stream.ReadVarint32(&byte_size));
+      auto limit = coded_stream.PushLimit(byte_size);
+      EXPECT_TRUE(unit.ParseFromCodedStream(&coded_stream));
+      coded_stream.PopLimit(limit);
+    }
+    close(fd);
+    return unit;
+  }
+
+  /// \brief Returns true if `unit` was extracted with `argument`.
+  static bool HasArgument(const kythe::proto::CompilationUnit &unit,
+                          const std::string &argument) {
+    return std::find(unit.argument().begin(), unit.argument().end(),
+                     argument) != unit.argument().end();
+  }
+
+  /// Where kindex files are written.
+  std::string output_directory_;
+  /// Where units are recorded.
+  std::string record_directory_;
+};
+
+TEST_F(CxxExtractorIncrementalTest, SkipsUnchangedUnit) {
+  EXPECT_TRUE(Extracts({}));
+  EXPECT_FALSE(Extracts({}));
+  EXPECT_EQ(1, FilesIn(record_directory_, ".kunit").size());
+}
+
+TEST_F(CxxExtractorIncrementalTest, ExtractsChangedInput) {
+  EXPECT_TRUE(Extracts({}));
+  AddSourceFile("inc.h", "int x = 1;\n");
+  EXPECT_TRUE(Extracts({}));
+  EXPECT_FALSE(Extracts({}));
+}
+
+TEST_F(CxxExtractorIncrementalTest, ExtractsChangedArguments) {
+  EXPECT_TRUE(Extracts({}));
+  EXPECT_TRUE(Extracts({"-DCHANGED"}));
+  EXPECT_FALSE(Extracts({"-DCHANGED"}));
+  EXPECT_EQ(2, FilesIn(record_directory_, ".kunit").size());
+}
+
+TEST_F(CxxExtractorIncrementalTest, ExtractsDeletedKindex) {
+  EXPECT_TRUE(Extracts({}));
+  for (const auto &kindex : FilesIn(output_directory_, ".kindex")) {
+    ASSERT_EQ(0, unlink(kindex.c_str()));
+  }
+  EXPECT_TRUE(Extracts({}));
+  EXPECT_EQ(1, FilesIn(output_directory_, ".kindex").size());
+}
+
+TEST_F(CxxExtractorIncrementalTest, ExtractsChangedHeaderSearchEnvironment) {
+  EXPECT_TRUE(Extracts({}));
+  setenv("CPATH", GetRootedPath("nowhere").c_str(), 1);
+  EXPECT_TRUE(Extracts({}));
+  EXPECT_FALSE(Extracts({}));
+}
+
+TEST_F(CxxExtractorIncrementalTest, ExtractsShadowingHeader) {
+  AddSourceFile("inc.cc", "#include <shadow.h>\nint main() { return x; }\n");
+  AddSourceFile("late/shadow.h", "int x;\n");
+  std::vector<std::string> args = {"-I" + GetRootedPath("early"),
+                                   "-I" + GetRootedPath("late")};
+  EXPECT_TRUE(Extracts(args));
+  EXPECT_FALSE(Extracts(args));
+  AddSourceFile("early/shadow.h", "int x = 1;\n");
+  EXPECT_TRUE(Extracts(args));
+  EXPECT_FALSE(Extracts(args));
+}
+
+TEST_F(CxxExtractorIncrementalTest, ExtractsChangedHasInclude) {
+  AddSourceFile("inc.cc",
+                "#if __has_include(\"new.h\")\n#include \"new.h\"\n#endif\n"
+                "int main() { return 0; }\n");
+  EXPECT_TRUE(Extracts({}));
+  EXPECT_FALSE(Extracts({}));
+  AddSourceFile("new.h", "int x;\n");
+  EXPECT_TRUE(Extracts({}));
+  EXPECT_FALSE(Extracts({}));
+}
+
+TEST_F(CxxExtractorIncrementalTest, ChecksWhichUnitIsInFixedKindex) {
+  std::string kindex_path = GetRootedPath("fixed.kindex");
+  files_to_remove_.insert(kindex_path);
+  RunExtractor("inc.cc", {"-DFIRST"}, kindex_path);
+  EXPECT_TRUE(HasArgument(ReadKindexUnit(kindex_path), "-DFIRST"));
+  RunExtractor("inc.cc", {"-DSECOND"}, kindex_path);
+  EXPECT_TRUE(HasArgument(ReadKindexUnit(kindex_path), "-DSECOND"));
+  // The first unit is recorded as current, but its kindex was overwritten.
+  RunExtractor("inc.cc", {"-DFIRST"}, kindex_path);
+  EXPECT_TRUE(HasArgument(ReadKindexUnit(kindex_path), "-DFIRST"));
+}
+
 }  // anonymous namespace
 }  // namespace kythe
 
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DeduplicatingOutputStream.h"
+
+#include <string.h>
+
+namespace kythe {
+
+namespace {
+
+uint64_t RotateLeft(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t FinalMix(uint64_t value) {
+  value ^= value >> 33;
+  value *= 0xff51afd7ed558ccdULL;
+  value ^= value >> 33;
+  value *= 0xc4ceb9fe1a85ec53ULL;
+  value ^= value >> 33;
+  return value;
+}
+
+/// \brief Computes the 128-bit MurmurHash3 (x64 variant) of `data`.
+///
+/// Fingerprints never leave the process, so this needs to be fast and well
+/// distributed, not cryptographic or stable across platforms.
+void MurmurHash3(const std::string &data, uint64_t *high, uint64_t *low) {
+  const uint64_t c1 = 0x87c37b91114253d5ULL;
+  const uint64_t c2 = 0x4cf5ad432745937fULL;
+  const char *bytes = data.data();
+  const size_t size = data.size();
+  const size_t block_count = size / 16;
+  uint64_t h1 = 0;
+  uint64_t h2 = 0;
+  for (size_t block = 0; block < block_count; ++block) {
+    uint64_t k1, k2;
+    ::memcpy(&k1, bytes + block * 16, sizeof(k1));
+    ::memcpy(&k2, bytes + block * 16 + 8, sizeof(k2));
+    k1 *= c1;
+    k1 = RotateLeft(k1, 31);
+    k1 *= c2;
+    h1 ^= k1;
+    h1 = RotateLeft(h1, 27);
+    h1 += h2;
+    h1 = h1 * 5 + 0x52dce729;
+    k2 *= c2;
+    k2 = RotateLeft(k2, 33);
+    k2 *= c1;
+    h2 ^= k2;
+    h2 = RotateLeft(h2, 31);
+    h2 += h1;
+    h2 = h2 * 5 + 0x38495ab5;
+  }
+  const unsigned char *tail =
+      reinterpret_cast<const unsigned char *>(bytes + block_count * 16);
+  uint64_t k1 = 0;
+  uint64_t k2 = 0;
+  switch (size & 15) {
+    case 15: k2 ^= static_cast<uint64_t>(tail[14]) << 48;
+    case 14: k2 ^= static_cast<uint64_t>(tail[13]) << 40;
+    case 13: k2 ^= static_cast<uint64_t>(tail[12]) << 32;
+    case 12: k2 ^= static_cast<uint64_t>(tail[11]) << 24;
+    case 11: k2 ^= static_cast<uint64_t>(tail[10]) << 16;
+    case 10: k2 ^= static_cast<uint64_t>(tail[9]) << 8;
+    case 9:
+      k2 ^= static_cast<uint64_t>(tail[8]);
+      k2 *= c2;
+      k2 = RotateLeft(k2, 33);
+      k2 *= c1;
+      h2 ^= k2;
+    case 8: k1 ^= static_cast<uint64_t>(tail[7]) << 56;
+    case 7: k1 ^= static_cast<uint64_t>(tail[6]) << 48;
+    case 6: k1 ^= static_cast<uint64_t>(tail[5]) << 40;
+    case 5: k1 ^= static_cast<uint64_t>(tail[4]) << 32;
+    case 4: k1 ^= static_cast<uint64_t>(tail[3]) << 24;
+    case 3: k1 ^= static_cast<uint64_t>(tail[2]) << 16;
+    case 2: k1 ^= static_cast<uint64_t>(tail[1]) << 8;
+    case 1:
+      k1 ^= static_cast<uint64_t>(tail[0]);
+      k1 *= c1;
+      k1 = RotateLeft(k1, 31);
+      k1 *= c2;
+      h1 ^= k1;
+  }
+  h1 ^= size;
+  h2 ^= size;
+  h1 += h2;
+  h2 += h1;
+  h1 = FinalMix(h1);
+  h2 = FinalMix(h2);
+  h1 += h2;
+  h2 += h1;
+  *high = h2;
+  *low = h1;
+}
+
+}  // anonymous namespace
+
+void DeduplicatingOutputStream::Emit(const kythe::proto::Entry &entry) {
+  if (generation_size_ == 0) {
+    ++entries_seen_;
+    stream_->Emit(entry);
+    return;
+  }
+  // Serialize once; the same bytes are fingerprinted and then written.
+  serialized_entry_.clear();
+  entry.AppendToString(&serialized_entry_);
+  EmitSerialized(entry, serialized_entry_);
+}
+
+void DeduplicatingOutputStream::EmitSerialized(const kythe::proto::Entry &entry,
+                                               const std::string &serialized) {
+  ++entries_seen_;
+  if (generation_size_ == 0) {
+    stream_->EmitSerialized(entry, serialized);
+    return;
+  }
+  Fingerprint fingerprint;
+  MurmurHash3(serialized, &fingerprint.high, &fingerprint.low);
+  if (SeenBefore(fingerprint)) {
+    ++entries_dropped_;
+    return;
+  }
+  stream_->EmitSerialized(entry, serialized);
+}
+bool DeduplicatingOutputStream::SeenBefore(const Fingerprint &fingerprint) {
+  if (current_generation_.count(fingerprint)) {
+    return true;
+  }
+  bool seen = previous_generation_.count(fingerprint) != 0;
+  current_generation_.insert(fingerprint);
+  if (current_generation_.size() >= generation_size_) {
+    previous_generation_.swap(current_generation_);
+    current_generation_.clear();
+  }
+  return seen;
+}
+
+}  // namespace kythe
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_INDEXER_CXX_DEDUPLICATING_OUTPUT_STREAM_H_
+#define KYTHE_CXX_INDEXER_CXX_DEDUPLICATING_OUTPUT_STREAM_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <unordered_set>
+
+#include "KytheOutputStream.h"
+
+namespace kythe {
+
+/// \brief A `KytheOutputStream` that drops entries it has recently seen before
+/// passing the rest on to another `KytheOutputStream`.
+///
+/// Entries are identified by a 128-bit fingerprint of their wire format.
+/// Fingerprints are kept in two generations of at most `generation_size`
+/// elements each. When the current generation fills, it replaces the previous
+/// one (whose fingerprints are forgotten); fingerprints found in the previous
+/// generation are promoted to the current one. Memory use is therefore
+/// bounded, at the cost of letting through some duplicates that are far apart
+/// in the stream.
+class DeduplicatingOutputStream : public KytheOutputStream {
+ public:
+  /// \param stream The stream to which unique entries are forwarded. Not
+  /// owned.
+  /// \param generation_size The maximum number of fingerprints to keep in
+  /// each generation. If 0, every entry is forwarded without being
+  /// fingerprinted.
+  DeduplicatingOutputStream(KytheOutputStream *stream, size_t generation_size)
+      : stream_(stream), generation_size_(generation_size) {}
+
+  void Emit(const kythe::proto::Entry &entry) override;
+
+  void EmitSerialized(const kythe::proto::Entry &entry,
+                      const std::string &serialized) override;
+
+  /// \brief The number of entries passed to `Emit` or `EmitSerialized`.
+  size_t entries_seen() const { return entries_seen_; }
+
+  /// \brief The number of entries that were dropped as duplicates.
+  size_t entries_dropped() const { return entries_dropped_; }
+
+  /// \brief Returns `entries_dropped() / entries_seen()`, or 0 if no entries
+  /// have been seen.
+  double dedup_ratio() const {
+    return entries_seen_ == 0
+               ? 0.0
+               : static_cast<double>(entries_dropped_) / entries_seen_;
+  }
+
+ private:
+  /// \brief A 128-bit fingerprint of a serialized entry.
+  struct Fingerprint {
+    uint64_t high;
+    uint64_t low;
+    bool operator==(const Fingerprint &other) const {
+      return high == other.high && low == other.low;
+    }
+  };
+
+  /// \brief Hashes fingerprints (which are already well-distributed).
+  struct FingerprintHash {
+    size_t operator()(const Fingerprint &fingerprint) const {
+      return static_cast<size_t>(fingerprint.low);
+    }
+  };
+
+  using FingerprintSet = std::unordered_set<Fingerprint, FingerprintHash>;
+
+  /// \brief Records `fingerprint` and returns whether it was already known.
+  bool SeenBefore(const Fingerprint &fingerprint);
+
+  /// The stream to which unique entries are forwarded.
+  KytheOutputStream *stream_;
+  /// The maximum size of each generation.
+  size_t generation_size_;
+  /// Fingerprints recorded in the current generation.
+  FingerprintSet current_generation_;
+  /// Fingerprints recorded in the previous generation.
+  FingerprintSet previous_generation_;
+  /// Scratch space for serializing entries.
+  std::string serialized_entry_;
+  /// The number of entries passed to `Emit` or `EmitSerialized`.
+  size_t entries_seen_ = 0;
+  /// The number of entries dropped as duplicates.
+  size_t entries_dropped_ = 0;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_DEDUPLICATING_OUTPUT_STREAM_H_
@@ -84,21 +84,38 @@ StackSizeRestorer<StackType> RestoreStack(StackType &S) {
   return StackSizeRestorer<StackType>(S);
 }
 
-void IndexerASTVisitor::deleteAllParents() {
-  if (!AllParents) {
-    return;
-  }
-  for (const auto &Entry : *AllParents) {
-    if (Entry.second.is<IndexedParentVector *>()) {
-      delete Entry.second.get<IndexedParentVector *>();
-    } else {
-      delete Entry.second.get<IndexedParent *>();
+void IndexedParentMap::build(const std::vector<Edge> &Edges) {
+  // Count each child's edges, then lay the children out back to back.
+  Runs.reserve(Edges.size());
+  for (const auto &E : Edges) {
+    auto Inserted = Runs.insert(std::make_pair(E.Child, Run{0, 0}));
+    ++Inserted.first->second.Count;
+  }
+  unsigned Next = 0;
+  for (auto &R : Runs) {
+    R.second.Begin = Next;
+    Next += R.second.Count;
+    R.second.Count = 0;
+  }
+  Parents.resize(Next);
+  for (const auto &E : Edges) {
+    Run &R = Runs.find(E.Child)->second;
+    auto *First = Parents.data() + R.Begin;
+    auto *Last = First + R.Count;
+    // Skip duplicates for types that have memoization data.
+    // We must check that the type has memoization data before calling
+    // std::find() because DynTypedNode::operator== can't compare all
+    // types.
+    if (R.Count != 0 && E.Parent.Parent.getMemoizationData() &&
+        std::find(First, Last, E.Parent) != Last) {
+      continue;
     }
+    *Last = E.Parent;
+    ++R.Count;
   }
-  AllParents.reset(nullptr);
 }
 
-IndexedParentVector IndexerASTVisitor::getIndexedParents(
+llvm::ArrayRef<IndexedParent> IndexerASTVisitor::getIndexedParents(
     const ast_type_traits::DynTypedNode &Node) {
   assert(Node.getMemoizationData() &&
          "Invariant broken: only nodes that support memoization may be "
@@ -110,16 +127,7 @@ IndexedParentVector IndexerASTVisitor::getIndexedParents(
     AllParents =
         IndexedParentASTVisitor::buildMap(*Context.getTranslationUnitDecl());
   }
-  IndexedParentMap::const_iterator I =
-      AllParents->find(Node.getMemoizationData());
-  if (I == AllParents->end()) {
-    return IndexedParentVector();
-  }
-  if (I->second.is<IndexedParent *>()) {
-    return IndexedParentVector(1, *I->second.get<IndexedParent *>());
-  }
-  const auto &Parents = *I->second.get<IndexedParentVector *>();
-  return IndexedParentVector(Parents.begin(), Parents.end());
+  return AllParents->getParents(Node.getMemoizationData());
 }
 
 bool IndexerASTVisitor::IsDefinition(const clang::VarDecl *VD) {
@@ -1255,6 +1263,19 @@ bool IndexerASTVisitor::AddNameToStream(llvm::raw_string_ostream &Ostream,
 
 GraphObserver::NameId
 IndexerASTVisitor::BuildNameIdForDecl(const clang::Decl *Decl) {
+  auto Cached = DeclNameIds.find(Decl);
+  if (Cached != DeclNameIds.end()) {
+    ++CacheStats.NameIdHits;
+    return Cached->second;
+  }
+  ++CacheStats.NameIdMisses;
+  GraphObserver::NameId Id(ComputeNameIdForDecl(Decl));
+  DeclNameIds.insert(std::make_pair(Decl, Id));
+  return Id;
+}
+
+GraphObserver::NameId
+IndexerASTVisitor::ComputeNameIdForDecl(const clang::Decl *Decl) {
   GraphObserver::NameId Id;
   Id.EqClass = BuildNameEqClassForDecl(Decl);
   // Cons onto the end of the name instead of the beginning to optimize for
@@ -1271,7 +1292,7 @@ IndexerASTVisitor::BuildNameIdForDecl(const clang::Decl *Decl) {
     // NestedNameSpecifier return memoization data. Can we claim an invariant
     // that if we start at any Decl, we will always encounter nodes with
     // memoization data?
-    IndexedParentVector IPV = getIndexedParents(CurrentNode);
+    llvm::ArrayRef<IndexedParent> IPV = getIndexedParents(CurrentNode);
     if (IPV.empty()) {
       // Make sure that we don't miss out on implicit nodes.
       if (CurrentNodeAsDecl && CurrentNodeAsDecl->isImplicit()) {
@@ -1280,7 +1301,7 @@ IndexerASTVisitor::BuildNameIdForDecl(const clang::Decl *Decl) {
             if (const DeclContext *DC = ND->getDeclContext()) {
               if (DC->isFunctionOrMethod()) {
                 // Heroically try to come up with a disambiguating identifier,
-                // even when the IndexedParentVector is empty. This can happen
+                // even when the list of parents is empty. This can happen
                 // in anonymous parameter declarations that belong to function
                 // prototypes.
                 const clang::FunctionDecl *FD =
@@ -1303,7 +1324,7 @@ IndexerASTVisitor::BuildNameIdForDecl(const clang::Decl *Decl) {
       break;
     }
     // Pick the first path we took to get to this node.
-    IndexedParent IP = IPV[0];
+    const IndexedParent &IP = IPV[0];
     // We would rather name 'template <etc> class C' as C, not C::C, but
     // we also want to be able to give useful names to templates when they're
     // explicitly requested. Therefore:
@@ -1320,7 +1341,6 @@ IndexerASTVisitor::BuildNameIdForDecl(const clang::Decl *Decl) {
     if (CurrentNodeAsDecl) {
       // TODO(zarko): check for other specializations and emit accordingly
       // Alternately, maybe it would be better to just always emit the hash?
-      // At any rate, a hash cache might be a good idea.
       if (const NamedDecl *ND = dyn_cast<NamedDecl>(CurrentNodeAsDecl)) {
         if (!AddNameToStream(Ostream, ND)) {
           Ostream << IP.Index;
@@ -1362,10 +1382,80 @@ IndexerASTVisitor::BuildNameIdForDecl(const clang::Decl *Decl) {
   return Id;
 }
 
+/// \brief Hashes `Text` with 64-bit FNV-1a, continuing from `Hash`.
+///
+/// Semantic hashes become part of NodeIds that must agree between
+/// translation units and indexer runs, so this must not depend on the
+/// process, the standard library or the LLVM version (as `llvm::hash_value`
+/// and `std::hash` do).
+static uint64_t HashText(llvm::StringRef Text,
+                         uint64_t Hash = 0xcbf29ce484222325ULL) {
+  for (unsigned char C : Text) {
+    Hash ^= C;
+    Hash *= 0x100000001b3ULL;
+  }
+  return Hash;
+}
+
+/// \brief Mixes the 64-bit `Value` into `Hash` with FNV-1a, one byte at a
+/// time from least to most significant.
+static uint64_t HashValue(uint64_t Value,
+                          uint64_t Hash = 0xcbf29ce484222325ULL) {
+  for (size_t Byte = 0; Byte < sizeof(Value); ++Byte) {
+    Hash ^= (Value >> (Byte * CHAR_BIT)) & 0xff;
+    Hash *= 0x100000001b3ULL;
+  }
+  return Hash;
+}
+
+/// \brief Mixes the parts of `Id` into `Hash`.
+static uint64_t HashNameId(const GraphObserver::NameId &Id,
+                           uint64_t Hash = 0xcbf29ce484222325ULL) {
+  const char EqClass = static_cast<char>(Id.EqClass);
+  return HashText(Id.Path, HashText(llvm::StringRef(&EqClass, 1), Hash));
+}
+
+/// \brief Returns the value cached for `Key` in `Cache`, computing it with
+/// `Compute` and storing it on a miss.
+template <typename Computer>
+static uint64_t MemoizeHash(llvm::DenseMap<const void *, uint64_t> &Cache,
+                            const void *Key, Computer Compute) {
+  auto Cached = Cache.find(Key);
+  if (Cached != Cache.end()) {
+    return Cached->second;
+  }
+  // Compute may recurse and grow the map, invalidating `Cached`.
+  uint64_t Hash = Compute();
+  Cache.insert(std::make_pair(Key, Hash));
+  return Hash;
+}
+
+/// \brief Returns true if `SemanticHash(TN)` can hash `TN` structurally.
+static bool HasStructuralHash(const clang::TemplateName &TN) {
+  return TN.getKind() == TemplateName::Template;
+}
+
+/// \brief Returns true if `SemanticHash(TA)` can hash `TA` structurally.
+static bool HasStructuralHash(const clang::TemplateArgument &TA) {
+  switch (TA.getKind()) {
+  case TemplateArgument::Null:
+  case TemplateArgument::Type:
+  case TemplateArgument::Integral:
+    return true;
+  case TemplateArgument::Template:
+    return HasStructuralHash(TA.getAsTemplate());
+  default:
+    return false;
+  }
+}
+
 template <typename TemplateDeclish>
 uint64_t
 IndexerASTVisitor::SemanticHashTemplateDeclish(const TemplateDeclish *Decl) {
-  return std::hash<std::string>()(BuildNameIdForDecl(Decl).ToString());
+  return MemoizeHash(TemplateDeclishHashes, Decl, [this, Decl]() {
+    // Hash the parts of the name instead of its printed form.
+    return HashNameId(BuildNameIdForDecl(Decl));
+  });
 }
 
 uint64_t IndexerASTVisitor::SemanticHash(const clang::TemplateName &TN) {
@@ -1411,7 +1501,7 @@ uint64_t IndexerASTVisitor::SemanticHash(const clang::TemplateArgument &TA) {
     if (Val.getMinSignedBits() <= sizeof(uint64_t) * CHAR_BIT) {
       return static_cast<uint64_t>(Val.getExtValue());
     } else {
-      return std::hash<std::string>()(Val.toString(10));
+      return HashText(Val.toString(10));
     }
   }
   case TemplateArgument::Template:
@@ -1433,30 +1523,168 @@ uint64_t IndexerASTVisitor::SemanticHash(const clang::TemplateArgument &TA) {
 
 uint64_t IndexerASTVisitor::SemanticHash(const clang::QualType &T) {
   QualType CQT(T.getCanonicalType());
-  return std::hash<std::string>()(CQT.getAsString());
+  // Canonical types are uniqued, so every spelling of the same type shares
+  // one entry.
+  return MemoizeHash(TypeHashes, CQT.getAsOpaquePtr(),
+                     [this, &CQT]() { return ComputeSemanticHash(CQT); });
+}
+
+uint64_t IndexerASTVisitor::ComputeSemanticHash(const clang::QualType &CQT) {
+  SplitQualType Split = CQT.split();
+  const clang::Type *Ty = Split.Ty;
+  // Hash spellings rather than clang's enumerators, whose values change
+  // between LLVM versions.
+  uint64_t Hash =
+      HashText(Split.Quals.getAsString(), HashText(Ty->getTypeClassName()));
+  // Component types are already canonical, so they are hashed (and cached)
+  // on their own rather than through this type's entry.
+  switch (Ty->getTypeClass()) {
+  case clang::Type::Builtin: {
+    // Use a fixed policy so that (e.g.) bool is spelled the same way in C
+    // and C++ translation units.
+    clang::LangOptions DefaultLangOpts;
+    clang::PrintingPolicy DefaultPolicy(DefaultLangOpts);
+    return HashText(cast<BuiltinType>(Ty)->getName(DefaultPolicy), Hash);
+  }
+  case clang::Type::Complex:
+    return HashValue(SemanticHash(cast<ComplexType>(Ty)->getElementType()),
+                     Hash);
+  case clang::Type::Pointer:
+    return HashValue(SemanticHash(cast<PointerType>(Ty)->getPointeeType()),
+                     Hash);
+  case clang::Type::BlockPointer:
+    return HashValue(
+        SemanticHash(cast<BlockPointerType>(Ty)->getPointeeType()), Hash);
+  case clang::Type::LValueReference:
+  case clang::Type::RValueReference:
+    return HashValue(SemanticHash(cast<ReferenceType>(Ty)->getPointeeType()),
+                     Hash);
+  case clang::Type::MemberPointer: {
+    const auto *MPT = cast<MemberPointerType>(Ty);
+    Hash = HashValue(SemanticHash(MPT->getPointeeType()), Hash);
+    return HashValue(SemanticHash(QualType(MPT->getClass(), 0)), Hash);
+  }
+  case clang::Type::ConstantArray: {
+    const auto *CAT = cast<ConstantArrayType>(Ty);
+    Hash = HashValue(SemanticHash(CAT->getElementType()), Hash);
+    return HashValue(CAT->getSize().getLimitedValue(), Hash);
+  }
+  case clang::Type::IncompleteArray:
+  case clang::Type::VariableArray:
+  case clang::Type::DependentSizedArray:
+    return HashValue(SemanticHash(cast<ArrayType>(Ty)->getElementType()),
+                     Hash);
+  case clang::Type::Vector:
+  case clang::Type::ExtVector: {
+    const auto *VT = cast<VectorType>(Ty);
+    Hash = HashValue(SemanticHash(VT->getElementType()), Hash);
+    return HashValue(VT->getNumElements(), Hash);
+  }
+  case clang::Type::FunctionNoProto:
+    return HashValue(
+        SemanticHash(cast<FunctionNoProtoType>(Ty)->getReturnType()), Hash);
+  case clang::Type::FunctionProto: {
+    const auto *FPT = cast<FunctionProtoType>(Ty);
+    Hash = HashValue(SemanticHash(FPT->getReturnType()), Hash);
+    for (const auto &Param : FPT->getParamTypes()) {
+      Hash = HashValue(SemanticHash(Param), Hash);
+    }
+    Hash = HashValue(FPT->isVariadic(), Hash);
+    Hash = HashText(
+        clang::Qualifiers::fromCVRMask(FPT->getTypeQuals()).getAsString(),
+        Hash);
+    switch (FPT->getRefQualifier()) {
+    case clang::RQ_LValue:
+      return HashText("&", Hash);
+    case clang::RQ_RValue:
+      return HashText("&&", Hash);
+    default:
+      return Hash;
+    }
+  }
+  case clang::Type::Record: {
+    const auto *RD = cast<RecordType>(Ty)->getDecl();
+    if (const auto *CTSD = dyn_cast<ClassTemplateSpecializationDecl>(RD)) {
+      // ComputeSemanticHash(RecordDecl) hashes a specialization by its type,
+      // so hash its template and arguments here instead of the record.
+      Hash = HashValue(
+          SemanticHashTemplateDeclish(CTSD->getSpecializedTemplate()), Hash);
+      return HashValue(SemanticHash(&CTSD->getTemplateArgs()), Hash);
+    }
+    // The member hash alone can't tell apart records with the same shape
+    // in different scopes (or anonymous ones), so mix in the qualified name.
+    return HashValue(SemanticHash(RD),
+                     HashNameId(BuildNameIdForDecl(RD), Hash));
+  }
+  case clang::Type::Enum: {
+    const auto *ED = cast<EnumType>(Ty)->getDecl();
+    return HashValue(SemanticHash(ED),
+                     HashNameId(BuildNameIdForDecl(ED), Hash));
+  }
+  case clang::Type::TemplateTypeParm: {
+    const auto *TTPT = cast<TemplateTypeParmType>(Ty);
+    Hash = HashValue(TTPT->getDepth(), Hash);
+    Hash = HashValue(TTPT->getIndex(), Hash);
+    return HashValue(TTPT->isParameterPack(), Hash);
+  }
+  case clang::Type::TemplateSpecialization: {
+    const auto *TST = cast<TemplateSpecializationType>(Ty);
+    // Dependent template names and declaration, nullptr or expression
+    // arguments have no structural hash yet; use the printed form instead
+    // of asserting (or hashing them all to 0).
+    bool Structural = HasStructuralHash(TST->getTemplateName());
+    for (unsigned A = 0, AE = TST->getNumArgs(); Structural && A != AE; ++A) {
+      Structural = HasStructuralHash(TST->getArg(A));
+    }
+    if (!Structural) {
+      return HashText(CQT.getAsString(), Hash);
+    }
+    Hash = HashValue(SemanticHash(TST->getTemplateName()), Hash);
+    for (unsigned A = 0, AE = TST->getNumArgs(); A != AE; ++A) {
+      Hash = HashValue(SemanticHash(TST->getArg(A)), Hash);
+    }
+    return Hash;
+  }
+  case clang::Type::Atomic:
+    return HashValue(SemanticHash(cast<AtomicType>(Ty)->getValueType()),
+                     Hash);
+  default:
+    // Dependent names, Objective-C types and the like are rare enough in
+    // NodeIds that their printed form is still a reasonable stand-in.
+    return HashText(CQT.getAsString(), Hash);
+  }
 }
 
 uint64_t IndexerASTVisitor::SemanticHash(const clang::EnumDecl *ED) {
-  // TODO(zarko): Do we need a better hash function?
-  uint64_t hash = 0;
-  for (auto E : ED->enumerators()) {
-    if (E->getDeclName().isIdentifier()) {
-      hash ^= std::hash<std::string>()(E->getName());
+  return MemoizeHash(DeclHashes, ED, [ED]() {
+    // TODO(zarko): Do we need a better hash function?
+    uint64_t hash = 0;
+    for (auto E : ED->enumerators()) {
+      if (E->getDeclName().isIdentifier()) {
+        hash ^= HashText(E->getName());
+      }
     }
-  }
-  return hash;
+    return hash;
+  });
 }
 
 uint64_t
 IndexerASTVisitor::SemanticHash(const clang::TemplateArgumentList *RD) {
-  uint64_t hash = 0;
-  for (const auto &A : RD->asArray()) {
-    hash ^= SemanticHash(A);
-  }
-  return hash;
+  return MemoizeHash(TemplateArgumentListHashes, RD, [this, RD]() {
+    uint64_t hash = 0;
+    for (const auto &A : RD->asArray()) {
+      hash ^= SemanticHash(A);
+    }
+    return hash;
+  });
 }
 
 uint64_t IndexerASTVisitor::SemanticHash(const clang::RecordDecl *RD) {
+  return MemoizeHash(DeclHashes, RD,
+                     [this, RD]() { return ComputeSemanticHash(RD); });
+}
+
+uint64_t IndexerASTVisitor::ComputeSemanticHash(const clang::RecordDecl *RD) {
   // TODO(zarko): Do we need a better hash function? We may need to
   // hash the type variable context all the way up to the root template.
   uint64_t hash = 0;
@@ -1471,7 +1699,7 @@ uint64_t IndexerASTVisitor::SemanticHash(const clang::RecordDecl *RD) {
     }
     if (const auto *ND = dyn_cast<NamedDecl>(D)) {
       if (ND->getDeclName().isIdentifier()) {
-        hash ^= std::hash<std::string>()(ND->getName());
+        hash ^= HashText(ND->getName());
       }
     }
   }
@@ -1503,11 +1731,11 @@ IndexerASTVisitor::BuildNodeIdForCallableDecl(const clang::Decl *Decl) {
     const clang::Decl *CurrentNodeAsDecl;
     while (!(CurrentNodeAsDecl = CurrentNode.get<clang::Decl>()) ||
            !isa<clang::TranslationUnitDecl>(CurrentNodeAsDecl)) {
-      IndexedParentVector IPV = getIndexedParents(CurrentNode);
+      llvm::ArrayRef<IndexedParent> IPV = getIndexedParents(CurrentNode);
       if (IPV.empty()) {
         break;
       }
-      IndexedParent IP = IPV[0];
+      const IndexedParent &IP = IPV[0];
       CurrentNode = IP.Parent;
       if (!CurrentNodeAsDecl) {
         continue;
@@ -1548,6 +1776,25 @@ IndexerASTVisitor::BuildNodeIdForDecl(const clang::Decl *Decl, unsigned Index) {
 
 GraphObserver::NodeId
 IndexerASTVisitor::BuildNodeIdForDecl(const clang::Decl *Decl) {
+  // Look the token up first: it's cheap compared to walking the parent chain,
+  // and it keeps us honest if the claim state shifts underneath us.
+  const auto Key = std::make_pair(
+      Decl, Observer.getClaimTokenForLocation(Decl->getLocation()));
+  auto Cached = DeclNodeIds.find(Key);
+  if (Cached != DeclNodeIds.end()) {
+    ++CacheStats.NodeIdHits;
+    return Cached->second;
+  }
+  ++CacheStats.NodeIdMisses;
+  // Don't hold on to an iterator here; ComputeNodeIdForDecl may recurse and
+  // grow the map.
+  GraphObserver::NodeId Id(ComputeNodeIdForDecl(Decl));
+  DeclNodeIds.insert(std::make_pair(Key, Id));
+  return Id;
+}
+
+GraphObserver::NodeId
+IndexerASTVisitor::ComputeNodeIdForDecl(const clang::Decl *Decl) {
   // We can't assume that no two nodes of the same Kind can appear
   // simultaneously at the same SourceLocation: witness implicit overloaded
   // operator=. We rely on names and types to disambiguate them.
@@ -1576,11 +1823,11 @@ IndexerASTVisitor::BuildNodeIdForDecl(const clang::Decl *Decl) {
   const clang::Decl *CurrentNodeAsDecl;
   while (!(CurrentNodeAsDecl = CurrentNode.get<clang::Decl>()) ||
          !isa<clang::TranslationUnitDecl>(CurrentNodeAsDecl)) {
-    IndexedParentVector IPV = getIndexedParents(CurrentNode);
+    llvm::ArrayRef<IndexedParent> IPV = getIndexedParents(CurrentNode);
     if (IPV.empty()) {
       break;
     }
-    IndexedParent IP = IPV[0];
+    const IndexedParent &IP = IPV[0];
     CurrentNode = IP.Parent;
     if (!CurrentNodeAsDecl) {
       continue;
@@ -22,6 +22,7 @@
 
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/ASTContext.h"
@@ -29,6 +30,8 @@
 #include "clang/AST/RecursiveASTVisitor.h"
 #include "clang/Index/USRGeneration.h"
 #include "clang/Sema/Template.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
 
 #include "IndexerLibrarySupport.h"
 #include "GraphObserver.h"
@@ -130,11 +133,50 @@ inline bool operator!=(const IndexedParent &L, const IndexedParent &R) {
   return !(L == R);
 }
 
-typedef llvm::SmallVector<IndexedParent, 2> IndexedParentVector;
+/// \brief Maps memoizable AST nodes to their `IndexedParent`s.
+///
+/// All parents live in a single flat array; each node owns a contiguous run
+/// of that array, so lookups hand out views without copying and the whole map
+/// is released in a few large deallocations rather than one per node.
+class IndexedParentMap {
+public:
+  /// \brief Returns the parents recorded for the node whose memoization data
+  /// is `Key`, or an empty list if there are none. The result is valid for as
+  /// long as this map is.
+  llvm::ArrayRef<IndexedParent> getParents(const void *Key) const {
+    auto I = Runs.find(Key);
+    if (I == Runs.end()) {
+      return llvm::ArrayRef<IndexedParent>();
+    }
+    return llvm::ArrayRef<IndexedParent>(Parents.data() + I->second.Begin,
+                                         I->second.Count);
+  }
 
-typedef llvm::DenseMap<
-    const void *, llvm::PointerUnion<IndexedParent *, IndexedParentVector *>>
-    IndexedParentMap;
+private:
+  friend class IndexedParentASTVisitor;
+
+  /// \brief A node's slice of `Parents`.
+  struct Run {
+    unsigned Begin;
+    unsigned Count;
+  };
+
+  /// \brief A parent edge recorded during traversal, before it is filed
+  /// under its child.
+  struct Edge {
+    const void *Child;
+    IndexedParent Parent;
+  };
+
+  /// \brief Files `Edges` under their children, in the order they were
+  /// recorded, dropping repeated parents that have memoization data.
+  void build(const std::vector<Edge> &Edges);
+
+  /// Every node's parents, grouped by node.
+  std::vector<IndexedParent> Parents;
+  /// Where each node's parents live in `Parents`.
+  llvm::DenseMap<const void *, Run> Runs;
+};
 
 /// FIXME: Currently only builds up the map using \c Stmt and \c Decl nodes.
 /// TODO(zarko): Is this necessary to change for naming?
@@ -147,16 +189,16 @@ public:
   static std::unique_ptr<IndexedParentMap>
   buildMap(clang::TranslationUnitDecl &TU) {
     std::unique_ptr<IndexedParentMap> ParentMap(new IndexedParentMap);
-    IndexedParentASTVisitor Visitor(ParentMap.get());
+    IndexedParentASTVisitor Visitor;
     Visitor.TraverseDecl(&TU);
+    ParentMap->build(Visitor.Edges);
     return std::move(ParentMap);
   }
 
 private:
   typedef RecursiveASTVisitor<IndexedParentASTVisitor> VisitorBase;
 
-  explicit IndexedParentASTVisitor(IndexedParentMap *Parents)
-      : Parents(Parents) {}
+  IndexedParentASTVisitor() {}
 
   bool shouldVisitTemplateInstantiations() const { return true; }
   bool shouldVisitImplicitCode() const { return true; }
@@ -179,29 +221,9 @@ private:
       // map. The main problem there is to implement hash functions /
       // comparison operators for all types that DynTypedNode supports that
       // do not have pointer identity.
-      auto &NodeOrVector = (*Parents)[Node];
-      if (NodeOrVector.isNull()) {
-        NodeOrVector = new IndexedParent(ParentStack.back());
-      } else {
-        if (NodeOrVector.template is<IndexedParent *>()) {
-          auto *Node = NodeOrVector.template get<IndexedParent *>();
-          auto *Vector = new IndexedParentVector(1, *Node);
-          NodeOrVector = Vector;
-          delete Node;
-        }
-        assert(NodeOrVector.template is<IndexedParentVector *>());
-
-        auto *Vector = NodeOrVector.template get<IndexedParentVector *>();
-        // Skip duplicates for types that have memoization data.
-        // We must check that the type has memoization data before calling
-        // std::find() because DynTypedNode::operator== can't compare all
-        // types.
-        bool Found = ParentStack.back().Parent.getMemoizationData() &&
-                     std::find(Vector->begin(), Vector->end(),
-                               ParentStack.back()) != Vector->end();
-        if (!Found)
-          Vector->push_back(ParentStack.back());
-      }
+      // Duplicates are dropped when the edges are filed in
+      // `IndexedParentMap::build`.
+      Edges.push_back({Node, ParentStack.back()});
     }
     ParentStack.push_back(
         {clang::ast_type_traits::DynTypedNode::create(*Node), 0});
@@ -221,7 +243,8 @@ private:
     return TraverseNode(StmtNode, &VisitorBase::TraverseStmt);
   }
 
-  IndexedParentMap *Parents;
+  /// Every (child, parent) pair seen, in traversal order.
+  std::vector<IndexedParentMap::Edge> Edges;
   llvm::SmallVector<IndexedParent, 16> ParentStack;
 
   friend class RecursiveASTVisitor<IndexedParentASTVisitor>;
@@ -240,6 +263,23 @@ enum BehaviorOnTemplates : bool {
   VisitInstantiations = true  ///< Visit template instantiations.
 };
 
+/// \brief Counts lookups in the per-translation-unit caches that sit in front
+/// of `BuildNodeIdForDecl` and `BuildNameIdForDecl`.
+struct IdCacheStats {
+  size_t NodeIdHits = 0;   ///< `NodeId`s returned from the cache.
+  size_t NodeIdMisses = 0; ///< `NodeId`s that had to be computed.
+  size_t NameIdHits = 0;   ///< `NameId`s returned from the cache.
+  size_t NameIdMisses = 0; ///< `NameId`s that had to be computed.
+
+  /// \brief Adds the counts from `Other` to this one.
+  void Accumulate(const IdCacheStats &Other) {
+    NodeIdHits += Other.NodeIdHits;
+    NodeIdMisses += Other.NodeIdMisses;
+    NameIdHits += Other.NameIdHits;
+    NameIdMisses += Other.NameIdMisses;
+  }
+};
+
 /// \brief An AST visitor that extracts information for a translation unit and
 /// writes it to a `GraphObserver`.
 class IndexerASTVisitor : public clang::RecursiveASTVisitor<IndexerASTVisitor> {
@@ -250,7 +290,9 @@ public:
       : IgnoreUnimplemented(B), TemplateMode(T),
         Observer(GO ? *GO : NullObserver), Context(C), Supports(S) {}
 
-  ~IndexerASTVisitor() { deleteAllParents(); }
+  /// \brief Returns the hit and miss counts for the `NodeId` and `NameId`
+  /// caches.
+  const IdCacheStats &getIdCacheStats() const { return CacheStats; }
 
   bool VisitVarDecl(const clang::VarDecl *Decl);
   bool VisitDeclRefExpr(const clang::DeclRefExpr *DRE);
@@ -340,6 +382,10 @@ public:
   /// \return The node for `Decl`.
   GraphObserver::NodeId BuildNodeIdForDecl(const clang::Decl *Decl);
 
+  /// \brief Builds a stable node ID for `Decl` without consulting
+  /// `DeclNodeIds`.
+  GraphObserver::NodeId ComputeNodeIdForDecl(const clang::Decl *Decl);
+
   /// \brief Builds a stable node ID for `Decl` as a callable.
   ///
   /// \param Decl The callable declaration that is being identified.
@@ -383,6 +429,10 @@ public:
   /// \return The name for `Decl`.
   GraphObserver::NameId BuildNameIdForDecl(const clang::Decl *Decl);
 
+  /// \brief Builds a stable name ID for `Decl` without consulting
+  /// `DeclNameIds`.
+  GraphObserver::NameId ComputeNameIdForDecl(const clang::Decl *Decl);
+
   /// \brief Builds a NodeId for the given dependent name.
   ///
   /// \param NNS The qualifier on the name.
@@ -556,6 +606,10 @@ private:
   /// always canonicalized before its hash is taken.
   uint64_t SemanticHash(const clang::QualType &T);
 
+  /// \brief Builds a semantic hash of the canonical type `CQT` from its type
+  /// class, qualifiers and component types without consulting `TypeHashes`.
+  uint64_t ComputeSemanticHash(const clang::QualType &CQT);
+
   /// \brief Builds a semantic hash of the given `RecordDecl`, such that
   /// if R and R' are similar records, SH(R) == SH(R'). This notion of
   /// similarity is meant to join together definitions copied and pasted
@@ -564,6 +618,9 @@ private:
   /// to form an identifying token.
   uint64_t SemanticHash(const clang::RecordDecl *RD);
 
+  /// \brief Builds a semantic hash of `RD` without consulting `DeclHashes`.
+  uint64_t ComputeSemanticHash(const clang::RecordDecl *RD);
+
   /// \brief Builds a semantic hash of the given `EnumDecl`, such that
   /// if E and E' are similar records, SH(E) == SH(E'). This notion of
   /// similarity is meant to join together definitions copied and pasted
@@ -619,22 +676,21 @@ private:
   ///
   /// 'NodeT' can be one of Decl, Stmt, Type, TypeLoc,
   /// NestedNameSpecifier or NestedNameSpecifierLoc.
+  ///
+  /// The returned list points into `AllParents` and is not copied.
   template <typename NodeT>
-  IndexedParentVector getIndexedParents(const NodeT &Node) {
+  llvm::ArrayRef<IndexedParent> getIndexedParents(const NodeT &Node) {
     return getIndexedParents(
         clang::ast_type_traits::DynTypedNode::create(Node));
   }
 
-  IndexedParentVector
+  llvm::ArrayRef<IndexedParent>
   getIndexedParents(const clang::ast_type_traits::DynTypedNode &Node);
   /// A map from memoizable DynTypedNodes to their parent nodes
   /// and their child indices with respect to those parents.
   /// Filled on the first call to `getIndexedParents`.
   std::unique_ptr<IndexedParentMap> AllParents;
 
-  /// \brief Deallocates `AllParents`.
-  void deleteAllParents();
-
   /// Records information about the template `Template` wrapping the node
   /// `BodyId`, including the edge linking the template and its body. Returns
   /// the `NodeId` for the dominating template.
@@ -675,6 +731,36 @@ private:
   /// makes sense only within the implementation of this class.
   std::unordered_map<int64_t, MaybeFew<GraphObserver::NodeId>> TypeNodes;
 
+  /// Avoid rebuilding node IDs for `Decl`s we've already seen. A `NodeId`
+  /// embeds the claim token for the `Decl`'s location, so that token is part
+  /// of the key; should the observer's claim state change partway through the
+  /// translation unit, stale IDs will simply be missed.
+  llvm::DenseMap<std::pair<const clang::Decl *,
+                           const GraphObserver::ClaimToken *>,
+                 GraphObserver::NodeId>
+      DeclNodeIds;
+
+  /// Avoid rebuilding name IDs for `Decl`s we've already seen. Names depend
+  /// only on the AST, so they're keyed on the `Decl` alone.
+  llvm::DenseMap<const clang::Decl *, GraphObserver::NameId> DeclNameIds;
+
+  /// Hit and miss counts for `DeclNodeIds` and `DeclNameIds`.
+  IdCacheStats CacheStats;
+
+  /// Semantic hashes of canonical types, keyed by their opaque pointers.
+  llvm::DenseMap<const void *, uint64_t> TypeHashes;
+
+  /// Semantic hashes of `RecordDecl`s and `EnumDecl`s.
+  llvm::DenseMap<const void *, uint64_t> DeclHashes;
+
+  /// Semantic hashes of template-like `Decl`s. These are kept apart from
+  /// `DeclHashes` because partial specializations are both records and
+  /// templates and hash differently as each.
+  llvm::DenseMap<const void *, uint64_t> TemplateDeclishHashes;
+
+  /// Semantic hashes of `TemplateArgumentList`s.
+  llvm::DenseMap<const void *, uint64_t> TemplateArgumentListHashes;
+
   /// The current type variable context for the visitor (indexed by depth).
   std::vector<clang::TemplateParameterList *> TypeContext;
 
@@ -703,13 +789,18 @@ private:
 class IndexerASTConsumer : public clang::ASTConsumer {
 public:
   explicit IndexerASTConsumer(GraphObserver *GO, BehaviorOnUnimplemented B,
-                              BehaviorOnTemplates T, const LibrarySupports &S)
-      : Observer(GO), IgnoreUnimplemented(B), TemplateMode(T), Supports(S) {}
+                              BehaviorOnTemplates T, const LibrarySupports &S,
+                              IdCacheStats *CS = nullptr)
+      : Observer(GO), IgnoreUnimplemented(B), TemplateMode(T), Supports(S),
+        CacheStats(CS) {}
 
   void HandleTranslationUnit(clang::ASTContext &Context) override {
     IndexerASTVisitor Visitor(Context, IgnoreUnimplemented, TemplateMode,
                               Supports, Observer);
     Visitor.TraverseDecl(Context.getTranslationUnitDecl());
+    if (CacheStats) {
+      CacheStats->Accumulate(Visitor.getIdCacheStats());
+    }
   }
 
 private:
@@ -720,6 +811,8 @@ private:
   BehaviorOnTemplates TemplateMode;
   /// Which library supports are enabled.
   const LibrarySupports &Supports;
+  /// If non-null, receives the visitor's ID cache counts.
+  IdCacheStats *CacheStats;
 };
 
 } // namespace kythe
@@ -77,6 +77,11 @@ public:
   /// \param T The behavior to use for template instantiations.
   void setTemplateMode(BehaviorOnTemplates T) { TemplateMode = T; }
 
+  /// \brief Collect hit and miss counts for the AST visitor's ID caches?
+  /// \param CS If non-null, the counts for each translation unit are added
+  /// here. Must outlive the action.
+  void setIdCacheStats(IdCacheStats *CS) { CacheStats = CS; }
+
 private:
   std::unique_ptr<clang::ASTConsumer>
   CreateASTConsumer(clang::CompilerInstance &CI,
@@ -114,8 +119,8 @@ private:
       Observer->setLangOptions(&CI.getLangOpts());
       Observer->setPreprocessor(&CI.getPreprocessor());
     }
-    return llvm::make_unique<IndexerASTConsumer>(Observer, IgnoreUnimplemented,
-                                                 TemplateMode, Supports);
+    return llvm::make_unique<IndexerASTConsumer>(
+        Observer, IgnoreUnimplemented, TemplateMode, Supports, CacheStats);
   }
 
   bool BeginSourceFileAction(clang::CompilerInstance &CI,
@@ -139,6 +144,8 @@ private:
   HeaderSearchInfo HeaderConfig;
   /// Library-specific callbacks.
   LibrarySupports Supports;
+  /// Receives ID cache counts, if non-null.
+  IdCacheStats *CacheStats = nullptr;
 };
 
 /// \brief Allows stdin to be replaced with a mapped file.
@@ -16,4 +16,28 @@ void StaticClaimClient::AssignClaim(const kythe::proto::VName &claimable,
                                     const kythe::proto::VName &claimant) {
   claim_table_[claimable] = claimant;
 }
+
+bool MappedStaticClaimClient::Claim(const kythe::proto::VName &claimant,
+                                    const kythe::proto::VName &vname) {
+  uint64_t claimant_fingerprint;
+  if (!table_->Lookup(vname, &claimant_fingerprint)) {
+    // We don't know who's responsible for this VName.
+    return process_unknown_status_;
+  }
+  return claimant_fingerprint == FingerprintVName(claimant);
+}
+
+bool OverlayClaimClient::Claim(const kythe::proto::VName &claimant,
+                               const kythe::proto::VName &vname) {
+  const auto lookup = claim_table_.find(vname);
+  if (lookup == claim_table_.end()) {
+    return base_->Claim(claimant, vname);
+  }
+  return VNameEquals(lookup->second, claimant);
+}
+
+void OverlayClaimClient::AssignClaim(const kythe::proto::VName &claimable,
+                                     const kythe::proto::VName &claimant) {
+  claim_table_[claimable] = claimant;
+}
 }
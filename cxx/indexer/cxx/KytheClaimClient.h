@@ -2,7 +2,9 @@
 #define KYTHE_CXX_INDEXER_CXX_KYTHE_CLAIM_CLIENT_H_
 
 #include <map>
+#include <memory>
 
+#include "kythe/cxx/common/static_claim_table.h"
 #include "kythe/cxx/common/vname_ordering.h"
 #include "kythe/proto/storage.pb.h"
 #include "GraphObserver.h"
@@ -25,6 +27,9 @@ class KytheClaimClient {
 };
 
 /// \brief A client that makes static decisions about resources when possible.
+///
+/// Once all claims have been assigned, `Claim` may be called concurrently
+/// from multiple threads.
 class StaticClaimClient : public KytheClaimClient {
  public:
   bool Claim(const kythe::proto::VName &claimant,
@@ -49,6 +54,63 @@ class StaticClaimClient : public KytheClaimClient {
   bool process_unknown_status_ = true;
 };
 
+/// \brief A client that makes static decisions using a memory-mapped
+/// `StaticClaimTable`.
+///
+/// Unlike `StaticClaimClient`, this client doesn't need to load the claim
+/// assignment into memory first. `Claim` may be called concurrently from
+/// multiple threads.
+class MappedStaticClaimClient : public KytheClaimClient {
+ public:
+  /// \param table The table to consult.
+  explicit MappedStaticClaimClient(std::unique_ptr<StaticClaimTable> table)
+      : table_(std::move(table)) {}
+
+  bool Claim(const kythe::proto::VName &claimant,
+             const kythe::proto::VName &vname) override;
+
+  /// \brief Process data with unknown claim status?
+  ///
+  /// If true, then entities without claimants assigned will be
+  /// processed by every claimant.
+  void set_process_unknown_status(bool process_unknown_status) {
+    process_unknown_status_ = process_unknown_status;
+  }
+
+ private:
+  /// Maps from claimable fingerprints to claimant fingerprints.
+  std::unique_ptr<StaticClaimTable> table_;
+  /// Process data with unknown claim status?
+  bool process_unknown_status_ = true;
+};
+
+/// \brief A client that layers claims local to one compilation unit over
+/// another client.
+///
+/// This allows a single (possibly large) `StaticClaimClient` to be shared
+/// between multiple compilation units indexed by the same process while
+/// still honoring each unit's own claim assignments.
+class OverlayClaimClient : public KytheClaimClient {
+ public:
+  /// \param base The client to consult for resources without local claims.
+  /// Not owned.
+  explicit OverlayClaimClient(KytheClaimClient *base) : base_(base) {}
+
+  bool Claim(const kythe::proto::VName &claimant,
+             const kythe::proto::VName &vname) override;
+
+  /// \brief Assigns responsibility for `claimable` to `claimant`, shadowing
+  /// any assignment made by the base client.
+  void AssignClaim(const kythe::proto::VName &claimable,
+                   const kythe::proto::VName &claimant);
+
+ private:
+  /// The client to consult when no local claim exists.
+  KytheClaimClient *base_;
+  /// Maps from claimables to claimants for local claims.
+  std::map<kythe::proto::VName, kythe::proto::VName, VNameLess> claim_table_;
+};
+
 }  // namespace kythe
 
 #endif
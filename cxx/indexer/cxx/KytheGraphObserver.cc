@@ -767,10 +767,10 @@ bool KytheGraphObserver::claimLocation(clang::SourceLocation source_location) {
 void KytheGraphObserver::AddContextInformation(
     const std::string &path, const PreprocessorContext &context,
     unsigned offset, const PreprocessorContext &dest_context) {
-  auto found_file = vfs_->status(path);
-  if (found_file) {
-    path_to_context_data_[found_file->getUniqueID()][context][offset] =
-        dest_context;
+  // Only the file's identity matters here; don't make the VFS read it.
+  llvm::sys::fs::UniqueID uid;
+  if (vfs_->get_unique_id(path, &uid)) {
+    path_to_context_data_[uid][context][offset] = dest_context;
   } else {
     fprintf(stderr, "WARNING: Path %s could not be mapped to a VFS record.\n",
             path.c_str());
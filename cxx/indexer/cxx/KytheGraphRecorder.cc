@@ -16,6 +16,8 @@
 
 #include "KytheGraphRecorder.h"
 
+#include <limits>
+
 #include "kythe/proto/storage.pb.h"
 
 namespace kythe {
@@ -101,29 +103,29 @@ void KytheGraphRecorder::BeginNode(const VName &node_vname,
 void KytheGraphRecorder::BeginNode(const VName &node_vname,
                                    const llvm::StringRef &kind) {
   assert(!in_node_);
-  node_vname_ = node_vname;
   in_node_ = true;
-  kythe::proto::Entry node_fact;
-  node_fact.mutable_source()->CopyFrom(node_vname);
-  node_fact.set_fact_name(*kKindSpelling);
-  node_fact.set_fact_value(kind.str());
-  stream_->Emit(node_fact);
+  node_entry_.mutable_source()->CopyFrom(node_vname);
+  node_entry_.set_fact_name(*kKindSpelling);
+  node_entry_.set_fact_value(kind.data(), kind.size());
+  stream_->Emit(node_entry_);
 }
 
 void KytheGraphRecorder::AddProperty(PropertyID property_id,
-                                     const std::string &property_value) {
+                                     llvm::StringRef property_value) {
   assert(in_node_);
-  kythe::proto::Entry node_fact;
-  node_fact.mutable_source()->CopyFrom(node_vname_);
-  node_fact.set_fact_name(
+  node_entry_.set_fact_name(
       *kPropertySpellings[static_cast<ptrdiff_t>(property_id)]);
-  node_fact.set_fact_value(property_value);
-  stream_->Emit(node_fact);
+  node_entry_.set_fact_value(property_value.data(), property_value.size());
+  stream_->Emit(node_entry_);
 }
 
 void KytheGraphRecorder::AddProperty(PropertyID property_id,
                                      const size_t property_value) {
-  AddProperty(property_id, std::to_string(property_value));
+  assert(in_node_);
+  node_entry_.set_fact_name(
+      *kPropertySpellings[static_cast<ptrdiff_t>(property_id)]);
+  SetFactValue(property_value, &node_entry_);
+  stream_->Emit(node_entry_);
 }
 
 void KytheGraphRecorder::EndNode() {
@@ -131,38 +133,48 @@ void KytheGraphRecorder::EndNode() {
   in_node_ = false;
 }
 
+void KytheGraphRecorder::SetFactValue(size_t value,
+                                      kythe::proto::Entry *entry) {
+  char buffer[std::numeric_limits<size_t>::digits10 + 2];
+  char *end = buffer + sizeof(buffer);
+  char *begin = end;
+  do {
+    *--begin = '0' + (value % 10);
+    value /= 10;
+  } while (value);
+  entry->set_fact_value(begin, end - begin);
+}
+
 void KytheGraphRecorder::AddEdge(const VName &edge_from,
                                  EdgeKindID edge_kind_id,
                                  const VName &edge_to) {
   assert(!in_node_);
-  kythe::proto::Entry edge_fact;
-  edge_fact.mutable_source()->CopyFrom(edge_from);
-  edge_fact.set_edge_kind(
+  edge_entry_.mutable_source()->CopyFrom(edge_from);
+  edge_entry_.set_edge_kind(
       *kEdgeKindSpellings[static_cast<ptrdiff_t>(edge_kind_id)]);
-  edge_fact.mutable_target()->CopyFrom(edge_to);
-  edge_fact.set_fact_name(*kRootPropertySpelling);
-  edge_fact.set_fact_value(*kEmptyStringSpelling);
-  stream_->Emit(edge_fact);
+  edge_entry_.mutable_target()->CopyFrom(edge_to);
+  edge_entry_.set_fact_name(*kRootPropertySpelling);
+  edge_entry_.set_fact_value(*kEmptyStringSpelling);
+  stream_->Emit(edge_entry_);
 }
 
 void KytheGraphRecorder::AddEdge(const VName &edge_from,
                                  EdgeKindID edge_kind_id, const VName &edge_to,
                                  uint32_t ordinal) {
   assert(!in_node_);
-  kythe::proto::Entry edge_fact;
-  edge_fact.mutable_source()->CopyFrom(edge_from);
-  edge_fact.set_edge_kind(
+  edge_entry_.mutable_source()->CopyFrom(edge_from);
+  edge_entry_.set_edge_kind(
       *kEdgeKindSpellings[static_cast<ptrdiff_t>(edge_kind_id)]);
-  edge_fact.mutable_target()->CopyFrom(edge_to);
-  edge_fact.set_fact_name(*kEdgePropertySpelling);
-  edge_fact.set_fact_value(std::to_string(ordinal));
-  stream_->Emit(edge_fact);
+  edge_entry_.mutable_target()->CopyFrom(edge_to);
+  edge_entry_.set_fact_name(*kEdgePropertySpelling);
+  SetFactValue(ordinal, &edge_entry_);
+  stream_->Emit(edge_entry_);
 }
 
 void KytheGraphRecorder::AddFileContent(const VName &file_vname,
                                         const llvm::StringRef &file_content) {
   BeginNode(file_vname, NodeKindID::kFile);
-  AddProperty(PropertyID::kText, file_content.str());
+  AddProperty(PropertyID::kText, file_content);
   EndNode();
 }
 
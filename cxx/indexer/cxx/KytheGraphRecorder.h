@@ -19,6 +19,8 @@
 
 #include "llvm/ADT/StringRef.h"
 
+#include "kythe/proto/storage.pb.h"
+
 #include "KytheOutputStream.h"
 
 namespace kythe {
@@ -110,6 +112,10 @@ const std::string &spelling_of(PropertyID property_id);
 const std::string &spelling_of(EdgeKindID edge_kind_id);
 
 /// \brief Records Kythe nodes and edges to a provided `KytheOutputStream`.
+///
+/// Entries are built in scratch `Entry` messages that are reused from call to
+/// call, so once their fields have grown to a steady-state capacity, emitting
+/// an entry does not allocate.
 class KytheGraphRecorder {
  public:
   /// A Kythe VName.
@@ -152,9 +158,9 @@ class KytheGraphRecorder {
   /// \pre `BeginNode` has been called, but a matching call to `EndNode` has not
   /// yet been made.
   /// \sa BeginNode, EndNode
-  void AddProperty(PropertyID property_id, const std::string &property_value);
+  void AddProperty(PropertyID property_id, llvm::StringRef property_value);
 
-  /// \copydoc KytheGraphRecorder::AddProperty(PropertyID,std::string&)
+  /// \copydoc KytheGraphRecorder::AddProperty(PropertyID,llvm::StringRef)
   void AddProperty(PropertyID property_id, size_t property_value);
 
   /// \brief Commit the current partially-constructed node.
@@ -195,10 +201,17 @@ class KytheGraphRecorder {
                       const llvm::StringRef &file_content);
 
  private:
+  /// \brief Writes the decimal representation of `value` to `entry`'s
+  /// fact value.
+  static void SetFactValue(size_t value, kythe::proto::Entry *entry);
+
   /// The `KytheOutputStream` to which new graph elements are written.
   KytheOutputStream *stream_;
-  /// The current incomplete node's VName. Meaningful if `in_node_ == true`.
-  VName node_vname_;
+  /// Scratch entry for node facts. Its source is the current incomplete
+  /// node's VName, which is meaningful if `in_node_ == true`.
+  kythe::proto::Entry node_entry_;
+  /// Scratch entry for edges.
+  kythe::proto::Entry edge_entry_;
   /// `true` if there is an uncommitted node.
   bool in_node_ = false;
 };
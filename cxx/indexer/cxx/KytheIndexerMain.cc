@@ -18,15 +18,25 @@
 // this program reads a single C++ compilation unit from stdin and emits
 // binary Kythe artifacts to stdout as a sequence of Entity protos.
 // Command-line arguments may be passed to Clang as positional parameters.
+// Multiple .kindex files or index pack units may be indexed in one process.
 //
 //   eg: indexer -i foo.cc -o foo.bin -- -DINDEXING
 //       indexer -i foo.cc | verifier foo.cc
 //       indexer some/index.kindex
+//       indexer -batch_manifest units.txt -output_dir out/
 
+#include <errno.h>
 #include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "clang/Frontend/FrontendActions.h"
 #include "clang/Tooling/Tooling.h"
@@ -36,15 +46,19 @@
 #include "google/protobuf/io/zero_copy_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
 #include "google/protobuf/io/coded_stream.h"
-#include "google/protobuf/io/gzip_stream.h"
 #include "google/protobuf/stubs/common.h"
+#include "kythe/cxx/common/compression.h"
+#include "kythe/cxx/common/decompressed_blob_cache.h"
 #include "kythe/cxx/common/index_pack.h"
 #include "kythe/cxx/common/json_proto.h"
+#include "kythe/cxx/common/parallel_for.h"
 #include "kythe/proto/analysis.pb.h"
 #include "kythe/proto/claim.pb.h"
 #include "kythe/proto/cxx.pb.h"
 
+#include "DeduplicatingOutputStream.h"
 #include "IndexerFrontendAction.h"
+#include "KytheClaimClient.h"
 #include "KytheGraphObserver.h"
 #include "KytheGraphRecorder.h"
 #include "KytheOutputStream.h"
@@ -55,17 +69,51 @@ DEFINE_string(i, "-", "Input filename");
 DEFINE_bool(ignore_unimplemented, false,
             "Continue indexing even if we find something we don't support.");
 DEFINE_bool(flush_after_each_entry, false,
-            "Flush output after writing each entry.");
-DEFINE_string(static_claim, "", "Use a static claim table.");
+            "Deprecated; equivalent to -flush_interval_ms=0.");
+DEFINE_int32(flush_interval_ms, -1,
+             "If nonnegative, flush output when an entry is written at least "
+             "this many milliseconds after the last flush, and after each "
+             "unit. If 0, flush after each entry. If negative, flush only "
+             "when buffers fill. The interval is not checked while no "
+             "entries are being written.");
+DEFINE_string(static_claim, "",
+              "Use a static claim table. Both the compressed and the "
+              "memory-mappable formats written by static_claim are accepted.");
 DEFINE_bool(claim_unknown, true, "Process files with unknown claim status.");
 DEFINE_bool(index_template_instantiations, true,
             "Index template instantiations.");
 DEFINE_string(index_pack, "", "Mount an index pack rooted at this directory.");
+DEFINE_string(batch_manifest, "",
+              "Also index the .kindex files (or index pack unit IDs) listed "
+              "one per line in this file; use - to read the list from stdin.");
+DEFINE_int32(jobs, 1,
+             "The number of .kindex files or index pack units to index "
+             "concurrently.");
+DEFINE_int64(dedup_cache_size, 0,
+             "If positive, drop duplicate entries before writing them out, "
+             "remembering at most twice this many distinct entries.");
+DEFINE_bool(report_id_cache_stats, false,
+            "Log how often node and name IDs for declarations were served "
+            "from the indexer's per-unit caches.");
+DEFINE_string(output_dir, "",
+              "When indexing .kindex files or index pack units, write each "
+              "unit's entries to its own file in this directory instead of "
+              "to -o. Files are named after the units' basenames; units "
+              "whose basenames collide also get their position in the "
+              "batch (foo.3.entries).");
+DEFINE_string(file_cache_dir, "",
+              "When reading from an index pack, keep decompressed copies of "
+              "input files in this existing directory and map them from "
+              "there. The directory may be shared between indexer runs.");
+DEFINE_int32(prefetch_threads, 4,
+             "With -file_cache_dir, decompress each index pack unit's "
+             "uncached inputs into the cache on this many threads before "
+             "indexing the unit.");
 
 namespace kythe {
 /// \brief Reads the output of the static claim tool.
 ///
-/// `path` should be a file that contains a GZip-compressed sequence of
+/// `path` should be a file that contains a compressed sequence of
 /// varint-prefixed wire format ClaimAssignment protobuf messages.
 static void DecodeStaticClaimTable(const std::string &path,
                                    kythe::StaticClaimClient *client) {
@@ -73,8 +121,8 @@ static void DecodeStaticClaimTable(const std::string &path,
   int fd = open(path.c_str(), O_RDONLY, S_IREAD | S_IWRITE);
   CHECK_GE(fd, 0) << "Couldn't open input file " << path;
   FileInputStream file_input_stream(fd);
-  GzipInputStream gzip_input_stream(&file_input_stream);
-  CodedInputStream coded_input_stream(&gzip_input_stream);
+  auto decompressed_stream = NewDecompressingInputStream(&file_input_stream);
+  CodedInputStream coded_input_stream(decompressed_stream.get());
   google::protobuf::uint32 byte_size;
   // Silence a warning about input size.
   coded_input_stream.SetTotalBytesLimit(INT_MAX, -1);
@@ -90,61 +138,111 @@ static void DecodeStaticClaimTable(const std::string &path,
   close(fd);
 }
 
+/// \brief Builds the claim client to share between all indexed units.
+/// \param path The static claim file to use, if any. This may be either the
+/// compressed output of the static claim tool or a memory-mappable
+/// table written with its `-table_out` flag.
+static std::unique_ptr<kythe::KytheClaimClient> OpenStaticClaimClient(
+    const std::string &path) {
+  if (!path.empty() && kythe::StaticClaimTable::IsStaticClaimTable(path)) {
+    std::string error_text;
+    auto table = kythe::StaticClaimTable::Open(path, &error_text);
+    CHECK(table) << "Couldn't open claim table " << path << ": "
+                 << error_text;
+    std::unique_ptr<kythe::MappedStaticClaimClient> client(
+        new kythe::MappedStaticClaimClient(std::move(table)));
+    client->set_process_unknown_status(FLAGS_claim_unknown);
+    return std::move(client);
+  }
+  std::unique_ptr<kythe::StaticClaimClient> client(
+      new kythe::StaticClaimClient());
+  if (!path.empty()) {
+    DecodeStaticClaimTable(path, client.get());
+  }
+  client->set_process_unknown_status(FLAGS_claim_unknown);
+  return std::move(client);
+}
+
 /// \brief Reads data from a .kindex file into memory.
 /// \param path The path from which the file should be read.
 /// \param virtual_files A vector to be filled with FileData.
 /// \param unit A `CompilationUnit` to be decoded from the .kindex.
-static void DecodeIndexFile(const std::string &path,
+/// \param error_text Set to an error description on failure.
+/// \return false if the file couldn't be read or was malformed.
+static bool DecodeIndexFile(const std::string &path,
                             std::vector<proto::FileData> *virtual_files,
-                            proto::CompilationUnit *unit) {
+                            proto::CompilationUnit *unit,
+                            std::string *error_text) {
   using namespace google::protobuf::io;
   int fd = open(path.c_str(), O_RDONLY, S_IREAD | S_IWRITE);
-  CHECK_GE(fd, 0) << "Couldn't open input file " << path;
-  FileInputStream file_input_stream(fd);
-  GzipInputStream gzip_input_stream(&file_input_stream);
-  CodedInputStream coded_input_stream(&gzip_input_stream);
-  // Silence a warning about input size.
-  coded_input_stream.SetTotalBytesLimit(INT_MAX, -1);
-  google::protobuf::uint32 byte_size;
-  while (coded_input_stream.ReadVarint32(&byte_size)) {
-    auto limit = coded_input_stream.PushLimit(byte_size);
-    if (unit) {
-      CHECK(unit->ParseFromCodedStream(&coded_input_stream));
-      unit = nullptr;
-    } else {
-      proto::FileData content;
-      CHECK(content.ParseFromCodedStream(&coded_input_stream));
-      CHECK(content.has_info());
-      virtual_files->push_back(std::move(content));
+  if (fd < 0) {
+    *error_text = std::string("Couldn't open input file: ") + strerror(errno);
+    return false;
+  }
+  bool decoded = true;
+  {
+    FileInputStream file_input_stream(fd);
+    auto decompressed_stream =
+        NewDecompressingInputStream(&file_input_stream);
+    CodedInputStream coded_input_stream(decompressed_stream.get());
+    // Silence a warning about input size.
+    coded_input_stream.SetTotalBytesLimit(INT_MAX, -1);
+    google::protobuf::uint32 byte_size;
+    while (decoded && coded_input_stream.ReadVarint32(&byte_size)) {
+      auto limit = coded_input_stream.PushLimit(byte_size);
+      if (unit) {
+        if (!unit->ParseFromCodedStream(&coded_input_stream)) {
+          *error_text = "Couldn't parse the compilation unit.";
+          decoded = false;
+        }
+        unit = nullptr;
+      } else {
+        proto::FileData content;
+        if (!content.ParseFromCodedStream(&coded_input_stream) ||
+            !content.has_info()) {
+          *error_text = "Couldn't parse file data.";
+          decoded = false;
+        } else {
+          virtual_files->push_back(std::move(content));
+        }
+      }
+      coded_input_stream.PopLimit(limit);
+    }
+    if (decoded && unit) {
+      *error_text = "Never saw a CompilationUnit.";
+      decoded = false;
     }
-    coded_input_stream.PopLimit(limit);
   }
-  CHECK(!unit) << "Never saw a CompilationUnit.";
   close(fd);
+  return decoded;
 }
 
-static void DecodeIndexPack(const std::string &cu_hash,
-                            std::unique_ptr<IndexPack> index_pack,
-                            std::vector<proto::FileData> *virtual_files,
-                            proto::CompilationUnit *unit) {
-  std::string error_text;
-  CHECK(index_pack->ReadCompilationUnit(cu_hash, unit, &error_text))
-      << "Could not read " << cu_hash << ": " << error_text;
+/// \brief Reads the unit `cu_hash` from `index_pack`.
+///
+/// Input file content is not read here; the `IndexVFS` fetches it on demand.
+/// \param lazy_files A vector to be filled with the unit's required inputs.
+/// \param error_text Set to an error description on failure.
+/// \return false if the unit couldn't be read or was malformed.
+static bool DecodeIndexPack(const std::string &cu_hash, IndexPack *index_pack,
+                            std::vector<proto::FileInfo> *lazy_files,
+                            proto::CompilationUnit *unit,
+                            std::string *error_text) {
+  if (!index_pack->ReadCompilationUnit(cu_hash, unit, error_text)) {
+    return false;
+  }
   for (const auto &input : unit->required_input()) {
     const auto &info = input.info();
-    CHECK(!info.path().empty());
-    CHECK(!info.digest().empty()) << "Required input " << info.path()
-                                  << " is missing its digest.";
-    std::string read_data;
-    CHECK(index_pack->ReadFileData(info.digest(), &read_data))
-        << "Could not read " << info.path() << " (digest " << info.digest()
-        << ") from the index pack: " << read_data;
-    proto::FileData file_data;
-    file_data.set_content(read_data);
-    file_data.mutable_info()->set_path(info.path());
-    file_data.mutable_info()->set_digest(info.digest());
-    virtual_files->push_back(std::move(file_data));
+    if (info.path().empty()) {
+      *error_text = "A required input is missing its path.";
+      return false;
+    }
+    if (info.digest().empty()) {
+      *error_text = "Required input " + info.path() + " is missing its digest.";
+      return false;
+    }
+    lazy_files->push_back(info);
   }
+  return true;
 }
 
 static void DecodeHeaderSearchInformation(const proto::CompilationUnit &unit,
@@ -188,27 +286,292 @@ static bool EndsWith(const std::string &input, const std::string &suffix) {
          !input.compare(input.size() - suffix.size(), suffix.size(), suffix);
 }
 
+/// \brief Everything needed to index a single compilation unit.
+struct IndexerJob {
+  /// The unit being indexed. Left empty when indexing loose source text.
+  proto::CompilationUnit unit;
+  /// Files to make available to Clang through the `IndexVFS`.
+  std::vector<proto::FileData> virtual_files;
+  /// Files whose content `IndexVFS` reads from `content_source` on demand.
+  std::vector<proto::FileInfo> lazy_files;
+  /// Supplies content for `lazy_files`. Not owned.
+  FileContentSource *content_source = nullptr;
+  /// Arguments to pass to Clang, starting with the name of the executable.
+  std::vector<std::string> args;
+  /// The absolute working directory for the compilation.
+  std::string working_directory;
+  /// If true, Clang may only see `virtual_files` and `lazy_files`; otherwise,
+  /// it may read from the real filesystem.
+  bool hermetic = true;
+};
+
+/// \brief Loads the unit named by `kindex_file_or_cu` into `job`.
+/// \param kindex_file_or_cu A path to a .kindex file, or a unit hash if
+/// `index_pack` is not null.
+/// \param index_pack The index pack from which units are read, or null.
+/// \param content_source Reads file content from `index_pack`.
+/// \param error_text Set to an error description on failure.
+/// \return false if the unit couldn't be loaded. The caller should skip it.
+static bool LoadIndexerJob(const std::string &kindex_file_or_cu,
+                           IndexPack *index_pack,
+                           IndexPackContentSource *content_source,
+                           IndexerJob *job, std::string *error_text) {
+  if (index_pack) {
+    if (!DecodeIndexPack(kindex_file_or_cu, index_pack, &job->lazy_files,
+                         &job->unit, error_text)) {
+      return false;
+    }
+    std::string prefetch_error_text;
+    if (!content_source->Prefetch(job->lazy_files, FLAGS_prefetch_threads,
+                                  &prefetch_error_text)) {
+      // Whatever wasn't prefetched is read again when Clang asks for it.
+      LOG(WARNING) << "Couldn't prefetch inputs for " << kindex_file_or_cu
+                   << ": " << prefetch_error_text;
+    }
+    job->content_source = content_source;
+  } else if (!DecodeIndexFile(kindex_file_or_cu, &job->virtual_files,
+                              &job->unit, error_text)) {
+    return false;
+  }
+  // CompilationUnit's arguments field includes the names of source files.
+  job->args.assign(job->unit.argument().begin(), job->unit.argument().end());
+  // We presently handle kindex files with only one main source file.
+  if (job->unit.source_file_size() != 1) {
+    *error_text = "Expected one source file, but the unit lists " +
+                  std::to_string(job->unit.source_file_size()) + ".";
+    return false;
+  }
+  job->working_directory = job->unit.working_directory();
+  if (!llvm::sys::path::is_absolute(job->working_directory)) {
+    llvm::SmallString<1024> stored_wd;
+    if (auto err = llvm::sys::fs::make_absolute(stored_wd)) {
+      *error_text = "Couldn't find the working directory: " + err.message();
+      return false;
+    }
+    job->working_directory = stored_wd.str();
+  }
+  job->hermetic = true;
+  return true;
+}
+
+/// \brief Logs the hit rates of the AST visitor's declaration ID caches.
+/// \param label Describes the unit that was indexed.
+static void LogIdCacheStats(const IdCacheStats &stats,
+                            const std::string &label) {
+  auto rate = [](size_t hits, size_t misses) {
+    return hits + misses == 0 ? 0.0 : hits * 100.0 / (hits + misses);
+  };
+  LOG(INFO) << label << ": NodeId cache " << stats.NodeIdHits << " hits, "
+            << stats.NodeIdMisses << " misses ("
+            << rate(stats.NodeIdHits, stats.NodeIdMisses) << "%); NameId cache "
+            << stats.NameIdHits << " hits, " << stats.NameIdMisses
+            << " misses (" << rate(stats.NameIdHits, stats.NameIdMisses)
+            << "%)";
+}
+
+/// \brief Runs the indexer on `job`.
+/// \param job The unit to index.
+/// \param claim_client The claim client to share between units. Claims that
+/// are specific to `job` are layered on top of it and are discarded when
+/// indexing completes.
+/// \param output The stream to which entries should be written.
+/// \return true if indexing succeeded without errors.
+static bool IndexJob(const IndexerJob &job, KytheClaimClient *claim_client,
+                     KytheOutputStream *output) {
+  const proto::CompilationUnit &unit = job.unit;
+  clang::FileSystemOptions file_system_options;
+  file_system_options.WorkingDir = job.working_directory;
+  llvm::IntrusiveRefCntPtr<IndexVFS> virtual_file_system(
+      new IndexVFS(file_system_options.WorkingDir, job.virtual_files,
+                   job.lazy_files, job.content_source));
+  kythe::OverlayClaimClient unit_claim_client(claim_client);
+  kythe::KytheGraphRecorder kythe_recorder(output);
+  kythe::KytheGraphObserver observer(&kythe_recorder, &unit_claim_client,
+                                     virtual_file_system);
+  observer.set_claimant(unit.v_name());
+  observer.set_starting_context(unit.entry_context());
+  kythe::HeaderSearchInfo header_search_info;
+  DecodeHeaderSearchInformation(unit, &header_search_info);
+
+  for (const auto &input : unit.required_input()) {
+    if (input.has_info() && !input.info().path().empty() &&
+        input.has_v_name()) {
+      virtual_file_system->SetVName(input.info().path(), input.v_name());
+    }
+    const std::string &file_path = input.info().path();
+    for (const auto &row : input.context()) {
+      if (row.always_process()) {
+        auto claimable_vname = input.v_name();
+        claimable_vname.set_signature(row.source_context() +
+                                      claimable_vname.signature());
+        unit_claim_client.AssignClaim(claimable_vname, unit.v_name());
+      }
+      for (const auto &col : row.column()) {
+        observer.AddContextInformation(file_path, row.source_context(),
+                                       col.offset(), col.linked_context());
+      }
+    }
+  }
+
+  std::unique_ptr<kythe::IndexerFrontendAction> action(
+      new kythe::IndexerFrontendAction(&observer, header_search_info));
+  action->setIgnoreUnimplemented(FLAGS_ignore_unimplemented
+                                     ? kythe::BehaviorOnUnimplemented::Continue
+                                     : kythe::BehaviorOnUnimplemented::Abort);
+  action->setTemplateMode(FLAGS_index_template_instantiations
+                              ? BehaviorOnTemplates::VisitInstantiations
+                              : BehaviorOnTemplates::SkipInstantiations);
+  IdCacheStats cache_stats;
+  if (FLAGS_report_id_cache_stats) {
+    action->setIdCacheStats(&cache_stats);
+  }
+  llvm::IntrusiveRefCntPtr<clang::FileManager> file_manager(
+      new clang::FileManager(file_system_options,
+                             job.hermetic ? virtual_file_system : nullptr));
+  std::vector<std::string> final_args(job.args);
+  final_args.insert(final_args.begin() + 1, "-fsyntax-only");
+  // StdinAdjustSingleFrontendActionFactory takes ownership of its action.
+  std::unique_ptr<kythe::StdinAdjustSingleFrontendActionFactory> tool(
+      new kythe::StdinAdjustSingleFrontendActionFactory(action.release()));
+  // ToolInvocation doesn't take ownership of ToolActions.
+  clang::tooling::ToolInvocation invocation(final_args, tool.get(),
+                                            file_manager.get());
+  bool result = invocation.run();
+  if (FLAGS_report_id_cache_stats) {
+    // LoadIndexerJob only accepts .kindex units with exactly one source
+    // file, so only source text read directly (from stdin or -i) comes
+    // without a unit. Its source file is the last argument.
+    LogIdCacheStats(cache_stats, unit.source_file_size() > 0
+                                     ? unit.source_file(0)
+                                     : job.args.back());
+  }
+  return result;
+}
+
+/// \brief Logs how many entries `stream` dropped, if deduplication is on.
+/// \param label Describes what was written to `stream`.
+static void LogDedupStats(const DeduplicatingOutputStream &stream,
+                          const std::string &label) {
+  if (FLAGS_dedup_cache_size > 0) {
+    LOG(INFO) << label << ": dropped " << stream.entries_dropped() << " of "
+              << stream.entries_seen() << " entries as duplicates ("
+              << stream.dedup_ratio() * 100.0 << "%)";
+  }
+}
+
+/// \brief Appends the non-empty lines of the file at `path` to `lines`.
+/// \param path The file to read, or "-" for stdin.
+static void ReadManifest(const std::string &path,
+                         std::vector<std::string> *lines) {
+  FILE *manifest = path == "-" ? stdin : fopen(path.c_str(), "r");
+  CHECK(manifest != nullptr) << "Couldn't open manifest " << path;
+  std::string line;
+  int next;
+  while ((next = fgetc(manifest)) != EOF) {
+    if (next == '\n') {
+      if (!line.empty()) {
+        lines->push_back(line);
+      }
+      line.clear();
+    } else if (next != '\r') {
+      line.push_back(next);
+    }
+  }
+  if (!line.empty()) {
+    lines->push_back(line);
+  }
+  if (manifest != stdin) {
+    fclose(manifest);
+  }
+}
+
+/// \brief Opens `path` for writing, or returns STDOUT_FILENO for "-".
+/// \return The file descriptor, or -1 (after logging why) on failure.
+static int OpenOutputFile(const std::string &path) {
+  if (path == "-") {
+    return STDOUT_FILENO;
+  }
+  int write_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (write_fd == -1) {
+    LOG(ERROR) << "Can't open output file " << path << ": "
+               << strerror(errno);
+  }
+  return write_fd;
+}
+
+/// \brief Closes `write_fd`.
+/// \return false (after logging why) on failure.
+static bool CloseOutputFile(int write_fd) {
+  if (close(write_fd) != 0) {
+    LOG(ERROR) << "Error closing output file: " << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+/// \brief Returns the paths in `--output_dir` to use for the units named by
+/// `kindex_files_or_cus`, in the same order.
+///
+/// Each unit's file is named after its basename. Units whose basenames
+/// collide (like `a/foo.kindex` and `b/foo.kindex`) also get their position
+/// in the batch, so that they don't overwrite one another.
+static std::vector<std::string> OutputPathsForUnits(
+    const std::vector<std::string> &kindex_files_or_cus) {
+  std::vector<std::string> unit_names;
+  std::map<std::string, size_t> name_counts;
+  for (const auto &kindex_file_or_cu : kindex_files_or_cus) {
+    llvm::StringRef unit_name = llvm::sys::path::filename(kindex_file_or_cu);
+    if (unit_name.endswith(".kindex")) {
+      unit_name = unit_name.drop_back(strlen(".kindex"));
+    }
+    unit_names.push_back(unit_name.str());
+    ++name_counts[unit_names.back()];
+  }
+  std::vector<std::string> out_paths;
+  for (size_t index = 0; index < unit_names.size(); ++index) {
+    std::string file_name = unit_names[index];
+    if (name_counts[file_name] > 1) {
+      file_name += "." + std::to_string(index);
+    }
+    llvm::SmallString<1024> out_path(FLAGS_output_dir);
+    llvm::sys::path::append(out_path, file_name + ".entries");
+    out_paths.push_back(out_path.str());
+  }
+  return out_paths;
+}
+
 int main(int argc, char *argv[]) {
   GOOGLE_PROTOBUF_VERIFY_VERSION;
   google::SetVersionString("0.1");
   google::SetUsageMessage(R"(Command-line frontend for the Kythe C++ indexer.
-Invokes the Kythe C++ indexer on a single compilation unit. By default reads
+Invokes the Kythe C++ indexer on one or more compilation units. By default reads
 source text from stdin and writes binary Kythe artifacts to stdout as a sequence
 of Entity protos. Command-line arguments may be passed to Clang as positional
 parameters.
 
-If -index_pack is not specified, there may be a positional parameter specified
-that ends in .kindex. If one exists, no other positional parameters may be
-specified, nor may an additional input parameter be specified. Input will
-be read from the index file.
+If -index_pack is not specified, there may be positional parameters specified
+that end in .kindex. If one exists, every positional parameter must name a
+.kindex file, and no additional input parameter may be specified. Input will
+be read from the index files.
+
+If -index_pack is specified, every positional parameter should be the ID of a
+compilation unit from the mounted index pack that is meant to be indexed. No
+additional input parameters may be specified.
 
-If -index_pack is specified, there must be exactly one positional parameter.
-This parameter should be the compilation unit ID from the mounted index pack
-that is meant to be indexed. No additional input parameters may be specified.
+Further .kindex files or unit IDs may be listed one per line in the file named
+by -batch_manifest (or on stdin if it is -). All units are indexed one after
+another by the same process. Their entries are concatenated into the -o output
+unless -output_dir is set, in which case each unit is written to its own file.
+Up to -jobs units are indexed concurrently on separate threads, sharing the
+static claim table and the index pack. A unit that can't be read is logged and
+skipped; the indexer still exits with an error once the rest are indexed.
 
 Examples:
   indexer -index_pack path/to/pack/root 660f1f840000000000
   indexer some/index.kindex
+  indexer some/index.kindex other/index.kindex
+  find . -name '*.kindex' | indexer -batch_manifest - -output_dir out/ -jobs 8
   indexer -i foo.cc -o foo.bin -- -DINDEXING
   indexer -i foo.cc | verifier foo.cc
   indexer -i foo.cc | gqui from rawproto:- proto \
@@ -217,9 +580,11 @@ Examples:
 
   std::vector<std::string> final_args(argv, argv + argc);
 
-  // Check to see if we should be using an index pack or a .kindex file.
+  // Check to see if we should be using an index pack or .kindex files.
   std::unique_ptr<kythe::IndexPack> index_pack;
-  std::string kindex_file_or_cu;
+  std::unique_ptr<kythe::DecompressedBlobCache> blob_cache;
+  std::unique_ptr<kythe::IndexPackContentSource> content_source;
+  std::vector<std::string> kindex_files_or_cus;
   if (!FLAGS_index_pack.empty()) {
     std::string error_text;
     auto filesystem = kythe::IndexPackPosixFilesystem::Open(
@@ -228,54 +593,55 @@ Examples:
     CHECK(filesystem) << "Couldn't open index pack from " << FLAGS_index_pack
                       << ": " << error_text;
     index_pack.reset(new kythe::IndexPack(std::move(filesystem)));
-    CHECK(final_args.size() >= 2) << "You must specify a compilation unit.";
-    kindex_file_or_cu = final_args[1];
+    if (!FLAGS_file_cache_dir.empty()) {
+      blob_cache.reset(new kythe::DecompressedBlobCache(FLAGS_file_cache_dir));
+    }
+    content_source.reset(
+        new kythe::IndexPackContentSource(index_pack.get(), blob_cache.get()));
+    kindex_files_or_cus.assign(final_args.begin() + 1, final_args.end());
   } else {
     std::string kindex_suffix = ".kindex";
     for (const auto &arg : final_args) {
       if (EndsWith(arg, kindex_suffix)) {
-        kindex_file_or_cu = arg;
-        break;
+        kindex_files_or_cus.push_back(arg);
       }
     }
+    if (!kindex_files_or_cus.empty()) {
+      CHECK_EQ(kindex_files_or_cus.size() + 1, final_args.size())
+          << "No other positional arguments are allowed when reading "
+          << "from index files.";
+    }
   }
-
-  if (!kindex_file_or_cu.empty()) {
-    CHECK_EQ(2, final_args.size())
-        << "No other positional arguments are allowed when reading "
-        << "from an index file or an index pack.";
+  if (!FLAGS_batch_manifest.empty()) {
+    ReadManifest(FLAGS_batch_manifest, &kindex_files_or_cus);
+  }
+  if (index_pack) {
+    CHECK(!kindex_files_or_cus.empty())
+        << "You must specify a compilation unit.";
+  }
+  if (!kindex_files_or_cus.empty()) {
     CHECK_EQ("-", FLAGS_i)
         << "No other input is allowed when reading from an index file or an "
         << "index pack.";
+  } else {
+    CHECK(FLAGS_output_dir.empty())
+        << "-output_dir may only be used with index files or an index pack.";
   }
 
-  std::vector<proto::FileData> virtual_files;
-  clang::FileSystemOptions file_system_options;
-  proto::CompilationUnit unit;
+  CHECK_GE(FLAGS_dedup_cache_size, 0)
+      << "-dedup_cache_size must not be negative.";
 
-  if (!kindex_file_or_cu.empty()) {
-    if (index_pack) {
-      DecodeIndexPack(kindex_file_or_cu, std::move(index_pack), &virtual_files,
-                      &unit);
-    } else {
-      DecodeIndexFile(kindex_file_or_cu, &virtual_files, &unit);
-    }
-    // CompilationUnit's arguments field includes the names of source files.
-    final_args.assign(unit.argument().begin(), unit.argument().end());
-    // We presently handle kindex files with only one main source file.
-    CHECK_EQ(1, unit.source_file_size());
-    file_system_options.WorkingDir = unit.working_directory();
-    if (!llvm::sys::path::is_absolute(file_system_options.WorkingDir)) {
-      llvm::SmallString<1024> stored_wd;
-      CHECK(!llvm::sys::fs::make_absolute(stored_wd));
-      file_system_options.WorkingDir = stored_wd.str();
-    }
-  } else {
+  std::unique_ptr<kythe::KytheClaimClient> claim_client =
+      OpenStaticClaimClient(FLAGS_static_claim);
+
+  if (kindex_files_or_cus.empty()) {
+    IndexerJob job;
+    job.hermetic = false;
     int read_fd = STDIN_FILENO;
     std::string source_file_name = "stdin.cc";
     llvm::SmallString<1024> cwd;
     CHECK(!llvm::sys::fs::current_path(cwd));
-    file_system_options.WorkingDir = cwd.str();
+    job.working_directory = cwd.str();
 
     if (FLAGS_i != "-") {
       read_fd = open(FLAGS_i.c_str(), O_RDONLY);
@@ -286,7 +652,8 @@ Examples:
       source_file_name = FLAGS_i;
     }
 
-    final_args.push_back(source_file_name);
+    job.args = final_args;
+    job.args.push_back(source_file_name);
 
     char buf[1024];
     llvm::SmallString<1024> source_data;
@@ -304,87 +671,146 @@ Examples:
     proto::FileData file_data;
     file_data.mutable_info()->set_path(source_file_name);
     file_data.set_content(source_data.str());
-    virtual_files.push_back(std::move(file_data));
-  }
+    job.virtual_files.push_back(std::move(file_data));
 
-  kythe::StaticClaimClient claim_client;
-  if (!FLAGS_static_claim.empty()) {
-    DecodeStaticClaimTable(FLAGS_static_claim, &claim_client);
+    int write_fd = OpenOutputFile(FLAGS_o);
+    if (write_fd == -1) {
+      exit(1);
+    }
+    bool had_no_errors;
+    {
+      google::protobuf::io::FileOutputStream raw_output(
+          write_fd, kythe::FileOutputStream::kBlockSize);
+      kythe::FileOutputStream kythe_output(&raw_output);
+      kythe::DeduplicatingOutputStream dedup_output(&kythe_output,
+                                                    FLAGS_dedup_cache_size);
+      had_no_errors = IndexJob(job, claim_client.get(), &dedup_output);
+      LogDedupStats(dedup_output, job.args.back());
+    }
+    if (!CloseOutputFile(write_fd)) {
+      exit(1);
+    }
+    return had_no_errors == false;
   }
-  claim_client.set_process_unknown_status(FLAGS_claim_unknown);
 
-  int write_fd = STDOUT_FILENO;
-  if (FLAGS_o != "-") {
-    write_fd = open(FLAGS_o.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
-                    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  CHECK_GT(FLAGS_jobs, 0) << "-jobs must be positive.";
+  size_t worker_count =
+      std::min<size_t>(FLAGS_jobs, kindex_files_or_cus.size());
+  int write_fd = -1;
+  if (FLAGS_output_dir.empty()) {
+    write_fd = OpenOutputFile(FLAGS_o);
     if (write_fd == -1) {
-      perror("Can't open output file");
       exit(1);
     }
   }
-
-  bool had_no_errors;
+  std::vector<std::string> output_paths;
+  if (!FLAGS_output_dir.empty()) {
+    output_paths = OutputPathsForUnits(kindex_files_or_cus);
+  }
+  std::atomic<bool> had_errors(false);
   {
-    llvm::IntrusiveRefCntPtr<IndexVFS> virtual_file_system(
-        new IndexVFS(file_system_options.WorkingDir, virtual_files));
-    google::protobuf::io::FileOutputStream raw_output(write_fd);
-    kythe::FileOutputStream kythe_output(&raw_output);
-    kythe::KytheGraphRecorder kythe_recorder(&kythe_output);
-    kythe::KytheGraphObserver observer(&kythe_recorder, &claim_client,
-                                       virtual_file_system);
-    observer.set_claimant(unit.v_name());
-    observer.set_starting_context(unit.entry_context());
-    kythe::HeaderSearchInfo header_search_info;
-    DecodeHeaderSearchInformation(unit, &header_search_info);
-
-    for (const auto &input : unit.required_input()) {
-      if (input.has_info() && !input.info().path().empty() &&
-          input.has_v_name()) {
-        virtual_file_system->SetVName(input.info().path(), input.v_name());
+    std::unique_ptr<google::protobuf::io::FileOutputStream> raw_output;
+    std::unique_ptr<SharedOutputSink> shared_sink;
+    if (write_fd != -1) {
+      raw_output.reset(new google::protobuf::io::FileOutputStream(
+          write_fd, kythe::FileOutputStream::kBlockSize));
+      shared_sink.reset(new SharedOutputSink(raw_output.get()));
+    }
+    // Each worker has its own VFS, observer and recorder (built by
+    // `IndexJob`) but shares the static claim table, the index pack and the
+    // output sink. Workers that write to the shared sink keep one
+    // deduplicating stream across all of their units.
+    std::vector<std::unique_ptr<SharedSinkOutputStream>> shared_outputs(
+        worker_count);
+    std::vector<std::unique_ptr<DeduplicatingOutputStream>> dedup_outputs(
+        worker_count);
+    if (shared_sink) {
+      for (size_t worker = 0; worker < worker_count; ++worker) {
+        shared_outputs[worker].reset(
+            new SharedSinkOutputStream(shared_sink.get()));
+        dedup_outputs[worker].reset(new DeduplicatingOutputStream(
+            shared_outputs[worker].get(), FLAGS_dedup_cache_size));
       }
-      const std::string &file_path = input.info().path();
-      for (const auto &row : input.context()) {
-        if (row.always_process()) {
-          auto claimable_vname = input.v_name();
-          claimable_vname.set_signature(row.source_context() +
-                                        claimable_vname.signature());
-          claim_client.AssignClaim(claimable_vname, unit.v_name());
-        }
-        for (const auto &col : row.column()) {
-          observer.AddContextInformation(file_path, row.source_context(),
-                                         col.offset(), col.linked_context());
-        }
+    }
+    ParallelForWithThreadIndex(
+        kindex_files_or_cus.size(), worker_count,
+        [&](size_t worker, size_t unit_index) {
+          const std::string &kindex_file_or_cu =
+              kindex_files_or_cus[unit_index];
+          IndexerJob job;
+          std::string error_text;
+          if (!LoadIndexerJob(kindex_file_or_cu, index_pack.get(),
+                              content_source.get(), &job, &error_text)) {
+            // Keep going with the rest of the batch; main still fails.
+            LOG(ERROR) << "Skipping " << kindex_file_or_cu << ": "
+                       << error_text;
+            had_errors = true;
+            return;
+          }
+          bool unit_ok;
+          if (shared_sink) {
+            unit_ok = IndexJob(job, claim_client.get(),
+                               dedup_outputs[worker].get());
+            if (OutputFlushTimer::enabled()) {
+              // Don't hold this unit's last entries while the worker parses
+              // its next unit, when nothing is emitted to trigger a flush.
+              shared_outputs[worker]->Flush(true);
+            }
+          } else {
+            // Other workers are still running, so a unit whose output
+            // can't be written fails on its own instead of ending the batch.
+            int unit_fd = OpenOutputFile(output_paths[unit_index]);
+            if (unit_fd == -1) {
+              had_errors = true;
+              return;
+            }
+            {
+              google::protobuf::io::FileOutputStream unit_raw_output(
+                  unit_fd, kythe::FileOutputStream::kBlockSize);
+              {
+                kythe::FileOutputStream unit_output(&unit_raw_output);
+                kythe::DeduplicatingOutputStream unit_dedup_output(
+                    &unit_output, FLAGS_dedup_cache_size);
+                unit_ok =
+                    IndexJob(job, claim_client.get(), &unit_dedup_output);
+                LogDedupStats(unit_dedup_output, kindex_file_or_cu);
+              }
+              // A full disk must not leave a truncated file that looks
+              // complete.
+              if (!unit_raw_output.Flush()) {
+                LOG(ERROR) << "Couldn't write " << output_paths[unit_index]
+                           << ": " << strerror(unit_raw_output.GetErrno());
+                unit_ok = false;
+              }
+            }
+            if (!CloseOutputFile(unit_fd)) {
+              unit_ok = false;
+            }
+          }
+          if (!unit_ok) {
+            LOG(ERROR) << "Errors while indexing " << kindex_file_or_cu;
+            had_errors = true;
+          }
+        });
+    for (const auto &dedup_output : dedup_outputs) {
+      if (dedup_output) {
+        LogDedupStats(*dedup_output, "worker output");
       }
     }
-
-    std::unique_ptr<kythe::IndexerFrontendAction> action(
-        new kythe::IndexerFrontendAction(&observer, header_search_info));
-    action->setIgnoreUnimplemented(
-        FLAGS_ignore_unimplemented ? kythe::BehaviorOnUnimplemented::Continue
-                                   : kythe::BehaviorOnUnimplemented::Abort);
-    action->setTemplateMode(FLAGS_index_template_instantiations
-                                ? BehaviorOnTemplates::VisitInstantiations
-                                : BehaviorOnTemplates::SkipInstantiations);
-    llvm::IntrusiveRefCntPtr<clang::FileManager> file_manager(
-        new clang::FileManager(file_system_options, kindex_file_or_cu.empty()
-                                                        ? nullptr
-                                                        : virtual_file_system));
-    final_args.insert(final_args.begin() + 1, "-fsyntax-only");
-    // StdinAdjustSingleFrontendActionFactory takes ownership of its action.
-    std::unique_ptr<kythe::StdinAdjustSingleFrontendActionFactory> tool(
-        new kythe::StdinAdjustSingleFrontendActionFactory(action.release()));
-    // ToolInvocation doesn't take ownership of ToolActions.
-    clang::tooling::ToolInvocation invocation(final_args, tool.get(),
-                                              file_manager.get());
-    had_no_errors = invocation.run();
+    // Dedup streams write through the per-worker shared outputs, which
+    // hand their last blocks to the sink when they're destroyed.
+    dedup_outputs.clear();
+    shared_outputs.clear();
+    // A full disk or a closed pipe must not look like a complete index.
+    if (shared_sink && !shared_sink->Flush()) {
+      had_errors = true;
+    }
   }
-
-  if (close(write_fd) != 0) {
-    perror("Error closing output file");
-    exit(1);
+  if (write_fd != -1 && !CloseOutputFile(write_fd)) {
+    had_errors = true;
   }
 
-  return had_no_errors == false;
+  return had_errors;
 }
 
 }  // namespace kythe
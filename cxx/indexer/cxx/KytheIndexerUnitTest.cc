@@ -39,7 +39,9 @@
 #include "google/protobuf/stubs/common.h"
 #include "gtest/gtest.h"
 
+#include "DeduplicatingOutputStream.h"
 #include "KytheGraphRecorder.h"
+#include "KytheVFS.h"
 #include "RecordingOutputStream.h"
 
 namespace kythe {
@@ -155,6 +157,75 @@ TEST(KytheIndexerUnitTest, GraphRecorderEdgeOrdinal) {
   ASSERT_EQ(vname_target.DebugString(), entry.target().DebugString());
 }
 
+TEST(KytheIndexerUnitTest, DeduplicatingOutputStreamDropsDuplicates) {
+  RecordingOutputStream stream;
+  DeduplicatingOutputStream dedup_stream(&stream, 2);
+  KytheGraphRecorder recorder(&dedup_stream);
+  kythe::proto::VName vname_a, vname_b, vname_c;
+  vname_a.set_signature("a");
+  vname_b.set_signature("b");
+  vname_c.set_signature("c");
+  recorder.AddEdge(vname_a, EdgeKindID::kRef, vname_b);
+  recorder.AddEdge(vname_a, EdgeKindID::kRef, vname_b);
+  recorder.AddEdge(vname_a, EdgeKindID::kRef, vname_c);
+  // Now in the previous generation.
+  recorder.AddEdge(vname_a, EdgeKindID::kRef, vname_b);
+  recorder.AddEdge(vname_b, EdgeKindID::kRef, vname_c);
+  recorder.AddEdge(vname_c, EdgeKindID::kRef, vname_a);
+  // Forgotten after two generation changes.
+  recorder.AddEdge(vname_a, EdgeKindID::kRef, vname_c);
+  ASSERT_EQ(5, stream.entries().size());
+  EXPECT_EQ(7, dedup_stream.entries_seen());
+  EXPECT_EQ(2, dedup_stream.entries_dropped());
+  EXPECT_EQ(vname_c.DebugString(), stream.entries()[4].target().DebugString());
+}
+
+TEST(KytheIndexerUnitTest, DeduplicatingOutputStreamDisabled) {
+  RecordingOutputStream stream;
+  DeduplicatingOutputStream dedup_stream(&stream, 0);
+  KytheGraphRecorder recorder(&dedup_stream);
+  kythe::proto::VName vname;
+  vname.set_signature("a");
+  recorder.AddEdge(vname, EdgeKindID::kRef, vname);
+  recorder.AddEdge(vname, EdgeKindID::kRef, vname);
+  EXPECT_EQ(2, stream.entries().size());
+  EXPECT_EQ(0, dedup_stream.entries_dropped());
+}
+
+/// \brief A `FileContentSource` that counts how often it's asked for content.
+class CountingContentSource : public FileContentSource {
+ public:
+  std::unique_ptr<llvm::MemoryBuffer> GetContent(
+      const proto::FileInfo &info) override {
+    ++reads_;
+    return llvm::MemoryBuffer::getMemBufferCopy("int x;", info.path());
+  }
+
+  size_t reads() const { return reads_; }
+
+ private:
+  size_t reads_ = 0;
+};
+
+TEST(KytheIndexerUnitTest, VFSUniqueIdDoesNotReadLazyFiles) {
+  CountingContentSource source;
+  std::vector<proto::FileData> virtual_files;
+  std::vector<proto::FileInfo> lazy_files(1);
+  lazy_files[0].set_path("/root/lazy.h");
+  llvm::IntrusiveRefCntPtr<IndexVFS> vfs(
+      new IndexVFS("/root", virtual_files, lazy_files, &source));
+  llvm::sys::fs::UniqueID uid;
+  ASSERT_TRUE(vfs->get_unique_id("lazy.h", &uid));
+  EXPECT_EQ(0, source.reads());
+  EXPECT_FALSE(vfs->get_unique_id("/root/missing.h", &uid));
+  // The ID is the one Clang will see once it reads the file.
+  auto status = vfs->status("/root/lazy.h");
+  ASSERT_TRUE(static_cast<bool>(status));
+  EXPECT_EQ(1, source.reads());
+  EXPECT_TRUE(uid == status->getUniqueID());
+  EXPECT_EQ(6, status->getSize());
+}
+
 TEST(KytheIndexerUnitTest, TrivialHappyCase) {
   NullGraphObserver observer;
   HeaderSearchInfo info;
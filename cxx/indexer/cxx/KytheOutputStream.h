@@ -17,16 +17,24 @@
 #ifndef KYTHE_CXX_INDEXER_CXX_KYTHE_OUTPUT_STREAM_H_
 #define KYTHE_CXX_INDEXER_CXX_KYTHE_OUTPUT_STREAM_H_
 
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 #include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
 
 #include "gflags/gflags.h"
+#include "glog/logging.h"
 #include "kythe/proto/storage.pb.h"
 
 DECLARE_bool(flush_after_each_entry);
+DECLARE_int32(flush_interval_ms);
 
 namespace kythe {
 
@@ -37,28 +45,253 @@ namespace kythe {
 class KytheOutputStream {
  public:
   virtual void Emit(const kythe::proto::Entry &entry) = 0;
+
+  // Emits `entry`, whose wire format (without a length prefix) is
+  // `serialized`. Streams that write the wire format should copy these bytes
+  // rather than serialize `entry` again.
+  virtual void EmitSerialized(const kythe::proto::Entry &entry,
+                              const std::string &serialized) {
+    Emit(entry);
+  }
+};
+
+// Decides when buffered output should be flushed to honor
+// `--flush_interval_ms`. The interval is only checked when an entry is
+// written, so it doesn't bound how long entries wait while nothing is being
+// emitted (for example, while Clang parses the next unit); callers that
+// reach such a point should flush if `enabled()`.
+class OutputFlushTimer {
+ public:
+  // Returns true if output should be flushed at all before buffers fill.
+  static bool enabled() {
+    return FLAGS_flush_after_each_entry || FLAGS_flush_interval_ms >= 0;
+  }
+
+  // Returns true if buffered output should be flushed now.
+  bool ShouldFlush() {
+    if (FLAGS_flush_after_each_entry || FLAGS_flush_interval_ms == 0) {
+      return true;
+    }
+    if (FLAGS_flush_interval_ms < 0) {
+      return false;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_flush_ < std::chrono::milliseconds(FLAGS_flush_interval_ms)) {
+      return false;
+    }
+    last_flush_ = now;
+    return true;
+  }
+
+ private:
+  std::chrono::steady_clock::time_point last_flush_ =
+      std::chrono::steady_clock::now();
 };
 
+// Returns the number of bytes needed to write `entry` (whose size must have
+// been cached by a call to `ByteSize`) with a varint length prefix.
+inline size_t DelimitedEntrySize(size_t entry_size) {
+  return google::protobuf::io::CodedOutputStream::VarintSize32(entry_size) +
+         entry_size;
+}
+
+// Writes `entry` with a varint length prefix to `target`, which must have
+// room for `DelimitedEntrySize(entry_size)` bytes. `entry_size` must be the
+// value returned by the last call to `entry.ByteSize()`.
+inline google::protobuf::uint8 *WriteDelimitedEntryToArray(
+    const kythe::proto::Entry &entry, size_t entry_size,
+    google::protobuf::uint8 *target) {
+  target = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(
+      entry_size, target);
+  return entry.SerializeWithCachedSizesToArray(target);
+}
+
+// Writes `serialized` with a varint length prefix to `target`, which must
+// have room for `DelimitedEntrySize(serialized.size())` bytes.
+inline google::protobuf::uint8 *WriteDelimitedBytesToArray(
+    const std::string &serialized, google::protobuf::uint8 *target) {
+  target = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(
+      serialized.size(), target);
+  return google::protobuf::io::CodedOutputStream::WriteStringToArray(
+      serialized, target);
+}
+
 // A `KytheOutputStream` that records `Entry` instances to a
-// `FileOutputStream`.
+// `FileOutputStream`. Entries are written through a single long-lived
+// `CodedOutputStream` directly into the `FileOutputStream`'s buffer, which is
+// only flushed when it fills or when `--flush_interval_ms` requires.
 class FileOutputStream : public KytheOutputStream {
  public:
+  // The block size to use for `google::protobuf::io::FileOutputStream`s
+  // that back a `FileOutputStream`.
+  static constexpr int kBlockSize = 1024 * 1024;
+
   FileOutputStream(google::protobuf::io::FileOutputStream *stream)
-      : stream_(stream) {}
+      : stream_(stream), coded_stream_(stream) {}
+
+  ~FileOutputStream() { Flush(); }
 
   void Emit(const kythe::proto::Entry &entry) override {
-    {
-      google::protobuf::io::CodedOutputStream coded_stream(stream_);
-      coded_stream.WriteVarint32(entry.ByteSize());
-      entry.SerializeToCodedStream(&coded_stream);
+    size_t entry_size = entry.ByteSize();
+    size_t total_size = DelimitedEntrySize(entry_size);
+    if (auto *target =
+            coded_stream_.GetDirectBufferForNBytesAndAdvance(total_size)) {
+      WriteDelimitedEntryToArray(entry, entry_size, target);
+    } else {
+      // The entry straddles a buffer boundary.
+      coded_stream_.WriteVarint32(entry_size);
+      entry.SerializeWithCachedSizes(&coded_stream_);
+    }
+    if (flush_timer_.ShouldFlush()) {
+      Flush();
+    }
+  }
+
+  void EmitSerialized(const kythe::proto::Entry &entry,
+                      const std::string &serialized) override {
+    coded_stream_.WriteVarint32(serialized.size());
+    coded_stream_.WriteString(serialized);
+    if (flush_timer_.ShouldFlush()) {
+      Flush();
+    }
+  }
+
+  // Writes all buffered entries to the underlying file.
+  void Flush() {
+    coded_stream_.Trim();
+    stream_->Flush();
+  }
+
+ private:
+  google::protobuf::io::FileOutputStream *stream_;
+  google::protobuf::io::CodedOutputStream coded_stream_;
+  OutputFlushTimer flush_timer_;
+};
+
+// A `FileOutputStream` that may be written to from multiple threads. Data
+// is written in blocks; blocks from different writers are never interleaved.
+// Once the stream fails, later blocks are dropped and `had_error` is set.
+class SharedOutputSink {
+ public:
+  explicit SharedOutputSink(google::protobuf::io::FileOutputStream *stream)
+      : stream_(stream) {}
+
+  // Appends `block` to the underlying stream as a single unit.
+  // \param flush Whether to flush the underlying stream afterward.
+  void Write(const std::string &block, bool flush) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (had_error_) {
+      return;
+    }
+    const char *data = block.data();
+    size_t bytes_left = block.size();
+    while (bytes_left) {
+      void *buffer;
+      int buffer_size;
+      if (!stream_->Next(&buffer, &buffer_size)) {
+        ReportError();
+        return;
+      }
+      size_t chunk_size = std::min<size_t>(bytes_left, buffer_size);
+      ::memcpy(buffer, data, chunk_size);
+      if (static_cast<size_t>(buffer_size) > chunk_size) {
+        stream_->BackUp(buffer_size - chunk_size);
+      }
+      data += chunk_size;
+      bytes_left -= chunk_size;
     }
-    if (FLAGS_flush_after_each_entry) {
-      stream_->Flush();
+    if (flush && !stream_->Flush()) {
+      ReportError();
+    }
+  }
+
+  // Flushes the underlying stream.
+  // \return false if any write to the stream has failed.
+  bool Flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!had_error_ && !stream_->Flush()) {
+      ReportError();
     }
+    return !had_error_;
+  }
+
+  // Returns true if any write to the underlying stream has failed.
+  bool had_error() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return had_error_;
   }
 
  private:
+  // Records and logs a failure of the underlying stream. Requires `mutex_`.
+  void ReportError() {
+    had_error_ = true;
+    LOG(ERROR) << "Error writing entries: " << strerror(stream_->GetErrno());
+  }
+
+  std::mutex mutex_;
   google::protobuf::io::FileOutputStream *stream_;
+  bool had_error_ = false;
+};
+
+// A `KytheOutputStream` that serializes entries into a local buffer and
+// hands them to a `SharedOutputSink` in large blocks. Each thread writing to
+// the same sink should have its own `SharedSinkOutputStream`.
+class SharedSinkOutputStream : public KytheOutputStream {
+ public:
+  // \param sink The sink to write to. Not owned.
+  // \param block_size The buffer size at which entries are handed to `sink`.
+  explicit SharedSinkOutputStream(SharedOutputSink *sink,
+                                  size_t block_size = 1024 * 1024)
+      : sink_(sink), block_size_(block_size) {
+    buffer_.reserve(block_size_);
+  }
+
+  ~SharedSinkOutputStream() { Flush(true); }
+
+  void Emit(const kythe::proto::Entry &entry) override {
+    size_t entry_size = entry.ByteSize();
+    size_t offset = buffer_.size();
+    buffer_.resize(offset + DelimitedEntrySize(entry_size));
+    WriteDelimitedEntryToArray(
+        entry, entry_size,
+        reinterpret_cast<google::protobuf::uint8 *>(&buffer_[offset]));
+    MaybeFlush();
+  }
+
+  void EmitSerialized(const kythe::proto::Entry &entry,
+                      const std::string &serialized) override {
+    size_t offset = buffer_.size();
+    buffer_.resize(offset + DelimitedEntrySize(serialized.size()));
+    WriteDelimitedBytesToArray(
+        serialized,
+        reinterpret_cast<google::protobuf::uint8 *>(&buffer_[offset]));
+    MaybeFlush();
+  }
+
+  // Hands all buffered entries to the sink.
+  // \param flush_sink Whether the sink should also flush its stream.
+  void Flush(bool flush_sink) {
+    if (!buffer_.empty()) {
+      sink_->Write(buffer_, flush_sink);
+      buffer_.clear();
+    }
+  }
+
+ private:
+  // Hands buffered entries to the sink if the buffer is full or
+  // `--flush_interval_ms` requires.
+  void MaybeFlush() {
+    if (flush_timer_.ShouldFlush()) {
+      Flush(true);
+    } else if (buffer_.size() >= block_size_) {
+      Flush(false);
+    }
+  }
+
+  SharedOutputSink *sink_;
+  size_t block_size_;
+  std::string buffer_;
+  OutputFlushTimer flush_timer_;
 };
 
 }  // namespace kythe
@@ -16,6 +16,8 @@
 
 #include "KytheVFS.h"
 
+#include <algorithm>
+
 #include "kythe/cxx/common/proto_conversions.h"
 
 #include "llvm/Support/Path.h"
@@ -23,10 +25,82 @@
 #include "llvm/Support/FileSystem.h"
 
 namespace kythe {
+namespace {
+/// \brief A `MemoryBuffer` that takes ownership of a string's storage
+/// instead of copying it.
+class StringMemoryBuffer : public llvm::MemoryBuffer {
+ public:
+  StringMemoryBuffer(std::string content, const std::string &name)
+      : content_(std::move(content)), name_(name) {
+    // std::string keeps its content null-terminated.
+    init(content_.data(), content_.data() + content_.size(), true);
+  }
+
+  const char *getBufferIdentifier() const override { return name_.c_str(); }
+
+  BufferKind getBufferKind() const override { return MemoryBuffer_Malloc; }
+
+ private:
+  std::string content_;
+  std::string name_;
+};
+}  // anonymous namespace
+
+std::unique_ptr<llvm::MemoryBuffer> IndexPackContentSource::GetContent(
+    const proto::FileInfo &info) {
+  if (cache_) {
+    if (auto cached = cache_->Lookup(info.digest())) {
+      return cached;
+    }
+  }
+  std::string content;
+  if (!index_pack_->ReadFileData(info.digest(), &content)) {
+    return nullptr;
+  }
+  std::string error_text;
+  if (cache_ && cache_->Insert(info.digest(), content, &error_text)) {
+    // Prefer the mapped copy so that the pages are shared.
+    if (auto cached = cache_->Lookup(info.digest())) {
+      return cached;
+    }
+  }
+  return std::unique_ptr<llvm::MemoryBuffer>(
+      new StringMemoryBuffer(std::move(content), info.path()));
+}
+
+bool IndexPackContentSource::Prefetch(const std::vector<proto::FileInfo> &files,
+                                      size_t max_threads,
+                                      std::string *error_text) {
+  if (!cache_) {
+    return true;
+  }
+  std::vector<std::string> missing;
+  for (const auto &info : files) {
+    if (DecompressedBlobCache::IsValidDigest(info.digest()) &&
+        !cache_->Contains(info.digest())) {
+      missing.push_back(info.digest());
+    }
+  }
+  std::sort(missing.begin(), missing.end());
+  missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+  // Store each file as soon as it's read, so that only one decompressed
+  // file per thread is ever held in memory.
+  return index_pack_->ReadFileDataBatch(
+      missing, max_threads,
+      [this, &missing](size_t index, std::string *content,
+                       std::string *error_text) {
+        return cache_->Insert(missing[index], *content, error_text);
+      },
+      error_text);
+}
 
 IndexVFS::IndexVFS(const std::string &working_directory,
-                   const std::vector<proto::FileData> &virtual_files)
-    : virtual_files_(virtual_files), working_directory_(working_directory) {
+                   const std::vector<proto::FileData> &virtual_files,
+                   const std::vector<proto::FileInfo> &lazy_files,
+                   FileContentSource *content_source)
+    : virtual_files_(virtual_files),
+      content_source_(content_source),
+      working_directory_(working_directory) {
   assert(llvm::sys::path::is_absolute(working_directory) &&
          "Working directory must be absolute.");
   for (const auto &data : virtual_files_) {
@@ -36,6 +110,35 @@ IndexVFS::IndexVFS(const std::string &working_directory,
       record->data = llvm::StringRef(data.content());
     }
   }
+  assert((lazy_files.empty() || content_source_) &&
+         "Lazy files need a content source.");
+  for (const auto &info : lazy_files) {
+    // The size is filled in when the file is materialized.
+    if (auto *record = FileRecordForPath(ToStringRef(info.path()),
+                                         BehaviorOnMissing::kCreateFile, 0)) {
+      record->lazy_info = &info;
+    }
+  }
+}
+
+bool IndexVFS::MaterializeRecord(FileRecord *record) {
+  if (!record->lazy_info) {
+    return true;
+  }
+  auto buffer = content_source_->GetContent(*record->lazy_info);
+  if (!buffer) {
+    return false;
+  }
+  record->data = buffer->getBuffer();
+  record->buffer = std::move(buffer);
+  record->lazy_info = nullptr;
+  const auto &old_status = record->status;
+  record->status = clang::vfs::Status(
+      old_status.getName(), old_status.getName(), old_status.getUniqueID(),
+      old_status.getLastModificationTime(), old_status.getUser(),
+      old_status.getGroup(), record->data.size(), old_status.getType(),
+      old_status.getPermissions());
+  return true;
 }
 
 IndexVFS::~IndexVFS() {
@@ -45,8 +148,12 @@ IndexVFS::~IndexVFS() {
 }
 
 llvm::ErrorOr<clang::vfs::Status> IndexVFS::status(const llvm::Twine &path) {
-  if (const auto *record =
+  if (auto *record =
           FileRecordForPath(path.str(), BehaviorOnMissing::kReturnError, 0)) {
+    // Clang uses the size from the status, so we have to read the file now.
+    if (!MaterializeRecord(record)) {
+      return make_error_code(llvm::errc::io_error);
+    }
     return record->status;
   }
   return make_error_code(llvm::errc::no_such_file_or_directory);
@@ -57,6 +164,9 @@ llvm::ErrorOr<std::unique_ptr<clang::vfs::File>> IndexVFS::openFileForRead(
   if (FileRecord *record =
           FileRecordForPath(path.str(), BehaviorOnMissing::kReturnError, 0)) {
     if (record->status.getType() == llvm::sys::fs::file_type::regular_file) {
+      if (!MaterializeRecord(record)) {
+        return make_error_code(llvm::errc::io_error);
+      }
       return std::unique_ptr<clang::vfs::File>(new File(record));
     }
   }
@@ -92,6 +202,16 @@ bool IndexVFS::get_vname(const clang::FileEntry *entry,
   return false;
 }
 
+bool IndexVFS::get_unique_id(const std::string &path,
+                             llvm::sys::fs::UniqueID *uid) {
+  if (FileRecord *record =
+          FileRecordForPath(path, BehaviorOnMissing::kReturnError, 0)) {
+    *uid = record->status.getUniqueID();
+    return true;
+  }
+  return false;
+}
+
 std::string IndexVFS::get_debug_uid_string(const llvm::sys::fs::UniqueID &uid) {
   auto record = uid_to_record_map_.find(uid);
   if (record != uid_to_record_map_.end()) {
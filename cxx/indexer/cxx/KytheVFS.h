@@ -17,12 +17,57 @@
 #ifndef KYTHE_CXX_INDEXER_CXX_KYTHE_VFS_H_
 #define KYTHE_CXX_INDEXER_CXX_KYTHE_VFS_H_
 
+#include <memory>
+
 #include "clang/Basic/FileManager.h"
 #include "clang/Basic/VirtualFileSystem.h"
+#include "kythe/cxx/common/decompressed_blob_cache.h"
+#include "kythe/cxx/common/index_pack.h"
 #include "kythe/proto/analysis.pb.h"
+#include "llvm/Support/MemoryBuffer.h"
 
 namespace kythe {
 
+/// \brief Supplies the content of files that an `IndexVFS` maps lazily.
+///
+/// A source may be shared between `IndexVFS` instances on different threads.
+class FileContentSource {
+ public:
+  virtual ~FileContentSource() {}
+
+  /// \brief Returns the content of the file described by `info`, or null
+  /// if it isn't available. The buffer must be null-terminated.
+  virtual std::unique_ptr<llvm::MemoryBuffer> GetContent(
+      const proto::FileInfo &info) = 0;
+};
+
+/// \brief Reads file content from an `IndexPack`, optionally through a
+/// `DecompressedBlobCache`.
+class IndexPackContentSource : public FileContentSource {
+ public:
+  /// \param index_pack The pack to read from. Not owned.
+  /// \param cache Where to keep decompressed files, or null to keep them only
+  /// in memory. Not owned.
+  IndexPackContentSource(IndexPack *index_pack, DecompressedBlobCache *cache)
+      : index_pack_(index_pack), cache_(cache) {}
+
+  std::unique_ptr<llvm::MemoryBuffer> GetContent(
+      const proto::FileInfo &info) override;
+
+  /// \brief Decompresses those of `files` that aren't yet in the cache,
+  /// using up to `max_threads` threads. Does nothing without a cache.
+  /// \param error_text Non-null; used to return error details.
+  /// \return false if some file couldn't be read or stored.
+  bool Prefetch(const std::vector<proto::FileInfo> &files, size_t max_threads,
+                std::string *error_text);
+
+ private:
+  /// The pack to read from.
+  IndexPack *index_pack_;
+  /// Where to keep decompressed files, or null.
+  DecompressedBlobCache *cache_;
+};
+
 /// \brief A filesystem that allows access only to mapped files.
 ///
 /// IndexVFS normalizes all paths (using the working directory for
@@ -32,8 +77,14 @@ class IndexVFS : public clang::vfs::FileSystem {
  public:
   /// \param working_directory The absolute path to the working directory.
   /// \param virtual_files Files to map.
+  /// \param lazy_files Files to map whose content is only read from
+  /// `content_source` when Clang first looks at them.
+  /// \param content_source Supplies content for `lazy_files`. Not owned.
   IndexVFS(const std::string &working_directory,
-           const std::vector<proto::FileData> &virtual_files);
+           const std::vector<proto::FileData> &virtual_files,
+           const std::vector<proto::FileInfo> &lazy_files =
+               std::vector<proto::FileInfo>(),
+           FileContentSource *content_source = nullptr);
   ~IndexVFS();
   /// \brief Implements clang::vfs::FileSystem::status.
   llvm::ErrorOr<clang::vfs::Status> status(const llvm::Twine &path) override;
@@ -50,6 +101,11 @@ class IndexVFS : public clang::vfs::FileSystem {
   /// \param merge_with The `VName` to copy the vname onto.
   /// \return true if a match was found; false otherwise.
   bool get_vname(const clang::FileEntry *entry, proto::VName *merge_with);
+  /// \brief Finds the unique ID of the file or directory at `path` without
+  /// reading the content of a lazily-mapped file.
+  /// \param uid Set to the unique ID on success.
+  /// \return true if `path` is mapped; false otherwise.
+  bool get_unique_id(const std::string &path, llvm::sys::fs::UniqueID *uid);
   /// \brief Returns a string representation of `uid` for error messages.
   std::string get_debug_uid_string(const llvm::sys::fs::UniqueID &uid);
   const std::string &working_directory() const { return working_directory_; }
@@ -69,6 +125,11 @@ class IndexVFS : public clang::vfs::FileSystem {
     std::vector<FileRecord *> children;
     /// This file's content.
     llvm::StringRef data;
+    /// If non-null, this file's content hasn't been read yet and should be
+    /// fetched using this information.
+    const proto::FileInfo *lazy_info;
+    /// Owns `data` for files that were read lazily.
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
   };
 
   /// \brief A clang::vfs::File that wraps a `FileRecord`.
@@ -93,6 +154,11 @@ class IndexVFS : public clang::vfs::FileSystem {
     std::string name_;
   };
 
+  /// \brief Fetches `record`'s content if it was mapped lazily and hasn't
+  /// been read yet.
+  /// \return false if the content couldn't be read.
+  bool MaterializeRecord(FileRecord *record);
+
   /// \brief Controls what happens when a missing path node is encountered.
   enum class BehaviorOnMissing {
     kCreateFile,       ///< Create intermediate directories and a final file.
@@ -128,6 +194,8 @@ class IndexVFS : public clang::vfs::FileSystem {
 
   /// The virtual files that were included in the index.
   const std::vector<proto::FileData> &virtual_files_;
+  /// Supplies content for lazily-mapped files.
+  FileContentSource *content_source_;
   /// The working directory. Must be absolute.
   std::string working_directory_;
   /// Maps root names to root nodes. For indexes captured from Unix
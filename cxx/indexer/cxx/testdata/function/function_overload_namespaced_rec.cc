@@ -0,0 +1,12 @@
+// Checks that overloads on same-shaped records from different namespaces
+// are recorded as different functions.
+namespace ns1 { struct Foo { int x; }; }
+namespace ns2 { struct Foo { int x; }; }
+//- @F defines FnF1
+void F(ns1::Foo X) { }
+//- @F defines FnF2
+void F(ns2::Foo Y) { }
+//- FnF1 param.0 X1
+//- FnF2 param.0 Y2
+//- X1 named vname("X:F#n",_,_,_,_)
+//- Y2 named vname("Y:F#n",_,_,_,_)
@@ -24,3 +24,12 @@ cat "${OUT_DIR}/kindex_test.entries" \
 "${INDEXER}" "${REPO_TEST_INDEX}" > "${OUT_DIR}/kindex_repo_test.entries"
 cat "${OUT_DIR}/kindex_repo_test.entries" \
     | "${VERIFIER}" "${BASE_DIR}/kindex_repo_test.verify"
+# A unit that can't be read is skipped: the rest of the batch is still
+# indexed, but the indexer reports failure.
+if "${INDEXER}" "${OUT_DIR}/missing.kindex" "${TEST_INDEX}" \
+    > "${OUT_DIR}/kindex_skip_test.entries"; then
+  echo "The indexer should fail when a unit can't be read." >&2
+  exit 1
+fi
+cat "${OUT_DIR}/kindex_skip_test.entries" \
+    | "${VERIFIER}" "${BASE_DIR}/kindex_test.verify"
@@ -0,0 +1,71 @@
+#!/bin/bash -e
+# Tests that the indexer can index a batch of kindex files concurrently,
+# both into a single stream and into one file per unit.
+BASE_DIR="$TEST_SRCDIR/kythe/cxx/indexer/cxx/testdata"
+OUT_DIR="$TEST_TMPDIR/batch"
+VERIFIER="kythe/cxx/verifier/verifier"
+INDEXER="kythe/cxx/indexer/cxx/indexer"
+KINDEX_TOOL="kythe/cxx/tools/kindex_tool"
+TEST_INDEX="${OUT_DIR}/test.kindex"
+REPO_TEST_INDEX="${OUT_DIR}/repo_test.kindex"
+UNIT_COUNT=8
+rm -rf "${OUT_DIR}"
+mkdir -p "${OUT_DIR}"
+"${KINDEX_TOOL}" -assemble "${TEST_INDEX}" \
+    "${BASE_DIR}/kindex_test.unit" \
+    "${BASE_DIR}/kindex_test.header" \
+    "${BASE_DIR}/kindex_test.main"
+"${KINDEX_TOOL}" -assemble "${REPO_TEST_INDEX}" \
+    "${BASE_DIR}/kindex_repo_test.unit" \
+    "${BASE_DIR}/kindex_repo_test.header" \
+    "${BASE_DIR}/kindex_repo_test.main"
+# Every unit in the batch is named test.kindex, alternating between the two
+# test units. The first two are passed as arguments and the rest are listed
+# in a manifest.
+MANIFEST="${OUT_DIR}/manifest"
+: > "${MANIFEST}"
+UNITS=()
+for ((i = 0; i < UNIT_COUNT; ++i)); do
+  mkdir -p "${OUT_DIR}/unit${i}"
+  if ((i % 2 == 0)); then
+    cp "${TEST_INDEX}" "${OUT_DIR}/unit${i}/test.kindex"
+  else
+    cp "${REPO_TEST_INDEX}" "${OUT_DIR}/unit${i}/test.kindex"
+  fi
+  if ((i < 2)); then
+    UNITS+=("${OUT_DIR}/unit${i}/test.kindex")
+  else
+    echo "${OUT_DIR}/unit${i}/test.kindex" >> "${MANIFEST}"
+  fi
+done
+# A unit whose basename is unique keeps its plain name.
+echo "${REPO_TEST_INDEX}" >> "${MANIFEST}"
+# All units share one stream. Blocks from different workers are interleaved,
+# but each entry must arrive intact. The same units are indexed by several
+# workers, so their facts are duplicated.
+"${INDEXER}" -jobs 4 -dedup_cache_size 1000 -batch_manifest "${MANIFEST}" \
+    "${UNITS[@]}" > "${OUT_DIR}/batch.entries"
+cat "${OUT_DIR}/batch.entries" \
+    | "${VERIFIER}" --ignore_dups=true "${BASE_DIR}/kindex_test.verify"
+cat "${OUT_DIR}/batch.entries" \
+    | "${VERIFIER}" --ignore_dups=true "${BASE_DIR}/kindex_repo_test.verify"
+# Each unit gets its own file. Units whose basenames collide are told apart
+# by their position in the batch.
+ENTRIES_DIR="${OUT_DIR}/entries"
+mkdir -p "${ENTRIES_DIR}"
+"${INDEXER}" -jobs 4 -dedup_cache_size 1000 -batch_manifest "${MANIFEST}" \
+    -output_dir "${ENTRIES_DIR}" "${UNITS[@]}"
+for ((i = 0; i < UNIT_COUNT; ++i)); do
+  if ((i % 2 == 0)); then
+    VERIFY="${BASE_DIR}/kindex_test.verify"
+  else
+    VERIFY="${BASE_DIR}/kindex_repo_test.verify"
+  fi
+  cat "${ENTRIES_DIR}/test.${i}.entries" | "${VERIFIER}" "${VERIFY}"
+done
+cat "${ENTRIES_DIR}/repo_test.entries" \
+    | "${VERIFIER}" "${BASE_DIR}/kindex_repo_test.verify"
+if [[ -e "${ENTRIES_DIR}/test.entries" ]]; then
+  echo "Units with the same basename should get distinct files." >&2
+  exit 1
+fi
@@ -28,7 +28,6 @@
 #include "llvm/Support/raw_ostream.h"
 #include "third_party/llvm/src/clang_builtin_headers.h"
 #include "kythe/cxx/common/kythe_uri.h"
-#include "kythe/cxx/common/proto_conversions.h"
 
 namespace kythe {
 namespace fyi {
@@ -349,42 +348,6 @@ class Action : public clang::ASTFrontendAction,
                     compiler->getFrontendOpts().SkipFunctionBodies);
   }
 
-  /// \brief Copies the tickets from `reply.edge_set` to `request.ticket`.
-  /// \return false if no tickets were copied
-  template <typename Reply, typename Request>
-  bool CopyTicketsFromEdgeSets(const Reply &reply, Request *request) {
-    for (const auto &edge_set : reply.edge_set()) {
-      for (const auto &group : edge_set.group()) {
-        for (const auto &ticket : group.target_ticket()) {
-          request->add_ticket(ticket);
-        }
-      }
-    }
-    return request->ticket_size() != 0;
-  }
-
-  /// \brief Adds the paths of all /kythe/node/file nodes from `reply.node` to
-  /// this Action's `FileTracker`'s include list.
-  template <typename Reply>
-  void AddFileNodesToTracker(const Reply &reply) {
-    for (const auto &parent : reply.node()) {
-      bool is_file = false;
-      for (const auto &fact : parent.fact()) {
-        if (fact.name() == "/kythe/node/kind") {
-          is_file = (fact.value() == "/kythe/node/file");
-          break;
-        }
-      }
-      if (!is_file) {
-        continue;
-      }
-      auto maybe_uri = URI::FromString(parent.ticket());
-      if (maybe_uri.first) {
-        tracker_->TryInclude(maybe_uri.second.v_name().path());
-      }
-    }
-  }
-
   /// \copydoc ExternalSemaSource::CorrectTypo
   clang::TypoCorrection CorrectTypo(
       const clang::DeclarationNameInfo &typo, int lookup_kind,
@@ -395,65 +358,30 @@ class Action : public clang::ASTFrontendAction,
     // Conservatively assume that something went wrong if we had to invoke
     // typo correction.
     tracker_->pass_had_errors_ = true;
-    // Look for any name nodes that could help. We'll batch up several
-    // name node requests to send out at once and see what sticks.
-    proto::VName unqualified_name;
-    proto::SearchRequest name_search_request;
-    name_search_request.mutable_partial()->set_signature(
-        ToStringRef(typo.getAsString() + "#n"));
-    proto::SearchReply name_search_reply;
-    std::string error_text;
-    // Ideally we could use prefix search here, but for the moment we'll
-    // look for exact matches on the signature.
-    if (!factory_.xrefs_->Search(name_search_request, &name_search_reply,
-                                 &error_text)) {
-      fprintf(stderr, "Xrefs error: %s\n", error_text.c_str());
-      return clang::TypoCorrection();
-    }
-    proto::EdgesRequest named_edges_request;
-    for (const auto &ticket : name_search_reply.ticket()) {
-      named_edges_request.add_ticket(ticket);
-    }
-    if (named_edges_request.ticket_size() == 0) {
-      return clang::TypoCorrection();
-    }
-    // We've found at least one interesting name in the graph. Now we need
-    // to figure out which nodes those names are bound to.
-    named_edges_request.add_kind(ToStringRef("%/kythe/edge/named"));
-    proto::EdgesReply named_edges_reply;
-    if (!factory_.xrefs_->Edges(named_edges_request, &named_edges_reply,
-                                &error_text)) {
-      fprintf(stderr, "Xrefs error (named): %s\n", error_text.c_str());
-      return clang::TypoCorrection();
-    }
-    // Get information about the places where those nodes were defined.
-    proto::EdgesRequest defined_edges_request;
-    proto::EdgesReply defined_edges_reply;
-    if (!CopyTicketsFromEdgeSets(named_edges_reply, &defined_edges_request)) {
-      return clang::TypoCorrection();
-    }
-    defined_edges_request.add_kind(ToStringRef("%/kythe/edge/defines"));
-    if (!factory_.xrefs_->Edges(defined_edges_request, &defined_edges_reply,
-                                &error_text)) {
-      fprintf(stderr, "Xrefs error (defines): %s\n", error_text.c_str());
-      return clang::TypoCorrection();
-    }
-    // Finally, figure out whether we can make those definition sites visible
-    // to the site of the typo by adding an include.
-    proto::EdgesRequest childof_request;
-    proto::EdgesReply childof_reply;
-    if (!CopyTicketsFromEdgeSets(defined_edges_reply, &childof_request)) {
-      return clang::TypoCorrection();
+    // We never offer a correction directly. Instead, we remember the
+    // spelling so that every typo in this pass can be looked up at once
+    // in AddIncludesForTypos.
+    typos_.insert(typo.getAsString());
+    return clang::TypoCorrection();
+  }
+
+  /// \brief Looks up the spellings collected by `CorrectTypo` during the
+  /// last pass and adds the files that define them to this Action's
+  /// `FileTracker`'s include list.
+  void AddIncludesForTypos() {
+    if (typos_.empty()) {
+      return;
     }
-    childof_request.add_filter("/kythe/node/kind");
-    childof_request.add_kind(ToStringRef("/kythe/edge/childof"));
-    if (!factory_.xrefs_->Edges(childof_request, &childof_reply, &error_text)) {
-      fprintf(stderr, "Xrefs error (childof): %s\n", error_text.c_str());
-      return clang::TypoCorrection();
+    factory_.ResolveSpellings(typos_);
+    for (const auto &spelling : typos_) {
+      const auto includes = factory_.includes_for_spelling_.find(spelling);
+      if (includes != factory_.includes_for_spelling_.end()) {
+        for (const auto &path : includes->second) {
+          tracker_->TryInclude(path);
+        }
+      }
     }
-    // Add those files to the set of includes to try out.
-    AddFileNodesToTracker(childof_reply);
-    return clang::TypoCorrection();
+    typos_.clear();
   }
 
   FileTracker *tracker() { return tracker_; }
@@ -464,6 +392,9 @@ class Action : public clang::ASTFrontendAction,
 
   /// The `FileTracker` keeping track of the file being processed.
   FileTracker *tracker_ = nullptr;
+
+  /// Identifiers that needed typo correction during the current pass.
+  std::set<std::string> typos_;
 };
 
 void PreprocessorHooks::FileChanged(clang::SourceLocation loc,
@@ -564,6 +495,144 @@ FileTracker *ActionFactory::GetOrCreateTracker(llvm::StringRef filename) {
   return i->second;
 }
 
+bool ActionFactory::FollowEdges(
+    const std::set<std::string> &sources, const std::string &kind,
+    std::map<std::string, std::vector<std::string>> *targets,
+    std::set<std::string> *file_nodes) {
+  if (sources.empty()) {
+    return true;
+  }
+  proto::EdgesRequest request;
+  for (const auto &ticket : sources) {
+    request.add_ticket(ticket);
+  }
+  request.add_kind(kind);
+  if (file_nodes) {
+    request.add_filter("/kythe/node/kind");
+  }
+  // Every source shares one request, so follow the pages until the service
+  // has told us about all of them.
+  do {
+    proto::EdgesReply reply;
+    std::string error_text;
+    if (!xrefs_->Edges(request, &reply, &error_text)) {
+      fprintf(stderr, "Xrefs error (%s): %s\n", kind.c_str(),
+              error_text.c_str());
+      return false;
+    }
+    for (const auto &edge_set : reply.edge_set()) {
+      auto *source_targets = &(*targets)[edge_set.source_ticket()];
+      for (const auto &group : edge_set.group()) {
+        for (const auto &ticket : group.target_ticket()) {
+          source_targets->push_back(ticket);
+        }
+      }
+    }
+    if (file_nodes) {
+      for (const auto &node : reply.node()) {
+        for (const auto &fact : node.fact()) {
+          if (fact.name() == "/kythe/node/kind") {
+            if (fact.value() == "/kythe/node/file") {
+              file_nodes->insert(node.ticket());
+            }
+            break;
+          }
+        }
+      }
+    }
+    request.set_page_token(reply.next_page_token());
+  } while (!request.page_token().empty());
+  return true;
+}
+
+void ActionFactory::ResolveSpellings(const std::set<std::string> &spellings) {
+  std::vector<std::string> unresolved;
+  for (const auto &spelling : spellings) {
+    if (!includes_for_spelling_.count(spelling)) {
+      unresolved.push_back(spelling);
+    }
+  }
+  if (unresolved.empty()) {
+    return;
+  }
+  // Look for the name nodes for each spelling. Search only takes one
+  // pattern at a time, so issue these requests together and let the client
+  // run them concurrently.
+  // Ideally we could use prefix search here, but for the moment we'll
+  // look for exact matches on the signature.
+  std::vector<proto::SearchRequest> search_requests(unresolved.size());
+  for (size_t index = 0; index < unresolved.size(); ++index) {
+    search_requests[index].mutable_partial()->set_signature(unresolved[index] +
+                                                            "#n");
+  }
+  std::vector<proto::SearchReply> search_replies;
+  std::vector<bool> search_succeeded;
+  std::string search_error_text;
+  xrefs_->SearchAll(search_requests, &search_replies, &search_succeeded,
+                    &search_error_text);
+  if (!search_error_text.empty()) {
+    fprintf(stderr, "Xrefs error: %s\n", search_error_text.c_str());
+  }
+  // Figure out which nodes all of those names are bound to, where those
+  // nodes were defined, and which files hold those definitions. Each of
+  // these steps is a single request covering every spelling.
+  std::set<std::string> names;
+  for (size_t index = 0; index < unresolved.size(); ++index) {
+    for (const auto &ticket : search_replies[index].ticket()) {
+      names.insert(ticket);
+    }
+  }
+  std::map<std::string, std::vector<std::string>> named, defined, childof;
+  std::set<std::string> nodes, anchors, files;
+  if (!FollowEdges(names, "%/kythe/edge/named", &named, nullptr)) {
+    return;
+  }
+  for (const auto &name : named) {
+    nodes.insert(name.second.begin(), name.second.end());
+  }
+  if (!FollowEdges(nodes, "%/kythe/edge/defines", &defined, nullptr)) {
+    return;
+  }
+  for (const auto &node : defined) {
+    anchors.insert(node.second.begin(), node.second.end());
+  }
+  if (!FollowEdges(anchors, "/kythe/edge/childof", &childof, &files)) {
+    return;
+  }
+  // Attribute the files we found back to the spellings that led to them.
+  auto targets_of = [](
+      const std::map<std::string, std::vector<std::string>> &edges,
+      const std::set<std::string> &sources) {
+    std::set<std::string> targets;
+    for (const auto &source : sources) {
+      const auto found = edges.find(source);
+      if (found != edges.end()) {
+        targets.insert(found->second.begin(), found->second.end());
+      }
+    }
+    return targets;
+  };
+  for (size_t index = 0; index < unresolved.size(); ++index) {
+    if (!search_succeeded[index]) {
+      continue;
+    }
+    std::set<std::string> spelling_names(
+        search_replies[index].ticket().begin(),
+        search_replies[index].ticket().end());
+    auto *includes = &includes_for_spelling_[unresolved[index]];
+    for (const auto &file : targets_of(
+             childof, targets_of(defined, targets_of(named, spelling_names)))) {
+      if (!files.count(file)) {
+        continue;
+      }
+      auto maybe_uri = URI::FromString(file);
+      if (maybe_uri.first) {
+        includes->push_back(maybe_uri.second.v_name().path());
+      }
+    }
+  }
+}
+
 void ActionFactory::BeginNextIteration() {
   assert(iterations_ > 0);
   --iterations_;
@@ -644,6 +713,7 @@ bool ActionFactory::runInvocation(clang::CompilerInvocation *invocation,
          d != e; ++d) {
       action->tracker()->HandleStoredDiagnostic(*d);
     }
+    action->AddIncludesForTypos();
     clang::Rewriter rewriter(ast_unit->getSourceManager(),
                              ast_unit->getLangOpts());
     if (action->tracker()->Rewrite(&rewriter)) {
@@ -17,6 +17,11 @@
 #ifndef KYTHE_CXX_TOOLS_FYI_FYI_H_
 #define KYTHE_CXX_TOOLS_FYI_FYI_H_
 
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
 #include "clang/Lex/PreprocessorOptions.h"
 #include "clang/Tooling/Tooling.h"
 #include "kythe/cxx/common/net_client.h"
@@ -30,7 +35,8 @@ class FileTracker;
 /// \brief Creates actions for fyi passes.
 class ActionFactory : public clang::tooling::ToolAction {
  public:
-  /// \param xrefs A source for cross-references.
+  /// \param xrefs A source for cross-references. Independent searches are
+  /// issued together through `XrefsClient::SearchAll`.
   /// \param iterations The maximum number of iterations to try before stopping.
   ActionFactory(std::unique_ptr<XrefsClient> xrefs, size_t iterations);
   ~ActionFactory();
@@ -61,6 +67,25 @@ class ActionFactory : public clang::tooling::ToolAction {
   /// The client to use to find cross-references.
   std::unique_ptr<XrefsClient> xrefs_;
 
+  /// \brief Finds the files that define each spelling in `spellings` that
+  /// isn't already in `includes_for_spelling_`, then records them there.
+  void ResolveSpellings(const std::set<std::string> &spellings);
+
+  /// \brief Finds the targets of all edges of kind `kind` from `sources`.
+  /// \param sources The tickets to start from.
+  /// \param kind The edge kind to follow.
+  /// \param targets Maps each source ticket to its targets.
+  /// \param file_nodes If non-null, gains the targets that are file nodes.
+  /// \return false if the xrefs service reported an error.
+  bool FollowEdges(const std::set<std::string> &sources,
+                   const std::string &kind,
+                   std::map<std::string, std::vector<std::string>> *targets,
+                   std::set<std::string> *file_nodes);
+
+  /// Maps identifier spellings to the paths of files that define them.
+  /// Kept across iterations, so each spelling is only looked up once.
+  std::map<std::string, std::vector<std::string>> includes_for_spelling_;
+
   /// \brief Try to find a `FileTracker` for the given path.
   /// \param filename the path to search for
   /// \return the old `FileTracker` for `filename`, or a new one.
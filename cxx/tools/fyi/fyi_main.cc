@@ -14,6 +14,10 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <memory>
+#include <vector>
+
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "clang/Tooling/Tooling.h"
 #include "gflags/gflags.h"
@@ -31,6 +35,9 @@ static cl::OptionCategory fyi_options("Tool options");
 static cl::opt<std::string> xrefs("xrefs",
                                   cl::desc("Base URI for xrefs service"),
                                   cl::init("http://localhost:8080"));
+static cl::opt<unsigned> lookups(
+    "lookups", cl::desc("Number of xrefs lookups to issue concurrently"),
+    cl::init(4));
 
 int main(int argc, const char **argv) {
   GOOGLE_PROTOBUF_VERIFY_VERSION;
@@ -39,8 +46,11 @@ int main(int argc, const char **argv) {
   google::SetUsageMessage("fyi: repair a C++ file with missing includes");
   clang::tooling::CommonOptionsParser options(argc, argv, fyi_options);
   kythe::JsonClient::InitNetwork();
-  auto xrefs_db = llvm::make_unique<kythe::XrefsJsonClient>(
-      llvm::make_unique<kythe::JsonClient>(), xrefs);
+  auto xrefs_db = llvm::make_unique<kythe::XrefsProtoClient>(
+      llvm::make_unique<kythe::JsonClient>(),
+      llvm::make_unique<kythe::AsyncJsonClient>(
+          std::max(1u, lookups.getValue())),
+      xrefs);
   clang::tooling::ClangTool tool(options.getCompilations(),
                                  options.getSourcePathList());
   kythe::fyi::ActionFactory factory(std::move(xrefs_db), 5);
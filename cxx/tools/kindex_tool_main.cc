@@ -25,28 +25,32 @@
 
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 #include "google/protobuf/io/coded_stream.h"
-#include "google/protobuf/io/gzip_stream.h"
 #include "google/protobuf/io/zero_copy_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
 #include "google/protobuf/stubs/common.h"
 #include "google/protobuf/text_format.h"
+#include "kythe/cxx/common/compression.h"
 #include "kythe/proto/analysis.pb.h"
 
 DEFINE_string(assemble, "", "Assemble positional args into output file");
 DEFINE_string(explode, "", "Explode this kindex file into its constituents");
 DEFINE_bool(suppress_details, false, "Suppress CU details.");
+DEFINE_string(compression, "gzip",
+              "Compress assembled files with this codec (gzip or snappy).");
 
 static void DumpIndexFile(const std::string& path) {
   using namespace google::protobuf::io;
   int in_fd = open(path.c_str(), O_RDONLY, S_IREAD | S_IWRITE);
   CHECK_GE(in_fd, 0) << "Couldn't open input file " << path;
   FileInputStream file_input_stream(in_fd);
-  GzipInputStream gzip_input_stream(&file_input_stream);
-  CodedInputStream coded_input_stream(&gzip_input_stream);
+  auto decompressed_stream =
+      kythe::NewDecompressingInputStream(&file_input_stream);
+  CodedInputStream coded_input_stream(decompressed_stream.get());
   google::protobuf::uint32 byte_size;
   bool decoded_unit = false;
   while (coded_input_stream.ReadVarint32(&byte_size)) {
@@ -91,10 +95,12 @@ static void BuildIndexFile(const std::string& outfile,
   CHECK(out_fd >= 0) << "Couldn't open " << outfile << " for writing.";
   {
     FileOutputStream file_output_stream(out_fd);
-    GzipOutputStream::Options options;
-    options.format = GzipOutputStream::GZIP;
-    GzipOutputStream gzip_stream(&file_output_stream, options);
-    CodedOutputStream coded_stream(&gzip_stream);
+    kythe::CompressionCodec codec;
+    CHECK(kythe::ParseCompressionCodec(FLAGS_compression, &codec))
+        << "Unknown codec " << FLAGS_compression;
+    auto compressed_stream =
+        kythe::NewCompressingOutputStream(codec, &file_output_stream);
+    CodedOutputStream coded_stream(compressed_stream.get());
 
     kythe::proto::CompilationUnit unit;
     int in_fd = open(elements[0].c_str(), O_RDONLY, S_IREAD | S_IWRITE);
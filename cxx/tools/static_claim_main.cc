@@ -21,17 +21,27 @@
 
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <map>
-#include <set>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 #include "google/protobuf/io/coded_stream.h"
-#include "google/protobuf/io/gzip_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "kythe/cxx/common/compression.h"
 #include "kythe/cxx/common/index_pack.h"
+#include "kythe/cxx/common/parallel_for.h"
+#include "kythe/cxx/common/static_claim_table.h"
 #include "kythe/cxx/common/vname_ordering.h"
 #include "kythe/proto/analysis.pb.h"
 #include "kythe/proto/claim.pb.h"
@@ -43,16 +53,34 @@ using kythe::proto::VName;
 DEFINE_bool(text, false, "Dump output as text instead of protobuf.");
 DEFINE_bool(show_stats, false, "Show some statistics.");
 DEFINE_string(index_pack, "", "Read from an index pack instead of stdin.");
+DEFINE_string(table_out, "",
+              "Also write the claims to this path as a memory-mappable table "
+              "that the indexer's -static_claim flag accepts.");
+DEFINE_int32(jobs, 1, "The number of compilation units to read concurrently.");
+DEFINE_string(balance, "count",
+              "How to weigh claimables when balancing claims: 'count' gives "
+              "each claimable the same weight, 'size' weighs them by the size "
+              "of their file content, and 'cost_file' uses -cost_file.");
+DEFINE_string(cost_file, "",
+              "With -balance=cost_file, a file with lines of the form "
+              "'<path> <cost>' (for example, previous indexing times). Files "
+              "that aren't listed get the mean listed cost.");
+DEFINE_string(compression, "gzip",
+              "Compress the claim output with this codec (gzip or snappy).");
 
 struct Claimable;
 
 /// \brief Something (like a compilation unit) that can take responsibility for
 /// a claimable object.
 struct Claimant {
+  explicit Claimant(const VName &vname)
+      : vname(vname), claim_count(0), claim_cost(0) {}
   /// \brief This Claimant's VName.
   VName vname;
-  /// \brief The set of confirmed claims that this Claimant has. Non-owning.
-  std::set<Claimable *> claims;
+  /// \brief The number of confirmed claims that this Claimant has.
+  size_t claim_count;
+  /// \brief The total estimated cost of this Claimant's confirmed claims.
+  double claim_cost;
 };
 
 /// \brief Stably compares `Claimants` by vname.
@@ -67,24 +95,124 @@ struct ClaimantPointerLess {
 struct Claimable {
   /// \brief This Claimable's VName.
   VName vname;
+  /// \brief The digest of the file this Claimable is a transcript of. If
+  /// units disagree, the least nonempty digest, so that the choice doesn't
+  /// depend on the order in which units are read.
+  std::string digest;
+  /// \brief The estimated cost of indexing this Claimable. Set by
+  /// `AssignClaims`, once every file size is known.
+  double cost;
   /// \brief Of the `claimants`, which one has responsibility. Non-owning.
   Claimant *elected_claimant;
   /// \brief All of the Claimants that can possibly be given responsibility.
-  std::set<Claimant *, ClaimantPointerLess> claimants;
+  /// Sorted by VName and stripped of duplicates by `AssignClaims`.
+  std::vector<Claimant *> claimants;
 };
 
+/// \brief Estimates how expensive a file will be to index.
+class CostModel {
+ public:
+  virtual ~CostModel() {}
+
+  /// \brief Returns the estimated cost of indexing `claimable`.
+  virtual double Cost(const Claimable &claimable) = 0;
+
+  /// \brief Returns true if the model needs `AddFileSize` to be called with
+  /// the size of every file's content before any claimable is weighed.
+  virtual bool wants_file_sizes() const { return false; }
+
+  /// \brief Records that the file with digest `digest` has `size` bytes.
+  virtual void AddFileSize(const std::string &digest, size_t size) {}
+};
+
+/// \brief Gives every claimable the same cost. This balances claimants by
+/// the number of claims they hold.
+class CountCostModel : public CostModel {
+ public:
+  double Cost(const Claimable &claimable) override { return 1; }
+};
+
+/// \brief Estimates cost by the size of a file's content.
+class FileSizeCostModel : public CostModel {
+ public:
+  double Cost(const Claimable &claimable) override {
+    const auto size = sizes_.find(claimable.digest);
+    // Empty and unknown files still cost something to claim.
+    return size == sizes_.end() ? 1 : std::max<size_t>(1, size->second);
+  }
+
+  bool wants_file_sizes() const override { return true; }
+
+  void AddFileSize(const std::string &digest, size_t size) override {
+    sizes_[digest] = size;
+  }
+
+ private:
+  /// Maps from file digests to content sizes.
+  std::unordered_map<std::string, size_t> sizes_;
+};
+
+/// \brief Looks costs up by file path in a table (perhaps collected from
+/// previous indexing runs).
+class PathCostModel : public CostModel {
+ public:
+  /// \brief Reads `<path> <cost>` lines from `cost_file`.
+  explicit PathCostModel(const std::string &cost_file) {
+    std::ifstream stream(cost_file);
+    CHECK(stream) << "Couldn't open cost file " << cost_file;
+    std::string path;
+    double cost;
+    double total_cost = 0;
+    while (stream >> path >> cost) {
+      costs_[path] = cost;
+      total_cost += cost;
+    }
+    CHECK(stream.eof()) << "Couldn't parse cost file " << cost_file;
+    default_cost_ = costs_.empty() ? 1 : total_cost / costs_.size();
+  }
+
+  double Cost(const Claimable &claimable) override {
+    const auto cost = costs_.find(claimable.vname.path());
+    return cost == costs_.end() ? default_cost_ : cost->second;
+  }
+
+ private:
+  /// Maps from file paths to costs.
+  std::unordered_map<std::string, double> costs_;
+  /// The cost to use for files missing from `costs_`.
+  double default_cost_;
+};
+
+/// \brief Builds the `CostModel` named by `FLAGS_balance`.
+static std::unique_ptr<CostModel> MakeCostModel() {
+  if (FLAGS_balance == "count") {
+    return std::unique_ptr<CostModel>(new CountCostModel());
+  } else if (FLAGS_balance == "size") {
+    return std::unique_ptr<CostModel>(new FileSizeCostModel());
+  } else if (FLAGS_balance == "cost_file") {
+    CHECK(!FLAGS_cost_file.empty()) << "-balance=cost_file needs -cost_file.";
+    return std::unique_ptr<CostModel>(new PathCostModel(FLAGS_cost_file));
+  }
+  LOG(FATAL) << "Unknown -balance strategy " << FLAGS_balance;
+  return nullptr;
+}
+
 /// \brief Populates the compilation unit from a kindex.
 /// \param path Path to the .kindex file.
 /// \param unit Unit proto to fill.
-static void ReadCompilationUnit(const std::string &path,
-                                CompilationUnit *unit) {
+/// \param file_sizes If non-null, filled with the content size of each file
+/// in the .kindex, keyed by digest.
+static void ReadCompilationUnit(
+    const std::string &path, CompilationUnit *unit,
+    std::vector<std::pair<std::string, size_t>> *file_sizes) {
   namespace io = google::protobuf::io;
   CHECK(unit != nullptr);
   int in_fd = ::open(path.c_str(), O_RDONLY, S_IREAD | S_IWRITE);
   CHECK_GE(in_fd, 0) << "Couldn't open input file " << path;
   io::FileInputStream file_input_stream(in_fd);
-  io::GzipInputStream gzip_input_stream(&file_input_stream);
-  io::CodedInputStream coded_input_stream(&gzip_input_stream);
+  auto decompressed_stream =
+      kythe::NewDecompressingInputStream(&file_input_stream);
+  io::CodedInputStream coded_input_stream(decompressed_stream.get());
   google::protobuf::uint32 byte_size;
   bool decoded_unit = false;
   CHECK(coded_input_stream.ReadVarint32(&byte_size))
@@ -93,9 +221,35 @@ static void ReadCompilationUnit(const std::string &path,
   CHECK(unit->ParseFromCodedStream(&coded_input_stream))
       << "Couldn't parse compilation unit from " << path;
   coded_input_stream.PopLimit(limit);
+  if (file_sizes) {
+    coded_input_stream.SetTotalBytesLimit(INT_MAX, -1);
+    while (coded_input_stream.ReadVarint32(&byte_size)) {
+      limit = coded_input_stream.PushLimit(byte_size);
+      kythe::proto::FileData content;
+      CHECK(content.ParseFromCodedStream(&coded_input_stream))
+          << "Couldn't parse file data from " << path;
+      file_sizes->emplace_back(content.info().digest(),
+                               content.content().size());
+      coded_input_stream.PopLimit(limit);
+    }
+  }
   CHECK(file_input_stream.Close());
 }
 
+/// \brief Hashes VNames by their fingerprints.
+struct VNameHash {
+  size_t operator()(const VName &vname) const {
+    return kythe::FingerprintVName(vname);
+  }
+};
+
+/// \brief Compares VNames for equality.
+struct VNameEqual {
+  bool operator()(const VName &lhs, const VName &rhs) const {
+    return kythe::VNameEquals(lhs, rhs);
+  }
+};
+
 /// \brief Maps from vnames to claimants (like compilation units).
 using ClaimantMap = std::map<VName, Claimant, kythe::VNameLess>;
 
@@ -104,29 +258,53 @@ using ClaimantMap = std::map<VName, Claimant, kythe::VNameLess>;
 /// The vname for a claimable with a transcript (like a header file)
 /// is formed from the underlying vname with its signature changed to
 /// include the transcript as a prefix.
-using ClaimableMap = std::map<VName, Claimable, kythe::VNameLess>;
+using ClaimableMap = std::unordered_map<VName, Claimable, VNameHash, VNameEqual>;
 
 /// \brief Generates and exports a mapping from claimants to claimables.
 class ClaimTool {
  public:
+  /// \param cost_model Used to weigh claimables. Not owned.
+  explicit ClaimTool(CostModel *cost_model) : cost_model_(cost_model) {}
+
   /// \brief Selects a claimant for every claimable.
   ///
-  /// We apply a simple heuristic: for every claimable, for every possible
-  /// claimant, we choose the claimant with the fewest claimables assigned to
-  /// it when trying to assign a new claimable.
+  /// We apply a simple heuristic: we visit claimables from the most to the
+  /// least expensive, and assign each one to the possible claimant with the
+  /// lowest total cost so far. When every claimable costs the same, this
+  /// picks the claimant with the fewest claimables assigned to it.
   void AssignClaims() {
-    // claimables_ is sorted by VName.
+    sorted_claimables_.clear();
+    sorted_claimables_.reserve(claimables_.size());
     for (auto &claimable : claimables_) {
       CHECK(!claimable.second.claimants.empty());
-      Claimant *emptiest_claimant = *claimable.second.claimants.begin();
+      auto &claimants = claimable.second.claimants;
+      std::sort(claimants.begin(), claimants.end(), ClaimantPointerLess());
+      claimants.erase(std::unique(claimants.begin(), claimants.end()),
+                      claimants.end());
+      claimable.second.cost = cost_model_->Cost(claimable.second);
+      sorted_claimables_.push_back(&claimable.second);
+    }
+    std::sort(sorted_claimables_.begin(), sorted_claimables_.end(),
+              [](const Claimable *lhs, const Claimable *rhs) {
+                return kythe::VNameLess()(lhs->vname, rhs->vname);
+              });
+    // Break ties in cost by VName so that this assignment is stable.
+    std::vector<Claimable *> by_cost(sorted_claimables_);
+    std::stable_sort(by_cost.begin(), by_cost.end(),
+                     [](const Claimable *lhs, const Claimable *rhs) {
+                       return lhs->cost > rhs->cost;
+                     });
+    for (auto *claimable : by_cost) {
+      Claimant *cheapest_claimant = claimable->claimants.front();
       // claimants is also sorted by VName, so this assignment should be stable.
-      for (auto &claimant : claimable.second.claimants) {
-        if (claimant->claims.size() < emptiest_claimant->claims.size()) {
-          emptiest_claimant = claimant;
+      for (auto *claimant : claimable->claimants) {
+        if (claimant->claim_cost < cheapest_claimant->claim_cost) {
+          cheapest_claimant = claimant;
         }
       }
-      emptiest_claimant->claims.insert(&claimable.second);
-      claimable.second.elected_claimant = emptiest_claimant;
+      ++cheapest_claimant->claim_count;
+      cheapest_claimant->claim_cost += claimable->cost;
+      claimable->elected_claimant = cheapest_claimant;
     }
   }
 
@@ -134,12 +312,12 @@ class ClaimTool {
   /// `FLAGS_text`.
   void WriteClaimFile(int out_fd) {
     if (FLAGS_text) {
-      for (auto &claimable : claimables_) {
-        if (claimable.second.elected_claimant) {
+      for (const auto *claimable : sorted_claimables_) {
+        if (claimable->elected_claimant) {
           ClaimAssignment claim;
           claim.mutable_compilation_v_name()->CopyFrom(
-              claimable.second.elected_claimant->vname);
-          claim.mutable_dependency_v_name()->CopyFrom(claimable.second.vname);
+              claimable->elected_claimant->vname);
+          claim.mutable_dependency_v_name()->CopyFrom(claimable->vname);
           ::printf("%s", claim.DebugString().c_str());
         }
       }
@@ -148,16 +326,18 @@ class ClaimTool {
     namespace io = google::protobuf::io;
     {
       io::FileOutputStream file_output_stream(out_fd);
-      io::GzipOutputStream::Options options;
-      options.format = io::GzipOutputStream::GZIP;
-      io::GzipOutputStream gzip_stream(&file_output_stream, options);
-      io::CodedOutputStream coded_stream(&gzip_stream);
-      for (auto &claimable : claimables_) {
-        const auto &elected_claimant = claimable.second.elected_claimant;
+      kythe::CompressionCodec codec;
+      CHECK(kythe::ParseCompressionCodec(FLAGS_compression, &codec))
+          << "Unknown codec " << FLAGS_compression;
+      auto compressed_stream =
+          kythe::NewCompressingOutputStream(codec, &file_output_stream);
+      io::CodedOutputStream coded_stream(compressed_stream.get());
+      for (const auto *claimable : sorted_claimables_) {
+        const auto &elected_claimant = claimable->elected_claimant;
         if (elected_claimant) {
           ClaimAssignment claim;
           claim.mutable_compilation_v_name()->CopyFrom(elected_claimant->vname);
-          claim.mutable_dependency_v_name()->CopyFrom(claimable.second.vname);
+          claim.mutable_dependency_v_name()->CopyFrom(claimable->vname);
           coded_stream.WriteVarint32(claim.ByteSize());
           CHECK(claim.SerializeToCodedStream(&coded_stream));
         }
@@ -167,16 +347,31 @@ class ClaimTool {
     CHECK(::close(out_fd) == 0) << "errno was: " << errno;
   }
 
+  /// \brief Export claim data to `path` as a `kythe::StaticClaimTable`.
+  /// \param error_text Non-null; used to return error details.
+  /// \return false on failure and true on success.
+  bool WriteClaimTable(const std::string &path, std::string *error_text) {
+    kythe::StaticClaimTableBuilder builder;
+    for (const auto *claimable : sorted_claimables_) {
+      const auto &elected_claimant = claimable->elected_claimant;
+      if (elected_claimant) {
+        builder.AddClaim(claimable->vname, elected_claimant->vname);
+      }
+    }
+    return builder.WriteToFile(path, error_text);
+  }
+
   /// \brief Add `unit` as a possible claimant and remember all of its
   /// dependencies (and their different transcripts) as claimables.
   void HandleCompilationUnit(const CompilationUnit &unit) {
     auto insert_result =
-        claimants_.emplace(unit.v_name(), Claimant{unit.v_name()});
+        claimants_.emplace(unit.v_name(), Claimant(unit.v_name()));
     if (!insert_result.second) {
       LOG(WARNING) << "Compilation unit with name "
                    << unit.v_name().DebugString()
                    << " had the same VName as another previous unit.";
     }
+    Claimant *claimant = &insert_result.first->second;
     for (auto &input : unit.required_input()) {
       ++total_input_count_;
       if (input.context_size()) {
@@ -198,17 +393,11 @@ class ClaimTool {
           VName cxt_vname = input_vname;
           cxt_vname.set_signature(row.source_context() +
                                   input_vname.signature());
-          auto input_insert_result =
-              claimables_.emplace(cxt_vname, Claimable{cxt_vname, nullptr});
-          input_insert_result.first->second.claimants.insert(
-              &insert_result.first->second);
+          AddClaimant(cxt_vname, input, claimant);
         }
       } else {
         ++total_include_count_;
-        auto input_insert_result = claimables_.emplace(
-            input.v_name(), Claimable{input.v_name(), nullptr});
-        input_insert_result.first->second.claimants.insert(
-            &insert_result.first->second);
+        AddClaimant(input.v_name(), input, claimant);
       }
     }
   }
@@ -219,37 +408,109 @@ class ClaimTool {
   size_t total_input_count() const { return total_input_count_; }
 
  private:
+  /// \brief Records that `claimant` could take responsibility for the
+  /// claimable named `vname`, which is a transcript of `input`.
+  void AddClaimant(const VName &vname,
+                   const CompilationUnit::FileInput &input,
+                   Claimant *claimant) {
+    auto found = claimables_.find(vname);
+    if (found == claimables_.end()) {
+      found = claimables_
+                  .emplace(vname, Claimable{vname, input.info().digest(), 0,
+                                            nullptr})
+                  .first;
+    } else if (!input.info().digest().empty() &&
+               (found->second.digest.empty() ||
+                input.info().digest() < found->second.digest)) {
+      found->second.digest = input.info().digest();
+    }
+    // Duplicates are removed by `AssignClaims`; searching for them here
+    // would be quadratic in the number of units that share a header.
+    found->second.claimants.push_back(claimant);
+  }
+
+  /// Weighs claimables. Not owned.
+  CostModel *cost_model_;
   /// Objects that may claim resources.
   ClaimantMap claimants_;
   /// Resources that may be claimed.
   ClaimableMap claimables_;
+  /// `claimables_` sorted by VName; filled by `AssignClaims`.
+  std::vector<Claimable *> sorted_claimables_;
   /// Number of required inputs.
   size_t total_include_count_ = 0;
   /// Number of #includes.
   size_t total_input_count_ = 0;
 };
 
+/// \brief Reads compilation units on `FLAGS_jobs` threads and hands them to
+/// `tool` one at a time.
+/// \param unit_ids The .kindex paths or index pack unit hashes to read.
+/// \param pack The index pack to read from, or null to read .kindex files.
+static void ReadCompilationUnits(const std::vector<std::string> &unit_ids,
+                                 kythe::IndexPack *pack, ClaimTool *tool,
+                                 CostModel *cost_model) {
+  std::mutex tool_mutex;
+  // Digests whose sizes some worker has read or is reading from the pack.
+  // Inputs are shared by many units, so each one is decompressed only once.
+  std::mutex sized_digests_mutex;
+  std::unordered_set<std::string> sized_digests;
+  auto claim_digest = [&](const std::string &digest) {
+    std::lock_guard<std::mutex> lock(sized_digests_mutex);
+    return sized_digests.insert(digest).second;
+  };
+  CHECK_GT(FLAGS_jobs, 0) << "-jobs must be positive.";
+  kythe::ParallelFor(unit_ids.size(), FLAGS_jobs, [&](size_t i) {
+    CompilationUnit unit;
+    std::vector<std::pair<std::string, size_t>> file_sizes;
+    if (pack) {
+      std::string error_text;
+      CHECK(pack->ReadCompilationUnit(unit_ids[i], &unit, &error_text))
+          << "Error reading unit " << unit_ids[i] << ": " << error_text;
+      if (cost_model->wants_file_sizes()) {
+        for (const auto &input : unit.required_input()) {
+          std::string content;
+          if (claim_digest(input.info().digest()) &&
+              pack->ReadFileData(input.info().digest(), &content)) {
+            file_sizes.emplace_back(input.info().digest(), content.size());
+          }
+        }
+      }
+    } else {
+      ReadCompilationUnit(unit_ids[i], &unit, cost_model->wants_file_sizes()
+                                                  ? &file_sizes
+                                                  : nullptr);
+    }
+    std::lock_guard<std::mutex> lock(tool_mutex);
+    for (const auto &size : file_sizes) {
+      cost_model->AddFileSize(size.first, size.second);
+    }
+    tool->HandleCompilationUnit(unit);
+  });
+}
+
 int main(int argc, char *argv[]) {
   GOOGLE_PROTOBUF_VERIFY_VERSION;
   google::InitGoogleLogging(argv[0]);
   google::SetVersionString("0.1");
   google::SetUsageMessage("static_claim: assign ownership for analysis");
   google::ParseCommandLineFlags(&argc, &argv, true);
-  std::string next_index_file;
-  ClaimTool tool;
+  std::unique_ptr<CostModel> cost_model = MakeCostModel();
+  ClaimTool tool(cost_model.get());
+  std::vector<std::string> unit_ids;
   if (FLAGS_index_pack.empty()) {
+    std::string next_index_file;
     while (getline(std::cin, next_index_file)) {
       if (next_index_file.empty()) {
         continue;
       }
-      CompilationUnit unit;
-      ReadCompilationUnit(next_index_file, &unit);
-      tool.HandleCompilationUnit(unit);
+      unit_ids.push_back(next_index_file);
     }
     if (!std::cin.eof()) {
       ::fprintf(stderr, "Error reading from standard input.\n");
       return 1;
     }
+    ReadCompilationUnits(unit_ids, nullptr, &tool, cost_model.get());
   } else {
     std::string error_text;
     auto filesystem = kythe::IndexPackPosixFilesystem::Open(
@@ -260,30 +521,38 @@ int main(int argc, char *argv[]) {
       return 1;
     }
     kythe::IndexPack pack(std::move(filesystem));
-    if (!pack.ScanData(
-            kythe::IndexPackFilesystem::DataKind::kCompilationUnit,
-            [&tool, &pack](const std::string &file_id) {
-              std::string error_text;
-              CompilationUnit unit;
-              CHECK(pack.ReadCompilationUnit(file_id, &unit, &error_text))
-                  << "Error reading unit " << file_id << ": " << error_text;
-              tool.HandleCompilationUnit(unit);
-              return true;
-            },
-            &error_text)) {
+    if (!pack.ScanData(kythe::IndexPackFilesystem::DataKind::kCompilationUnit,
+                       [&unit_ids](const std::string &file_id) {
+                         unit_ids.push_back(file_id);
+                         return true;
+                       },
+                       &error_text)) {
       ::fprintf(stderr, "Error scanning index pack: %s\n", error_text.c_str());
       return 1;
     }
+    ReadCompilationUnits(unit_ids, &pack, &tool, cost_model.get());
   }
   tool.AssignClaims();
   tool.WriteClaimFile(STDOUT_FILENO);
+  if (!FLAGS_table_out.empty()) {
+    std::string error_text;
+    if (!tool.WriteClaimTable(FLAGS_table_out, &error_text)) {
+      ::fprintf(stderr, "Error writing claim table: %s\n", error_text.c_str());
+      return 1;
+    }
+  }
   if (FLAGS_show_stats) {
+    double max_cost = 0;
+    for (const auto &claimant : tool.claimants()) {
+      max_cost = std::max(max_cost, claimant.second.claim_cost);
+    }
     ::printf("Number of claimables: %lu\n", tool.claimables().size());
     ::printf(" Number of claimants: %lu\n", tool.claimants().size());
     ::printf("   Total input count: %lu\n", tool.total_input_count());
     ::printf(" Total include count: %lu\n", tool.total_include_count());
     ::printf("%%claimables/includes: %f\n",
              tool.claimables().size() * 100.0 / tool.total_include_count());
+    ::printf("  Max claimant cost: %f\n", max_cost);
   }
   return 0;
 }
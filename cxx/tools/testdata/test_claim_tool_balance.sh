@@ -0,0 +1,36 @@
+#!/bin/bash -e
+# This script checks that the claiming tool's -balance strategies weigh
+# claimables as documented, and that reading units on several threads (from
+# .kindex files or from an index pack) doesn't change the assignment.
+BASE_DIR="$TEST_SRCDIR/kythe/cxx/tools/testdata"
+OUT_DIR="$TEST_TMPDIR"
+KINDEX_TOOL_BIN="kythe/cxx/tools/kindex_tool"
+CLAIM_TOOL_BIN="kythe/cxx/tools/static_claim"
+INDEX_PACK_BIN="kythe/go/platform/tools/indexpack"
+
+mkdir -p "${OUT_DIR}"
+# Both units require a.h (96 bytes), b.h (7 bytes) and c.h (7 bytes).
+"${KINDEX_TOOL_BIN}" -assemble "${OUT_DIR}/balance_test_1.kindex" \
+  "${BASE_DIR}/balance_test_1.kindex_UNIT" "${BASE_DIR}"/balance_test.kindex_*
+"${KINDEX_TOOL_BIN}" -assemble "${OUT_DIR}/balance_test_2.kindex" \
+  "${BASE_DIR}/balance_test_2.kindex_UNIT" "${BASE_DIR}"/balance_test.kindex_*
+rm -rf -- "${OUT_DIR}/balance_pack"
+"${INDEX_PACK_BIN}" -quiet=true --to_archive "${OUT_DIR}/balance_pack" \
+    "${OUT_DIR}"/balance_test_*.kindex >/dev/null
+# Claimables are visited from the most to the least expensive (ties broken
+# by VName) and each goes to the cheapest claimant so far.
+#  count: a.h = 1, b.h = 2 (1 has 1), c.h = 1 (tied at 1; 1 is first).
+#  size: a.h = 1, b.h = 2 (0 < 96), c.h = 2 (7 < 96).
+#  cost_file (a.h 1, b.h 1, c.h 5): c.h = 1, a.h = 2 (0 < 5), b.h = 2.
+for jobs in 1 4; do
+  for strategy in count size cost_file; do
+    ls "${OUT_DIR}"/balance_test_*.kindex \
+        | "${CLAIM_TOOL_BIN}" -text -jobs="${jobs}" -balance="${strategy}" \
+            -cost_file="${BASE_DIR}/balance_test.costs" \
+        | diff "${BASE_DIR}/balance_test_${strategy}.expected" -
+    "${CLAIM_TOOL_BIN}" -text -jobs="${jobs}" -balance="${strategy}" \
+        -cost_file="${BASE_DIR}/balance_test.costs" \
+        -index_pack "${OUT_DIR}/balance_pack" \
+        | diff "${BASE_DIR}/balance_test_${strategy}.expected" -
+  done
+done
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "entry_reader.h"
+
+#include <limits.h>
+
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+
+namespace kythe {
+namespace verifier {
+
+constexpr size_t EntryReader::kBatchSize;
+constexpr size_t EntryReader::kMaxQueuedBatches;
+
+EntryReader::~EntryReader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled_ = true;
+  }
+  changed_.notify_all();
+  thread_.join();
+}
+
+bool EntryReader::NextBatch(std::vector<kythe::proto::Entry> *batch) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this]() { return !batches_.empty() || done_; });
+  if (batches_.empty()) {
+    return false;
+  }
+  batch->swap(batches_.front());
+  batches_.pop_front();
+  changed_.notify_all();
+  return true;
+}
+
+bool EntryReader::had_error() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return had_error_;
+}
+
+void EntryReader::ReadAll(int fd) {
+  google::protobuf::uint32 byte_size;
+  google::protobuf::io::FileInputStream raw_input(fd);
+  google::protobuf::io::CodedInputStream coded_input(&raw_input);
+  coded_input.SetTotalBytesLimit(INT_MAX, -1);
+  std::vector<kythe::proto::Entry> batch;
+  bool ok = true;
+  while (coded_input.ReadVarint32(&byte_size)) {
+    auto limit = coded_input.PushLimit(byte_size);
+    batch.emplace_back();
+    if (!batch.back().ParseFromCodedStream(&coded_input)) {
+      batch.pop_back();
+      ok = false;
+      break;
+    }
+    coded_input.PopLimit(limit);
+    if (batch.size() == kBatchSize && !Push(&batch)) {
+      return;
+    }
+  }
+  if (!batch.empty()) {
+    Push(&batch);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  had_error_ = !ok;
+  done_ = true;
+  changed_.notify_all();
+}
+
+bool EntryReader::Push(std::vector<kythe::proto::Entry> *batch) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this]() {
+    return batches_.size() < kMaxQueuedBatches || cancelled_;
+  });
+  if (cancelled_) {
+    return false;
+  }
+  batches_.emplace_back();
+  batches_.back().swap(*batch);
+  changed_.notify_all();
+  return true;
+}
+
+}  // namespace verifier
+}  // namespace kythe
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_VERIFIER_ENTRY_READER_H_
+#define KYTHE_CXX_VERIFIER_ENTRY_READER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "kythe/proto/storage.pb.h"
+
+namespace kythe {
+namespace verifier {
+
+/// \brief Reads length-delimited `Entry` messages from a file descriptor.
+///
+/// Reading and parsing happen on a separate thread, so they overlap with
+/// the (single-threaded) work of adding facts to the `Verifier`.
+class EntryReader {
+ public:
+  /// The number of entries to hand over at once.
+  static constexpr size_t kBatchSize = 1024;
+  /// The number of batches to read ahead.
+  static constexpr size_t kMaxQueuedBatches = 8;
+
+  /// \brief Starts reading from `fd`, which must stay open until the
+  /// `EntryReader` is destroyed.
+  explicit EntryReader(int fd) : thread_([this, fd]() { ReadAll(fd); }) {}
+
+  /// \brief Stops reading (if it hasn't already finished) and waits for the
+  /// reader thread to exit.
+  ~EntryReader();
+
+  /// \brief Replaces the contents of `batch` with the next entries read.
+  /// \return false once all entries have been returned.
+  bool NextBatch(std::vector<kythe::proto::Entry> *batch);
+
+  /// \brief Returns true if reading stopped because of a malformed entry.
+  /// Only meaningful after `NextBatch` has returned false.
+  bool had_error();
+
+ private:
+  void ReadAll(int fd);
+
+  /// \brief Queues `batch` (leaving it empty), waiting for room if needed.
+  /// \return false if the reader was cancelled.
+  bool Push(std::vector<kythe::proto::Entry> *batch);
+
+  /// Guards all of the fields below.
+  std::mutex mutex_;
+  /// Signalled whenever `batches_`, `done_` or `cancelled_` changes.
+  std::condition_variable changed_;
+  /// Batches that have been read but not yet returned.
+  std::deque<std::vector<kythe::proto::Entry>> batches_;
+  /// Set when the reader has queued its last batch.
+  bool done_ = false;
+  /// Set when the reader stopped at a malformed entry.
+  bool had_error_ = false;
+  /// Set when the consumer no longer wants entries.
+  bool cancelled_ = false;
+  /// The thread running `ReadAll`. Started last, after the fields above are
+  /// initialized.
+  std::thread thread_;
+};
+
+}  // namespace verifier
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_VERIFIER_ENTRY_READER_H_
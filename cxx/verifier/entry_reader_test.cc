@@ -0,0 +1,287 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "entry_reader.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "glog/logging.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "google/protobuf/stubs/common.h"
+#include "gtest/gtest.h"
+
+#include "verifier.h"
+
+namespace kythe {
+namespace verifier {
+namespace {
+
+/// \brief Returns a fresh path for a temporary file. Nothing exists at the
+/// path yet.
+std::string TempPath() {
+  const char *tmpdir = getenv("TEST_TMPDIR");
+  std::string path = std::string(tmpdir ? tmpdir : "/tmp") + "/entriesXXXXXX";
+  int fd = mkstemp(&path[0]);
+  EXPECT_GE(fd, 0);
+  close(fd);
+  unlink(path.c_str());
+  return path;
+}
+
+/// \brief Writes `entries` to `path` in the verifier's input format,
+/// followed by `trailer` verbatim.
+void WriteEntries(const std::string &path,
+                  const std::vector<kythe::proto::Entry> &entries,
+                  const std::string &trailer = "") {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  ASSERT_GE(fd, 0);
+  {
+    google::protobuf::io::FileOutputStream raw_output(fd);
+    google::protobuf::io::CodedOutputStream coded_output(&raw_output);
+    for (const auto &entry : entries) {
+      coded_output.WriteVarint32(entry.ByteSize());
+      entry.SerializeWithCachedSizes(&coded_output);
+    }
+    coded_output.WriteRaw(trailer.data(), trailer.size());
+  }
+  close(fd);
+}
+
+/// \brief Reads all of the entries in `path` with an `EntryReader`.
+/// \return the value of `had_error()` once the reader is done.
+bool ReadEntries(const std::string &path,
+                 std::vector<kythe::proto::Entry> *entries) {
+  int fd = open(path.c_str(), O_RDONLY);
+  EXPECT_GE(fd, 0);
+  bool had_error;
+  {
+    EntryReader reader(fd);
+    std::vector<kythe::proto::Entry> batch;
+    while (reader.NextBatch(&batch)) {
+      EXPECT_LE(batch.size(), EntryReader::kBatchSize);
+      entries->insert(entries->end(), batch.begin(), batch.end());
+    }
+    had_error = reader.had_error();
+  }
+  close(fd);
+  return had_error;
+}
+
+/// \brief Returns `count` distinct facts, each on its own node.
+std::vector<kythe::proto::Entry> MakeContentFacts(size_t count) {
+  std::vector<kythe::proto::Entry> entries(count);
+  for (size_t i = 0; i < count; ++i) {
+    entries[i].mutable_source()->set_root(std::to_string(i));
+    entries[i].set_fact_name("/kythe/content");
+    entries[i].set_fact_value(std::to_string(i));
+  }
+  return entries;
+}
+
+TEST(EntryReaderTest, ReadsNothingFromEmptyInput) {
+  std::string path = TempPath();
+  WriteEntries(path, {});
+  std::vector<kythe::proto::Entry> read;
+  EXPECT_FALSE(ReadEntries(path, &read));
+  EXPECT_TRUE(read.empty());
+  unlink(path.c_str());
+}
+
+TEST(EntryReaderTest, ReadsEntriesInOrderAcrossBatches) {
+  std::string path = TempPath();
+  auto entries = MakeContentFacts(3 * EntryReader::kBatchSize + 7);
+  WriteEntries(path, entries);
+  std::vector<kythe::proto::Entry> read;
+  EXPECT_FALSE(ReadEntries(path, &read));
+  ASSERT_EQ(entries.size(), read.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    EXPECT_EQ(entries[i].SerializeAsString(), read[i].SerializeAsString());
+  }
+  unlink(path.c_str());
+}
+
+TEST(EntryReaderTest, StopsAtMalformedEntry) {
+  std::string path = TempPath();
+  auto entries = MakeContentFacts(EntryReader::kBatchSize + 1);
+  // A one-byte entry holding a tag with an invalid wire type.
+  WriteEntries(path, entries, std::string("\x01\x0f", 2));
+  std::vector<kythe::proto::Entry> read;
+  EXPECT_TRUE(ReadEntries(path, &read));
+  // Everything before the malformed entry is still returned.
+  ASSERT_EQ(entries.size(), read.size());
+  EXPECT_EQ(entries.back().SerializeAsString(),
+            read.back().SerializeAsString());
+  unlink(path.c_str());
+}
+
+TEST(EntryReaderTest, CanBeDestroyedBeforeReadingEverything) {
+  std::string path = TempPath();
+  // Enough entries that the reader thread has to wait for room.
+  WriteEntries(path, MakeContentFacts((EntryReader::kMaxQueuedBatches + 2) *
+                                      EntryReader::kBatchSize));
+  int fd = open(path.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  {
+    EntryReader reader(fd);
+    std::vector<kythe::proto::Entry> batch;
+    ASSERT_TRUE(reader.NextBatch(&batch));
+    EXPECT_EQ(EntryReader::kBatchSize, batch.size());
+  }
+  close(fd);
+  unlink(path.c_str());
+}
+
+/// \brief Loads the rules in `rule_path` and the entries in `entry_path`
+/// into `verifier`, reading the entries on the calling thread.
+/// \return false if the entries could not be read.
+bool LoadInline(const std::string &rule_path, const std::string &entry_path,
+                Verifier *verifier) {
+  EXPECT_TRUE(verifier->LoadInlineRuleFile(rule_path));
+  static std::string dbname = "database";
+  int fd = open(entry_path.c_str(), O_RDONLY);
+  EXPECT_GE(fd, 0);
+  google::protobuf::uint32 byte_size;
+  google::protobuf::io::FileInputStream raw_input(fd);
+  google::protobuf::io::CodedInputStream coded_input(&raw_input);
+  coded_input.SetTotalBytesLimit(INT_MAX, -1);
+  bool ok = true;
+  size_t facts = 0;
+  while (coded_input.ReadVarint32(&byte_size)) {
+    auto limit = coded_input.PushLimit(byte_size);
+    kythe::proto::Entry entry;
+    if (!entry.ParseFromCodedStream(&coded_input)) {
+      ok = false;
+      break;
+    }
+    coded_input.PopLimit(limit);
+    verifier->AssertSingleFact(&dbname, facts++, entry);
+  }
+  close(fd);
+  return ok;
+}
+
+/// \brief Loads the rules in `rule_path` and the entries in `entry_path`
+/// into `verifier`, reading the entries with an `EntryReader`.
+/// \return false if the entries could not be read.
+bool LoadWithReader(const std::string &rule_path,
+                    const std::string &entry_path, Verifier *verifier) {
+  EXPECT_TRUE(verifier->LoadInlineRuleFile(rule_path));
+  static std::string dbname = "database";
+  int fd = open(entry_path.c_str(), O_RDONLY);
+  EXPECT_GE(fd, 0);
+  bool had_error;
+  {
+    EntryReader reader(fd);
+    std::vector<kythe::proto::Entry> batch;
+    size_t facts = 0;
+    while (reader.NextBatch(&batch)) {
+      for (const auto &entry : batch) {
+        verifier->AssertSingleFact(&dbname, facts++, entry);
+      }
+    }
+    had_error = reader.had_error();
+  }
+  close(fd);
+  return !had_error;
+}
+
+/// \brief Checks that `rules` have the same outcome against `entries`
+/// whether the entries are read inline or with an `EntryReader`.
+/// \return whether the goals were satisfied.
+bool VerifiesSameWayFromReader(const std::string &rules,
+                               const std::vector<kythe::proto::Entry> &entries,
+                               const std::string &trailer = "") {
+  std::string rule_path = TempPath();
+  FILE *rule_file = fopen(rule_path.c_str(), "w");
+  EXPECT_TRUE(rule_file != nullptr);
+  fputs(rules.c_str(), rule_file);
+  fclose(rule_file);
+  std::string entry_path = TempPath();
+  WriteEntries(entry_path, entries, trailer);
+  Verifier inline_verifier;
+  Verifier reader_verifier;
+  bool inline_read = LoadInline(rule_path, entry_path, &inline_verifier);
+  EXPECT_EQ(inline_read,
+            LoadWithReader(rule_path, entry_path, &reader_verifier));
+  bool inline_prepared = inline_verifier.PrepareDatabase();
+  EXPECT_EQ(inline_prepared, reader_verifier.PrepareDatabase());
+  bool inline_verified = inline_prepared && inline_verifier.VerifyAllGoals();
+  EXPECT_EQ(inline_verified,
+            inline_prepared && reader_verifier.VerifyAllGoals());
+  EXPECT_EQ(inline_verifier.highest_group_reached(),
+            reader_verifier.highest_group_reached());
+  EXPECT_EQ(inline_verifier.highest_goal_reached(),
+            reader_verifier.highest_goal_reached());
+  unlink(rule_path.c_str());
+  unlink(entry_path.c_str());
+  return inline_read && inline_verified;
+}
+
+TEST(EntryReaderTest, ReaderFactsSatisfySameGoals) {
+  auto entries = MakeContentFacts(2 * EntryReader::kBatchSize + 1);
+  kythe::proto::Entry edge;
+  edge.mutable_source()->set_root("0");
+  edge.set_edge_kind("/kythe/edge/defines");
+  edge.mutable_target()->set_root(std::to_string(entries.size() - 1));
+  edge.set_fact_name("/");
+  entries.push_back(edge);
+  EXPECT_TRUE(VerifiesSameWayFromReader(R"(//- First.content 0
+//- Last.content 2048
+//- First defines Last
+)",
+                                        entries));
+}
+
+TEST(EntryReaderTest, ReaderFactsFailSameGoals) {
+  auto entries = MakeContentFacts(2 * EntryReader::kBatchSize + 1);
+  EXPECT_FALSE(VerifiesSameWayFromReader(R"(//- First.content 0
+//- Missing.content 4096
+)",
+                                         entries));
+}
+
+TEST(EntryReaderTest, ReaderFactsConflictTheSameWay) {
+  auto entries = MakeContentFacts(EntryReader::kBatchSize);
+  // Conflicts with the first fact, but arrives in a later batch.
+  entries.push_back(entries.front());
+  entries.back().set_fact_value("conflict");
+  EXPECT_FALSE(VerifiesSameWayFromReader("//- First.content 0\n", entries));
+}
+
+TEST(EntryReaderTest, ReaderStopsAtSameMalformedEntry) {
+  auto entries = MakeContentFacts(EntryReader::kBatchSize + 1);
+  EXPECT_FALSE(VerifiesSameWayFromReader("//- Last.content 1024\n", entries,
+                                         std::string("\x01\x0f", 2)));
+}
+
+}  // anonymous namespace
+}  // namespace verifier
+}  // namespace kythe
+
+int main(int argc, char **argv) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  ::google::InitGoogleLogging(argv[0]);
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
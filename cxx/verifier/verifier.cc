@@ -16,8 +16,11 @@
 
 #include "verifier.h"
 
+#include <algorithm>
+
 #include "glog/logging.h"
 #include "google/protobuf/text_format.h"
+#include "kythe/cxx/common/parallel_for.h"
 
 #include "assertions.h"
 #include "kythe/proto/storage.pb.h"
@@ -42,6 +45,69 @@ static ThunkRet kFirstCut = {3};
 
 typedef const std::function<ThunkRet()> &Thunk;
 
+/// \brief Mixes `value` into the hash `seed`.
+static size_t HashCombine(size_t seed, size_t value) {
+  return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+/// \brief Hashes `node`, which must not contain any unbound `EVar`s.
+///
+/// Terms that unify (once all `EVar`s are substituted away) always have
+/// the same hash.
+/// \return false if `node` contains an unbound `EVar`.
+static bool HashGroundTerm(AstNode *node, size_t *hash) {
+  if (EVar *evar = node->AsEVar()) {
+    return evar->current() != nullptr && HashGroundTerm(evar->current(), hash);
+  } else if (Identifier *identifier = node->AsIdentifier()) {
+    *hash = HashCombine(1, identifier->symbol());
+    return true;
+  } else if (App *app = node->AsApp()) {
+    size_t lhs, rhs;
+    if (!HashGroundTerm(app->lhs(), &lhs) ||
+        !HashGroundTerm(app->rhs(), &rhs)) {
+      return false;
+    }
+    *hash = HashCombine(HashCombine(2, lhs), rhs);
+    return true;
+  } else if (Tuple *tuple = node->AsTuple()) {
+    size_t tuple_hash = HashCombine(3, tuple->size());
+    for (size_t i = 0, c = tuple->size(); i != c; ++i) {
+      size_t element;
+      if (!HashGroundTerm(tuple->element(i), &element)) {
+        return false;
+      }
+      tuple_hash = HashCombine(tuple_hash, element);
+    }
+    *hash = tuple_hash;
+    return true;
+  }
+  return false;
+}
+
+/// \brief Appends every `EVar` in `node` to `evars`.
+static void CollectEVars(AstNode *node, std::vector<EVar *> *evars) {
+  if (EVar *evar = node->AsEVar()) {
+    evars->push_back(evar);
+  } else if (App *app = node->AsApp()) {
+    CollectEVars(app->lhs(), evars);
+    CollectEVars(app->rhs(), evars);
+  } else if (Tuple *tuple = node->AsTuple()) {
+    for (size_t i = 0, c = tuple->size(); i != c; ++i) {
+      CollectEVars(tuple->element(i), evars);
+    }
+  }
+}
+
+/// \brief Finds the representative of `index` in the disjoint-set forest
+/// `parents`, compressing paths along the way.
+static size_t FindSet(std::vector<size_t> *parents, size_t index) {
+  while ((*parents)[index] != index) {
+    (*parents)[index] = (*parents)[(*parents)[index]];
+    index = (*parents)[index];
+  }
+  return index;
+}
+
 static std::string *kDefaultDatabase = new std::string("builtin");
 static std::string *kStandardIn = new std::string("-");
 
@@ -139,12 +205,15 @@ class Solver {
     return f_ret;
   }
 
-  // TODO(zarko): For databases of nontrivial size this is obviously too
-  // expensive. Consider indexing the database. Optimizing for #fact-headed
-  // atoms with #vnodes at locations 0 and 2 is probably a very good idea.
   ThunkRet MatchAtomVersusDatabase(AstNode *atom, ThunkRet cut, Thunk f) {
-    for (size_t fact = 0; fact < database_.size(); ++fact) {
-      ThunkRet exc = Unify(atom, database_[fact], cut, f);
+    // Facts that disagree with a bound source, edge kind or target can't
+    // unify with `atom`, so we only need to try the ones that agree.
+    const Database *candidates = context_.CandidateFacts(atom);
+    if (candidates == nullptr) {
+      candidates = &database_;
+    }
+    for (size_t fact = 0; fact < candidates->size(); ++fact) {
+      ThunkRet exc = Unify(atom, (*candidates)[fact], cut, f);
       if (exc != kNoException) {
         return exc;
       }
@@ -203,29 +272,55 @@ class Solver {
     return true;
   }
 
-  ThunkRet SolveGoalGroups(AssertionParser *context, Thunk f) {
-    for (size_t cur = 0, cut = kFirstCut; cur < context->groups().size();
-         ++cur, ++cut) {
-      auto *group = &context->groups()[cur];
-      if (cur > highest_group_reached_) {
-        highest_goal_reached_ = 0;
-        highest_group_reached_ = cur;
+  /// \brief Solves the goal group at index `cur`. If the group succeeds,
+  /// the assignments it made are kept.
+  /// \return kSolved if the group's outcome is acceptable, kNoException if
+  /// it isn't, or kInvalidProgram.
+  ThunkRet SolveGoalGroup(AssertionParser *context, size_t cur) {
+    ThunkRet cut = kFirstCut + cur;
+    auto *group = &context->groups()[cur];
+    if (cur > highest_group_reached_) {
+      highest_goal_reached_ = 0;
+      highest_group_reached_ = cur;
+    }
+    ThunkRet result = SolveGoalArray(group, 0, cut, [cut]() { return cut; });
+    // Lots of unwinding later...
+    if (result == cut) {
+      // That last goal group succeeded.
+      return group->accept_if == AssertionParser::GoalGroup::kNoneMayFail
+                 ? kSolved
+                 : kNoException;
+    } else if (result == kNoException) {
+      // That last goal group failed.
+      return group->accept_if == AssertionParser::GoalGroup::kSomeMustFail
+                 ? kSolved
+                 : kNoException;
+    }
+    return result;
+  }
+
+  /// \brief Solves the goal groups at `group_indices` (in that order),
+  /// stopping at the first one whose outcome isn't acceptable. Doesn't
+  /// perform inspections.
+  /// \return kSolved if all of the groups' outcomes were acceptable,
+  /// kNoException if one wasn't, or kInvalidProgram.
+  ThunkRet SolveGoalGroupSequence(AssertionParser *context,
+                                  const std::vector<size_t> &group_indices) {
+    for (size_t cur : group_indices) {
+      ThunkRet result = SolveGoalGroup(context, cur);
+      if (result != kSolved) {
+        return result;
       }
-      ThunkRet result = SolveGoalArray(
-          group, 0, cut,
-          [this, context, group, cur, cut, &f]() { return cut; });
-      // Lots of unwinding later...
-      if (result == cut) {
-        // That last goal group succeeded.
-        if (group->accept_if != AssertionParser::GoalGroup::kNoneMayFail) {
-          return PerformInspection() ? kNoException : kInvalidProgram;
-        }
-      } else if (result == kNoException) {
-        // That last goal group failed.
-        if (group->accept_if != AssertionParser::GoalGroup::kSomeMustFail) {
-          return PerformInspection() ? kNoException : kInvalidProgram;
-        }
-      } else {
+    }
+    return kSolved;
+  }
+
+  ThunkRet SolveGoalGroups(AssertionParser *context, Thunk f) {
+    for (size_t cur = 0; cur < context->groups().size(); ++cur) {
+      ThunkRet result = SolveGoalGroup(context, cur);
+      if (result == kNoException) {
+        return PerformInspection() ? kNoException : kInvalidProgram;
+      } else if (result != kSolved) {
         return result;
       }
     }
@@ -419,6 +514,89 @@ bool Verifier::VerifyAllGoals(
   return result;
 }
 
+std::vector<std::vector<size_t>> Verifier::IndependentGoalGroups() {
+  // EVars are shared across all groups, and a group that succeeds keeps its
+  // assignments for the groups that follow. Groups that (transitively) share
+  // EVars must therefore be solved together and in order.
+  auto &groups = parser_.groups();
+  std::vector<size_t> parents(groups.size());
+  for (size_t i = 0; i < parents.size(); ++i) {
+    parents[i] = i;
+  }
+  std::unordered_map<EVar *, size_t> first_group_for_evar;
+  std::vector<EVar *> evars;
+  for (size_t group = 0; group < groups.size(); ++group) {
+    evars.clear();
+    for (AstNode *goal : groups[group].goals) {
+      CollectEVars(goal, &evars);
+    }
+    for (EVar *evar : evars) {
+      auto inserted = first_group_for_evar.emplace(evar, group);
+      if (!inserted.second) {
+        parents[FindSet(&parents, group)] =
+            FindSet(&parents, inserted.first->second);
+      }
+    }
+  }
+  std::vector<std::vector<size_t>> sets;
+  std::unordered_map<size_t, size_t> set_for_root;
+  for (size_t group = 0; group < groups.size(); ++group) {
+    auto inserted = set_for_root.emplace(FindSet(&parents, group), sets.size());
+    if (inserted.second) {
+      sets.emplace_back();
+    }
+    sets[inserted.first->second].push_back(group);
+  }
+  return sets;
+}
+
+bool Verifier::VerifyAllGoalsInParallel(
+    size_t max_threads,
+    std::function<bool(Verifier *, const std::string &, EVar *)> inspect) {
+  failures_.clear();
+  if (!PrepareDatabase()) {
+    return false;
+  }
+  std::vector<std::vector<size_t>> sets = IndependentGoalGroups();
+  std::vector<ThunkRet> results(sets.size(), kSolved);
+  std::vector<std::pair<size_t, size_t>> furthest(sets.size());
+  ParallelFor(sets.size(), max_threads, [&](size_t set) {
+    Solver solver(this, facts_, inspect);
+    results[set] = solver.SolveGoalGroupSequence(&parser_, sets[set]);
+    furthest[set] = std::make_pair(solver.highest_group_reached(),
+                                   solver.highest_goal_reached());
+  });
+  bool result = true;
+  for (size_t set = 0; set < sets.size(); ++set) {
+    if (results[set] != kSolved) {
+      failures_.push_back(furthest[set]);
+      result = false;
+    }
+  }
+  // Sets are ordered by their first group, but a set can fail well past the
+  // first group of the set after it.
+  std::sort(failures_.begin(), failures_.end());
+  if (!failures_.empty()) {
+    highest_group_reached_ = failures_.front().first;
+    highest_goal_reached_ = failures_.front().second;
+  }
+  Solver solver(this, facts_, inspect);
+  return solver.PerformInspection() && result;
+}
+
+bool Verifier::VerifyAllGoalsInParallel(size_t max_threads) {
+  return VerifyAllGoalsInParallel(
+      max_threads,
+      [this](Verifier *context, const std::string &tag, EVar *evar) {
+        FileHandlePrettyPrinter printer(stdout);
+        printer.Print(tag);
+        printer.Print(": ");
+        evar->Dump(symbol_table_, &printer);
+        printer.Print("\n");
+        return true;
+      });
+}
+
 bool Verifier::VerifyAllGoals() {
   return VerifyAllGoals(
       [this](Verifier *context, const std::string &tag, EVar *evar) {
@@ -696,25 +874,94 @@ bool Verifier::PrepareDatabase() {
       is_ok = false;
     }
   }
+  if (is_ok) {
+    // Index the facts (in their sorted order) by their source, edge kind and
+    // target.
+    for (auto &index : fact_indexes_) {
+      index.clear();
+    }
+    for (AstNode *fact : facts_) {
+      Tuple *t = fact->AsApp()->rhs()->AsTuple();
+      for (size_t field = 0; field < kIndexedFactFields; ++field) {
+        size_t hash;
+        CHECK(HashGroundTerm(t->element(field), &hash));
+        fact_indexes_[field][hash].push_back(fact);
+      }
+    }
+  }
   database_prepared_ = is_ok;
   return is_ok;
 }
 
+const std::vector<AstNode *> *Verifier::CandidateFacts(AstNode *atom) {
+  static const std::vector<AstNode *> *kNoFacts = new std::vector<AstNode *>();
+  App *app = atom->AsApp();
+  Tuple *tuple = app ? app->rhs()->AsTuple() : nullptr;
+  if (tuple == nullptr || tuple->size() <= kIndexedFactFields) {
+    return nullptr;
+  }
+  const std::vector<AstNode *> *best = nullptr;
+  for (size_t field = 0; field < kIndexedFactFields; ++field) {
+    size_t hash;
+    if (!HashGroundTerm(tuple->element(field), &hash)) {
+      continue;
+    }
+    const auto &index = fact_indexes_[field];
+    auto found = index.find(hash);
+    if (found == index.end()) {
+      return kNoFacts;
+    }
+    if (best == nullptr || found->second.size() < best->size()) {
+      best = &found->second;
+    }
+  }
+  return best;
+}
+
+size_t Verifier::VNameSymbolsHash::operator()(
+    const VNameSymbols &symbols) const {
+  size_t hash = 0;
+  for (Symbol symbol : symbols) {
+    hash = HashCombine(hash, symbol);
+  }
+  return hash;
+}
+
+AstNode *Verifier::DatabaseIdentifierFor(const yy::location &location,
+                                         const std::string &token) {
+  if (token.empty()) {
+    return empty_string_id_;
+  }
+  Symbol symbol = symbol_table_.intern(token);
+  if (symbol >= database_identifiers_.size()) {
+    database_identifiers_.resize(symbol + 1, nullptr);
+  }
+  AstNode *&identifier = database_identifiers_[symbol];
+  if (identifier == nullptr) {
+    identifier = new (&arena_) Identifier(location, symbol);
+  }
+  return identifier;
+}
+
 AstNode *Verifier::ConvertVName(const yy::location &loc,
                                 const kythe::proto::VName &vname) {
-  AstNode **values = (AstNode **)arena_.New(sizeof(AstNode *) * 5);
-  values[0] = vname.signature().empty() ? empty_string_id_
-                                        : IdentifierFor(loc, vname.signature());
-  values[1] = vname.corpus().empty() ? empty_string_id_
-                                     : IdentifierFor(loc, vname.corpus());
-  values[2] = vname.root().empty() ? empty_string_id_
-                                   : IdentifierFor(loc, vname.root());
-  values[3] = vname.path().empty() ? empty_string_id_
-                                   : IdentifierFor(loc, vname.path());
-  values[4] = vname.language().empty() ? empty_string_id_
-                                       : IdentifierFor(loc, vname.language());
-  AstNode *tuple = new (&arena_) Tuple(loc, 5, values);
-  return new (&arena_) App(vname_id_, tuple);
+  AstNode *fields[5] = {DatabaseIdentifierFor(loc, vname.signature()),
+                        DatabaseIdentifierFor(loc, vname.corpus()),
+                        DatabaseIdentifierFor(loc, vname.root()),
+                        DatabaseIdentifierFor(loc, vname.path()),
+                        DatabaseIdentifierFor(loc, vname.language())};
+  VNameSymbols symbols;
+  for (size_t i = 0; i < 5; ++i) {
+    symbols[i] = fields[i]->AsIdentifier()->symbol();
+  }
+  AstNode *&converted = vnames_[symbols];
+  if (converted == nullptr) {
+    AstNode **values = (AstNode **)arena_.New(sizeof(AstNode *) * 5);
+    std::copy(fields, fields + 5, values);
+    AstNode *tuple = new (&arena_) Tuple(loc, 5, values);
+    converted = new (&arena_) App(vname_id_, tuple);
+  }
+  return converted;
 }
 
 void Verifier::AssertSingleFact(std::string *database, unsigned int fact_id,
@@ -726,15 +973,11 @@ void Verifier::AssertSingleFact(std::string *database, unsigned int fact_id,
   AstNode **values = (AstNode **)arena_.New(sizeof(AstNode *) * 5);
   values[0] =
       entry.has_source() ? ConvertVName(loc, entry.source()) : empty_string_id_;
-  values[1] = entry.edge_kind().empty() ? empty_string_id_
-                                        : IdentifierFor(loc, entry.edge_kind());
+  values[1] = DatabaseIdentifierFor(loc, entry.edge_kind());
   values[2] =
       entry.has_target() ? ConvertVName(loc, entry.target()) : empty_string_id_;
-  values[3] = entry.fact_name().empty() ? empty_string_id_
-                                        : IdentifierFor(loc, entry.fact_name());
-  values[4] = entry.fact_value().empty()
-                  ? empty_string_id_
-                  : IdentifierFor(loc, entry.fact_value());
+  values[3] = DatabaseIdentifierFor(loc, entry.fact_name());
+  values[4] = DatabaseIdentifierFor(loc, entry.fact_value());
 
   AstNode *tuple = new (&arena_) Tuple(loc, 5, values);
   AstNode *fact = new (&arena_) App(fact_id_, tuple);
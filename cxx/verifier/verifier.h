@@ -17,8 +17,12 @@
 #ifndef KYTHE_CXX_VERIFIER_H_
 #define KYTHE_CXX_VERIFIER_H_
 
+#include <array>
 #include <functional>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "kythe/proto/storage.pb.h"
 
@@ -77,6 +81,28 @@ class Verifier {
   /// \return true if all goals could be satisfied.
   bool VerifyAllGoals();
 
+  /// \brief Attempts to satisfy all goals from all loaded rule files and
+  /// facts, solving independent sets of goal groups concurrently.
+  ///
+  /// Goal groups that share EVars see each other's assignments, so each set
+  /// of (transitively) dependent groups is solved in order on one thread.
+  /// Unlike `VerifyAllGoals`, a failure in one set doesn't stop the others;
+  /// see `failures`.
+  /// \param max_threads The maximum number of threads to solve on.
+  /// \param inspect function to call on any inspection request; called on
+  /// this thread once all sets have been solved.
+  /// \return true if all goals could be satisfied.
+  bool VerifyAllGoalsInParallel(
+      size_t max_threads,
+      std::function<bool(Verifier *context, const std::string &, EVar *)>
+          inspect);
+
+  /// \brief Attempts to satisfy all goals from all loaded rule files and
+  /// facts, solving independent sets of goal groups concurrently.
+  /// \param max_threads The maximum number of threads to solve on.
+  /// \return true if all goals could be satisfied.
+  bool VerifyAllGoalsInParallel(size_t max_threads);
+
   /// \brief Adds a single Kythe fact to the database.
   /// \param database_name some name used to define the database; should live
   /// as long as the `Verifier`. Used only for diagnostics.
@@ -90,6 +116,15 @@ class Verifier {
   /// \return false if the database was not well-formed.
   bool PrepareDatabase();
 
+  /// \brief Finds the facts that could possibly unify with `atom`.
+  ///
+  /// Looks `atom` up in the index for each of its source, edge kind and
+  /// target fields that is fully bound and picks the smallest result.
+  /// \pre `PrepareDatabase` has succeeded.
+  /// \return The candidate facts in database order, or null if `atom` has no
+  /// indexable field bound (so that every fact is a candidate).
+  const std::vector<AstNode *> *CandidateFacts(AstNode *atom);
+
   /// Arena for allocating memory for both static data loaded from the database
   /// and dynamic data allocated during the course of evaluation.
   Arena *arena() { return &arena_; }
@@ -149,11 +184,38 @@ class Verifier {
   /// solving.
   size_t highest_goal_reached() const { return highest_goal_reached_; }
 
+  /// \brief Returns the furthest (group index, goal index) reached in each
+  /// set of goal groups that failed during the last call to
+  /// `VerifyAllGoalsInParallel`, ordered by group index.
+  const std::vector<std::pair<size_t, size_t>> &failures() const {
+    return failures_;
+  }
+
  private:
+  /// \brief Partitions the goal groups into sets that share no EVars.
+  /// \return The sets, each in group order, ordered by their first group.
+  std::vector<std::vector<size_t>> IndependentGoalGroups();
+
   /// \brief Converts a VName proto to its AST representation.
+  ///
+  /// Equal VNames share the same representation.
   AstNode *ConvertVName(const yy::location &location,
                         const kythe::proto::VName &vname);
 
+  /// \brief Returns the shared `Identifier` used in facts for `token`, or
+  /// `empty_string_id()` if `token` is empty.
+  /// \param location The location to use if the identifier is new.
+  AstNode *DatabaseIdentifierFor(const yy::location &location,
+                                 const std::string &token);
+
+  /// \brief The symbols for the fields of a VName, in signature, corpus,
+  /// root, path, language order.
+  using VNameSymbols = std::array<Symbol, 5>;
+
+  struct VNameSymbolsHash {
+    size_t operator()(const VNameSymbols &symbols) const;
+  };
+
   /// \sa parser()
   AssertionParser parser_;
 
@@ -166,6 +228,22 @@ class Verifier {
   /// All known facts.
   std::vector<AstNode *> facts_;
 
+  /// The `Identifier` shared by all facts that use a given `Symbol`, or null
+  /// if no fact has used it yet.
+  std::vector<AstNode *> database_identifiers_;
+
+  /// The representation shared by all facts that use a given VName.
+  std::unordered_map<VNameSymbols, AstNode *, VNameSymbolsHash> vnames_;
+
+  /// The number of leading fact fields (source, edge kind, target) that
+  /// we index.
+  static constexpr size_t kIndexedFactFields = 3;
+
+  /// For each indexed field, maps the hash of a value for that field to all
+  /// facts (in database order) whose field has a value with that hash.
+  std::unordered_map<size_t, std::vector<AstNode *>>
+      fact_indexes_[kIndexedFactFields];
+
   /// Has the database been prepared?
   bool database_prepared_ = false;
 
@@ -206,6 +284,9 @@ class Verifier {
   /// The highest goal reached during solving (often the culprit for why
   /// the solution failed).
   size_t highest_goal_reached_ = 0;
+
+  /// \sa failures()
+  std::vector<std::pair<size_t, size_t>> failures_;
 };
 
 }  // namespace verifier
@@ -16,23 +16,26 @@
 
 #include <stdio.h>
 #include <unistd.h>
+
 #include <string>
+#include <vector>
 
 #include "gflags/gflags.h"
 #include "glog/logging.h"
-#include "google/protobuf/io/zero_copy_stream.h"
-#include "google/protobuf/io/zero_copy_stream_impl.h"
-#include "google/protobuf/io/coded_stream.h"
 
 #include "kythe/proto/storage.pb.h"
 
 #include "assertion_ast.h"
+#include "entry_reader.h"
 #include "verifier.h"
 
 DEFINE_bool(show_protos, false, "Show protocol buffers read from standard in");
 DEFINE_bool(show_goals, false, "Show goals after parsing");
 DEFINE_bool(ignore_dups, false, "Ignore duplicate facts during verification");
 DEFINE_bool(graphviz, false, "Only dump facts as a GraphViz-compatible graph");
+DEFINE_int32(solver_threads, 0,
+             "If positive, solve independent goal groups on up to this many "
+             "threads and report every failing group");
 
 int main(int argc, char **argv) {
   GOOGLE_PROTOBUF_VERIFY_VERSION;
@@ -71,23 +74,22 @@ Example:
 
   std::string dbname = "database";
   size_t facts = 0;
-  kythe::proto::Entry entry;
-  google::protobuf::uint32 byte_size;
-  google::protobuf::io::FileInputStream raw_input(STDIN_FILENO);
-  google::protobuf::io::CodedInputStream coded_input(&raw_input);
-  coded_input.SetTotalBytesLimit(INT_MAX, -1);
-  while (coded_input.ReadVarint32(&byte_size)) {
-    auto limit = coded_input.PushLimit(byte_size);
-    if (!entry.ParseFromCodedStream(&coded_input)) {
+  {
+    kythe::verifier::EntryReader reader(STDIN_FILENO);
+    std::vector<kythe::proto::Entry> batch;
+    while (reader.NextBatch(&batch)) {
+      for (const auto &entry : batch) {
+        if (FLAGS_show_protos) {
+          entry.PrintDebugString();
+        }
+        v.AssertSingleFact(&dbname, facts, entry);
+        ++facts;
+      }
+    }
+    if (reader.had_error()) {
       fprintf(stderr, "Error reading around fact %zu\n", facts);
       return 1;
     }
-    coded_input.PopLimit(limit);
-    if (FLAGS_show_protos) {
-      entry.PrintDebugString();
-    }
-    v.AssertSingleFact(&dbname, facts, entry);
-    ++facts;
   }
 
   if (FLAGS_show_goals) {
@@ -98,6 +100,24 @@ Example:
     v.DumpAsDot();
   }
 
+  if (FLAGS_solver_threads > 0) {
+    if (!v.PrepareDatabase()) {
+      fprintf(stderr, "Could not verify all goals: the database is invalid.\n");
+      return 1;
+    }
+    if (!v.VerifyAllGoalsInParallel(FLAGS_solver_threads)) {
+      fprintf(stderr,
+              "Could not verify all goals. The furthest we reached in each "
+              "failing set of groups was:\n");
+      for (const auto &failure : v.failures()) {
+        fprintf(stderr, "  ");
+        v.DumpErrorGoal(failure.first, failure.second);
+      }
+      return 1;
+    }
+    return 0;
+  }
+
   if (!v.VerifyAllGoals()) {
     fprintf(stderr,
             "Could not verify all goals. The furthest we reached was:\n  ");
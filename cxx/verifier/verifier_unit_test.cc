@@ -778,6 +778,86 @@ fact_value: "42"
   ASSERT_TRUE(v.VerifyAllGoals());
 }
 
+TEST(VerifierUnitTest, SharedVNamesUnify) {
+  Verifier v;
+  ASSERT_TRUE(v.LoadInlineProtoFile(R"(entries {
+#- SomeAnchor defines SomeNode
+#- SomeNode.content 42
+source { root:"1" }
+edge_kind: "/kythe/edge/defines"
+target { signature:"s" corpus:"c" root:"2" path:"p" language:"l" }
+fact_name: "/"
+fact_value: ""
+}
+entries {
+source { signature:"s" corpus:"c" root:"2" path:"p" language:"l" }
+fact_name: "/kythe/content"
+fact_value: "42"
+})"));
+  ASSERT_TRUE(v.PrepareDatabase());
+  ASSERT_TRUE(v.VerifyAllGoals());
+}
+
+TEST(VerifierUnitTest, VNamesDifferingInOneFieldDontUnify) {
+  Verifier v;
+  ASSERT_TRUE(v.LoadInlineProtoFile(R"(entries {
+#- SomeAnchor defines SomeNode
+#- SomeNode.content 42
+source { root:"1" }
+edge_kind: "/kythe/edge/defines"
+target { signature:"s" corpus:"c" root:"2" path:"p" language:"l" }
+fact_name: "/"
+fact_value: ""
+}
+entries {
+source { signature:"s" corpus:"c" root:"2" path:"q" language:"l" }
+fact_name: "/kythe/content"
+fact_value: "42"
+})"));
+  ASSERT_TRUE(v.PrepareDatabase());
+  ASSERT_FALSE(v.VerifyAllGoals());
+}
+
+TEST(VerifierUnitTest, VNameFieldsAreNotInterchangeable) {
+  Verifier v;
+  ASSERT_TRUE(v.LoadInlineProtoFile(R"(entries {
+#- SomeAnchor defines SomeNode
+#- SomeNode.content 42
+source { root:"1" }
+edge_kind: "/kythe/edge/defines"
+target { signature:"x" }
+fact_name: "/"
+fact_value: ""
+}
+entries {
+source { corpus:"x" }
+fact_name: "/kythe/content"
+fact_value: "42"
+})"));
+  ASSERT_TRUE(v.PrepareDatabase());
+  ASSERT_FALSE(v.VerifyAllGoals());
+}
+
+TEST(VerifierUnitTest, FactValuesUnifyWithVNameFields) {
+  Verifier v;
+  ASSERT_TRUE(v.LoadInlineProtoFile(R"(entries {
+#- SomeNode.content Value
+#- vname(_,_,Value,_,_) defines OtherNode
+source { root:"1" }
+fact_name: "/kythe/content"
+fact_value: "42"
+}
+entries {
+source { root:"42" }
+edge_kind: "/kythe/edge/defines"
+target { root:"3" }
+fact_name: "/"
+fact_value: ""
+})"));
+  ASSERT_TRUE(v.PrepareDatabase());
+  ASSERT_TRUE(v.VerifyAllGoals());
+}
+
 TEST(VerifierUnitTest, EVarsUnsetAfterNegatedBlock) {
   Verifier v;
   ASSERT_TRUE(v.LoadInlineProtoFile(R"(entries {
@@ -1992,6 +2072,106 @@ fact_value: "43"
   ASSERT_EQ(2, v.highest_goal_reached());
 }
 
+/// \brief Returns a database in which each node 0 through `count - 1` is a
+/// childof the next, preceded by `goals`.
+std::string MakeChildofChain(const std::string &goals, int count) {
+  std::string data = goals;
+  for (int i = 0; i < count; ++i) {
+    data += "entries {\nsource { root:\"" + std::to_string(i) + "\" }\n";
+    data += "edge_kind: \"/kythe/edge/childof\"\n";
+    data += "target { root:\"" + std::to_string(i + 1) + "\" }\n";
+    data += "fact_name: \"/\"\nfact_value: \"\"\n}\n";
+  }
+  return data;
+}
+
+TEST(VerifierUnitTest, IndexedGoalsFindBoundSourcesAndTargets) {
+  Verifier v;
+  ASSERT_TRUE(v.LoadInlineProtoFile(MakeChildofChain(R"(
+#- vname("", "", "20", "", "") childof Parent
+#- Parent childof vname("", "", "22", "", "")
+)",
+                                                     100)));
+  ASSERT_TRUE(v.PrepareDatabase());
+  ASSERT_TRUE(v.VerifyAllGoals());
+}
+
+TEST(VerifierUnitTest, IndexedGoalsFailOnMissingEdges) {
+  Verifier v;
+  ASSERT_TRUE(v.LoadInlineProtoFile(MakeChildofChain(R"(
+#- vname("", "", "20", "", "") childof Parent
+#- Parent childof vname("", "", "23", "", "")
+)",
+                                                     100)));
+  ASSERT_TRUE(v.PrepareDatabase());
+  ASSERT_FALSE(v.VerifyAllGoals());
+  ASSERT_EQ(1, v.highest_goal_reached());
+}
+
+TEST(VerifierUnitTest, ParallelGroupsKeepSharedAssignments) {
+  Verifier v;
+  ASSERT_TRUE(v.LoadInlineProtoFile(R"(entries {
+#- { SomeNode.content SomeValue }
+#- { SomeNode.content 43 }
+source { root:"1" }
+fact_name: "/kythe/content"
+fact_value: "42"
+}
+entries {
+source { root:"2" }
+fact_name: "/kythe/content"
+fact_value: "43"
+})"));
+  ASSERT_TRUE(v.PrepareDatabase());
+  ASSERT_FALSE(v.VerifyAllGoalsInParallel(4));
+  ASSERT_EQ(1, v.failures().size());
+  // Group 0 holds goals written outside braces.
+  EXPECT_EQ(2, v.failures()[0].first);
+}
+
+TEST(VerifierUnitTest, ParallelGroupsPass) {
+  Verifier v;
+  ASSERT_TRUE(v.LoadInlineProtoFile(R"(entries {
+#- { NodeA.content 42 }
+#- { NodeB.content 43 }
+#- !{ NodeC.content 44 }
+source { root:"1" }
+fact_name: "/kythe/content"
+fact_value: "42"
+}
+entries {
+source { root:"2" }
+fact_name: "/kythe/content"
+fact_value: "43"
+})"));
+  ASSERT_TRUE(v.PrepareDatabase());
+  ASSERT_TRUE(v.VerifyAllGoalsInParallel(4));
+  EXPECT_TRUE(v.failures().empty());
+}
+
+TEST(VerifierUnitTest, ParallelGroupsReportEveryFailure) {
+  Verifier v;
+  ASSERT_TRUE(v.LoadInlineProtoFile(R"(entries {
+#- { NodeA.content 44 }
+#- { NodeB.content 43 }
+#- { NodeC.content 45 }
+source { root:"1" }
+fact_name: "/kythe/content"
+fact_value: "42"
+}
+entries {
+source { root:"2" }
+fact_name: "/kythe/content"
+fact_value: "43"
+})"));
+  ASSERT_TRUE(v.PrepareDatabase());
+  ASSERT_FALSE(v.VerifyAllGoalsInParallel(4));
+  ASSERT_EQ(2, v.failures().size());
+  EXPECT_EQ(1, v.failures()[0].first);
+  EXPECT_EQ(3, v.failures()[1].first);
+  EXPECT_EQ(1, v.highest_group_reached());
+}
+
 }  // anonymous namespace
 }  // namespace verifier
 }  // namespace kythe
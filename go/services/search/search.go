@@ -68,7 +68,9 @@ func WebClient(addr string) Service {
 //     Response: JSON encoded storage.SearchReply
 //
 // Note: /search will return its response as serialized protobuf if the
-// "proto" query parameter is set.
+// "proto" query parameter is set.  Requests sent with the
+// "application/x-protobuf" Content-Type are decoded as serialized protobufs
+// rather than JSON.
 func RegisterHTTPHandlers(ctx context.Context, s Service, mux *http.ServeMux) {
 	mux.HandleFunc("/search", func(w http.ResponseWriter, r *http.Request) {
 		start := time.Now()
@@ -77,7 +79,7 @@ func RegisterHTTPHandlers(ctx context.Context, s Service, mux *http.ServeMux) {
 		}()
 
 		var req spb.SearchRequest
-		if err := web.ReadJSONBody(r, &req); err != nil {
+		if err := web.ReadRequest(r, &req); err != nil {
 			http.Error(w, err.Error(), http.StatusBadRequest)
 			return
 		}
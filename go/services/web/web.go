@@ -31,7 +31,10 @@ import (
 	"github.com/golang/protobuf/proto"
 )
 
-const jsonBodyType = "application/json; charset=utf-8"
+const (
+	jsonBodyType  = "application/json; charset=utf-8"
+	protoBodyType = "application/x-protobuf"
+)
 
 // RegisterQuitHandler adds a handler for /quitquitquit that call os.Exit(0).
 func RegisterQuitHandler(mux *http.ServeMux) {
@@ -74,6 +77,23 @@ func ReadJSONBody(r *http.Request, v interface{}) error {
 	return json.Unmarshal(rec, v)
 }
 
+// ReadRequest reads the entire body of r into msg.  The body is decoded as a
+// serialized protobuf if r's Content-Type is "application/x-protobuf";
+// otherwise it is decoded as JSON.
+func ReadRequest(r *http.Request, msg proto.Message) error {
+	if !strings.HasPrefix(r.Header.Get("Content-Type"), protoBodyType) {
+		return ReadJSONBody(r, msg)
+	}
+	rec, err := ioutil.ReadAll(r.Body)
+	if err != nil {
+		return fmt.Errorf("body read error: %v", err)
+	}
+	if err := proto.Unmarshal(rec, msg); err != nil {
+		return fmt.Errorf("error unmarshaling proto: %v", err)
+	}
+	return nil
+}
+
 // WriteResponse writes msg to w as a serialized protobuf if the "proto" query
 // parameter is set; otherwise as JSON.
 func WriteResponse(w http.ResponseWriter, r *http.Request, msg proto.Message) error {
@@ -93,7 +113,7 @@ func WriteJSONResponse(w http.ResponseWriter, r *http.Request, v interface{}) er
 
 // WriteProtoResponse serializes msg to w.
 func WriteProtoResponse(w http.ResponseWriter, r *http.Request, msg proto.Message) error {
-	w.Header().Set("Content-Type", "application/x-protobuf")
+	w.Header().Set("Content-Type", protoBodyType)
 	cw := httpencoding.CompressData(w, r)
 	defer cw.Close()
 	rec, err := proto.Marshal(msg)
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2015 Google Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package web
+
+import (
+	"bytes"
+	"net/http"
+	"testing"
+
+	"github.com/golang/protobuf/proto"
+
+	xpb "kythe.io/kythe/proto/xref_proto"
+)
+
+func TestReadRequest(t *testing.T) {
+	expected := &xpb.NodesRequest{
+		Ticket: []string{"kythe://corpus?lang=c++#sig"},
+		Filter: []string{"/kythe/node/kind"},
+	}
+	rec, err := proto.Marshal(expected)
+	if err != nil {
+		t.Fatalf("Error marshaling request: %v", err)
+	}
+
+	tests := []struct {
+		contentType string
+		body        []byte
+	}{
+		{jsonBodyType, []byte(`{"ticket":["kythe://corpus?lang=c++#sig"],"filter":["/kythe/node/kind"]}`)},
+		{"", []byte(`{"ticket":["kythe://corpus?lang=c++#sig"],"filter":["/kythe/node/kind"]}`)},
+		{protoBodyType, rec},
+	}
+
+	for _, test := range tests {
+		r, err := http.NewRequest("POST", "/nodes", bytes.NewReader(test.body))
+		if err != nil {
+			t.Fatalf("Error creating request: %v", err)
+		}
+		if test.contentType != "" {
+			r.Header.Set("Content-Type", test.contentType)
+		}
+		var req xpb.NodesRequest
+		if err := ReadRequest(r, &req); err != nil {
+			t.Errorf("ReadRequest (Content-Type %q) error: %v", test.contentType, err)
+		} else if !proto.Equal(&req, expected) {
+			t.Errorf("ReadRequest (Content-Type %q): got %v; expected %v", test.contentType, &req, expected)
+		}
+	}
+
+	r, err := http.NewRequest("POST", "/nodes", bytes.NewReader([]byte("not a proto")))
+	if err != nil {
+		t.Fatalf("Error creating request: %v", err)
+	}
+	r.Header.Set("Content-Type", protoBodyType)
+	var req xpb.NodesRequest
+	if err := ReadRequest(r, &req); err == nil {
+		t.Errorf("ReadRequest accepted a malformed proto: %v", &req)
+	}
+}
@@ -283,7 +283,9 @@ func WebClient(addr string) Service {
 //     Response: JSON encoded xrefs.DecorationsResponse
 //
 // Note: /nodes, /edges, and /decorations will return their responses as
-// serialized protobufs if the "proto" query parameter is set.
+// serialized protobufs if the "proto" query parameter is set.  Requests sent
+// with the "application/x-protobuf" Content-Type are decoded as serialized
+// protobufs rather than JSON.
 func RegisterHTTPHandlers(ctx context.Context, xs Service, mux *http.ServeMux) {
 	mux.HandleFunc("/decorations", func(w http.ResponseWriter, r *http.Request) {
 		start := time.Now()
@@ -291,7 +293,7 @@ func RegisterHTTPHandlers(ctx context.Context, xs Service, mux *http.ServeMux) {
 			log.Printf("xrefs.Decorations:\t%s", time.Since(start))
 		}()
 		var req xpb.DecorationsRequest
-		if err := web.ReadJSONBody(r, &req); err != nil {
+		if err := web.ReadRequest(r, &req); err != nil {
 			http.Error(w, err.Error(), http.StatusBadRequest)
 			return
 		}
@@ -312,7 +314,7 @@ func RegisterHTTPHandlers(ctx context.Context, xs Service, mux *http.ServeMux) {
 		}()
 
 		var req xpb.NodesRequest
-		if err := web.ReadJSONBody(r, &req); err != nil {
+		if err := web.ReadRequest(r, &req); err != nil {
 			http.Error(w, err.Error(), http.StatusBadRequest)
 			return
 		}
@@ -332,7 +334,7 @@ func RegisterHTTPHandlers(ctx context.Context, xs Service, mux *http.ServeMux) {
 		}()
 
 		var req xpb.EdgesRequest
-		if err := web.ReadJSONBody(r, &req); err != nil {
+		if err := web.ReadRequest(r, &req); err != nil {
 			http.Error(w, err.Error(), http.StatusBadRequest)
 			return
 		}